@@ -0,0 +1,166 @@
+"""
+Drains the rings in which the driver captures the datagrams exchanged with the boards
+(see the module parameter `capture_directory` of `litexcnc_eth`) and writes them as
+pcapng, which can be opened with Wireshark. The layout of the ring MUST coincide with
+`driver/etherbone.h`.
+
+The ring contains the UDP payload (the Etherbone packet) of each datagram. The IPv4
+and UDP headers are reconstructed from the addresses of the connection, so each board
+is a separate interface in the pcapng with raw IPv4 packets. The direction of each
+datagram is stored in the flags of the packet, datagrams which were received too late
+and discarded by the driver carry a comment.
+"""
+import mmap
+import socket
+import struct
+from typing import BinaryIO, Iterator, NamedTuple
+
+CAPTURE_MAGIC = 0x4C584350
+CAPTURE_VERSION = 2
+CAPTURE_SENT = 1
+CAPTURE_RECEIVED = 2
+CAPTURE_FLAG_DISCARDED = 0x01
+
+# struct eb_capture_header and the fixed part of struct eb_capture_slot
+HEADER = struct.Struct("<IIII4s4sHHHHQQQQ")
+HEAD_OFFSET = 32
+TAIL_OFFSET = 40
+SLOT = struct.Struct("<qIHHQ")
+
+# pcapng
+LINKTYPE_RAW = 101
+BLOCK_SHB = 0x0A0D0D0A
+BLOCK_IDB = 0x00000001
+BLOCK_EPB = 0x00000006
+OPTION_END = 0
+OPTION_COMMENT = 1
+OPTION_IF_NAME = 2
+OPTION_IF_TSRESOL = 9
+OPTION_EPB_FLAGS = 2
+EPB_INBOUND = 1
+EPB_OUTBOUND = 2
+
+
+class Datagram(NamedTuple):
+    timestamp: int
+    length: int
+    direction: int
+    flags: int
+    data: bytes
+
+
+class CaptureRing:
+    """The ring of a single board. The driver reserves the slots by advancing the head
+    and publishes each slot by setting its sequence. The ring is drained by reading the
+    published datagrams and advancing the tail."""
+
+    def __init__(self, file: BinaryIO):
+        self._memory = mmap.mmap(file.fileno(), 0)
+        (magic, version, self.slot_size, self.slot_count, local_address, remote_address,
+         self.local_tx_port, self.local_rx_port, self.remote_port, *_) = HEADER.unpack_from(self._memory, 0)
+        if magic != CAPTURE_MAGIC:
+            raise ValueError(f"File is not a valid capture (magic {magic:08X})")
+        if version != CAPTURE_VERSION:
+            raise ValueError(f"Unsupported version {version} of capture (supported: {CAPTURE_VERSION})")
+        # The addresses and ports are in network byte order
+        self.local_address = socket.inet_ntoa(local_address)
+        self.remote_address = socket.inet_ntoa(remote_address)
+        self.local_tx_port, self.local_rx_port, self.remote_port = (
+            socket.ntohs(port) for port in (self.local_tx_port, self.local_rx_port, self.remote_port)
+        )
+
+    @property
+    def dropped(self) -> int:
+        """The number of datagrams dropped by the driver because the ring was full."""
+        return HEADER.unpack_from(self._memory, 0)[-2]
+
+    def drain(self) -> Iterator[Datagram]:
+        """Returns all datagrams in the ring. The slots are released when all datagrams
+        have been processed."""
+        head, tail = struct.unpack_from("<QQ", self._memory, HEAD_OFFSET)
+        start = HEADER.size
+        index = tail
+        while index < head:
+            offset = start + (index % self.slot_count) * self.slot_size
+            timestamp, length, direction, flags, sequence = SLOT.unpack_from(self._memory, offset)
+            if sequence != index + 1:
+                # The slot has been reserved, but the driver is still writing it
+                break
+            size = min(length, self.slot_size - SLOT.size)
+            data = self._memory[offset + SLOT.size:offset + SLOT.size + size]
+            yield Datagram(timestamp, length, direction, flags, data)
+            index += 1
+        struct.pack_into("<Q", self._memory, TAIL_OFFSET, index)
+
+    def close(self):
+        self._memory.close()
+
+
+def _checksum(header: bytes) -> int:
+    total = sum(struct.unpack(f"!{len(header) // 2}H", header))
+    while total >> 16:
+        total = (total & 0xFFFF) + (total >> 16)
+    return ~total & 0xFFFF
+
+
+def _ipv4_udp(source, source_port, destination, destination_port, length: int) -> bytes:
+    """Returns the IPv4 and UDP headers for a datagram with the given payload length."""
+    ip = struct.pack(
+        "!BBHHHBBH4s4s", 0x45, 0, 28 + length, 0, 0x4000, 64, socket.IPPROTO_UDP, 0,
+        socket.inet_aton(source), socket.inet_aton(destination)
+    )
+    ip = ip[:10] + struct.pack("!H", _checksum(ip)) + ip[12:]
+    return ip + struct.pack("!HHHH", source_port, destination_port, 8 + length, 0)
+
+
+def _pad(data: bytes) -> bytes:
+    return data + b'\x00' * (-len(data) % 4)
+
+
+def _option(code: int, value: bytes) -> bytes:
+    return struct.pack("<HH", code, len(value)) + _pad(value)
+
+
+def _block(type: int, body: bytes) -> bytes:
+    length = 12 + len(body)
+    return struct.pack("<II", type, length) + body + struct.pack("<I", length)
+
+
+class PcapngWriter:
+    """Writes the datagrams of one or more rings as pcapng, each ring is an interface."""
+
+    def __init__(self, output: BinaryIO):
+        self._output = output
+        self._interfaces = 0
+        # Section header (version 1.0, unknown section length)
+        output.write(_block(BLOCK_SHB, struct.pack("<IHHq", 0x1A2B3C4D, 1, 0, -1)))
+
+    def add_interface(self, name: str) -> int:
+        """Adds an interface, with timestamps in nanoseconds. Returns the id."""
+        options = (
+            _option(OPTION_IF_NAME, name.encode()) +
+            _option(OPTION_IF_TSRESOL, bytes([9])) +
+            _option(OPTION_END, b'')
+        )
+        self._output.write(_block(BLOCK_IDB, struct.pack("<HHI", LINKTYPE_RAW, 0, 0) + options))
+        self._interfaces += 1
+        return self._interfaces - 1
+
+    def write(self, interface: int, ring: CaptureRing, datagram: Datagram):
+        """Writes the datagram with the reconstructed IPv4 and UDP headers."""
+        if datagram.direction == CAPTURE_SENT:
+            headers = _ipv4_udp(ring.local_address, ring.local_tx_port, ring.remote_address, ring.remote_port, datagram.length)
+            flags = EPB_OUTBOUND
+        else:
+            headers = _ipv4_udp(ring.remote_address, ring.remote_port, ring.local_address, ring.local_rx_port, datagram.length)
+            flags = EPB_INBOUND
+        packet = headers + datagram.data
+        options = _option(OPTION_EPB_FLAGS, struct.pack("<I", flags))
+        if datagram.flags & CAPTURE_FLAG_DISCARDED:
+            options += _option(OPTION_COMMENT, b"Received too late, discarded by the driver")
+        options += _option(OPTION_END, b'')
+        body = struct.pack(
+            "<IIIII", interface, datagram.timestamp >> 32, datagram.timestamp & 0xFFFFFFFF,
+            len(packet), 28 + datagram.length
+        ) + _pad(packet) + options
+        self._output.write(_block(BLOCK_EPB, body))
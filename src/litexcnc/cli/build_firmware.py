@@ -52,5 +52,15 @@ def cli(config, output_directory, build):
     )
     builder.build(run=build)
 
+    # Generate the pack and unpack functions of the driver for this firmware. The image
+    # is placed both with the firmware and in the driver, where it is compiled in when
+    # the driver is installed.
+    from litexcnc.firmware.image import image_name, generate_image, write_image
+    words = soc.MMIO_inst.descriptor.words()
+    with open(os.path.join(output_directory, f"{image_name(fingerprint)}.h"), 'w') as image:
+        image.write(generate_image(fingerprint, words))
+    path = write_image(fingerprint, words)
+    click.echo(click.style("INFO", fg="blue") + f": Driver image created in {path}, run 'litexcnc install_driver' to use it")
+
     # Done!
     click.echo(click.style("INFO", fg="blue") + f": Firmware created in {output_directory}")
\ No newline at end of file
@@ -0,0 +1,54 @@
+"""
+This file contains the command to drain the capture rings of the driver to a pcapng
+file, which can be opened with Wireshark.
+"""
+import os
+import time
+
+import click
+
+from litexcnc.capture import CaptureRing, PcapngWriter
+
+
+@click.command()
+@click.argument('rings', type=click.File('r+b'), nargs=-1, required=True)
+@click.option('-o', '--output', type=click.File('wb'), required=True, help="The pcapng-file to write the datagrams to.")
+@click.option('--follow/--no-follow', default=True, show_default=True, help="Keep draining the rings until interrupted (Ctrl-C), instead of stopping when the rings are empty.")
+@click.option('--interval', default=0.01, show_default=True, help="Time (in seconds) between draining the rings.")
+def cli(rings, output, follow, interval):
+    """Drains the rings in which the driver captures the datagrams exchanged with the
+    boards to a pcapng-file. The rings are created when litexcnc_eth is loaded with the
+    module parameter 'capture_directory' (i.e. /dev/shm/<board_name>.ring). Each board
+    is a separate interface in the pcapng-file."""
+    try:
+        opened = [CaptureRing(ring) for ring in rings]
+    except ValueError as e:
+        click.echo(click.style("Error", fg="red") + f": {e}")
+        return -1
+
+    writer = PcapngWriter(output)
+    interfaces = [
+        writer.add_interface(os.path.splitext(os.path.basename(file.name))[0])
+        for file in rings
+    ]
+    dropped = [ring.dropped for ring in opened]
+    count = 0
+    try:
+        while True:
+            drained = 0
+            for interface, ring in zip(interfaces, opened):
+                for datagram in ring.drain():
+                    writer.write(interface, ring, datagram)
+                    drained += 1
+            count += drained
+            if not follow and not drained:
+                break
+            time.sleep(interval)
+    except KeyboardInterrupt:
+        pass
+
+    click.echo(click.style("INFO", fg="blue") + f": {count} datagrams written to {output.name}")
+    for file, ring, before in zip(rings, opened, dropped):
+        if ring.dropped > before:
+            click.echo(click.style("WARNING", fg="yellow") + f": {ring.dropped - before} datagrams dropped by the driver for {file.name}, the ring is too small or the drain too slow")
+        ring.close()
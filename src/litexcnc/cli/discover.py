@@ -0,0 +1,60 @@
+"""
+This file contains the command to discover LitexCNC boards on the network and
+to match them with their configuration.
+"""
+import ipaddress
+import json
+import click
+
+from litexcnc.etherbone import config_fingerprint, discover, format_version, ETHERBONE_DEFAULT_PORT
+
+
+@click.command()
+@click.argument('configs', nargs=-1, type=click.Path(exists=True, dir_okay=False))
+@click.option('-n', '--network', help="Network to search, i.e. 192.168.2.0/24. Defaults to the /24-networks of the given config-files.")
+@click.option('-p', '--port', default=ETHERBONE_DEFAULT_PORT, show_default=True, help="UDP-port of the boards.")
+@click.option('-t', '--timeout', default=0.2, show_default=True, help="Time (in seconds) to wait for replies.")
+def cli(configs, network, port, timeout):
+    """Discovers the LitexCNC boards on the network and matches them to the given
+    config-files based on their fingerprint."""
+    # Load the fingerprints and addresses of the given config-files
+    fingerprints = {}
+    networks = set()
+    for config in configs:
+        fingerprints[config_fingerprint(config)] = config
+        with open(config, 'r') as config_file:
+            ip_address = json.load(config_file).get('etherbone', {}).get('ip_address')
+        if ip_address:
+            networks.add(str(ipaddress.IPv4Network(f"{ip_address}/24", strict=False)))
+    if network:
+        networks = {network}
+    if not networks:
+        click.echo(click.style("Error", fg="red") + ": No network given and no ip-address found in the config-files.")
+        return -1
+
+    # Discover the boards
+    boards = []
+    for network in sorted(networks):
+        click.echo(click.style("INFO", fg="blue") + f": Discovering boards on network {network}...")
+        boards += discover(network, port=port, timeout=timeout)
+    if not boards:
+        click.echo(click.style("WARNING", fg="yellow") + ": No boards found.")
+
+    # Report the boards and match them with the config-files
+    for board in boards:
+        if board.magic is None:
+            click.echo(f"{board.ip_address:<16} no response to read of header")
+            continue
+        if not board.is_litexcnc:
+            click.echo(f"{board.ip_address:<16} not a LitexCNC board (magic {board.magic:08X})")
+            continue
+        config = fingerprints.pop(board.fingerprint, None)
+        click.echo(
+            f"{board.ip_address:<16} version {format_version(board.version):<8} "
+            f"fingerprint {board.fingerprint:08X}  "
+            + (click.style(config, fg="green") if config else click.style("no matching config-file", fg="yellow"))
+        )
+
+    # Report config-files without a board
+    for fingerprint, config in fingerprints.items():
+        click.echo(click.style("WARNING", fg="yellow") + f": No board found for '{config}' (fingerprint {fingerprint:08X})")
@@ -0,0 +1,40 @@
+"""
+This file contains the command to emulate a LitexCNC board in software, so the
+driver can be tested and benchmarked without an FPGA.
+"""
+import click
+
+from litexcnc.emulator import Emulator
+from litexcnc.etherbone import ETHERBONE_DEFAULT_PORT
+
+
+@click.command()
+@click.argument('config', type=click.Path(exists=True, dir_okay=False))
+@click.option('-a', '--address', default='127.0.0.2', show_default=True, help="Ip-address the emulator listens on. Must differ from the ip-address of the host.")
+@click.option('-p', '--port', default=ETHERBONE_DEFAULT_PORT, show_default=True, help="UDP-port the emulator listens on.")
+@click.option('-d', '--delay', default=0.0, show_default=True, help="Additional delay (in microseconds) before each reply, to emulate a slower board or network.")
+@click.option('-i', '--interval', default=1.0, show_default=True, help="Interval (in seconds) between the reports of the statistics.")
+def cli(config, address, port, delay, interval):
+    """Emulates the LitexCNC board for the given config-file. Set the ip-address in
+    the config-file (or the `etherbone.ip_address` of the driver) to the address of
+    the emulator."""
+    emulator = Emulator(config, delay=delay * 1e-6)
+    click.echo(click.style("INFO", fg="blue") + f": Emulating '{config}' (fingerprint {emulator.fingerprint:08X}) on {address}:{port}")
+    click.echo(click.style("INFO", fg="blue") + f": Write block {emulator.layout.write[1]} bytes, read block {emulator.layout.read[1]} bytes")
+
+    previous = dict(emulator.statistics)
+    def report(emulator: Emulator):
+        # Report the number of cycles per second, which is the achieved servo rate
+        statistics = dict(emulator.statistics)
+        reads = (statistics['reads'] - previous['reads']) / interval
+        writes = (statistics['writes'] - previous['writes']) / interval
+        message = f"{reads:8.0f} reads/s {writes:8.0f} writes/s"
+        if statistics['bitten'] != previous['bitten']:
+            message += click.style(f" watchdog has bitten {statistics['bitten'] - previous['bitten']} times", fg="red")
+        click.echo(message)
+        previous.update(statistics)
+
+    try:
+        emulator.serve(address, port, callback=report, interval=interval)
+    except KeyboardInterrupt:
+        pass
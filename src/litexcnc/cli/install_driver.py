@@ -16,7 +16,7 @@ def cli():
     # compile the driver
     click.echo(click.style("INFO", fg="blue") + ": Compiling LitexCNC driver...")
     ret = subprocess.call(
-        f'{sys.executable} halcompile.py --install litexcnc.c litexcnc_eth.c stepgen/pos2vel.c',
+        f'{sys.executable} halcompile.py --install litexcnc.c litexcnc_eth.c litexcnc_replay.c stepgen/pos2vel.c',
         cwd=os.path.dirname(os.path.abspath(driver.__file__)),
         shell=True
     )
@@ -24,6 +24,18 @@ def cli():
         click.echo(click.style("Error", fg="red") + ": Compilation of the driver failed.")
         return
 
+    # compile the latency tool (see `litexcnc latency`), which runs without LinuxCNC and
+    # only uses the headers and the userspace library of LinuxCNC
+    click.echo(click.style("INFO", fg="blue") + ": Compiling LitexCNC latency tool...")
+    ret = subprocess.call(
+        'gcc -O2 -DULAPI -I/usr/include/linuxcnc litexcnc_latency.c -o litexcnc_latency -llinuxcnchal -lm',
+        cwd=os.path.dirname(os.path.abspath(driver.__file__)),
+        shell=True
+    )
+    if ret:
+        click.echo(click.style("Error", fg="red") + ": Compilation of the latency tool failed.")
+        return
+
     # Done!
     click.echo(click.style("INFO", fg="blue") + ": LitexCNC driver installed")
 
@@ -0,0 +1,34 @@
+"""
+This file contains the command to characterise the latency of the host to a board,
+before the host is commissioned.
+"""
+import os
+import subprocess
+import click
+
+# Import the driver module.
+from litexcnc import driver
+
+
+@click.command()
+@click.argument('config', type=click.Path(exists=True, dir_okay=False))
+@click.option('-r', '--rate', default=1000, show_default=True, help="The servo rate (in Hz) at which the cyclic pattern is run.")
+@click.option('-m', '--minutes', default=1.0, show_default=True, help="The duration of the test.")
+@click.option('-p', '--priority', default=80, show_default=True, help="The real-time priority (SCHED_FIFO) of the loop, 0 to run without real-time priority.")
+@click.option('-b', '--bins', default=1000, show_default=True, help="The number of bins (of 1 us) of the histograms.")
+@click.option('--histogram', is_flag=True, help="Print the histograms, in the format of cyclictest.")
+def cli(config, rate, minutes, priority, bins, histogram):
+    """Runs the cyclic read/write pattern of the driver for the given config-file at the
+    given rate, without LinuxCNC. Reports the wake-up latency, the round trip, the jitter
+    of the writes and the time from read to write, followed by the maximum servo rate
+    and the recommended settings for the watchdog and the stepgen. Real-time priority
+    requires root privileges. The board is written with zeros, so the watchdog is not
+    enabled and the outputs stay inactive."""
+    tool = os.path.join(os.path.dirname(os.path.abspath(driver.__file__)), "litexcnc_latency")
+    if not os.path.exists(tool):
+        click.echo(click.style("Error", fg="red") + ": Latency tool not found. Please run 'litexcnc install_driver' first.")
+        return -1
+    args = [tool, "-r", str(rate), "-m", str(minutes), "-p", str(priority), "-b", str(bins)]
+    if histogram:
+        args.append("-h")
+    return subprocess.call(args + [config])
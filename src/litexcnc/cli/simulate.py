@@ -0,0 +1,77 @@
+"""
+This file contains the command to simulate the firmware with Verilator, so the driver
+can be tested against the actual gateware without an FPGA.
+"""
+import binascii
+import os
+import click
+
+
+@click.command()
+@click.argument('config', type=click.File('r'))
+@click.option('-o', '--output-directory')
+@click.option('-i', '--interface', default='tap0', show_default=True, help="The tap-interface on the host to which the ethernet of the simulated board is connected.")
+@click.option('--host-ip-address', default='192.168.1.100', show_default=True, help="The ip-address of the host on the tap-interface. Must be in the same subnet as the ip-address of the board in the config-file.")
+@click.option('--trace', is_flag=True, help="Write a trace (VCD) of all signals, which can be converted to the step/dir timing with 'litexcnc steptrace'.")
+@click.option('--trace-start', default=0, show_default=True, help="Time (in ps) at which the trace starts.")
+@click.option('--trace-end', default=-1, show_default=True, help="Time (in ps) at which the trace ends (-1 for the end of the simulation).")
+@click.option('--run/--no-run', default=True, show_default=True, help="Run the simulation after building it.")
+def cli(config, output_directory, interface, host_ip_address, trace, trace_start, trace_end, run):
+    """Builds the litexCNC firmware with the given configuration for simulation with
+    Verilator and runs it. The board is simulated cycle-accurately and is connected to
+    a tap-interface on the host, so the driver can connect to the ip-address of the
+    config-file. Creating the tap-interface requires root privileges."""
+    # Local imports, with check whether Litex is available on path
+    try:
+        from litex.soc.integration.builder import Builder
+        from litexcnc.firmware.soc import LitexCNC_Firmware
+        from litexcnc.firmware.boards.sim import Simulation, sim_config
+    except ImportError as e:
+        click.echo(click.style("Error", fg="red") + ": Litex is not installed. Please run 'litexcnc install_litex' first.")
+        return -1
+
+    # Set the default value for the folder if not set
+    if not output_directory:
+        output_directory = os.path.basename(config.name)
+
+    # Add the config name and the simulation as folder, so the simulation does not
+    # overwrite the firmware of the board
+    output_directory = os.path.join(
+        output_directory,
+        os.path.splitext(config.name)[0],
+        "sim"
+    )
+    if not os.path.exists(output_directory):
+        os.makedirs(output_directory)
+
+    # Load configuration. The board in the config is replaced by the simulation, all
+    # other settings (including the ip-address) are used as is.
+    firmware_config = LitexCNC_Firmware.parse_raw(' '.join(config.readlines()))
+    firmware_config.baseclass = Simulation
+
+    # Generate the fingerprint, which must be the same as for the board itself
+    with open(config.name, 'rb') as config_binary:
+        fingerprint = binascii.crc32(config_binary.read())
+        print("Generated fingerprint (CRC): ", fingerprint)
+
+    # Generate the firmware
+    soc = firmware_config.generate(fingerprint)
+
+    # Build and run the simulation
+    builder = Builder(
+        soc,
+        output_dir=output_directory,
+        csr_csv=os.path.join(output_directory, "csr.csv")
+    )
+    click.echo(click.style("INFO", fg="blue") + f": Board '{firmware_config.board_name}' is simulated on {firmware_config.etherbone.ip_address}:{firmware_config.etherbone.port} (via {interface})")
+    builder.build(
+        sim_config=sim_config(firmware_config, interface, host_ip_address),
+        trace=trace,
+        trace_start=trace_start,
+        trace_end=trace_end,
+        run=run
+    )
+
+    # Done!
+    if trace:
+        click.echo(click.style("INFO", fg="blue") + f": Trace written in {os.path.join(output_directory, 'gateware')}")
@@ -0,0 +1,34 @@
+"""
+This file contains the command to extract the step/dir timing from a trace of the
+simulation.
+"""
+import click
+
+from litexcnc.steptrace import read_vcd, write_csv
+
+
+def _ns(value):
+    return "-" if value is None else f"{value:.0f} ns"
+
+
+@click.command()
+@click.argument('trace', type=click.File('r'))
+@click.option('-o', '--output', type=click.File('w'), help="Write all edges of the step and dir signals (with the position) to this CSV-file.")
+def cli(trace, output):
+    """Reports the steps and the shortest step/dir timings of all stepgens in a trace
+    (VCD) of the simulation, as created with 'litexcnc simulate --trace'."""
+    stepgens = read_vcd(trace)
+    if not stepgens:
+        click.echo(click.style("Error", fg="red") + ": No stepgens found in the trace.")
+        return -1
+
+    for index, stepgen in sorted(stepgens.items()):
+        click.echo(
+            f"stepgen.{index:02d}: {stepgen.steps} steps, position {stepgen.position}, "
+            f"steplen {_ns(stepgen.min_steplen)}, stepspace {_ns(stepgen.min_stepspace)}, "
+            f"dir_setup_time {_ns(stepgen.min_dir_setup)}, dir_hold_time {_ns(stepgen.min_dir_hold)}"
+        )
+
+    if output:
+        write_csv(stepgens, output)
+        click.echo(click.style("INFO", fg="blue") + f": Edges written to {output.name}")
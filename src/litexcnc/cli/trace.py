@@ -0,0 +1,59 @@
+"""
+This file contains the command to inspect a recording of the data exchanged with a
+board, as created by the driver.
+"""
+import statistics
+
+import click
+
+from litexcnc.trace import Trace
+
+
+def _percentile(values, fraction):
+    return sorted(values)[min(len(values) - 1, int(len(values) * fraction))]
+
+
+@click.command()
+@click.argument('trace', type=click.File('rb'))
+@click.option('-d', '--dump', type=int, multiple=True, help="Print the read and write data of the given cycle (starting at 0). Can be given multiple times.")
+def cli(trace, dump):
+    """Reports the contents of a recording of a board, as created by the driver when the
+    module parameter 'record_directory' of litexcnc is set. The recording can be
+    replayed with the component 'litexcnc_replay'."""
+    try:
+        recording = Trace(trace)
+    except ValueError as e:
+        click.echo(click.style("Error", fg="red") + f": {e}")
+        return -1
+
+    header = recording.header
+    version = header.fpga_version
+    click.echo(f"Firmware {(version >> 16) & 0xff}.{(version >> 8) & 0xff}.{version & 0xff}, fingerprint {header.fingerprint:08X}")
+    click.echo(f"{header.records} records, {header.used} of {header.size} bytes used")
+
+    counts = {}
+    failed = {}
+    reads = []
+    cycle = -1
+    for record in recording:
+        counts[record.type] = counts.get(record.type, 0) + 1
+        if record.failed:
+            failed[record.type] = failed.get(record.type, 0) + 1
+        if record.type == 'read':
+            cycle += 1
+            reads.append(record.timestamp)
+        if cycle in dump and record.type in ('read', 'write'):
+            data = "failed" if record.failed else record.data.hex(' ', 4)
+            click.echo(f"cycle {cycle} {record.type:5}: {data}")
+
+    for type, count in counts.items():
+        click.echo(f" - {type}: {count}" + (f" ({failed[type]} failed)" if type in failed else ""))
+
+    # Timing of the loop, as seen by the driver
+    if len(reads) > 2:
+        periods = [(b - a) / 1000 for a, b in zip(reads, reads[1:])]
+        click.echo(
+            f"Period: mean {statistics.mean(periods):.1f} us, min {min(periods):.1f} us, "
+            f"99% {_percentile(periods, 0.99):.1f} us, max {max(periods):.1f} us"
+        )
+    recording.close()
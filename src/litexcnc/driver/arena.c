@@ -0,0 +1,129 @@
+/********************************************************************
+* Description:  arena.c
+*               Memory of a board, which is allocated once when the
+*               board is registered. All buffers used while running
+*               are taken from this memory.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#include <rtapi_slab.h>
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "arena.h"
+
+
+#ifdef LITEXCNC_DEBUG_ARENA
+// Set when the first arena is sealed, from then on the driver should not allocate any
+// memory anymore
+static bool litexcnc_arena_debug_sealed = false;
+
+EXPORT_SYMBOL_GPL(litexcnc_arena_debug_allocation);
+void litexcnc_arena_debug_allocation(size_t size, const char *file, int line) {
+    if (litexcnc_arena_debug_sealed) {
+        LITEXCNC_ERR_NO_DEVICE("Allocation of %zu bytes after HAL is ready (%s:%d)\n", size, file, line);
+    }
+}
+#define LITEXCNC_ARENA_GUARD_SIZE LITEXCNC_ARENA_ALIGNMENT
+#else
+#define LITEXCNC_ARENA_GUARD_SIZE 0
+#endif
+
+
+EXPORT_SYMBOL_GPL(litexcnc_arena_init);
+int litexcnc_arena_init(litexcnc_arena_t *arena, size_t size) {
+    // In debug mode the arena is surrounded by guard words, to detect buffers which
+    // are written beyond their end.
+    arena->size = LITEXCNC_ARENA_ALIGN(size);
+    arena->used = 0;
+    arena->sealed = false;
+    arena->memory = rtapi_kmalloc(arena->size + 2 * LITEXCNC_ARENA_GUARD_SIZE, RTAPI_GFP_KERNEL);
+    if (arena->memory == NULL) {
+        arena->size = 0;
+        return -ENOMEM;
+    }
+    memset(arena->memory, 0, arena->size + 2 * LITEXCNC_ARENA_GUARD_SIZE);
+#ifdef LITEXCNC_DEBUG_ARENA
+    uint32_t guard = LITEXCNC_ARENA_GUARD;
+    memcpy(arena->memory, &guard, sizeof(guard));
+    memcpy(arena->memory + LITEXCNC_ARENA_GUARD_SIZE + arena->size, &guard, sizeof(guard));
+#endif
+    return 0;
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_arena_alloc);
+void *litexcnc_arena_alloc(litexcnc_arena_t *arena, size_t size) {
+    if (arena->sealed) {
+        LITEXCNC_ERR_NO_DEVICE("Allocation of %zu bytes from a sealed arena\n", size);
+        return NULL;
+    }
+    size = LITEXCNC_ARENA_ALIGN(size);
+    if (arena->used + size > arena->size) {
+        LITEXCNC_ERR_NO_DEVICE("Arena too small for %zu bytes (%zu of %zu bytes used)\n", size, arena->used, arena->size);
+        return NULL;
+    }
+    void *buffer = arena->memory + LITEXCNC_ARENA_GUARD_SIZE + arena->used;
+    arena->used += size;
+    return buffer;
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_arena_seal);
+void litexcnc_arena_seal(litexcnc_arena_t *arena) {
+    arena->sealed = true;
+#ifdef LITEXCNC_DEBUG_ARENA
+    litexcnc_arena_debug_sealed = true;
+#endif
+}
+
+
+bool litexcnc_arena_check(litexcnc_arena_t *arena) {
+#ifdef LITEXCNC_DEBUG_ARENA
+    uint32_t head, tail;
+    memcpy(&head, arena->memory, sizeof(head));
+    memcpy(&tail, arena->memory + LITEXCNC_ARENA_GUARD_SIZE + arena->size, sizeof(tail));
+    return (head == LITEXCNC_ARENA_GUARD) && (tail == LITEXCNC_ARENA_GUARD);
+#else
+    return true;
+#endif
+}
+
+
+void litexcnc_arena_free(litexcnc_arena_t *arena) {
+    if (arena->memory != NULL) {
+        rtapi_kfree(arena->memory);
+    }
+    arena->memory = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
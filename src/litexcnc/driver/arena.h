@@ -0,0 +1,69 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+#ifndef __INCLUDE_LITEXCNC_ARENA_H__
+#define __INCLUDE_LITEXCNC_ARENA_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// All buffers a board requires while running (config, read, write, request and
+// scratch) are taken from a single block of memory, which is allocated when the board
+// is registered. The arena is sealed before HAL is ready, from then on no memory can
+// be allocated anymore.
+//
+// Define LITEXCNC_DEBUG_ARENA to verify that no memory is allocated at all after a
+// board has been sealed: each `rtapi_kmalloc` in the driver is then reported. The
+// arena is also surrounded by guard words, which are checked each cycle.
+//#define LITEXCNC_DEBUG_ARENA
+
+// Alignment of the buffers in the arena (in bytes)
+#define LITEXCNC_ARENA_ALIGNMENT 8
+#define LITEXCNC_ARENA_ALIGN(size) (((size) + LITEXCNC_ARENA_ALIGNMENT - 1) & ~((size_t) LITEXCNC_ARENA_ALIGNMENT - 1))
+
+// Value of the guard words in debug mode
+#define LITEXCNC_ARENA_GUARD 0xDEADBEEF
+
+typedef struct {
+    uint8_t *memory;
+    size_t size;
+    size_t used;
+    bool sealed;
+} litexcnc_arena_t;
+
+// Allocates the memory of the arena. Returns 0 on success and -ENOMEM when the memory
+// could not be allocated.
+int litexcnc_arena_init(litexcnc_arena_t *arena, size_t size);
+// Takes a zeroed, aligned buffer from the arena. Returns NULL when the arena is full or
+// has been sealed.
+void *litexcnc_arena_alloc(litexcnc_arena_t *arena, size_t size);
+// Seals the arena, no buffers can be taken from it anymore
+void litexcnc_arena_seal(litexcnc_arena_t *arena);
+// Checks the guard words of the arena (only in debug mode, otherwise always true)
+bool litexcnc_arena_check(litexcnc_arena_t *arena);
+// Frees the memory of the arena
+void litexcnc_arena_free(litexcnc_arena_t *arena);
+
+#ifdef LITEXCNC_DEBUG_ARENA
+#include <rtapi_slab.h>
+// Reports an allocation after the first arena has been sealed
+void litexcnc_arena_debug_allocation(size_t size, const char *file, int line);
+#define rtapi_kmalloc(size, flags) (litexcnc_arena_debug_allocation((size), __FILE__, __LINE__), (rtapi_kmalloc)((size), (flags)))
+#endif
+
+#endif
@@ -0,0 +1,230 @@
+/********************************************************************
+* Description:  descriptor.c
+*               Reads the self-description of the MMIO from the FPGA
+*               and compares it with the configuration of the driver.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "descriptor.h"
+
+
+static const char *litexcnc_module_names[LITEXCNC_MODULE_COUNT] = {
+    [LITEXCNC_MODULE_WATCHDOG]  = "watchdog",
+    [LITEXCNC_MODULE_WALLCLOCK] = "wallclock",
+    [LITEXCNC_MODULE_GPIO_OUT]  = "gpio_out",
+    [LITEXCNC_MODULE_GPIO_IN]   = "gpio_in",
+    [LITEXCNC_MODULE_PWM]       = "pwm",
+    [LITEXCNC_MODULE_STEPGEN]   = "stepgen",
+    [LITEXCNC_MODULE_ENCODER]   = "encoder",
+    [LITEXCNC_MODULE_PID]       = "pid",
+    [LITEXCNC_MODULE_MODBUS]    = "modbus",
+    [LITEXCNC_MODULE_SPI]       = "spi",
+};
+
+
+int litexcnc_descriptor_module_id(const char *name) {
+    for (int id = 1; id < LITEXCNC_MODULE_COUNT; id++) {
+        if (strcmp(litexcnc_module_names[id], name) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+
+static int litexcnc_descriptor_read_words(litexcnc_t *litexcnc, uint32_t address, uint32_t *words, size_t count) {
+    int r = litexcnc->fpga->read_memory(litexcnc->fpga, address, (uint8_t *) words, count * sizeof(uint32_t));
+    if (r < 0) {
+        return r;
+    }
+    litexcnc_trace_record(&litexcnc->trace, LITEXCNC_TRACE_MEMORY, 0, address, (uint8_t *) words, count * sizeof(uint32_t));
+    for (size_t i = 0; i < count; i++) {
+        words[i] = be32toh(words[i]);
+    }
+    return 0;
+}
+
+
+int litexcnc_descriptor_read(litexcnc_t *litexcnc) {
+    litexcnc_descriptor_t *descriptor = &litexcnc->descriptor;
+    uint32_t header[LITEXCNC_DESCRIPTOR_HEADER_WORDS];
+    uint32_t entries[LITEXCNC_DESCRIPTOR_MAX_MODULES * LITEXCNC_DESCRIPTOR_MODULE_WORDS];
+    int r;
+
+    // Read the header of the descriptor
+    r = litexcnc_descriptor_read_words(litexcnc, LITEXCNC_DESCRIPTOR_ADDRESS, header, LITEXCNC_DESCRIPTOR_HEADER_WORDS);
+    if (r < 0) {
+        LITEXCNC_ERR("Cannot read descriptor from FPGA\n", litexcnc->fpga->name);
+        return r;
+    }
+    if (header[0] != LITEXCNC_DESCRIPTOR_MAGIC) {
+        LITEXCNC_ERR("Invalid descriptor magic received '%08X'\n", litexcnc->fpga->name, header[0]);
+        return -EINVAL;
+    }
+    if ((header[1] >> 16) != LITEXCNC_DESCRIPTOR_VERSION) {
+        LITEXCNC_ERR("Unsupported descriptor version %u (driver: %u)\n", litexcnc->fpga->name, header[1] >> 16, LITEXCNC_DESCRIPTOR_VERSION);
+        return -EINVAL;
+    }
+    size_t count = header[1] & 0xFFFF;
+    if (count > LITEXCNC_DESCRIPTOR_MAX_MODULES) {
+        LITEXCNC_ERR("Descriptor contains too many modules (%zu)\n", litexcnc->fpga->name, count);
+        return -EINVAL;
+    }
+    memset(descriptor, 0, sizeof(litexcnc_descriptor_t));
+    descriptor->reset_address  = header[2];
+    descriptor->config_address = header[3] >> 16;
+    descriptor->config_size    = header[3] & 0xFFFF;
+    descriptor->write_address  = header[4] >> 16;
+    descriptor->write_size     = header[4] & 0xFFFF;
+    descriptor->read_address   = header[5] >> 16;
+    descriptor->read_size      = header[5] & 0xFFFF;
+    descriptor->features       = header[6];
+
+    // Read the entries of the modules
+    r = litexcnc_descriptor_read_words(
+        litexcnc,
+        LITEXCNC_DESCRIPTOR_ADDRESS + LITEXCNC_DESCRIPTOR_HEADER_WORDS * sizeof(uint32_t),
+        entries,
+        count * LITEXCNC_DESCRIPTOR_MODULE_WORDS);
+    if (r < 0) {
+        LITEXCNC_ERR("Cannot read descriptor from FPGA\n", litexcnc->fpga->name);
+        return r;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint32_t *entry = &entries[i * LITEXCNC_DESCRIPTOR_MODULE_WORDS];
+        uint8_t id = entry[0] >> 24;
+        if ((id == 0) || (id >= LITEXCNC_MODULE_COUNT)) {
+            // Module not known by this driver, its data cannot be processed
+            LITEXCNC_ERR("Descriptor contains unknown module %u\n", litexcnc->fpga->name, id);
+            return -EINVAL;
+        }
+        litexcnc_descriptor_module_t *module = &descriptor->modules[id];
+        module->present      = true;
+        module->flags        = (entry[0] >> 16) & 0xFF;
+        module->instances    = entry[0] & 0xFFFF;
+        module->write_offset = entry[1] >> 16;
+        module->write_size   = entry[1] & 0xFFFF;
+        module->read_offset  = entry[2] >> 16;
+        module->read_size    = entry[2] & 0xFFFF;
+        // Check the data of the module lies within the blocks
+        if ((module->write_offset + module->write_size > descriptor->write_size) ||
+            (module->read_offset + module->read_size > descriptor->read_size)) {
+            LITEXCNC_ERR("Data of module '%s' lies outside the MMIO\n", litexcnc->fpga->name, litexcnc_module_names[id]);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+
+static int litexcnc_descriptor_verify_module(litexcnc_t *litexcnc, litexcnc_module_id_t id, size_t instances, size_t write_size, size_t read_size) {
+    litexcnc_descriptor_module_t *module = &litexcnc->descriptor.modules[id];
+    int r = 0;
+
+    if (!module->present && (instances || write_size || read_size)) {
+        LITEXCNC_ERR("Module '%s' is missing on the FPGA\n", litexcnc->fpga->name, litexcnc_module_names[id]);
+        return -EINVAL;
+    }
+    if (module->instances != instances) {
+        LITEXCNC_ERR(
+            "Mismatch in module '%s': %zu instances in driver, %u on FPGA\n",
+            litexcnc->fpga->name, litexcnc_module_names[id], instances, module->instances);
+        r = -EINVAL;
+    }
+    if (module->write_size != write_size) {
+        LITEXCNC_ERR(
+            "Mismatch in module '%s': write data is %zu bytes in driver, %u bytes on FPGA\n",
+            litexcnc->fpga->name, litexcnc_module_names[id], write_size, module->write_size);
+        r = -EINVAL;
+    }
+    if (module->read_size != read_size) {
+        LITEXCNC_ERR(
+            "Mismatch in module '%s': read data is %zu bytes in driver, %u bytes on FPGA\n",
+            litexcnc->fpga->name, litexcnc_module_names[id], read_size, module->read_size);
+        r = -EINVAL;
+    }
+    if (((module->flags & LITEXCNC_DESCRIPTOR_MODULE_FLAG_SLOW) != 0) != litexcnc->slow_modules[id]) {
+        LITEXCNC_ERR(
+            "Mismatch in module '%s': %s rate group in driver, %s rate group on FPGA\n",
+            litexcnc->fpga->name, litexcnc_module_names[id], 
+            litexcnc->slow_modules[id] ? "slow" : "fast",
+            (module->flags & LITEXCNC_DESCRIPTOR_MODULE_FLAG_SLOW) ? "slow" : "fast");
+        r = -EINVAL;
+    }
+    return r;
+}
+
+
+int litexcnc_descriptor_verify(litexcnc_t *litexcnc) {
+    /*
+     * Compares the descriptor with the sizes of the data as calculated by the modules
+     * of the driver. All mismatches are reported, so the user can see exactly which
+     * part of the configuration differs between the driver and the FPGA.
+     *
+     * The number of instances and the sizes are taken from the JSON configuration and
+     * not from the descriptor, because the descriptor does not contain the names of the
+     * pins and the settings of the instances which the modules require to create their
+     * pins. The descriptor only determines where the data of each module is placed.
+     */
+    int r = 0;
+
+    if (((litexcnc->descriptor.features & LITEXCNC_DESCRIPTOR_FEATURE_COMPACT_IMAGE) != 0) != litexcnc->compact_image) {
+        LITEXCNC_ERR(
+            "Mismatch in compact image: %s in driver, %s on FPGA\n",
+            litexcnc->fpga->name,
+            litexcnc->compact_image ? "enabled" : "disabled",
+            (litexcnc->descriptor.features & LITEXCNC_DESCRIPTOR_FEATURE_COMPACT_IMAGE) ? "enabled" : "disabled");
+        r = -EINVAL;
+    }
+    if (litexcnc->descriptor.config_size != LITEXCNC_CONFIG_HEADER_SIZE) {
+        LITEXCNC_ERR(
+            "Mismatch in config: %zu bytes in driver, %u bytes on FPGA\n",
+            litexcnc->fpga->name, LITEXCNC_CONFIG_HEADER_SIZE, litexcnc->descriptor.config_size);
+        r = -EINVAL;
+    }
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_WATCHDOG, 1, LITEXCNC_WATCHDOG_DATA_WRITE_SIZE, LITEXCNC_WATCHDOG_DATA_READ_SIZE) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_WALLCLOCK, 1, LITEXCNC_WALLCLOCK_DATA_WRITE_SIZE, LITEXCNC_WALLCLOCK_DATA_READ_SIZE) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_GPIO_OUT, litexcnc->gpio.num_output_pins, LITEXCNC_BOARD_GPIO_DATA_WRITE_SIZE(litexcnc), 0) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_GPIO_IN, litexcnc->gpio.num_input_pins, 0, LITEXCNC_BOARD_GPIO_DATA_READ_SIZE(litexcnc)) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_PWM, litexcnc->pwm.num_instances, LITEXCNC_BOARD_PWM_DATA_WRITE_SIZE(litexcnc), LITEXCNC_BOARD_PWM_DATA_READ_SIZE(litexcnc)) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_STEPGEN, litexcnc->stepgen.num_instances, LITEXCNC_BOARD_STEPGEN_DATA_WRITE_SIZE(litexcnc), LITEXCNC_BOARD_STEPGEN_DATA_READ_SIZE(litexcnc)) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_ENCODER, litexcnc->encoder.num_instances, LITEXCNC_BOARD_ENCODER_DATA_WRITE_SIZE(litexcnc), LITEXCNC_BOARD_ENCODER_DATA_READ_SIZE(litexcnc)) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_PID, litexcnc->pid.num_instances, LITEXCNC_BOARD_PID_DATA_WRITE_SIZE(litexcnc), LITEXCNC_BOARD_PID_DATA_READ_SIZE(litexcnc)) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_MODBUS, litexcnc->modbus.num_instances, LITEXCNC_BOARD_MODBUS_DATA_WRITE_SIZE(litexcnc), LITEXCNC_BOARD_MODBUS_DATA_READ_SIZE(litexcnc)) < 0) r = -EINVAL;
+    if (litexcnc_descriptor_verify_module(litexcnc, LITEXCNC_MODULE_SPI, litexcnc->spi.num_instances, LITEXCNC_BOARD_SPI_DATA_WRITE_SIZE(litexcnc), LITEXCNC_BOARD_SPI_DATA_READ_SIZE(litexcnc)) < 0) r = -EINVAL;
+
+    return r;
+}
@@ -0,0 +1,84 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+#ifndef __INCLUDE_LITEXCNC_DESCRIPTOR_H__
+#define __INCLUDE_LITEXCNC_DESCRIPTOR_H__
+
+// The descriptor is a ROM on the FPGA which describes the layout of the MMIO. These
+// values MUST coincide with the values in `firmware/mmio.py`.
+#define LITEXCNC_DESCRIPTOR_ADDRESS      0x00010000
+#define LITEXCNC_DESCRIPTOR_MAGIC        0x4C584344
+#define LITEXCNC_DESCRIPTOR_VERSION      1
+#define LITEXCNC_DESCRIPTOR_HEADER_WORDS 7
+#define LITEXCNC_DESCRIPTOR_MODULE_WORDS 3
+#define LITEXCNC_DESCRIPTOR_MAX_MODULES  32
+
+// Flags in the features of the descriptor and in the flags of the modules
+#define LITEXCNC_DESCRIPTOR_FEATURE_COMPACT_IMAGE   0x01
+#define LITEXCNC_DESCRIPTOR_FEATURE_BLOCK_READ      0x02
+#define LITEXCNC_DESCRIPTOR_FEATURE_CONFIG_READBACK 0x04
+#define LITEXCNC_DESCRIPTOR_MODULE_FLAG_COMPACT     0x01
+#define LITEXCNC_DESCRIPTOR_MODULE_FLAG_SLOW        0x02
+
+// Identifiers of the modules in the descriptor
+typedef enum {
+    LITEXCNC_MODULE_WATCHDOG  = 1,
+    LITEXCNC_MODULE_WALLCLOCK = 2,
+    LITEXCNC_MODULE_GPIO_OUT  = 3,
+    LITEXCNC_MODULE_GPIO_IN   = 4,
+    LITEXCNC_MODULE_PWM       = 5,
+    LITEXCNC_MODULE_STEPGEN   = 6,
+    LITEXCNC_MODULE_ENCODER   = 7,
+    LITEXCNC_MODULE_PID       = 8,
+    LITEXCNC_MODULE_MODBUS    = 9,
+    LITEXCNC_MODULE_SPI       = 10,
+    LITEXCNC_MODULE_COUNT
+} litexcnc_module_id_t;
+
+// Location of the data of a single module. The offsets are relative to the start of
+// the write and read block respectively. All offsets and sizes are in bytes.
+typedef struct {
+    bool present;
+    uint16_t instances;
+    uint8_t flags;
+    uint16_t write_offset;
+    uint16_t write_size;
+    uint16_t read_offset;
+    uint16_t read_size;
+} litexcnc_descriptor_module_t;
+
+// The layout of the MMIO as read from the descriptor
+typedef struct {
+    uint32_t reset_address;
+    uint16_t config_address;
+    uint16_t config_size;
+    uint16_t write_address;
+    uint16_t write_size;
+    uint16_t read_address;
+    uint16_t read_size;
+    uint32_t features;
+    litexcnc_descriptor_module_t modules[LITEXCNC_MODULE_COUNT];
+} litexcnc_descriptor_t;
+
+// Functions for reading the descriptor from the FPGA and comparing it with the
+// configuration of the driver
+int litexcnc_descriptor_read(litexcnc_t *litexcnc);
+int litexcnc_descriptor_verify(litexcnc_t *litexcnc);
+// Returns the identifier of the module with the given name, or -1 when the name is unknown
+int litexcnc_descriptor_module_id(const char *name);
+
+#endif
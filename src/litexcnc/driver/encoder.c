@@ -52,6 +52,9 @@ int litexcnc_encoder_init(litexcnc_t *litexcnc, cJSON *config) {
     const cJSON *encoder_config = NULL;
     const cJSON *encoder_instance_config = NULL;
     const cJSON *encoder_instance_name = NULL;
+    const cJSON *stepgen_instance_config = NULL;
+    const cJSON *gearing_encoder = NULL;
+    const cJSON *encoder_mpg = NULL;
     char base_name[HAL_NAME_LEN + 1];   // i.e. <board_name>.<board_index>.pwm.<pwm_name>
     char name[HAL_NAME_LEN + 1];        // i.e. <base_name>.<pin_name>
 
@@ -126,6 +129,63 @@ int litexcnc_encoder_init(litexcnc_t *litexcnc, cJSON *config) {
             rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "x4_mode"); 
             r = hal_param_bit_new(name, HAL_RW, &(instance->hal.param.x4_mode), litexcnc->fpga->comp_id);
             if (r < 0) { goto fail_params; }
+
+            // Electronic gearing: the encoder drives a stepgen when it is referred to in
+            // the gearing of any stepgen. The counts are then measured in windows by the
+            // FPGA as well.
+            cJSON_ArrayForEach(stepgen_instance_config, cJSON_GetObjectItemCaseSensitive(config, "stepgen")) {
+                gearing_encoder = cJSON_GetObjectItemCaseSensitive(cJSON_GetObjectItemCaseSensitive(stepgen_instance_config, "gearing"), "encoder");
+                if (cJSON_IsNumber(gearing_encoder) && (gearing_encoder->valueint == i)) {
+                    instance->data.gearing_source = true;
+                }
+            }
+            if (instance->data.gearing_source) {
+                litexcnc->encoder.num_gearing_sources++;
+                // - gearing velocity
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "gearing.velocity"); 
+                r = hal_pin_float_new(name, HAL_OUT, &(instance->hal.pin.gearing_velocity), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+            }
+
+            // Manual pulse generator (optional)
+            encoder_mpg = cJSON_GetObjectItemCaseSensitive(encoder_instance_config, "mpg");
+            if (cJSON_IsTrue(encoder_mpg)) {
+                instance->mpg = (litexcnc_encoder_mpg_t *)hal_malloc(sizeof(litexcnc_encoder_mpg_t));
+                if (instance->mpg == NULL) {
+                    LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+                    r = -ENOMEM;
+                    return r;
+                }
+                // - enable
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "mpg.enable"); 
+                r = hal_pin_bit_new(name, HAL_IN, &(instance->mpg->hal.pin.enable), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+                // - scale
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "mpg.scale"); 
+                r = hal_pin_float_new(name, HAL_IN, &(instance->mpg->hal.pin.scale), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+                // - max-velocity
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "mpg.max-velocity"); 
+                r = hal_pin_float_new(name, HAL_IN, &(instance->mpg->hal.pin.max_velocity), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+                // - max-acceleration
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "mpg.max-acceleration"); 
+                r = hal_pin_float_new(name, HAL_IN, &(instance->mpg->hal.pin.max_acceleration), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+                // - max-jerk
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "mpg.max-jerk"); 
+                r = hal_pin_float_new(name, HAL_IN, &(instance->mpg->hal.pin.max_jerk), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+                // - velocity
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "mpg.velocity"); 
+                r = hal_pin_float_new(name, HAL_OUT, &(instance->mpg->hal.pin.velocity), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+                // - active
+                rtapi_snprintf(name, sizeof(name), "%s.%s", base_name, "mpg.active"); 
+                r = hal_pin_bit_new(name, HAL_OUT, &(instance->mpg->hal.pin.active), litexcnc->fpga->comp_id);
+                if (r < 0) { goto fail_pins; }
+                instance->mpg->data.filter_length = 1;
+            }
             
             // Increase counter to proceed to the next encoder
             i++;
@@ -144,6 +204,88 @@ fail_params:
 }
 
 
+static void litexcnc_encoder_process_mpg(litexcnc_encoder_mpg_t *mpg, int32_t counts, long period) {
+    /* ENCODER PROCESS MPG
+     * Converts the counts of the encoder in this period to the jog velocity. The distance
+     * to go is followed with a velocity limited in acceleration, in the same way as the
+     * simple trajectory planner of LinuxCNC. The jerk is limited by a moving average over
+     * the time to reach the maximum acceleration, which keeps the distance travelled exact.
+     */
+    double dt = period * 0.000000001;
+    double max_acceleration = fabs(*(mpg->hal.pin.max_acceleration));
+    double max_velocity = fabs(*(mpg->hal.pin.max_velocity));
+    double max_dv = max_acceleration * dt;
+    double tiny_dp = max_dv * dt * 0.001;
+    double velocity_request = 0.0;
+
+    // Add the distance of the counts. Counts which cannot be followed, because the distance
+    // to go would exceed the stopping distance at the maximum velocity, are dropped. When the
+    // MPG is disabled, the counts are ignored and the jog is stopped.
+    if (*(mpg->hal.pin.enable) && (max_acceleration > 0.0)) {
+        double max_distance = max_velocity * max_velocity / (2.0 * max_acceleration);
+        mpg->data.distance += counts * *(mpg->hal.pin.scale);
+        if (mpg->data.distance > max_distance) mpg->data.distance = max_distance;
+        if (mpg->data.distance < -max_distance) mpg->data.distance = -max_distance;
+        // The velocity at which the distance to go can just be stopped
+        if (mpg->data.distance > tiny_dp) {
+            velocity_request = -max_dv + sqrt(2.0 * max_acceleration * mpg->data.distance + max_dv * max_dv);
+        } else if (mpg->data.distance < -tiny_dp) {
+            velocity_request = max_dv - sqrt(-2.0 * max_acceleration * mpg->data.distance + max_dv * max_dv);
+        }
+        if (velocity_request > max_velocity) velocity_request = max_velocity;
+        if (velocity_request < -max_velocity) velocity_request = -max_velocity;
+    } else {
+        mpg->data.distance = 0.0;
+    }
+
+    // Limit the acceleration
+    double velocity = mpg->data.velocity;
+    if (velocity_request > velocity + max_dv) {
+        velocity_request = velocity + max_dv;
+    } else if (velocity_request < velocity - max_dv) {
+        velocity_request = velocity - max_dv;
+    }
+    mpg->data.distance -= 0.5 * (velocity + velocity_request) * dt;
+    mpg->data.velocity = velocity_request;
+    // Stop exactly at the end of the jog
+    if ((fabs(mpg->data.distance) < tiny_dp) && (fabs(mpg->data.velocity) < max_dv)) {
+        mpg->data.distance = 0.0;
+        mpg->data.velocity = 0.0;
+    }
+
+    // Limit the jerk with the moving average. When the length of the moving average changes,
+    // the filter is restarted at the current velocity, so the output is continuous. When
+    // the jerk is not limited (zero), the length is a single period.
+    size_t filter_length = 1;
+    if (*(mpg->hal.pin.max_jerk) > 0.0) {
+        double length = max_acceleration / *(mpg->hal.pin.max_jerk) / dt;
+        filter_length = (length >= LITEXCNC_ENCODER_MPG_FILTER_SIZE) ? LITEXCNC_ENCODER_MPG_FILTER_SIZE : (length < 1.0) ? 1 : (size_t) (length + 0.5);
+    }
+    if (filter_length != mpg->data.filter_length) {
+        float average = mpg->data.filter_sum / mpg->data.filter_length;
+        for (size_t i = 0; i < filter_length; i++) {
+            mpg->data.filter[i] = average;
+        }
+        mpg->data.filter_sum = average * filter_length;
+        mpg->data.filter_length = filter_length;
+        mpg->data.filter_pointer = 0;
+    }
+    mpg->data.filter_sum += mpg->data.velocity - mpg->data.filter[mpg->data.filter_pointer];
+    mpg->data.filter[mpg->data.filter_pointer] = mpg->data.velocity;
+    if (++mpg->data.filter_pointer >= mpg->data.filter_length) {
+        mpg->data.filter_pointer = 0;
+        // Recalculate the sum once per round, so the rounding errors of the running sum
+        // do not accumulate and the output is exactly zero at standstill
+        mpg->data.filter_sum = 0.0;
+        for (size_t i = 0; i < mpg->data.filter_length; i++) {
+            mpg->data.filter_sum += mpg->data.filter[i];
+        }
+    }
+    *(mpg->hal.pin.velocity) = mpg->data.filter_sum / mpg->data.filter_length;
+    *(mpg->hal.pin.active) = (mpg->data.distance != 0.0) || (*(mpg->hal.pin.velocity) != 0.0);
+}
+
+
 uint8_t litexcnc_encoder_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period) {
     /* ENCODER PREPARE WRITE
      * This function assembles the data which is written to the FPGA:
@@ -153,6 +295,7 @@ uint8_t litexcnc_encoder_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
      *    during the next cycle of the thread the pin will be read as LOW. Possibly this
      *    method can be refined optionally let the user reset the pin_Z manually. This
      *    might be necessary when there are two parallel threads running at the same time. 
+     *  - the `x4 mode`-flag, as set by the hal param. The decoding is done on the FPGA.
      *
      * When there are no encoders defined, this function direclty returns.
      */
@@ -162,6 +305,12 @@ uint8_t litexcnc_encoder_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
         return 0;
     }
 
+    // Use the unrolled function generated for this board, when available
+    if (litexcnc->image) {
+        litexcnc->image->encoder_prepare_write(litexcnc, data);
+        return 0;
+    }
+
     // Declaration of shared variables
     uint8_t mask;
 
@@ -170,7 +319,7 @@ uint8_t litexcnc_encoder_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
     for (size_t i=LITEXCNC_BOARD_ENCODER_SHARED_INDEX_ENABLE_WRITE_SIZE(litexcnc)*8; i>0; i--) {
         // The counter i can have a value outside the range of possible instances. We only
         // should add data from existing instances
-        if (i < litexcnc->encoder.num_instances) {
+        if (i <= litexcnc->encoder.num_instances) {
             *(*data) |= *(litexcnc->encoder.instances[i-1].hal.pin.index_enable)?mask:0;
         }
         // Modify the mask for the next. When the mask is zero (happens in case of a 
@@ -187,7 +336,7 @@ uint8_t litexcnc_encoder_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
     for (size_t i=LITEXCNC_BOARD_ENCODER_SHARED_RESET_INDEX_PULSE_WRITE_SIZE(litexcnc)*8; i>0; i--) {
         // The counter i can have a value outside the range of possible instances. We only
         // should add data from existing instances
-        if (i < litexcnc->encoder.num_instances) {
+        if (i <= litexcnc->encoder.num_instances) {
             *(*data) |= *(litexcnc->encoder.instances[i-1].hal.pin.index_pulse)?mask:0;
         }
         // Modify the mask for the next. When the mask is zero (happens in case of a 
@@ -199,6 +348,23 @@ uint8_t litexcnc_encoder_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
         }
     }
 
+    // X4 mode (shared register)
+    mask = 0x80;
+    for (size_t i=LITEXCNC_BOARD_ENCODER_SHARED_X4_MODE_WRITE_SIZE(litexcnc)*8; i>0; i--) {
+        // The counter i can have a value outside the range of possible instances. We only
+        // should add data from existing instances
+        if (i <= litexcnc->encoder.num_instances) {
+            *(*data) |= litexcnc->encoder.instances[i-1].hal.param.x4_mode?mask:0;
+        }
+        // Modify the mask for the next. When the mask is zero (happens in case of a 
+        // roll-over), we should proceed to the next byte and reset the mask.
+        mask >>= 1;
+        if (!mask) {
+            mask = 0x80;  // Reset the mask
+            (*data)++; // Proceed the buffer to the next element
+        }
+    }
+
     return 0;
 }
 
@@ -223,27 +389,32 @@ uint8_t litexcnc_encoder_process_read(litexcnc_t *litexcnc, uint8_t** data, long
     // Declaration of shared variables
     uint8_t mask;
 
-    // Index pulse (shared register)
+    // Index pulse (shared register), using the unrolled function generated for this
+    // board when available
     mask = 0x80;
-    for (size_t i=LITEXCNC_BOARD_ENCODER_SHARED_INDEX_PULSE_READ_SIZE(litexcnc)*8; i>0; i--) {
-        // The counter i can have a value outside the range of possible instances. We only
-        // should add data to existing instances
-        if (i < litexcnc->encoder.num_instances) {
-            uint8_t index_pulse = (*(*data) & mask)?1:0;
-            // Reset the index enable on positive edge of the index pulse
-            // NOTE: the FPGA only sets the index pulse when a raising flank has been detected
-            if (index_pulse) {
-                *(litexcnc->encoder.instances[i-1].hal.pin.index_enable) = 0;
+    if (litexcnc->image) {
+        litexcnc->image->encoder_process_read(litexcnc, data);
+    } else {
+        for (size_t i=LITEXCNC_BOARD_ENCODER_SHARED_INDEX_PULSE_READ_SIZE(litexcnc)*8; i>0; i--) {
+            // The counter i can have a value outside the range of possible instances. We only
+            // should add data to existing instances
+            if (i <= litexcnc->encoder.num_instances) {
+                uint8_t index_pulse = (*(*data) & mask)?1:0;
+                // Reset the index enable on positive edge of the index pulse
+                // NOTE: the FPGA only sets the index pulse when a raising flank has been detected
+                if (index_pulse) {
+                    *(litexcnc->encoder.instances[i-1].hal.pin.index_enable) = 0;
+                }
+                // Set the index pulse
+                *(litexcnc->encoder.instances[i-1].hal.pin.index_pulse) = index_pulse;
+            }
+            // Modify the mask for the next. When the mask is zero (happens in case of a 
+            // roll-over), we should proceed to the next byte and reset the mask.
+            mask >>= 1;
+            if (!mask) {
+                mask = 0x80;  // Reset the mask
+                (*data)++; // Proceed the buffer to the next element
             }
-            // Set the index pulse
-            *(litexcnc->encoder.instances[i-1].hal.pin.index_pulse) = index_pulse;
-        }
-        // Modify the mask for the next. When the mask is zero (happens in case of a 
-        // roll-over), we should proceed to the next byte and reset the mask.
-        mask >>= 1;
-        if (!mask) {
-            mask = 0x80;  // Reset the mask
-            (*data)++; // Proceed the buffer to the next element
         }
     }
     
@@ -269,18 +440,41 @@ uint8_t litexcnc_encoder_process_read(litexcnc_t *litexcnc, uint8_t** data, long
         // Read the data and store it on the instance
         // - store the previous counts (required for roll-over detection)
         int32_t counts_old = *(instance->hal.pin.counts);
-        // - convert received data to struct
-        litexcnc_encoder_instance_read_data_t instance_data;
-        memcpy(&instance_data, *data, sizeof(litexcnc_encoder_instance_read_data_t));
-        *data += sizeof(litexcnc_encoder_instance_read_data_t);
-
-        // - store the counts from the FPGA to the driver (keep in mind the endianess). Also
-        //   take into account whether we are in x4_mode or not.
-        if (instance->hal.param.x4_mode) {
-            *(instance->hal.pin.counts) = (int32_t)be32toh((uint32_t)instance_data.counts);
+        int32_t raw_counts_old = instance->data.raw_counts + instance->data.counts_offset;
+        // - convert received data to the raw counts (keep in mind the endianess)
+        if (litexcnc->compact_image) {
+            // Compact image: only the lower 16 bits of the counts are received. The full
+            // count is restored by adding the difference with the previous count, which is
+            // valid as long as the encoder moves less than 2^15 counts per period. After
+            // an index pulse the counter on the FPGA has been reset, the count is then
+            // taken as is.
+            uint16_t counts_compact = ((uint16_t)(*data)[0] << 8) | (*data)[1];
+            *data += LITEXCNC_ENCODER_COMPACT_INSTANCE_READ_DATA_SIZE;
+            if (*(instance->hal.pin.index_pulse) || litexcnc->encoder.data.reseed) {
+                instance->data.raw_counts = (int16_t) counts_compact;
+            } else {
+                instance->data.raw_counts += (int16_t)(counts_compact - (uint16_t) instance->data.raw_counts);
+            }
         } else {
-            *(instance->hal.pin.counts) = ((int32_t)be32toh((uint32_t)instance_data.counts)) / 4;
+            litexcnc_encoder_instance_read_data_t instance_data;
+            memcpy(&instance_data, *data, sizeof(litexcnc_encoder_instance_read_data_t));
+            *data += sizeof(litexcnc_encoder_instance_read_data_t);
+            instance->data.raw_counts = (int32_t)be32toh((uint32_t)instance_data.counts);
         }
+        // - after the board has been power-cycled, the counter on the FPGA starts at zero
+        //   again. The counts continue from the last value, so the position does not jump.
+        //   After an index pulse the counts are referenced to the index again.
+        if (litexcnc->encoder.data.reseed) {
+            instance->data.counts_offset = raw_counts_old - instance->data.raw_counts;
+        }
+        if (*(instance->hal.pin.index_pulse)) {
+            instance->data.counts_offset = 0;
+        }
+        int32_t raw_counts = instance->data.raw_counts + instance->data.counts_offset;
+
+        // - store the counts from the FPGA to the driver. The FPGA already counts in the
+        //   selected mode (x4, or x1/x2).
+        *(instance->hal.pin.counts) = raw_counts;
 
         // Calculate the new position based on the counts
         // - store the previous position (requered for the velocity calculation)
@@ -319,6 +513,15 @@ uint8_t litexcnc_encoder_process_read(litexcnc_t *litexcnc, uint8_t** data, long
 
         }
 
+        // Jog with the counts in this period when the encoder is used as MPG. The counts
+        // are not continuous when the counter has been reset by an index pulse.
+        if (instance->mpg) {
+            litexcnc_encoder_process_mpg(
+                instance->mpg,
+                *(instance->hal.pin.index_pulse) ? 0 : (int32_t)((uint32_t) *(instance->hal.pin.counts) - (uint32_t) counts_old),
+                period);
+        }
+
         // Calculate the new speed based on the new position (running average). The
         // running average is not modified when an index-pulse is received, as this
         // means there is a large jump in position and thus to a large theoretical 
@@ -338,5 +541,30 @@ uint8_t litexcnc_encoder_process_read(litexcnc_t *litexcnc, uint8_t** data, long
         }
     }
 
+    // Skip the padding at the end of the compact image (odd number of encoders)
+    if (litexcnc->compact_image && (litexcnc->encoder.num_instances & 1)) {
+        *data += LITEXCNC_ENCODER_COMPACT_INSTANCE_READ_DATA_SIZE;
+    }
+
+    // The counts in the last window of the encoders driving a stepgen (electronic gearing)
+    for (size_t i=0; i < litexcnc->encoder.num_instances; i++) {
+        litexcnc_encoder_instance_t *instance = &(litexcnc->encoder.instances[i]);
+        if (!instance->data.gearing_source) {
+            continue;
+        }
+        uint32_t gearing_rate;
+        memcpy(&gearing_rate, *data, sizeof gearing_rate);
+        *data += sizeof gearing_rate;
+        instance->data.gearing_rate = (int32_t) be32toh(gearing_rate);
+        *(instance->hal.pin.gearing_velocity) = (float) instance->data.gearing_rate * litexcnc->clock_frequency / LITEXCNC_ENCODER_GEARING_WINDOW * instance->data.position_scale_recip;
+    }
+    litexcnc->encoder.data.reseed = false;
+
     return 0;
+}
+
+
+void litexcnc_encoder_reseed(litexcnc_t *litexcnc) {
+    // The counts are continued from their last value in the next read
+    litexcnc->encoder.data.reseed = true;
 }
\ No newline at end of file
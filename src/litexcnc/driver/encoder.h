@@ -41,6 +41,50 @@
 #include "cJSON/cJSON.h"
 
 #define LITEXCNC_ENCODER_POSITION_AVERAGE_SIZE 8
+// The window (in clock cycles) in which the FPGA counts the pulses of the encoders driving
+// a stepgen (electronic gearing). This value MUST coincide with `EncoderModule.GEARING_WINDOW_BITS`.
+#define LITEXCNC_ENCODER_GEARING_WINDOW 1024
+// The maximum number of periods of the moving average which limits the jerk of the MPG
+#define LITEXCNC_ENCODER_MPG_FILTER_SIZE 1024
+
+// Defines the manual pulse generator (MPG), which converts the counts of an encoder to a
+// jog velocity. The counts are added to the distance to go, which is followed with limited
+// acceleration. A moving average over the time to reach the acceleration limits the jerk,
+// without changing the distance travelled.
+typedef struct {
+    struct {
+        struct {
+            /* When true, the counts are converted to a jog velocity. When false, the counts are
+             * ignored and the jog velocity is brought to a stop.
+             */
+            hal_bit_t *enable;
+            /* The distance to jog per count, in length units. */
+            hal_float_t *scale;
+            /* The maximum jog velocity, in length units per second. */
+            hal_float_t *max_velocity;
+            /* The maximum jog acceleration, in length units per second squared. */
+            hal_float_t *max_acceleration;
+            /* The maximum jog jerk, in length units per second cubed. When zero (default), the
+             * jerk is not limited. When the time to reach the acceleration exceeds the size of
+             * the filter, the jerk is limited by the size of the filter.
+             */
+            hal_float_t *max_jerk;
+            /* The jog velocity, in length units per second. */
+            hal_float_t *velocity;
+            /* True while the jog is in progress (the distance to go or the velocity is not zero). */
+            hal_bit_t *active;
+        } pin;
+    } hal;
+
+    struct {
+        double distance;  /* The distance to go, in length units */
+        double velocity;  /* The velocity before the moving average */
+        float filter[LITEXCNC_ENCODER_MPG_FILTER_SIZE];
+        double filter_sum;
+        size_t filter_length;
+        size_t filter_pointer;
+    } data;
+} litexcnc_encoder_mpg_t;
 
 // Defines the structure of the PWM instance
 typedef struct {
@@ -78,6 +122,10 @@ typedef struct {
              * of 60 for convenience.
              */
             hal_bit_t *overflow_occurred;
+            /* Velocity in scaled units per second, as measured by the FPGA for the electronic
+             * gearing. Only exported for encoders which drive a stepgen.
+             */
+            hal_float_t *gearing_velocity;
         } pin;
 
         struct {
@@ -86,9 +134,9 @@ typedef struct {
              */ 
             hal_float_t position_scale;
             /* Enables times-4 mode. When true (the default), the counter counts each edge of the
-             * quadrature waveform (four counts per full cycle). When false, it only counts once 
-             * per full cycle. NOTE: this function is implemented by dividing applying an integer
-             * division of 4 between received data and counts.
+             * quadrature waveform (four counts per full cycle). When false, the decoding set in
+             * the configuration of the FPGA is used: once (x1) or twice (x2) per full cycle. The
+             * decoding is done by the FPGA, the counts are not changed when switching modes.
              */
             hal_bit_t x4_mode;
         } param;
@@ -105,7 +153,14 @@ typedef struct {
     // This struct contains data, both calculated and direct received from the FPGA
     struct {
         hal_float_t position_scale_recip;
+        int32_t raw_counts;   /* The counts as received from the FPGA */
+        int32_t counts_offset;  /* Added to raw_counts, so the counts continue after the board has been power-cycled */
+        bool gearing_source;  /* True when the encoder drives a stepgen (electronic gearing) */
+        int32_t gearing_rate;  /* The counts in the last window of the gearing */
     } data;
+
+    // The manual pulse generator, NULL when the encoder is not used as MPG
+    litexcnc_encoder_mpg_t *mpg;
     
 } litexcnc_encoder_instance_t;
 
@@ -114,6 +169,7 @@ typedef struct {
 typedef struct {
     // Input pins
     int num_instances;
+    int num_gearing_sources;
     litexcnc_encoder_instance_t *instances;
 
     struct {
@@ -123,6 +179,9 @@ typedef struct {
     // Struct containing pre-calculated values
     struct {
         float recip_dt;
+        // When true, the counter on the FPGA has been restarted (i.e. the board has
+        // been power-cycled) and the counts are taken as is in the next read
+        bool reseed;
     } data;
 
 } litexcnc_encoder_t;
@@ -133,7 +192,8 @@ typedef struct {
 // - write
 #define LITEXCNC_BOARD_ENCODER_SHARED_INDEX_ENABLE_WRITE_SIZE(litexcnc) (((litexcnc->encoder.num_instances)>>5) + ((litexcnc->encoder.num_instances & 0x1F)?1:0)) *4
 #define LITEXCNC_BOARD_ENCODER_SHARED_RESET_INDEX_PULSE_WRITE_SIZE(litexcnc) (((litexcnc->encoder.num_instances)>>5) + ((litexcnc->encoder.num_instances & 0x1F)?1:0)) *4
-#define LITEXCNC_BOARD_ENCODER_DATA_WRITE_SIZE(litexcnc) LITEXCNC_BOARD_ENCODER_SHARED_INDEX_ENABLE_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_SHARED_RESET_INDEX_PULSE_WRITE_SIZE(litexcnc)
+#define LITEXCNC_BOARD_ENCODER_SHARED_X4_MODE_WRITE_SIZE(litexcnc) (((litexcnc->encoder.num_instances)>>5) + ((litexcnc->encoder.num_instances & 0x1F)?1:0)) *4
+#define LITEXCNC_BOARD_ENCODER_DATA_WRITE_SIZE(litexcnc) LITEXCNC_BOARD_ENCODER_SHARED_INDEX_ENABLE_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_SHARED_RESET_INDEX_PULSE_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_SHARED_X4_MODE_WRITE_SIZE(litexcnc)
 // - read
 #pragma pack(push,4)
 typedef struct {
@@ -141,7 +201,12 @@ typedef struct {
 } litexcnc_encoder_instance_read_data_t;
 #pragma pack(pop)
 #define LITEXCNC_BOARD_ENCODER_SHARED_INDEX_PULSE_READ_SIZE(litexcnc) (((litexcnc->encoder.num_instances)>>5) + ((litexcnc->encoder.num_instances & 0x1F)?1:0)) *4
-#define LITEXCNC_BOARD_ENCODER_DATA_READ_SIZE(litexcnc) LITEXCNC_BOARD_ENCODER_SHARED_INDEX_PULSE_READ_SIZE(litexcnc) + litexcnc->encoder.num_instances * 4  //sizeof(litexcnc_encoder_instance_read_data_t)
+// - read (compact image): the lower 16 bits of the counts, padded to a multiple of 4 bytes
+#define LITEXCNC_ENCODER_COMPACT_INSTANCE_READ_DATA_SIZE 2
+#define LITEXCNC_BOARD_ENCODER_COUNTS_READ_SIZE(litexcnc) (litexcnc->compact_image?((LITEXCNC_ENCODER_COMPACT_INSTANCE_READ_DATA_SIZE*litexcnc->encoder.num_instances + 3) & ~3):(litexcnc->encoder.num_instances * 4))  //sizeof(litexcnc_encoder_instance_read_data_t)
+// - read (gearing): the counts in the last window for each encoder driving a stepgen
+#define LITEXCNC_BOARD_ENCODER_GEARING_READ_SIZE(litexcnc) (litexcnc->encoder.num_gearing_sources * 4)
+#define LITEXCNC_BOARD_ENCODER_DATA_READ_SIZE(litexcnc) LITEXCNC_BOARD_ENCODER_SHARED_INDEX_PULSE_READ_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_COUNTS_READ_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_GEARING_READ_SIZE(litexcnc)
 
 
 // Functions for creating, reading and writing stepgen pins
@@ -149,5 +214,7 @@ int litexcnc_encoder_init(litexcnc_t *litexcnc, cJSON *config);
 uint8_t litexcnc_encoder_config(litexcnc_t *litexcnc, uint8_t **data, long period);
 uint8_t litexcnc_encoder_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period);
 uint8_t litexcnc_encoder_process_read(litexcnc_t *litexcnc, uint8_t** data, long period);
+// Continues the counts from their last value after the board has been power-cycled
+void litexcnc_encoder_reseed(litexcnc_t *litexcnc);
 
 #endif
\ No newline at end of file
@@ -14,7 +14,14 @@
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h> 
+#include <sys/mman.h>
+#include <time.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if_arp.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
 
 #include "etherbone.h"
 #include "litexcnc.h"
@@ -28,11 +35,22 @@ struct timespec begin, end;
 uint32_t create_packet = 0, send_adresses = 0, receive_data = 0, unpack_data = 0;
 #endif
 
+// Size of the packets of eb_read8 and eb_write8: the header (16 bytes) and the maximum
+// payload size (255 bytes)
+#define EB_PACKET_SIZE (16 + 255)
+
 struct eb_connection {
     int fd;
     int read_fd;
     int is_direct;
     struct addrinfo* addr;
+    // Capture of the datagrams, NULL when not capturing
+    struct eb_capture_header *capture;
+    size_t capture_size;
+    // Buffers for the packets of eb_read8 and eb_write8. Each connection has its own
+    // buffers, so boards on different threads do not share any data.
+    uint8_t packet[EB_PACKET_SIZE];
+    uint8_t response[EB_PACKET_SIZE];
 };
 
 
@@ -93,17 +111,63 @@ void eb_wait_for_tx_buffer_empty(struct eb_connection *conn) {
 }
 
 
+static void eb_capture(struct eb_connection *conn, const void *bytes, size_t len, uint16_t direction, uint16_t flags) {
+    struct eb_capture_header *capture = conn->capture;
+    uint64_t head = __atomic_load_n(&capture->head, __ATOMIC_RELAXED);
+
+    // Reserve a slot. Drop the datagram when the drain has not kept up
+    do {
+        if (head - __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE) >= capture->slot_count) {
+            __atomic_fetch_add(&capture->dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&capture->head, &head, head + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    struct eb_capture_slot *slot = (struct eb_capture_slot *)((uint8_t *)capture + sizeof(struct eb_capture_header)) + (head % capture->slot_count);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    slot->timestamp = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+    slot->length = len;
+    slot->direction = direction;
+    slot->flags = flags;
+    memcpy(slot->data, bytes, len < sizeof(slot->data) ? len : sizeof(slot->data));
+
+    // Publish the slot to the drain
+    __atomic_store_n(&slot->sequence, head + 1, __ATOMIC_RELEASE);
+}
+
+
 int eb_send(struct eb_connection *conn, const void *bytes, size_t len) {
+    int r;
+    // The Tx socket is connected to the board, so no address lookup is required for
+    // each packet
     if (conn->is_direct)
-        return sendto(conn->fd, bytes, len, 0, conn->addr->ai_addr, conn->addr->ai_addrlen);
-    return write(conn->fd, bytes, len);
+        r = send(conn->fd, bytes, len, 0);
+    else
+        r = write(conn->fd, bytes, len);
+    if (conn->capture && r > 0)
+        eb_capture(conn, bytes, r, EB_CAPTURE_SENT, 0);
+    return r;
 }
 
 
 int eb_recv(struct eb_connection *conn, void *bytes, size_t max_len) {
+    int r;
     if (conn->is_direct)
-        return recvfrom(conn->read_fd, bytes, max_len, 0, NULL, NULL);
-    return read(conn->fd, bytes, max_len);
+        r = recvfrom(conn->read_fd, bytes, max_len, 0, NULL, NULL);
+    else
+        r = read(conn->fd, bytes, max_len);
+    if (conn->capture && r > 0)
+        eb_capture(conn, bytes, r, EB_CAPTURE_RECEIVED, 0);
+    return r;
+}
+
+
+int eb_recv_pending(struct eb_connection *conn, void *bytes, size_t max_len) {
+    int r = recv(conn->is_direct ? conn->read_fd : conn->fd, bytes, max_len, MSG_DONTWAIT);
+    if (conn->capture && r > 0)
+        eb_capture(conn, bytes, r, EB_CAPTURE_RECEIVED, 0);
+    return r;
 }
 
 
@@ -120,20 +184,26 @@ int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t
     // 0x07 = 0;	 	 // Padding
     // 0x08 = 0;		 // No Wishbone flags are set (cyc, wca, wff, etc.)
     // 0x09 = 0x0f;	     // Byte enable
-    static uint8_t eth_pkt[16+255] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
-    static uint8_t response[16+255];
+    static const uint8_t header[10] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
+    uint8_t *eth_pkt = conn->packet;
+    uint8_t *response = conn->response;
+
+    if (size > EB_PACKET_SIZE - 16) {
+        fprintf(stderr, "etherbone: read of %zu bytes exceeds the maximum payload\n", size);
+        return -1;
+    }
 
      // Clear data and write data to package
-    memset((void*) &eth_pkt[16], 0, 255);
+    memset((void*) eth_pkt, 0, EB_PACKET_SIZE);
+    memcpy(eth_pkt, header, sizeof(header));
     // - size
     size_t words = size >> 2;
     eth_pkt[11] = words; // Write count (in WORD-count, bitshift to divide by 4)
     // - addresses to read
-    uint32_t addresses[words];
     for (size_t i=0; i<words; i++) {
-        addresses[i] = htobe32(address + (i << 2));
+        uint32_t read_address = htobe32(address + (i << 2));
+        memcpy(&eth_pkt[16 + (i << 2)], &read_address, 4);
     }
-    memcpy(&eth_pkt[16], addresses, size);
 
     if (debug) {
         LITEXCNC_PRINT_NO_DEVICE("Read addresses:\n");
@@ -150,7 +220,7 @@ int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t
     eb_send(conn, eth_pkt, 16+size);
 
     // Check response
-    memset((void*) response, 0, 16+255);
+    memset((void*) response, 0, EB_PACKET_SIZE);
     int count = eb_recv(conn, response, 16+size);
     if (count != (16+size)) {
         fprintf(stderr, "Unexpected read length: %d, expected %zu\n", count, (16+size));
@@ -189,10 +259,17 @@ void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data
     // 0x07 = 0;	 	 // Padding
     // 0x08 = 0;		 // No Wishbone flags are set (cyc, wca, wff, etc.)
     // 0x09 = 0x0f;	     // Byte enable
-    static uint8_t eth_pkt[16+255] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
+    static const uint8_t header[10] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
+    uint8_t *eth_pkt = conn->packet;
+
+    if (size > EB_PACKET_SIZE - 16) {
+        fprintf(stderr, "etherbone: write of %zu bytes exceeds the maximum payload\n", size);
+        return;
+    }
     
     // Clear data and write data to package
-    memset((void*) &eth_pkt[16], 0, 255);
+    memset((void*) eth_pkt, 0, EB_PACKET_SIZE);
+    memcpy(eth_pkt, header, sizeof(header));
     // - size
     eth_pkt[10] = size >> 2; // Write count (in WORD-count, bitshift to divide by 4)
     // - address
@@ -216,36 +293,25 @@ void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data
     eb_send(conn, eth_pkt, 16+size);
 }
 
-// https://stackoverflow.com/questions/38071732/how-to-check-if-udp-packet-received-in-c-linux
-void eb_discard_pending_packet(struct eb_connection *conn, size_t size)
-{
-	
-    int retval;
-    fd_set rfds;
-    // NO wait
-    struct timeval tv = {0,0};
-
-    uint8_t buffer[size];
+int eb_discard_pending_packets(struct eb_connection *conn, void *buffer, size_t size) {
+    /*
+     * Discards all packets which are waiting in the Rx socket, without waiting. When a
+     * reply arrives after the timeout, it would otherwise be taken as the reply to the
+     * next request. The given buffer is used as scratch space. Returns the number of
+     * discarded packets.
+     */
+    int discarded = 0;
 
     if (!conn->is_direct) {
-	    return;
-    }
-
-    FD_ZERO(&rfds);
-    FD_SET(conn->fd, &rfds);
-
-    retval = select(1, &rfds, NULL, NULL, &tv);
-
-    if (retval == -1) {
-        perror("select()");
-        exit(1);
+        return 0;
     }
-    
-    if (retval > 0) {
-        // read data and ignore
-        int rc = eb_recv(conn, buffer, sizeof(buffer));
-        fprintf(stderr,"colorcnc: found qeued packet. Ignore that data, size %d\n", rc);
+    int count;
+    while ((count = recv(conn->read_fd, buffer, size, MSG_DONTWAIT)) >= 0) {
+        if (conn->capture)
+            eb_capture(conn, buffer, count, EB_CAPTURE_RECEIVED, EB_CAPTURE_FLAG_DISCARDED);
+        discarded++;
     }
+    return discarded;
 }
 
 
@@ -275,6 +341,7 @@ struct eb_connection *eb_connect(const char *addr, const char *port, int is_dire
     }
 
     conn->is_direct = is_direct;
+    conn->capture = NULL;
 
     if (is_direct) {
         // Rx half
@@ -292,16 +359,34 @@ struct eb_connection *eb_connect(const char *addr, const char *port, int is_dire
             free(conn);
             return NULL;
         }
+        // All boards reply to the same port on the host. Allow multiple connections to bind
+        // to this port, the connect below makes sure each socket only receives the packets
+        // from its own board.
+        int reuse = 1;
+        if (setsockopt(rx_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) == -1) {
+            fprintf(stderr, "Unable to set SO_REUSEADDR on Rx socket: %s\n", strerror(errno));
+            close(rx_socket);
+            freeaddrinfo(res);
+            free(conn);
+            return NULL;
+        }
         if (bind(rx_socket, (struct sockaddr*)&si_me, sizeof(si_me)) == -1) {
             fprintf(stderr, "Unable to bind Rx socket to port: %s\n", strerror(errno));
             close(rx_socket);
             freeaddrinfo(res);
             free(conn);
             return NULL;
+        }
+        if (connect(rx_socket, res->ai_addr, res->ai_addrlen) == -1) {
+            fprintf(stderr, "Unable to connect Rx socket to board: %s\n", strerror(errno));
+            close(rx_socket);
+            freeaddrinfo(res);
+            free(conn);
+            return NULL;
         }
 		struct timeval timeout;
 		timeout.tv_sec = 0;        
-		timeout.tv_usec = 10000; //FIRST_PACKETS
+		timeout.tv_usec = RECEIVE_TIMEOUT_US; //FIRST_PACKETS
 		err = setsockopt(rx_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
 		if (err < 0) {
             close(rx_socket);
@@ -333,6 +418,14 @@ struct eb_connection *eb_connect(const char *addr, const char *port, int is_dire
             free(conn);
             return NULL;
 		}
+        if (connect(tx_socket, res->ai_addr, res->ai_addrlen) == -1) {
+            fprintf(stderr, "Unable to connect Tx socket to board: %s\n", strerror(errno));
+            close(rx_socket);
+            close(tx_socket);
+            freeaddrinfo(res);
+            free(conn);
+            return NULL;
+        }
 
         conn->read_fd = rx_socket;
         conn->fd = tx_socket;
@@ -363,10 +456,216 @@ struct eb_connection *eb_connect(const char *addr, const char *port, int is_dire
     return conn;
 }
 
+int eb_set_timeouts(struct eb_connection *conn, long receive_timeout_us, long send_timeout_us) {
+    struct timeval timeout;
+
+    if (!conn->is_direct) {
+        return 0;
+    }
+
+    timeout.tv_sec  = receive_timeout_us / 1000000;
+    timeout.tv_usec = receive_timeout_us % 1000000;
+    if (setsockopt(conn->read_fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
+        fprintf(stderr,"etherbone: unable to set receive timeout: %s\n", strerror(errno));
+        return -1;
+    }
+
+    timeout.tv_sec  = send_timeout_us / 1000000;
+    timeout.tv_usec = send_timeout_us % 1000000;
+    if (setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout)) < 0) {
+        fprintf(stderr,"etherbone: unable to set send timeout: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+void eb_default_latency_profile(struct eb_latency_profile *profile) {
+    memset(profile, 0, sizeof(struct eb_latency_profile));
+    profile->priority = -1;
+    profile->tos = -1;
+}
+
+static int eb_set_buffer(int fd, int option, int force_option, int size, const char *name) {
+    // The forced variant is not limited by net.core.rmem_max / wmem_max, but requires
+    // CAP_NET_ADMIN. Without it the size is capped by the system.
+    if (setsockopt(fd, SOL_SOCKET, force_option, &size, sizeof(size)) == 0) {
+        return 0;
+    }
+    if (setsockopt(fd, SOL_SOCKET, option, &size, sizeof(size)) < 0) {
+        fprintf(stderr,"etherbone: unable to set %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int eb_set_latency_profile(struct eb_connection *conn, const struct eb_latency_profile *profile) {
+    // A connection over TCP only has a single socket
+    int rx_fd = conn->is_direct ? conn->read_fd : conn->fd;
+
+    if (profile->interface[0]) {
+        if ((setsockopt(rx_fd, SOL_SOCKET, SO_BINDTODEVICE, profile->interface, strlen(profile->interface)) < 0) ||
+            (setsockopt(conn->fd, SOL_SOCKET, SO_BINDTODEVICE, profile->interface, strlen(profile->interface)) < 0)) {
+            fprintf(stderr,"etherbone: unable to bind to interface '%s': %s\n", profile->interface, strerror(errno));
+            return -1;
+        }
+    }
+    if (profile->busy_poll_us > 0) {
+        if (setsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &profile->busy_poll_us, sizeof(profile->busy_poll_us)) < 0) {
+            fprintf(stderr,"etherbone: unable to set busy poll: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    // NOTE: setting the type of service also sets the priority, so it is set first
+    if (profile->tos >= 0) {
+        if (setsockopt(conn->fd, IPPROTO_IP, IP_TOS, &profile->tos, sizeof(profile->tos)) < 0) {
+            fprintf(stderr,"etherbone: unable to set type of service: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (profile->priority >= 0) {
+        if (setsockopt(conn->fd, SOL_SOCKET, SO_PRIORITY, &profile->priority, sizeof(profile->priority)) < 0) {
+            fprintf(stderr,"etherbone: unable to set priority: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (profile->receive_buffer > 0) {
+        if (eb_set_buffer(rx_fd, SO_RCVBUF, SO_RCVBUFFORCE, profile->receive_buffer, "receive buffer") < 0) {
+            return -1;
+        }
+    }
+    if (profile->send_buffer > 0) {
+        if (eb_set_buffer(conn->fd, SO_SNDBUF, SO_SNDBUFFORCE, profile->send_buffer, "send buffer") < 0) {
+            return -1;
+        }
+    }
+    if (profile->static_arp) {
+        if (conn->addr->ai_family != AF_INET) {
+            fprintf(stderr,"etherbone: static ARP entry is only supported for IPv4\n");
+            return -1;
+        }
+        struct arpreq request;
+        memset(&request, 0, sizeof(request));
+        memcpy(&request.arp_pa, conn->addr->ai_addr, sizeof(struct sockaddr_in));
+        request.arp_ha.sa_family = ARPHRD_ETHER;
+        memcpy(request.arp_ha.sa_data, profile->mac_address, sizeof(profile->mac_address));
+        request.arp_flags = ATF_COM | ATF_PERM;
+        // Without a device, the kernel uses the interface given by the routing table
+        snprintf(request.arp_dev, sizeof(request.arp_dev), "%s", profile->interface);
+        if (ioctl(conn->fd, SIOCSARP, &request) < 0) {
+            fprintf(stderr,"etherbone: unable to add static ARP entry: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int eb_find_interface(struct eb_connection *conn, char *interface, size_t size) {
+    // When the socket is bound to an interface, that is the interface
+    socklen_t length = size;
+    if ((getsockopt(conn->fd, SOL_SOCKET, SO_BINDTODEVICE, interface, &length) == 0) && (length > 1)) {
+        interface[size - 1] = '\0';
+        return 0;
+    }
+    // Otherwise the interface is the one which has the local address of the connected
+    // socket
+    struct sockaddr_in local;
+    length = sizeof(local);
+    if (getsockname(conn->fd, (struct sockaddr *) &local, &length) < 0 || local.sin_family != AF_INET) {
+        return -1;
+    }
+    struct ifaddrs *addresses;
+    if (getifaddrs(&addresses) < 0) {
+        return -1;
+    }
+    int result = -1;
+    for (struct ifaddrs *address = addresses; address; address = address->ifa_next) {
+        if (!address->ifa_addr || address->ifa_addr->sa_family != AF_INET) {
+            continue;
+        }
+        if (((struct sockaddr_in *) address->ifa_addr)->sin_addr.s_addr == local.sin_addr.s_addr) {
+            snprintf(interface, size, "%s", address->ifa_name);
+            result = 0;
+            break;
+        }
+    }
+    freeifaddrs(addresses);
+    return result;
+}
+
+int eb_get_latency_profile(struct eb_connection *conn, struct eb_latency_profile *profile) {
+    int rx_fd = conn->is_direct ? conn->read_fd : conn->fd;
+    socklen_t length;
+
+    eb_default_latency_profile(profile);
+    length = sizeof(int);
+    if (getsockopt(rx_fd, SOL_SOCKET, SO_BUSY_POLL, &profile->busy_poll_us, &length) < 0) {
+        return -1;
+    }
+    length = sizeof(int);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_PRIORITY, &profile->priority, &length) < 0) {
+        return -1;
+    }
+    length = sizeof(int);
+    if (getsockopt(conn->fd, IPPROTO_IP, IP_TOS, &profile->tos, &length) < 0) {
+        return -1;
+    }
+    // NOTE: the kernel reports twice the requested size, as it includes the bookkeeping
+    length = sizeof(int);
+    if (getsockopt(rx_fd, SOL_SOCKET, SO_RCVBUF, &profile->receive_buffer, &length) < 0) {
+        return -1;
+    }
+    length = sizeof(int);
+    if (getsockopt(conn->fd, SOL_SOCKET, SO_SNDBUF, &profile->send_buffer, &length) < 0) {
+        return -1;
+    }
+    if (eb_find_interface(conn, profile->interface, sizeof(profile->interface)) < 0) {
+        profile->interface[0] = '\0';
+    }
+
+    // The entry in the ARP table of the board, which is either static or learned
+    if (conn->addr->ai_family == AF_INET && profile->interface[0]) {
+        struct arpreq request;
+        memset(&request, 0, sizeof(request));
+        memcpy(&request.arp_pa, conn->addr->ai_addr, sizeof(struct sockaddr_in));
+        snprintf(request.arp_dev, sizeof(request.arp_dev), "%s", profile->interface);
+        if ((ioctl(conn->fd, SIOCGARP, &request) == 0) && (request.arp_flags & ATF_COM)) {
+            profile->static_arp = (request.arp_flags & ATF_PERM) != 0;
+            memcpy(profile->mac_address, request.arp_ha.sa_data, sizeof(profile->mac_address));
+        }
+    }
+
+    return 0;
+}
+
+int eb_get_coalescing(struct eb_connection *conn, const char *interface, struct eb_coalescing *coalescing) {
+    struct ethtool_coalesce settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.cmd = ETHTOOL_GCOALESCE;
+
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, interface, sizeof(request.ifr_name) - 1);
+    request.ifr_data = (void *) &settings;
+    if (ioctl(conn->fd, SIOCETHTOOL, &request) < 0) {
+        return -1;
+    }
+
+    coalescing->rx_usecs    = settings.rx_coalesce_usecs;
+    coalescing->rx_frames   = settings.rx_max_coalesced_frames;
+    coalescing->tx_usecs    = settings.tx_coalesce_usecs;
+    coalescing->tx_frames   = settings.tx_max_coalesced_frames;
+    coalescing->adaptive_rx = settings.use_adaptive_rx_coalesce != 0;
+    coalescing->adaptive_tx = settings.use_adaptive_tx_coalesce != 0;
+    return 0;
+}
+
 void eb_disconnect(struct eb_connection **conn) {
     if (!conn || !*conn)
         return;
 
+    eb_capture_stop(*conn);
     freeaddrinfo((*conn)->addr);
     close((*conn)->fd);
     if ((*conn)->read_fd)
@@ -375,3 +674,234 @@ void eb_disconnect(struct eb_connection **conn) {
     *conn = NULL;
     return;
 }
+
+
+int eb_capture_start(struct eb_connection *conn, const char *path, size_t slots) {
+    /*
+     * Starts capturing the datagrams of the connection in a ring with the given number
+     * of slots, in a memory mapped file at the given path. Only supported for UDP.
+     */
+    struct sockaddr_in local_tx, local_rx;
+    socklen_t length;
+
+    if (!conn->is_direct) {
+        fprintf(stderr, "etherbone: capture is only supported for UDP\n");
+        return -1;
+    }
+    length = sizeof(local_tx);
+    if (getsockname(conn->fd, (struct sockaddr *) &local_tx, &length) < 0) {
+        fprintf(stderr, "etherbone: unable to get address of Tx socket: %s\n", strerror(errno));
+        return -1;
+    }
+    length = sizeof(local_rx);
+    if (getsockname(conn->read_fd, (struct sockaddr *) &local_rx, &length) < 0) {
+        fprintf(stderr, "etherbone: unable to get address of Rx socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // The file is given its final size and all pages are touched before capturing
+    // starts, so capturing a datagram does not cause a page fault
+    size_t size = sizeof(struct eb_capture_header) + slots * sizeof(struct eb_capture_slot);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "etherbone: unable to create capture '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        fprintf(stderr, "etherbone: unable to allocate capture '%s': %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    struct eb_capture_header *capture = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (capture == MAP_FAILED) {
+        fprintf(stderr, "etherbone: unable to map capture '%s': %s\n", path, strerror(errno));
+        return -1;
+    }
+    memset(capture, 0, size);
+
+    capture->slot_size      = sizeof(struct eb_capture_slot);
+    capture->slot_count     = slots;
+    capture->local_address  = local_tx.sin_addr.s_addr;
+    capture->remote_address = ((struct sockaddr_in *) conn->addr->ai_addr)->sin_addr.s_addr;
+    capture->local_tx_port  = local_tx.sin_port;
+    capture->local_rx_port  = local_rx.sin_port;
+    capture->remote_port    = ((struct sockaddr_in *) conn->addr->ai_addr)->sin_port;
+    capture->version        = EB_CAPTURE_VERSION;
+    // The magic is written last, the drain only accepts the ring once it is complete
+    __atomic_store_n(&capture->magic, EB_CAPTURE_MAGIC, __ATOMIC_RELEASE);
+
+    conn->capture = capture;
+    conn->capture_size = size;
+    return 0;
+}
+
+
+void eb_capture_stop(struct eb_connection *conn) {
+    if (!conn->capture)
+        return;
+    if (conn->capture->dropped)
+        fprintf(stderr, "etherbone: %llu datagrams dropped from capture\n", (unsigned long long) conn->capture->dropped);
+    munmap(conn->capture, conn->capture_size);
+    conn->capture = NULL;
+}
+
+
+static int eb_discover_wait(int sock, uint32_t network, uint32_t mask, long timeout_us,
+                            struct eb_discovered_board *boards, size_t max_boards, size_t *count,
+                            int phase) {
+    /*
+     * Collects the replies on the discovery socket until the timeout expires. In the
+     * first phase the replies to the probes are stored, in the second phase the header
+     * of the boards which responded to the probe is filled in.
+     */
+    uint8_t packet[16 + 4 * ETHERBONE_DISCOVERY_HEADER_WORDS];
+    struct sockaddr_in source;
+    socklen_t source_len;
+    char ip_address[16];
+    size_t answered = 0;
+    long start = timestampUsec();
+    long remaining;
+
+    while ((remaining = timeout_us - (long)(timestampUsec() - start)) > 0) {
+        fd_set rfds;
+        struct timeval tv = {remaining / 1000000, remaining % 1000000};
+        FD_ZERO(&rfds);
+        FD_SET(sock, &rfds);
+        if (select(sock + 1, &rfds, NULL, NULL, &tv) <= 0) {
+            break;
+        }
+        source_len = sizeof(source);
+        int length = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&source, &source_len);
+        if ((length < 8) || (packet[0] != 0x4e) || (packet[1] != 0x6f)) {
+            continue;
+        }
+        // Only accept replies from the network which is searched
+        if ((be32toh(source.sin_addr.s_addr) & mask) != network) {
+            continue;
+        }
+        inet_ntop(AF_INET, &source.sin_addr, ip_address, sizeof(ip_address));
+
+        if (phase == 0) {
+            // Reply to a probe, store the board when it is not yet known
+            if (!(packet[2] & ETHERBONE_PROBE_REPLY)) {
+                continue;
+            }
+            size_t i;
+            for (i = 0; i < *count; i++) {
+                if (strcmp(boards[i].ip_address, ip_address) == 0) break;
+            }
+            if ((i == *count) && (*count < max_boards)) {
+                memset(&boards[i], 0, sizeof(struct eb_discovered_board));
+                snprintf(boards[i].ip_address, sizeof(boards[i].ip_address), "%s", ip_address);
+                (*count)++;
+            }
+        } else {
+            // Reply to the read of the header
+            if (length != sizeof(packet)) {
+                continue;
+            }
+            for (size_t i = 0; i < *count; i++) {
+                if ((strcmp(boards[i].ip_address, ip_address) == 0) && (boards[i].magic == 0)) {
+                    uint32_t header[ETHERBONE_DISCOVERY_HEADER_WORDS];
+                    memcpy(header, &packet[16], sizeof(header));
+                    boards[i].magic       = be32toh(header[0]);
+                    boards[i].version     = be32toh(header[1]);
+                    boards[i].fingerprint = be32toh(header[2]);
+                    answered++;
+                    break;
+                }
+            }
+            // All boards have answered, no need to wait any longer
+            if (answered == *count) {
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+int eb_discover(const char *network, const char *port, long timeout_us, struct eb_discovered_board *boards, size_t max_boards) {
+    /*
+     * Discovers the boards on the given network (i.e. 192.168.2.0/24). First an Etherbone
+     * probe is sent to the broadcast address and to every host on the network. All
+     * boards which reply to the probe are then asked for their header (magic, version
+     * and fingerprint) in parallel. Returns the number of boards found, or a negative
+     * number on error.
+     */
+    char address[32];
+    struct in_addr network_address;
+    unsigned int prefix = 32;
+    size_t count = 0;
+
+    // Split the network in the address and the prefix length
+    strncpy(address, network, sizeof(address) - 1);
+    address[sizeof(address) - 1] = '\0';
+    char *separator = strchr(address, '/');
+    if (separator) {
+        *separator = '\0';
+        prefix = strtoul(separator + 1, NULL, 10);
+    }
+    if ((inet_pton(AF_INET, address, &network_address) != 1) || (prefix < 16) || (prefix > 32)) {
+        fprintf(stderr, "etherbone: invalid network '%s', expected for example '192.168.2.0/24'\n", network);
+        return -1;
+    }
+    uint32_t mask = prefix ? (0xFFFFFFFF << (32 - prefix)) : 0;
+    uint32_t first = be32toh(network_address.s_addr) & mask;
+    uint32_t last  = first | ~mask;
+
+    // Create the socket, the boards reply to the same port as they listen to
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == -1) {
+        fprintf(stderr, "etherbone: unable to create socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int enable = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &enable, sizeof(enable));
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_port = htons(atoi(port));
+    local.sin_addr.s_addr = htobe32(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *)&local, sizeof(local)) == -1) {
+        fprintf(stderr, "etherbone: unable to bind discovery socket to port %s: %s\n", port, strerror(errno));
+        close(sock);
+        return -1;
+    }
+    struct sockaddr_in remote = local;
+
+    // PHASE 1: send the probe to the broadcast address and all hosts on the network
+    uint8_t probe[8] = { 0x4e, 0x6f, 0x10 | ETHERBONE_PROBE_FLAG, 0x44, 0x00, 0x00, 0x00, 0x00 };
+    remote.sin_addr.s_addr = htobe32(INADDR_BROADCAST);
+    sendto(sock, probe, sizeof(probe), 0, (struct sockaddr *)&remote, sizeof(remote));
+    for (uint32_t host = first; host <= last; host++) {
+        // Skip the network and broadcast address for normal networks
+        if ((prefix < 31) && ((host == first) || (host == last))) continue;
+        remote.sin_addr.s_addr = htobe32(host);
+        sendto(sock, probe, sizeof(probe), 0, (struct sockaddr *)&remote, sizeof(remote));
+        if (host == last) break;  // Prevent overflow for 255.255.255.255
+    }
+    eb_discover_wait(sock, first, mask, timeout_us, boards, max_boards, &count, 0);
+
+    // PHASE 2: read the header of all boards in parallel
+    if (count > 0) {
+        uint8_t request[16 + 4 * ETHERBONE_DISCOVERY_HEADER_WORDS];
+        memcpy(request, etherbone_header, sizeof(etherbone_header));
+        request[11] = ETHERBONE_DISCOVERY_HEADER_WORDS;
+        for (size_t i = 0; i < ETHERBONE_DISCOVERY_HEADER_WORDS; i++) {
+            uint32_t address = htobe32(i << 2);
+            memcpy(&request[16 + 4 * i], &address, sizeof(address));
+        }
+        for (size_t i = 0; i < count; i++) {
+            inet_pton(AF_INET, boards[i].ip_address, &remote.sin_addr);
+            sendto(sock, request, sizeof(request), 0, (struct sockaddr *)&remote, sizeof(remote));
+        }
+        eb_discover_wait(sock, first, mask, timeout_us, boards, max_boards, &count, 1);
+    }
+
+    close(sock);
+    return count;
+}
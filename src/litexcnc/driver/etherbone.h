@@ -5,7 +5,9 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <net/if.h>
 
 /*
 
@@ -58,12 +60,113 @@ write_addr is specified along with a value.
 The same type of record is returned, so your data is at offset 16.
 */
 #define SEND_TIMEOUT_US 10
+#define RECEIVE_TIMEOUT_US 10000
+#define ETHERBONE_DEFAULT_PORT "1234"
 
 struct eb_connection;
 static const uint8_t etherbone_header[16] = { 0x4e, 0x6f, 0x10, 0x44, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0f };
 
+// Flags in the third byte of the Etherbone packet header
+#define ETHERBONE_PROBE_FLAG  0x01
+#define ETHERBONE_PROBE_REPLY 0x02
+
+// Boards which responded during discovery. The header (magic, version and fingerprint)
+// is read from the first three registers of the board.
+#define ETHERBONE_DISCOVERY_HEADER_WORDS 3
+struct eb_discovered_board {
+    char ip_address[16];
+    uint32_t magic;
+    uint32_t version;
+    uint32_t fingerprint;
+};
+
+// Capture of the datagrams exchanged with the board. The datagrams are copied with a
+// timestamp into a ring in a memory mapped file, from which they are drained by a
+// separate process (`litexcnc capture`). The driver reserves a slot by advancing the
+// head atomically and publishes it by setting the sequence of the slot, so datagrams
+// can be captured from multiple threads. The drain only writes the tail, so no locks
+// are required. When the ring is full, datagrams are dropped (and counted) instead of
+// blocking the driver. The layout MUST coincide with `capture.py`.
+#define EB_CAPTURE_MAGIC         0x4C584350  // LXCP
+#define EB_CAPTURE_VERSION       2
+#define EB_CAPTURE_SLOT_SIZE     2048
+#define EB_CAPTURE_DEFAULT_SLOTS 4096
+// Direction of the datagram
+#define EB_CAPTURE_SENT     1
+#define EB_CAPTURE_RECEIVED 2
+// Flags of the datagram
+#define EB_CAPTURE_FLAG_DISCARDED 0x01  // Received too late, discarded before the next request
+
+struct eb_capture_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t slot_count;
+    // Addresses and ports of the connection (network byte order), so the drain can
+    // reconstruct the IP and UDP headers of the datagrams
+    uint32_t local_address;
+    uint32_t remote_address;
+    uint16_t local_tx_port;
+    uint16_t local_rx_port;
+    uint16_t remote_port;
+    uint16_t reserved;
+    // Number of datagrams reserved by the driver, read by the drain and dropped because
+    // the ring was full
+    uint64_t head;
+    uint64_t tail;
+    uint64_t dropped;
+    uint64_t reserved2;
+};
+
+struct eb_capture_slot {
+    int64_t timestamp;   // CLOCK_REALTIME, in nanoseconds
+    uint32_t length;     // Length of the datagram, only the part which fits the slot is stored
+    uint16_t direction;
+    uint16_t flags;
+    uint64_t sequence;   // Index of the datagram plus one, set when the slot is complete
+    uint8_t data[EB_CAPTURE_SLOT_SIZE - 24];
+};
+
+// Latency profile of the sockets of a connection. The profile trades CPU time and
+// bandwidth for a lower and more predictable round trip:
+//  - busy_poll_us: the receiving socket polls the device queue for this many
+//    microseconds before sleeping (SO_BUSY_POLL). 0 leaves the system default;
+//  - priority / tos: priority of the sent datagrams for the queueing discipline
+//    (SO_PRIORITY) and the network (IP_TOS). -1 leaves the system default;
+//  - receive_buffer / send_buffer: size of the socket buffers in bytes (SO_RCVBUF and
+//    SO_SNDBUF). A small receive buffer limits the number of stale replies which can
+//    queue up. 0 leaves the system default;
+//  - interface: the sockets only use this network interface (SO_BINDTODEVICE). Empty
+//    to use the interface given by the routing table;
+//  - static_arp: the MAC address of the board is pinned in the ARP table, so the host
+//    never has to resolve it while the machine is running.
+struct eb_latency_profile {
+    int busy_poll_us;
+    int priority;
+    int tos;
+    int receive_buffer;
+    int send_buffer;
+    char interface[IFNAMSIZ];
+    bool static_arp;
+    uint8_t mac_address[6];
+};
+
+// Interrupt coalescing of a network interface, as reported by the driver of the
+// interface (ethtool -c)
+struct eb_coalescing {
+    uint32_t rx_usecs;
+    uint32_t rx_frames;
+    uint32_t tx_usecs;
+    uint32_t tx_frames;
+    bool adaptive_rx;
+    bool adaptive_tx;
+};
+
 int eb_send(struct eb_connection *conn, const void *bytes, size_t len);
 int eb_recv(struct eb_connection *conn, void *bytes, size_t max_len);
+// Receives a packet which is waiting in the Rx socket, without waiting. Returns -1 when no
+// packet is waiting.
+int eb_recv_pending(struct eb_connection *conn, void *bytes, size_t max_len);
 
 int eb_create_packet(uint8_t* eth_buffer, uint32_t address, const uint8_t* data, size_t size, int is_read);
 void eb_write8(struct eb_connection *conn, uint32_t address, const uint8_t* data, size_t size, bool debug);
@@ -71,11 +174,28 @@ int eb_read8(struct eb_connection *conn, uint32_t address, uint8_t* data, size_t
 void usecSleep(long usec);
 
 void eb_wait_for_tx_buffer_empty(struct eb_connection *conn);
-void eb_discard_pending_packet(struct eb_connection *conn, size_t size);
+int eb_discard_pending_packets(struct eb_connection *conn, void *buffer, size_t size);
 
 struct eb_connection *eb_connect(const char *addr, const char *port, int is_direct);
+int eb_set_timeouts(struct eb_connection *conn, long receive_timeout_us, long send_timeout_us);
+// Initializes the profile to the system defaults
+void eb_default_latency_profile(struct eb_latency_profile *profile);
+// Applies the profile to the sockets of the connection. Returns 0 on success and -1
+// when one of the settings could not be applied.
+int eb_set_latency_profile(struct eb_connection *conn, const struct eb_latency_profile *profile);
+// Reads the settings as they are effective on the sockets of the connection. The
+// interface is the interface the datagrams to the board are sent from, also when the
+// sockets are not bound to it. Returns 0 on success and -1 on failure.
+int eb_get_latency_profile(struct eb_connection *conn, struct eb_latency_profile *profile);
+// Reads the interrupt coalescing of the interface. Returns 0 on success and -1 when the
+// driver of the interface does not report it.
+int eb_get_coalescing(struct eb_connection *conn, const char *interface, struct eb_coalescing *coalescing);
+int eb_discover(const char *network, const char *port, long timeout_us, struct eb_discovered_board *boards, size_t max_boards);
 void eb_disconnect(struct eb_connection **conn);
 
+int eb_capture_start(struct eb_connection *conn, const char *path, size_t slots);
+void eb_capture_stop(struct eb_connection *conn);
+
 #ifdef __cplusplus
 };
 #endif /* __cplusplus */
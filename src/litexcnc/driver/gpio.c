@@ -188,8 +188,14 @@ uint8_t litexcnc_gpio_prepare_write(litexcnc_t *litexcnc, uint8_t **data) {
         return 0;
     }
 
+    // Use the unrolled function generated for this board, when available
+    if (litexcnc->image) {
+        litexcnc->image->gpio_prepare_write(litexcnc, data);
+        return 0;
+    }
+
     // Process all the bytes
-    static uint8_t mask;
+    uint8_t mask;
     mask = 0x80;
     for (size_t i=LITEXCNC_BOARD_GPIO_DATA_WRITE_SIZE(litexcnc)*8; i>0; i--) {
         // The counter i can have a value outside the range of possible pins. We only
@@ -216,8 +222,14 @@ uint8_t litexcnc_gpio_process_read(litexcnc_t *litexcnc, uint8_t** data) {
         return 0;
     }
 
+    // Use the unrolled function generated for this board, when available
+    if (litexcnc->image) {
+        litexcnc->image->gpio_process_read(litexcnc, data);
+        return 0;
+    }
+
     // Process all the bytes
-    static uint8_t mask;
+    uint8_t mask;
     mask = 0x80;
     for (size_t i=LITEXCNC_BOARD_GPIO_DATA_READ_SIZE(litexcnc)*8; i>0; i--) {
         // The counter i can have a value outside the range of possible pins. We only
@@ -0,0 +1,82 @@
+/********************************************************************
+* Description:  image.c
+*               Selects the pack and unpack functions generated for
+*               the configuration of the board, if available.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "image.h"
+
+// The index of the generated images is written by `litexcnc build_firmware`, together
+// with the images themselves. It defines LITEXCNC_IMAGES, a list of pointers to all
+// images. Without it, the driver only contains the generic functions.
+#if defined(__has_include)
+#if __has_include("images/images.h")
+#include "images/images.h"
+#endif
+#endif
+#ifndef LITEXCNC_IMAGES
+#define LITEXCNC_IMAGES
+#endif
+
+static const litexcnc_image_t *litexcnc_images[] = {
+    LITEXCNC_IMAGES
+    NULL
+};
+
+
+const litexcnc_image_t *litexcnc_image_find(litexcnc_t *litexcnc) {
+    for (size_t i = 0; litexcnc_images[i] != NULL; i++) {
+        const litexcnc_image_t *image = litexcnc_images[i];
+        if (image->fingerprint != litexcnc->fpga->fingerprint) {
+            continue;
+        }
+        // The fingerprint is a CRC of the config, so in theory a different config could
+        // lead to the same fingerprint. Only use the image when it matches the layout
+        // on the FPGA exactly.
+        bool match = (image->write_size == litexcnc->descriptor.write_size) && (image->read_size == litexcnc->descriptor.read_size);
+        for (int id = 1; id < LITEXCNC_MODULE_COUNT; id++) {
+            if (image->instances[id] != litexcnc->descriptor.modules[id].instances) {
+                match = false;
+            }
+        }
+        if (!match) {
+            LITEXCNC_WARN("Generated image %08X does not match the layout of the FPGA, using generic functions\n", litexcnc->fpga->name, image->fingerprint);
+            return NULL;
+        }
+        return image;
+    }
+    return NULL;
+}
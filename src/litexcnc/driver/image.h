@@ -0,0 +1,75 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+#ifndef __INCLUDE_LITEXCNC_IMAGE_H__
+#define __INCLUDE_LITEXCNC_IMAGE_H__
+
+#include <stdint.h>
+
+// When the firmware is built, a header with pack and unpack functions specialised for
+// that configuration is generated (see `firmware/image.py`) and placed in the directory
+// `images` of the driver. These functions replace the loops over the instances in the
+// bit-fields of the GPIO, PWM and encoder, of which the number of bits is only known
+// at runtime. When no image with the fingerprint of the board is compiled in, or the
+// image does not match the descriptor, the generic functions of the modules are used.
+//
+// Each pack or unpack function handles the data of the bit-field(s) at *data and
+// advances *data past them, exactly like the generic code it replaces.
+typedef void (*litexcnc_image_funct_t)(litexcnc_t *litexcnc, uint8_t **data);
+
+typedef struct {
+    uint32_t fingerprint;
+    // The layout for which the functions were generated, which is compared with the
+    // descriptor read from the FPGA before the image is used.
+    uint16_t write_size;
+    uint16_t read_size;
+    uint16_t instances[LITEXCNC_MODULE_COUNT];
+    // - GPIO
+    litexcnc_image_funct_t gpio_prepare_write;
+    litexcnc_image_funct_t gpio_process_read;
+    // - PWM (enable)
+    litexcnc_image_funct_t pwm_prepare_write;
+    // - encoder (index enable, reset index pulse and x4 mode, index pulse)
+    litexcnc_image_funct_t encoder_prepare_write;
+    litexcnc_image_funct_t encoder_process_read;
+} litexcnc_image_t;
+
+// Helpers for the generated code. The bits of a bit-field are stored in big-endian
+// order, the bit of instance `n` is bit `n % 8` of byte `size - 1 - n / 8`.
+#define LITEXCNC_IMAGE_GPIO_OUT(n, shift) \
+    (((*(litexcnc->gpio.output_pins[n].hal.pin.out) ^ litexcnc->gpio.output_pins[n].hal.param.invert_output) ? 1 : 0) << (shift))
+#define LITEXCNC_IMAGE_GPIO_IN(n, byte, shift) \
+    *(litexcnc->gpio.input_pins[n].hal.pin.in) = ((*data)[byte] >> (shift)) & 1; \
+    *(litexcnc->gpio.input_pins[n].hal.pin.in_not) = !*(litexcnc->gpio.input_pins[n].hal.pin.in)
+#define LITEXCNC_IMAGE_PWM_ENABLE(n, shift) \
+    ((*(litexcnc->pwm.instances[n].hal.pin.enable) ? 1 : 0) << (shift))
+#define LITEXCNC_IMAGE_ENCODER_INDEX_ENABLE(n, shift) \
+    ((*(litexcnc->encoder.instances[n].hal.pin.index_enable) ? 1 : 0) << (shift))
+#define LITEXCNC_IMAGE_ENCODER_INDEX_PULSE(n, shift) \
+    ((*(litexcnc->encoder.instances[n].hal.pin.index_pulse) ? 1 : 0) << (shift))
+#define LITEXCNC_IMAGE_ENCODER_X4_MODE(n, shift) \
+    ((litexcnc->encoder.instances[n].hal.param.x4_mode ? 1 : 0) << (shift))
+// NOTE: the index enable is reset on the positive edge of the index pulse
+#define LITEXCNC_IMAGE_ENCODER_INDEX_PULSE_READ(n, byte, shift) \
+    *(litexcnc->encoder.instances[n].hal.pin.index_pulse) = ((*data)[byte] >> (shift)) & 1; \
+    if (*(litexcnc->encoder.instances[n].hal.pin.index_pulse)) *(litexcnc->encoder.instances[n].hal.pin.index_enable) = 0
+
+// Returns the image with the fingerprint of the board when it matches the descriptor,
+// otherwise NULL (the generic functions are then used).
+const litexcnc_image_t *litexcnc_image_find(litexcnc_t *litexcnc);
+
+#endif
@@ -16,6 +16,7 @@
 //    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 //
 #include <stdio.h>
+#include <limits.h>
 #include <time.h>
 
 #include <rtapi_slab.h>
@@ -49,15 +50,23 @@ struct rtapi_list_head litexcnc_list;
 // This keeps track of the component id. Required for setup and tear down.
 static int comp_id;
 
-static void litexcnc_config(void* void_litexcnc, long period) {
-    litexcnc_t *litexcnc = void_litexcnc;
+// Recording of the data exchanged with the boards, which can be replayed with the
+// component `litexcnc_replay`
+static char *record_directory = "";
+RTAPI_MP_STRING(record_directory, "Directory in which the data exchanged with each board is recorded (<board_name>.trace). Recording is disabled when empty.")
+static int record_size = 64;
+RTAPI_MP_INT(record_size, "Size of the trace of each board in MB. Recording stops when the trace is full.")
+
+static void litexcnc_config_build(litexcnc_t *litexcnc, long period) {
+    /*
+     * Fills the buffer with the configuration of the FPGA for the given period.
+     */
 
     // Clear buffer
-    uint8_t *config_buffer = rtapi_kmalloc(LITEXCNC_CONFIG_HEADER_SIZE, RTAPI_GFP_KERNEL);
-    memset(config_buffer, 0, LITEXCNC_CONFIG_HEADER_SIZE);
+    memset(litexcnc->config_buffer, 0, LITEXCNC_CONFIG_HEADER_SIZE);
     
     // Configure all the functions
-    uint8_t* pointer = config_buffer;
+    uint8_t* pointer = litexcnc->config_buffer;
 
     // Configure the general settings
     litexcnc_config_header_t config_data;
@@ -72,9 +81,127 @@ static void litexcnc_config(void* void_litexcnc, long period) {
     // litexcnc_pwm_config(litexcnc, &pointer, period);
     litexcnc_stepgen_config(litexcnc, &pointer, period);
     // litexcnc_encoder_config(litexcnc, &pointer, period);
+}
+
+
+static int litexcnc_config(void* void_litexcnc, long period) {
+    litexcnc_t *litexcnc = void_litexcnc;
+
+    // The configuration is built in the first attempt. When the board does not respond,
+    // only the handshake is retried in the next cycles, with the same configuration.
+    if (!litexcnc->config_failures) {
+        litexcnc_config_build(litexcnc, period);
+    }
     
-    // Write the data to the FPGA
-    litexcnc->fpga->write_config(litexcnc->fpga, config_buffer, LITEXCNC_CONFIG_HEADER_SIZE);
+    // Inform the board driver on the period, i.e. to scale the timeouts. This is done
+    // before the configuration is written, so the handshake uses these timeouts as well
+    // (in high-rate mode, see `set_period`).
+    if (litexcnc->fpga->set_period) {
+        litexcnc->fpga->set_period(litexcnc->fpga, period);
+    }
+
+    // Write the data to the FPGA, which releases the reset of the FPGA. When the board
+    // does not respond, this is retried every cycle, so the error is only reported once
+    // every LITEXCNC_CONFIG_REPORT_INTERVAL cycles.
+    if (litexcnc->fpga->write_config(litexcnc->fpga, litexcnc->config_buffer, LITEXCNC_CONFIG_HEADER_SIZE) < 0) {
+        if (litexcnc->config_failures++ % LITEXCNC_CONFIG_REPORT_INTERVAL == 0) {
+            LITEXCNC_ERR("Configuration of the FPGA failed (%u cycles), retrying in the next cycle\n", litexcnc->fpga->name, litexcnc->config_failures);
+        }
+        return -1;
+    }
+    litexcnc->config_failures = 0;
+    litexcnc_trace_record(&litexcnc->trace, LITEXCNC_TRACE_CONFIG, 0, 0, litexcnc->config_buffer, LITEXCNC_CONFIG_HEADER_SIZE);
+    return 0;
+}
+
+
+static void litexcnc_process_read(litexcnc_t *litexcnc, bool slow, long period) {
+    /*
+     * Processes the read data of all modules in the given rate group. The watchdog,
+     * wall-clock, stepgen and PID are always in the fast rate group.
+     */
+    uint8_t* pointer;
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_WATCHDOG] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_WATCHDOG];
+        litexcnc_watchdog_process_read(litexcnc, &pointer);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_WALLCLOCK] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_WALLCLOCK];
+        litexcnc_wallclock_process_read(litexcnc, &pointer);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_GPIO_IN] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_GPIO_IN];
+        litexcnc_gpio_process_read(litexcnc, &pointer);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_PWM] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_PWM];
+        litexcnc_pwm_process_read(litexcnc, &pointer);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_STEPGEN] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_STEPGEN];
+        litexcnc_stepgen_process_read(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_ENCODER] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_ENCODER];
+        litexcnc_encoder_process_read(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_PID] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_PID];
+        litexcnc_pid_process_read(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_MODBUS] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_MODBUS];
+        litexcnc_modbus_process_read(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_SPI] == slow) {
+        pointer = litexcnc->read_data[LITEXCNC_MODULE_SPI];
+        litexcnc_spi_process_read(litexcnc, &pointer, period);
+    }
+}
+
+
+static void litexcnc_prepare_write(litexcnc_t *litexcnc, bool slow, long period) {
+    /*
+     * Prepares the write data of all modules in the given rate group. The watchdog,
+     * wall-clock, stepgen and PID are always in the fast rate group.
+     */
+    uint8_t* pointer;
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_WATCHDOG] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_WATCHDOG];
+        litexcnc_watchdog_prepare_write(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_WALLCLOCK] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_WALLCLOCK];
+        litexcnc_wallclock_prepare_write(litexcnc, &pointer);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_GPIO_OUT] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_GPIO_OUT];
+        litexcnc_gpio_prepare_write(litexcnc, &pointer);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_PWM] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_PWM];
+        litexcnc_pwm_prepare_write(litexcnc, &pointer);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_STEPGEN] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_STEPGEN];
+        litexcnc_stepgen_prepare_write(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_ENCODER] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_ENCODER];
+        litexcnc_encoder_prepare_write(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_PID] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_PID];
+        litexcnc_pid_prepare_write(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_MODBUS] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_MODBUS];
+        litexcnc_modbus_prepare_write(litexcnc, &pointer, period);
+    }
+    if (litexcnc->slow_modules[LITEXCNC_MODULE_SPI] == slow) {
+        pointer = litexcnc->write_data[LITEXCNC_MODULE_SPI];
+        litexcnc_spi_prepare_write(litexcnc, &pointer, period);
+    }
 }
 
 
@@ -88,28 +215,71 @@ static void litexcnc_read(void* void_litexcnc, long period) {
         return;
     }
 
-    // Clear buffer (except for the header)
-    memset(
+    // Clear buffer (except for the header). Not required in high-rate mode, as the data
+    // is only processed when the complete buffer has been received.
+    if (!litexcnc->high_rate) {
+        memset(
+            litexcnc->fpga->read_buffer + litexcnc->fpga->read_header_size, 
+            0, 
+            litexcnc->fpga->read_buffer_size - litexcnc->fpga->read_header_size
+        );
+    }
+    
+    // Read the state from the FPGA. The read data is not processed when the read has
+    // failed, the modules keep the state of the previous cycle.
+    if (litexcnc->fpga->read(litexcnc->fpga) < 0) {
+        litexcnc_trace_record(&litexcnc->trace, LITEXCNC_TRACE_READ, LITEXCNC_TRACE_FLAG_FAILED, 0, NULL, 0);
+        litexcnc_recovery_process_read(litexcnc, false);
+        return;
+    }
+    litexcnc_trace_record(
+        &litexcnc->trace, LITEXCNC_TRACE_READ, 0, 0, 
         litexcnc->fpga->read_buffer + litexcnc->fpga->read_header_size, 
-        0, 
-        litexcnc->fpga->read_buffer_size
+        litexcnc->fpga->read_buffer_size - litexcnc->fpga->read_header_size
     );
-    
-    // Read the state from the FPGA
-    litexcnc->fpga->read(litexcnc->fpga);
-
-    // TODO: don't process the read data in case the read has failed.
-
-    // Process the read data for the different compenents
-    uint8_t* pointer = litexcnc->fpga->read_buffer + litexcnc->fpga->read_header_size;
-    litexcnc_watchdog_process_read(litexcnc, &pointer);
-    litexcnc_wallclock_process_read(litexcnc, &pointer);
-    litexcnc_gpio_process_read(litexcnc, &pointer);
-    litexcnc_pwm_process_read(litexcnc, &pointer);
-    litexcnc_stepgen_process_read(litexcnc, &pointer, period);
-    litexcnc_encoder_process_read(litexcnc, &pointer, period);
+
+    // Check whether the board is still the board which has been configured. The data is
+    // not processed when the board has restarted or does not match, nor when the board
+    // has not been configured yet.
+    if (!litexcnc_recovery_process_read(litexcnc, true) || !litexcnc->write_loop_has_run) {
+        return;
+    }
+
+    // Process the read data for the different compenents in the fast rate group
+    litexcnc_process_read(litexcnc, false, period);
+}
+
+
+static void litexcnc_read_slow(void* void_litexcnc, long period) {
+    litexcnc_t *litexcnc = void_litexcnc;
+
+    // No data is read until the FPGA has been configured by the fast rate group, nor when
+    // the connection with the board has been lost
+    if (!litexcnc->write_loop_has_run || !litexcnc->fpga->slow_read_buffer_size || !*(litexcnc->recovery->hal.pin.connected)) {
+        return;
+    }
+
+    // Read the state from the FPGA. When the read fails or no new data is available yet,
+    // the modules keep the state of the previous cycle.
+    int r = litexcnc->fpga->read_slow(litexcnc->fpga);
+    if (r < 0) {
+        litexcnc_trace_record(&litexcnc->trace, LITEXCNC_TRACE_READ_SLOW, LITEXCNC_TRACE_FLAG_FAILED, 0, NULL, 0);
+        return;
+    }
+    if (r > 0) {
+        return;
+    }
+    litexcnc_trace_record(
+        &litexcnc->trace, LITEXCNC_TRACE_READ_SLOW, 0, 0, 
+        litexcnc->fpga->slow_read_buffer + litexcnc->fpga->read_header_size, 
+        litexcnc->fpga->slow_read_buffer_size - litexcnc->fpga->read_header_size
+    );
+
+    // Process the read data for the different compenents in the slow rate group
+    litexcnc_process_read(litexcnc, true, period);
 }
 
+
 static void litexcnc_write(void *void_litexcnc, long period) {
     litexcnc_t *litexcnc = void_litexcnc;
 
@@ -123,39 +293,196 @@ static void litexcnc_write(void *void_litexcnc, long period) {
         if (!litexcnc->read_loop_has_run) {
             LITEXCNC_WARN("Read and write functions in incorrect order. Recommended order is read first, then write.\n", litexcnc->fpga->name);
         }
-        // Configure the FPGA and set flag that the write function has been done once
-        litexcnc_config(void_litexcnc, period);
+        // Configure the FPGA and set flag that the write function has been done once. The
+        // FPGA is kept in reset until the configuration succeeds. When the read of this
+        // cycle has failed, the board does not respond and the configuration is not
+        // attempted, so the cycle is not blocked by a second timeout.
+        if (litexcnc->recovery->failed_reads) {
+            return;
+        }
+        if (litexcnc_config(void_litexcnc, period) < 0) {
+            return;
+        }
         litexcnc->write_loop_has_run = true;
         return;
     }
 
+    // Nothing is sent when the connection with the board has been lost, or when another
+    // board responds
+    if (!*(litexcnc->recovery->hal.pin.connected)) {
+        return;
+    }
+
+    // Check no buffer has been written beyond its end (only in debug mode)
+    if (!litexcnc_arena_check(&litexcnc->fpga->arena)) {
+        LITEXCNC_ERR("Guard of the arena has been overwritten\n", litexcnc->fpga->name);
+    }
+
     // Clear buffer (except for the header)
     memset(
         litexcnc->fpga->write_buffer + litexcnc->fpga->write_header_size, 
         0, 
-        litexcnc->fpga->write_buffer_size
+        litexcnc->fpga->write_buffer_size - litexcnc->fpga->write_header_size
     );
 
-    // Process all functions
-    uint8_t* pointer = litexcnc->fpga->write_buffer + litexcnc->fpga->write_header_size;
-    litexcnc_watchdog_prepare_write(litexcnc, &pointer, period);
-    litexcnc_wallclock_prepare_write(litexcnc, &pointer);
-    litexcnc_gpio_prepare_write(litexcnc, &pointer);
-    litexcnc_pwm_prepare_write(litexcnc, &pointer);
-    litexcnc_stepgen_prepare_write(litexcnc, &pointer, period);
-    litexcnc_encoder_prepare_write(litexcnc, &pointer, period);
+    // Process all functions in the fast rate group
+    litexcnc_prepare_write(litexcnc, false, period);
+    litexcnc_trace_record(
+        &litexcnc->trace, LITEXCNC_TRACE_WRITE, 0, 0, 
+        litexcnc->fpga->write_buffer + litexcnc->fpga->write_header_size, 
+        litexcnc->fpga->write_buffer_size - litexcnc->fpga->write_header_size
+    );
 
     // Write the data to the FPGA
     litexcnc->fpga->write(litexcnc->fpga);
 }
 
 
+static void litexcnc_write_slow(void *void_litexcnc, long period) {
+    litexcnc_t *litexcnc = void_litexcnc;
+
+    // No data is written until the FPGA has been configured by the fast rate group, nor
+    // when the connection with the board has been lost
+    if (!litexcnc->write_loop_has_run || !litexcnc->fpga->slow_write_buffer_size || !*(litexcnc->recovery->hal.pin.connected)) {
+        return;
+    }
+
+    // Clear buffer (except for the header)
+    memset(
+        litexcnc->fpga->slow_write_buffer + litexcnc->fpga->write_header_size, 
+        0, 
+        litexcnc->fpga->slow_write_buffer_size - litexcnc->fpga->write_header_size
+    );
+
+    // Process all functions in the slow rate group
+    litexcnc_prepare_write(litexcnc, true, period);
+    litexcnc_trace_record(
+        &litexcnc->trace, LITEXCNC_TRACE_WRITE_SLOW, 0, 0, 
+        litexcnc->fpga->slow_write_buffer + litexcnc->fpga->write_header_size, 
+        litexcnc->fpga->slow_write_buffer_size - litexcnc->fpga->write_header_size
+    );
+
+    // Write the data to the FPGA
+    litexcnc->fpga->write_slow(litexcnc->fpga);
+}
+
+
+static bool litexcnc_name_in_use(const char *name) {
+    struct rtapi_list_head *ptr;
+    rtapi_list_for_each(ptr, &litexcnc_list) {
+        litexcnc_t *entry = rtapi_list_entry(ptr, litexcnc_t, list);
+        if (strncmp(entry->fpga->name, name, sizeof(entry->fpga->name)) == 0) return true;
+    }
+    return false;
+}
+
+
+static int litexcnc_rate_group_windows(litexcnc_t *litexcnc, size_t *write_window, size_t *read_window) {
+    /*
+     * Determines the size of the window of the fast rate group in the write and read
+     * block. The window of the slow rate group follows directly after it, up to the end
+     * of the block. The firmware places the modules in the slow rate group last, this
+     * function checks whether the data of both groups does not overlap.
+     */
+    size_t fast_write_end = 0, fast_read_end = 0;
+    size_t slow_write_start = litexcnc->descriptor.write_size, slow_read_start = litexcnc->descriptor.read_size;
+    for (size_t id = 1; id < LITEXCNC_MODULE_COUNT; id++) {
+        litexcnc_descriptor_module_t *module = &litexcnc->descriptor.modules[id];
+        if (litexcnc->slow_modules[id]) {
+            if (module->write_size && (module->write_offset < slow_write_start)) slow_write_start = module->write_offset;
+            if (module->read_size && (module->read_offset < slow_read_start)) slow_read_start = module->read_offset;
+        } else {
+            if (module->write_size && (module->write_offset + module->write_size > fast_write_end)) fast_write_end = module->write_offset + module->write_size;
+            if (module->read_size && (module->read_offset + module->read_size > fast_read_end)) fast_read_end = module->read_offset + module->read_size;
+        }
+    }
+    if ((fast_write_end > slow_write_start) || (fast_read_end > slow_read_start)) {
+        LITEXCNC_ERR("Data of the fast and slow rate group overlaps on the FPGA\n", litexcnc->fpga->name);
+        return -EINVAL;
+    }
+    *write_window = slow_write_start;
+    *read_window = slow_read_start;
+    return 0;
+}
+
+
+static void litexcnc_rate_group_locate(litexcnc_t *litexcnc, size_t write_window, size_t read_window) {
+    /*
+     * Stores the location of the data of each module in the buffer of its rate group.
+     * Modules without data in a block point to the start of the data of the fast group.
+     */
+    litexcnc_fpga_t *fpga = litexcnc->fpga;
+    for (size_t id = 1; id < LITEXCNC_MODULE_COUNT; id++) {
+        litexcnc_descriptor_module_t *module = &litexcnc->descriptor.modules[id];
+        litexcnc->write_data[id] = fpga->write_buffer + fpga->write_header_size;
+        litexcnc->read_data[id] = fpga->read_buffer + fpga->read_header_size;
+        if (module->write_size) {
+            if (litexcnc->slow_modules[id]) {
+                litexcnc->write_data[id] = fpga->slow_write_buffer + fpga->write_header_size + (module->write_offset - write_window);
+            } else {
+                litexcnc->write_data[id] += module->write_offset;
+            }
+        }
+        if (module->read_size) {
+            if (litexcnc->slow_modules[id]) {
+                litexcnc->read_data[id] = fpga->slow_read_buffer + fpga->read_header_size + (module->read_offset - read_window);
+            } else {
+                litexcnc->read_data[id] += module->read_offset;
+            }
+        }
+    }
+}
+
+
 static void litexcnc_cleanup(litexcnc_t *litexcnc) {
     // clean up the Pins, if they're initialized
     // if (litexcnc->pin != NULL) rtapi_kfree(litexcnc->pin);
 
-    // clean up the Modules
-    // TODO
+    // clean up the buffers
+    litexcnc_arena_free(&litexcnc->fpga->arena);
+    litexcnc->config_buffer = NULL;
+    litexcnc->fpga->write_buffer = NULL;
+    litexcnc->fpga->read_buffer = NULL;
+    litexcnc->fpga->slow_write_buffer = NULL;
+    litexcnc->fpga->slow_read_buffer = NULL;
+    litexcnc->fpga->scratch_buffer = NULL;
+
+    // close the trace, all recorded data is written to disk
+    litexcnc_trace_close(&litexcnc->trace);
+
+    // clean up the Modules. The pins and the instances are allocated by HAL and are
+    // released when the component exits, the references to them are cleared.
+    litexcnc->watchdog = NULL;
+    litexcnc->wallclock = NULL;
+    memset(&litexcnc->gpio, 0, sizeof(litexcnc->gpio));
+    memset(&litexcnc->pwm, 0, sizeof(litexcnc->pwm));
+    memset(&litexcnc->stepgen, 0, sizeof(litexcnc->stepgen));
+    memset(&litexcnc->encoder, 0, sizeof(litexcnc->encoder));
+    memset(&litexcnc->pid, 0, sizeof(litexcnc->pid));
+    memset(&litexcnc->modbus, 0, sizeof(litexcnc->modbus));
+    memset(&litexcnc->spi, 0, sizeof(litexcnc->spi));
+    litexcnc->recovery = NULL;
+    litexcnc->image = NULL;
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_unregister);
+void litexcnc_unregister(litexcnc_fpga_t *fpga) {
+    /*
+     * Removes the board from LitexCNC and releases its memory. Called by the board driver
+     * when it closes the board, before the connection is closed. Boards which have not
+     * been registered are ignored.
+     */
+    struct rtapi_list_head *ptr;
+    rtapi_list_for_each(ptr, &litexcnc_list) {
+        litexcnc_t *litexcnc = rtapi_list_entry(ptr, litexcnc_t, list);
+        if (litexcnc->fpga == fpga) {
+            rtapi_list_del(&litexcnc->list);
+            litexcnc_cleanup(litexcnc);
+            rtapi_kfree(litexcnc);
+            return;
+        }
+    }
 }
 
 EXPORT_SYMBOL_GPL(litexcnc_load_config);
@@ -169,11 +496,15 @@ int litexcnc_load_config(const char *config_file, cJSON **config, uint32_t *fing
     long filelen;
     // - open file get the length of the file
     fileptr = fopen(config_file, "r");  // Open the file in binary mode
+    if (fileptr == NULL) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot open config-file '%s'\n", config_file);
+        return -1;
+    }
     fseek(fileptr, 0, SEEK_END);          // Jump to the end of the file
     filelen = ftell(fileptr);             // Get the current byte offset in the file
     rewind(fileptr);                      // Jump back to the beginning of the file
     // - create buffer, read contents and close file
-    buffer = (unsigned char *) calloc(1, filelen * sizeof(unsigned char)); // Enough memory for the file
+    buffer = (unsigned char *) calloc(1, (filelen + 1) * sizeof(unsigned char)); // Enough memory for the file and the terminating NULL
     fread(buffer, filelen, 1, fileptr);   // Read in the entire file
     fclose(fileptr);                      // Close the file
 
@@ -182,7 +513,7 @@ int litexcnc_load_config(const char *config_file, cJSON **config, uint32_t *fing
 
     // Parse the JSON and check whether it is valid
     *config = cJSON_Parse((char *) buffer);
-    if (config == NULL) {
+    if (*config == NULL) {
         const char *error_ptr = cJSON_GetErrorPtr();
         if (error_ptr != NULL) {
             LITEXCNC_ERR_NO_DEVICE("Error in '%s' before: %s\n", config_file, error_ptr);
@@ -217,9 +548,6 @@ int litexcnc_register(litexcnc_fpga_t *fpga, cJSON *config, uint32_t fingerprint
 
     // Store the FPGA on it
     litexcnc->fpga = fpga;
-    
-    // Add it to the list
-    rtapi_list_add_tail(&litexcnc->list, &litexcnc_list);
 
     // Verify the configuration of the FPGA, does it work with this version of LitexCNC?
     r = litexcnc->fpga->verify_config(litexcnc->fpga);
@@ -251,17 +579,27 @@ int litexcnc_register(litexcnc_fpga_t *fpga, cJSON *config, uint32_t fingerprint
     }
     if (r != 0) {
         LITEXCNC_ERR_NO_DEVICE("Validation of config failed.\n");
-        goto fail0;
+        goto fail_free;
     }
 
     // Store the name of the board
     const cJSON *board_name = NULL;
     board_name = cJSON_GetObjectItemCaseSensitive(config, "board_name");
     if (cJSON_IsString(board_name) && (board_name->valuestring != NULL)) {
-        rtapi_snprintf(fpga->name, sizeof(fpga->name), board_name->valuestring);
+        rtapi_snprintf(fpga->name, sizeof(fpga->name), "%s", board_name->valuestring);
+        if (litexcnc_name_in_use(fpga->name)) {
+            LITEXCNC_ERR_NO_DEVICE("Board name '%s' is already in use by another board\n", fpga->name);
+            r = -EINVAL;
+            goto fail_free;
+        }
     } else {
+        // Boards without a name are numbered, the first free index is used
         LITEXCNC_WARN_NO_DEVICE("Missing optional JSON key: '%s'\n", "board_name");
-        rtapi_snprintf(fpga->name, sizeof(fpga->name), "litexcnc.0"); //TODO: add counter
+        for (int index = 0; ; index++) {
+            rtapi_snprintf(fpga->name, sizeof(fpga->name), LITEXCNC_NAME ".%d", index);
+            if (!litexcnc_name_in_use(fpga->name)) break;
+        }
+        LITEXCNC_PRINT_NO_DEVICE("Board registered as '%s'\n", fpga->name);
     }
 
     // Check the name of the board for validity
@@ -271,87 +609,228 @@ int litexcnc_register(litexcnc_fpga_t *fpga, cJSON *config, uint32_t fingerprint
         if (!isprint(fpga->name[i])) {
             LITEXCNC_ERR_NO_DEVICE("Invalid board name (contains non-printable character)\n");
             r = -EINVAL;
-            goto fail1;
+            goto fail_free;
         }
     }
     if (i == HAL_NAME_LEN+1) {
         LITEXCNC_ERR_NO_DEVICE("Invalid board name (not NULL terminated)\n");
         r = -EINVAL;
-        goto fail1;
+        goto fail_free;
     }
     if (i == 0) {
         LITEXCNC_ERR_NO_DEVICE("Invalid board name (zero length)\n");
         r = -EINVAL;
-        goto fail1;
-    }    
+        goto fail_free;
+    }
+
+    // Add it to the list, from this point on the name of the board is reserved
+    rtapi_list_add_tail(&litexcnc->list, &litexcnc_list);
+
+    // Record the data exchanged with the board (optional). The trace is created before
+    // the descriptor is read, so the trace can be replayed without the board.
+    if (*record_directory) {
+        char path[PATH_MAX];
+        rtapi_snprintf(path, sizeof(path), "%s/%s.trace", record_directory, fpga->name);
+        r = litexcnc_trace_create(&litexcnc->trace, path, (size_t) record_size << 20, fpga->version, fpga->fingerprint);
+        if (r < 0) {
+            goto fail0;
+        }
+        LITEXCNC_PRINT_NO_DEVICE("Recording to '%s' (%d MB)\n", path, record_size);
+    }
 
     // Store the clock-frequency from the file
     const cJSON *clock_frequency = NULL;
     clock_frequency = cJSON_GetObjectItemCaseSensitive(config, "clock_frequency");
     if (!(cJSON_IsNumber(clock_frequency))) {
         LITEXCNC_ERR_NO_DEVICE("Missing required JSON key: '%s'\n", "clock_frequency");
+        r = -EINVAL;
         goto fail1;
     } 
     litexcnc->clock_frequency = clock_frequency->valueint;
     litexcnc->clock_frequency_recip = 1.0f / litexcnc->clock_frequency;
 
+    // Check whether the data is packed in the compact image (optional)
+    const cJSON *compact_image = NULL;
+    compact_image = cJSON_GetObjectItemCaseSensitive(config, "compact_image");
+    litexcnc->compact_image = cJSON_IsTrue(compact_image);
+    if (litexcnc->compact_image) {
+        LITEXCNC_PRINT_NO_DEVICE("Using compact image\n");
+    }
+
+    // Check whether the board is used at a high servo rate (optional)
+    const cJSON *high_rate = NULL;
+    high_rate = cJSON_GetObjectItemCaseSensitive(config, "high_rate");
+    litexcnc->high_rate = cJSON_IsTrue(high_rate);
+    litexcnc->fpga->high_rate = litexcnc->high_rate;
+    if (litexcnc->high_rate) {
+        LITEXCNC_PRINT_NO_DEVICE("Using high-rate mode\n");
+    }
+
+    // Read the modules in the slow rate group (optional)
+    const cJSON *slow_modules = NULL;
+    const cJSON *slow_module = NULL;
+    slow_modules = cJSON_GetObjectItemCaseSensitive(config, "slow_modules");
+    cJSON_ArrayForEach(slow_module, slow_modules) {
+        int id = cJSON_IsString(slow_module) ? litexcnc_descriptor_module_id(slow_module->valuestring) : -1;
+        if ((id < 0) || (id == LITEXCNC_MODULE_WATCHDOG) || (id == LITEXCNC_MODULE_WALLCLOCK) || (id == LITEXCNC_MODULE_STEPGEN) || (id == LITEXCNC_MODULE_PID)) {
+            LITEXCNC_ERR_NO_DEVICE("Invalid module in JSON key '%s'\n", "slow_modules");
+            r = -EINVAL;
+            goto fail0;
+        }
+        litexcnc->slow_modules[id] = true;
+        litexcnc->has_slow_group = true;
+        LITEXCNC_PRINT_NO_DEVICE("Module '%s' in slow rate group\n", slow_module->valuestring);
+    }
+
     // Initialize modules
     LITEXCNC_PRINT_NO_DEVICE("Setting up modules...\n");
     LITEXCNC_PRINT_NO_DEVICE(" - Watchdog\n");
-    if (litexcnc_watchdog_init(litexcnc, config) < 0) {
+    r = litexcnc_watchdog_init(litexcnc, config);
+    if (r < 0) {
         LITEXCNC_ERR_NO_DEVICE("Watchdog init failed\n");
         goto fail0;
     }
     LITEXCNC_PRINT_NO_DEVICE(" - Wallclock\n");
-    if (litexcnc_wallclock_init(litexcnc, config) < 0) {
+    r = litexcnc_wallclock_init(litexcnc, config);
+    if (r < 0) {
         LITEXCNC_ERR_NO_DEVICE("Wallclock init failed\n");
         goto fail0;
     }
     LITEXCNC_PRINT_NO_DEVICE(" - GPIO\n");
-    if (litexcnc_gpio_init(litexcnc, config) < 0) {
+    r = litexcnc_gpio_init(litexcnc, config);
+    if (r < 0) {
         LITEXCNC_ERR_NO_DEVICE("GPIO init failed\n");
         goto fail0;
     }
     LITEXCNC_PRINT_NO_DEVICE(" - PWM\n");
-    if (litexcnc_pwm_init(litexcnc, config) < 0) {
+    r = litexcnc_pwm_init(litexcnc, config);
+    if (r < 0) {
         LITEXCNC_ERR_NO_DEVICE("PWM init failed\n");
         goto fail0;
     }
     LITEXCNC_PRINT_NO_DEVICE(" - Stepgen\n");
-    if (litexcnc_stepgen_init(litexcnc, config) < 0) {
+    r = litexcnc_stepgen_init(litexcnc, config);
+    if (r < 0) {
         LITEXCNC_ERR_NO_DEVICE("Stepgen init failed\n");
         goto fail0;
     }
     LITEXCNC_PRINT_NO_DEVICE(" - Encoder\n");
-    if (litexcnc_encoder_init(litexcnc, config) < 0) {
+    r = litexcnc_encoder_init(litexcnc, config);
+    if (r < 0) {
         LITEXCNC_ERR_NO_DEVICE("Encoder init failed\n");
         goto fail0;
     }
+    LITEXCNC_PRINT_NO_DEVICE(" - PID\n");
+    r = litexcnc_pid_init(litexcnc, config);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("PID init failed\n");
+        goto fail0;
+    }
+    LITEXCNC_PRINT_NO_DEVICE(" - Modbus\n");
+    r = litexcnc_modbus_init(litexcnc, config);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Modbus init failed\n");
+        goto fail0;
+    }
+    LITEXCNC_PRINT_NO_DEVICE(" - SPI\n");
+    r = litexcnc_spi_init(litexcnc, config);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("SPI init failed\n");
+        goto fail0;
+    }
+    // Create the pins for the state of the connection
+    r = litexcnc_recovery_init(litexcnc);
+    if (r < 0) {
+        goto fail0;
+    }
+
+    // Read the layout of the MMIO from the FPGA and check it matches the configuration
+    // of the driver
+    LITEXCNC_PRINT_NO_DEVICE("Reading descriptor...\n");
+    r = litexcnc_descriptor_read(litexcnc);
+    if (r < 0) {
+        goto fail0;
+    }
+    r = litexcnc_descriptor_verify(litexcnc);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Layout of the FPGA does not match the configuration of the driver\n");
+        goto fail0;
+    }
+    litexcnc->fpga->reset_address  = litexcnc->descriptor.reset_address;
+    litexcnc->fpga->config_address = litexcnc->descriptor.config_address;
+    litexcnc->fpga->write_address  = litexcnc->descriptor.write_address;
+    litexcnc->fpga->read_address   = litexcnc->descriptor.read_address;
+    litexcnc->fpga->features       = litexcnc->descriptor.features;
+
+    // Use the pack and unpack functions generated for this board, when available
+    litexcnc->image = litexcnc_image_find(litexcnc);
+    if (litexcnc->image) {
+        LITEXCNC_PRINT_NO_DEVICE("Using generated image %08X\n", litexcnc->image->fingerprint);
+    }
+
+    // Determine the windows of the rate groups in the MMIO
+    size_t write_window, read_window;
+    r = litexcnc_rate_group_windows(litexcnc, &write_window, &read_window);
+    if (r < 0) {
+        goto fail0;
+    }
 
-    // Create the buffers for reading and writing data
+    // Create the buffers for reading and writing data. All buffers are taken from the
+    // arena, which is allocated once. After HAL is ready, no memory is allocated anymore.
     LITEXCNC_PRINT_NO_DEVICE("Creating read and write buffers...\n");
-    // - write buffer
-    litexcnc->fpga->write_buffer_size = litexcnc->fpga->write_header_size + LITEXCNC_BOARD_DATA_WRITE_SIZE(litexcnc);
-    LITEXCNC_PRINT_NO_DEVICE(" - Write buffer: %zu bytes)\n", LITEXCNC_BOARD_DATA_WRITE_SIZE(litexcnc));
-    uint8_t *write_buffer = rtapi_kmalloc(litexcnc->fpga->write_buffer_size, RTAPI_GFP_KERNEL);
-    if (litexcnc == NULL) {
+    litexcnc->fpga->write_buffer_size = litexcnc->fpga->write_header_size + write_window;
+    litexcnc->fpga->read_buffer_size = litexcnc->fpga->read_header_size + read_window;
+    litexcnc->fpga->slow_write_address = litexcnc->fpga->write_address + write_window;
+    litexcnc->fpga->slow_read_address = litexcnc->fpga->read_address + read_window;
+    if (litexcnc->descriptor.write_size > write_window) {
+        litexcnc->fpga->slow_write_buffer_size = litexcnc->fpga->write_header_size + litexcnc->descriptor.write_size - write_window;
+    }
+    if (litexcnc->descriptor.read_size > read_window) {
+        litexcnc->fpga->slow_read_buffer_size = litexcnc->fpga->read_header_size + litexcnc->descriptor.read_size - read_window;
+    }
+    litexcnc->fpga->scratch_buffer_size = litexcnc->fpga->read_header_size + litexcnc->descriptor.read_size;
+    if (litexcnc->fpga->scratch_buffer_size < litexcnc->fpga->write_header_size + litexcnc->descriptor.write_size) {
+        litexcnc->fpga->scratch_buffer_size = litexcnc->fpga->write_header_size + litexcnc->descriptor.write_size;
+    }
+    size_t arena_size = 
+        LITEXCNC_ARENA_ALIGN(LITEXCNC_CONFIG_HEADER_SIZE) +
+        LITEXCNC_ARENA_ALIGN(litexcnc->fpga->write_buffer_size) +
+        LITEXCNC_ARENA_ALIGN(litexcnc->fpga->read_buffer_size) +
+        LITEXCNC_ARENA_ALIGN(litexcnc->fpga->slow_write_buffer_size) +
+        LITEXCNC_ARENA_ALIGN(litexcnc->fpga->slow_read_buffer_size) +
+        LITEXCNC_ARENA_ALIGN(litexcnc->fpga->scratch_buffer_size);
+    if (litexcnc->fpga->arena_size) {
+        arena_size += LITEXCNC_ARENA_ALIGN(litexcnc->fpga->arena_size(litexcnc->fpga));
+    }
+    r = litexcnc_arena_init(&litexcnc->fpga->arena, arena_size);
+    if (r < 0) {
         LITEXCNC_PRINT_NO_DEVICE("out of memory!\n");
-        r = -ENOMEM;
-        goto fail1;
+        goto fail0;
     }
-    memset(write_buffer, 0, litexcnc->fpga->write_buffer_size);
-    litexcnc->fpga->write_buffer = write_buffer;
+    LITEXCNC_PRINT_NO_DEVICE(" - Arena: %zu bytes\n", litexcnc->fpga->arena.size);
+    // - config buffer
+    litexcnc->config_buffer = litexcnc_arena_alloc(&litexcnc->fpga->arena, LITEXCNC_CONFIG_HEADER_SIZE);
+    // - write buffer
+    LITEXCNC_PRINT_NO_DEVICE(" - Write buffer: %zu bytes\n", write_window);
+    litexcnc->fpga->write_buffer = litexcnc_arena_alloc(&litexcnc->fpga->arena, litexcnc->fpga->write_buffer_size);
     // - read buffer
-    LITEXCNC_PRINT_NO_DEVICE(" - Read buffer: %zu bytes)\n", LITEXCNC_BOARD_DATA_READ_SIZE(litexcnc));
-    litexcnc->fpga->read_buffer_size = litexcnc->fpga->read_header_size + LITEXCNC_BOARD_DATA_READ_SIZE(litexcnc);
-    uint8_t *read_buffer = rtapi_kmalloc(litexcnc->fpga->read_buffer_size, RTAPI_GFP_KERNEL);
-    if (litexcnc == NULL) {
-        LITEXCNC_PRINT_NO_DEVICE("out of memory!\n");
-        r = -ENOMEM;
-        goto fail1;
+    LITEXCNC_PRINT_NO_DEVICE(" - Read buffer: %zu bytes\n", read_window);
+    litexcnc->fpga->read_buffer = litexcnc_arena_alloc(&litexcnc->fpga->arena, litexcnc->fpga->read_buffer_size);
+    // - buffers of the slow rate group
+    if (litexcnc->has_slow_group) {
+        LITEXCNC_PRINT_NO_DEVICE(" - Write buffer (slow): %zu bytes\n", litexcnc->descriptor.write_size - write_window);
+        LITEXCNC_PRINT_NO_DEVICE(" - Read buffer (slow): %zu bytes\n", litexcnc->descriptor.read_size - read_window);
+    }
+    if (litexcnc->fpga->slow_write_buffer_size) {
+        litexcnc->fpga->slow_write_buffer = litexcnc_arena_alloc(&litexcnc->fpga->arena, litexcnc->fpga->slow_write_buffer_size);
+    }
+    if (litexcnc->fpga->slow_read_buffer_size) {
+        litexcnc->fpga->slow_read_buffer = litexcnc_arena_alloc(&litexcnc->fpga->arena, litexcnc->fpga->slow_read_buffer_size);
     }
-    memset(read_buffer, 0, litexcnc->fpga->read_buffer_size);
-    litexcnc->fpga->read_buffer = read_buffer;
+    // - scratch buffer
+    litexcnc->fpga->scratch_buffer = litexcnc_arena_alloc(&litexcnc->fpga->arena, litexcnc->fpga->scratch_buffer_size);
+    // Store the location of the data of each module in the buffers
+    litexcnc_rate_group_locate(litexcnc, write_window, read_window);
 
     // Export functions
     LITEXCNC_PRINT_NO_DEVICE("Exporting functions...\n");
@@ -381,6 +860,23 @@ int litexcnc_register(litexcnc_fpga_t *fpga, cJSON *config, uint32_t fingerprint
         r = -EINVAL;
         goto fail1;
     }
+    // - read and write functions of the slow rate group
+    if (litexcnc->has_slow_group) {
+        rtapi_snprintf(name, sizeof(name), "%s.read-slow", litexcnc->fpga->name);
+        r = hal_export_funct(name, litexcnc_read_slow, litexcnc, 1, 0, litexcnc->fpga->comp_id);
+        if (r != 0) {
+            LITEXCNC_ERR("error %d exporting read function %s\n", litexcnc->fpga->name, r, name);
+            r = -EINVAL;
+            goto fail1;
+        }
+        rtapi_snprintf(name, sizeof(name), "%s.write-slow", litexcnc->fpga->name);
+        r = hal_export_funct(name, litexcnc_write_slow, litexcnc, 1, 0, litexcnc->fpga->comp_id);
+        if (r != 0) {
+            LITEXCNC_ERR("error %d exporting write function %s\n", litexcnc->fpga->name, r, name);
+            r = -EINVAL;
+            goto fail1;
+        }
+    }
 
     r = litexcnc->fpga->post_register(litexcnc->fpga);
     if (r != 0) {
@@ -388,7 +884,7 @@ int litexcnc_register(litexcnc_fpga_t *fpga, cJSON *config, uint32_t fingerprint
         goto fail1;
     }
 
-    // Reset the FPGA
+    // Reset the FPGA, it is kept in reset until it is configured in the first cycle
     r = litexcnc->fpga->reset(litexcnc->fpga);
     if (r != 0) {
         LITEXCNC_PRINT_NO_DEVICE("Reset of FPGA failed \n");
@@ -401,7 +897,9 @@ fail1:
     litexcnc_cleanup(litexcnc);  // undoes the rtapi_kmallocs from hm2_parse_module_descriptors()
 
 fail0:
+    litexcnc_trace_close(&litexcnc->trace);
     rtapi_list_del(&litexcnc->list);
+fail_free:
     rtapi_kfree(litexcnc);
     return r;
 }
@@ -422,6 +920,16 @@ int rtapi_app_main(void) {
 
 
 void rtapi_app_exit(void) {
+    // Release the boards which have not been unregistered by their board driver. The
+    // board driver has been unloaded already, so only the trace is closed.
+    struct rtapi_list_head *ptr, *next;
+    for (ptr = litexcnc_list.next; ptr != &litexcnc_list; ptr = next) {
+        next = ptr->next;
+        litexcnc_t *litexcnc = rtapi_list_entry(ptr, litexcnc_t, list);
+        litexcnc_trace_close(&litexcnc->trace);
+        rtapi_list_del(ptr);
+        rtapi_kfree(litexcnc);
+    }
     hal_exit(comp_id);
     LITEXCNC_PRINT_NO_DEVICE("LitexCNC driver unloaded \n");
 }
@@ -432,9 +940,17 @@ void rtapi_app_exit(void) {
 // the whole contents of that file into this source-file.
 #include "cJSON/cJSON.c"
 #include "crc.c"
+#include "descriptor.c"
+#include "arena.c"
+#include "image.c"
+#include "trace.c"
+#include "recovery.c"
 #include "watchdog.c"
 #include "wallclock.c"
 #include "gpio.c"
 #include "pwm.c"
 #include "stepgen.c"
-#include "encoder.c"
\ No newline at end of file
+#include "encoder.c"
+#include "pid.c"
+#include "modbus.c"
+#include "spi.c"
\ No newline at end of file
@@ -30,10 +30,18 @@ typedef struct litexcnc_struct litexcnc_t;
 #include "wallclock.h"
 #include "watchdog.h"
 #include "encoder.h"
+#include "pid.h"
+#include "modbus.h"
+#include "spi.h"
+#include "descriptor.h"
+#include "arena.h"
+#include "image.h"
+#include "trace.h"
+#include "recovery.h"
 
 #define LITEXCNC_NAME    "litexcnc"
 #define LITEXCNC_VERSION_MAJOR 1
-#define LITEXCNC_VERSION_MINOR 1
+#define LITEXCNC_VERSION_MINOR 2
 #define LITEXCNC_VERSION_PATCH 0
 
 
@@ -58,8 +66,8 @@ typedef struct litexcnc_struct litexcnc_t;
 // ------------------------------------
 // Basically these are the summations of all the data sizes from the
 // sub-modules
-#define LITEXCNC_BOARD_DATA_WRITE_SIZE(litexcnc) LITEXCNC_WATCHDOG_DATA_WRITE_SIZE + LITEXCNC_WALLCLOCK_DATA_WRITE_SIZE + LITEXCNC_BOARD_GPIO_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_PWM_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_STEPGEN_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_DATA_WRITE_SIZE(litexcnc)
-#define LITEXCNC_BOARD_DATA_READ_SIZE(litexcnc) LITEXCNC_WATCHDOG_DATA_READ_SIZE + LITEXCNC_WALLCLOCK_DATA_READ_SIZE + LITEXCNC_BOARD_GPIO_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_PWM_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_STEPGEN_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_DATA_READ_SIZE(litexcnc)
+#define LITEXCNC_BOARD_DATA_WRITE_SIZE(litexcnc) LITEXCNC_WATCHDOG_DATA_WRITE_SIZE + LITEXCNC_WALLCLOCK_DATA_WRITE_SIZE + LITEXCNC_BOARD_GPIO_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_PWM_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_STEPGEN_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_PID_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_MODBUS_DATA_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_SPI_DATA_WRITE_SIZE(litexcnc)
+#define LITEXCNC_BOARD_DATA_READ_SIZE(litexcnc) LITEXCNC_WATCHDOG_DATA_READ_SIZE + LITEXCNC_WALLCLOCK_DATA_READ_SIZE + LITEXCNC_BOARD_GPIO_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_PWM_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_STEPGEN_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_ENCODER_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_PID_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_MODBUS_DATA_READ_SIZE(litexcnc) + LITEXCNC_BOARD_SPI_DATA_READ_SIZE(litexcnc)
 
 typedef struct litexcnc_fpga_struct litexcnc_fpga_t;
 struct litexcnc_fpga_struct {
@@ -68,13 +76,44 @@ struct litexcnc_fpga_struct {
     uint32_t version;
     uint32_t fingerprint;
 
-    // Functions to verify the board and reset the board
-    // - on success these two return TRUE (not zero)
-    // - on failure they return FALSE (0) and set *self->io_error (below) to TRUE
+    // Functions to verify, reset and configure the board. These return 0 on success and
+    // a negative value on failure.
+    // - verify_config reads the version and the fingerprint of the board;
+    // - reset asserts the reset of the board, the board is kept in reset until it is
+    //   configured;
+    // - write_config writes the configuration and releases the reset. It is called in
+    //   the first cycle of the servo-thread, as the configuration requires the period.
     int (*verify_config)(litexcnc_fpga_t *self);
     int (*reset)(litexcnc_fpga_t *self);
     int (*write_config)(litexcnc_fpga_t *self, uint8_t *data, size_t size);
 
+    // Function to read an arbitrary block of memory from the board (i.e. the
+    // descriptor). Returns 0 on success and a negative value on failure.
+    int (*read_memory)(litexcnc_fpga_t *self, uint32_t address, uint8_t *data, size_t size);
+
+    // Addresses of the registers on the board, as read from the descriptor. These are
+    // set by LitexCNC before the functions above (except verify_config) are called.
+    uint32_t reset_address;
+    uint32_t config_address;
+    uint32_t write_address;
+    uint32_t read_address;
+    // Features of the firmware (see LITEXCNC_DESCRIPTOR_FEATURE_*), i.e. whether the
+    // status block can be read with a single block read
+    uint32_t features;
+
+    // When true, the board is used at a high servo rate (see the optional key `high_rate`
+    // in the config). The board driver should then do as little work as possible in the
+    // functions `read` and `write`.
+    bool high_rate;
+
+    // Function which is called with the period of the servo thread, before the
+    // configuration is written. It is called again in every cycle until the configuration
+    // succeeds. Optional (may be NULL), i.e. to scale the timeouts to the period. From
+    // then on the handshake (`verify_config`, `reset` and `write_config`) is done in the
+    // servo-thread, so it must not block for more than a single attempt. Returns 0 on
+    // success and a negative value on failure.
+    int (*set_period)(litexcnc_fpga_t *self, long period);
+
     // Functions to read and write data from the board
     // - on success these two return TRUE (not zero)
     // - on failure they return FALSE (0) and set *self->io_error (below) to TRUE
@@ -82,9 +121,27 @@ struct litexcnc_fpga_struct {
     int (*write)(litexcnc_fpga_t *self);
     hal_bit_t *io_error;
 
+    // Functions to read and write the data of the slow rate group (see the optional key
+    // `slow_modules` in the config), with the same return values as the functions above.
+    // The read may return a positive value when no new data is available yet, i.e. when
+    // the data is exchanged by the fast rate group. Required when the board has modules
+    // in the slow rate group.
+    int (*read_slow)(litexcnc_fpga_t *self);
+    int (*write_slow)(litexcnc_fpga_t *self);
+
     // Functions which will be called during various stages
     int (*post_register)(litexcnc_fpga_t *self);
 
+    // Memory the board driver requires in the arena (i.e. for the request of the read),
+    // on top of the buffers of LitexCNC. Called when the sizes of the read and write
+    // buffers are known. Optional (may be NULL).
+    size_t (*arena_size)(litexcnc_fpga_t *self);
+
+    // Memory from which all buffers of the board are taken. It is allocated when the
+    // board is registered and sealed before HAL is ready, the board driver should take
+    // its buffers from the arena before sealing it.
+    litexcnc_arena_t arena;
+
     // Buffers for reading and writing data
     uint8_t *write_buffer;
     size_t write_header_size;
@@ -92,6 +149,20 @@ struct litexcnc_fpga_struct {
     uint8_t *read_buffer;
     size_t read_header_size;
     size_t read_buffer_size;
+    // Buffers for the slow rate group, with the same header as the buffers above. The
+    // buffers above only contain the data of the fast rate group. The data of each group
+    // is a contiguous window in the MMIO, starting at the given address. The sizes are
+    // zero when the board has no modules in the slow rate group.
+    uint8_t *slow_write_buffer;
+    size_t slow_write_buffer_size;
+    uint32_t slow_write_address;
+    uint8_t *slow_read_buffer;
+    size_t slow_read_buffer_size;
+    uint32_t slow_read_address;
+    // Buffer for temporary data, i.e. for discarding packets or resetting the board. It
+    // is at least as large as the read and write buffers.
+    uint8_t *scratch_buffer;
+    size_t scratch_buffer_size;
     
     // For the low-level driver to hang their struct on
     void *private;  
@@ -102,6 +173,15 @@ struct litexcnc_struct {
     uint32_t clock_frequency;
     float clock_frequency_recip;
 
+    // When true, the stepgen and encoder data is packed in narrower words (see the
+    // optional key `compact_image` in the config)
+    bool compact_image;
+
+    // When true, the board is used at a high servo rate (4 - 10 kHz). Wider tolerances are
+    // used for the timing of the loop and all non-essential work is skipped (see the
+    // optional key `high_rate` in the config)
+    bool high_rate;
+
     struct {
         size_t num_gpio_inputs;
         size_t num_gpio_outputs;
@@ -114,9 +194,33 @@ struct litexcnc_struct {
     uint32_t config_fingerprint;
     uint32_t driver_version;
 
+    // The layout of the MMIO, as read from the FPGA
+    litexcnc_descriptor_t descriptor;
+
+    // The pack and unpack functions generated for the configuration of the board, or
+    // NULL when the generic functions of the modules are used
+    const litexcnc_image_t *image;
+
+    // Recording of the data exchanged with the board (see the module parameter
+    // `record_directory`), not open when the board is not recorded
+    litexcnc_trace_t trace;
+
+    // Buffer for the configuration, which is sent in the first cycle
+    uint8_t *config_buffer;
+
+    // Modules of which the data is exchanged in the slow rate group (see the optional key
+    // `slow_modules` in the config) and the location of the data of each module in the
+    // read and write buffers of its rate group
+    bool slow_modules[LITEXCNC_MODULE_COUNT];
+    bool has_slow_group;
+    uint8_t *write_data[LITEXCNC_MODULE_COUNT];
+    uint8_t *read_data[LITEXCNC_MODULE_COUNT];
+
     // Booleans to indicate whether the loop is run for the first time
     bool write_loop_has_run;
     bool read_loop_has_run;
+    // Number of consecutive cycles in which the configuration failed
+    uint32_t config_failures;
 
     // the litexcnc "Components"
     litexcnc_watchdog_t *watchdog;
@@ -125,6 +229,13 @@ struct litexcnc_struct {
     litexcnc_pwm_t pwm;
     litexcnc_stepgen_t stepgen;
     litexcnc_encoder_t encoder;
+    litexcnc_pid_t pid;
+    litexcnc_modbus_t modbus;
+    litexcnc_spi_t spi;
+
+    // State of the connection with the board, used to recover a board which has been
+    // power-cycled or of which the connection has been lost
+    litexcnc_recovery_t *recovery;
 
     struct rtapi_list_head list;
 };
@@ -160,6 +271,8 @@ typedef struct {
 } litexcnc_config_header_t;
 #pragma pack(pop)
 #define LITEXCNC_CONFIG_HEADER_SIZE sizeof(litexcnc_config_header_t) + LITEXCNC_STEPGEN_CONFIG_DATA_SIZE
+// Number of cycles between the messages when the configuration keeps failing
+#define LITEXCNC_CONFIG_REPORT_INTERVAL 1000
 
 int litexcnc_load_config(const char *config_file, cJSON **config, uint32_t *fingerprint) ;
 int litexcnc_register(litexcnc_fpga_t *fpga, cJSON *config, uint32_t fingerprint);
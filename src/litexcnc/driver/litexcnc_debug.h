@@ -1,30 +0,0 @@
-//
-//    Copyright (C) 2022 Peter van Tol
-//
-//    This program is free software; you can redistribute it and/or modify
-//    it under the terms of the GNU General Public License as published by
-//    the Free Software Foundation; either version 2 of the License, or
-//    (at your option) any later version.
-//
-//    This program is distributed in the hope that it will be useful,
-//    but WITHOUT ANY WARRANTY; without even the implied warranty of
-//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-//    GNU General Public License for more details.
-//
-//    You should have received a copy of the GNU General Public License
-//    along with this program; if not, write to the Free Software
-//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
-//
-#ifndef __INCLUDE_LITEXCNC_DEBUG_H__
-#define __INCLUDE_LITEXCNC_DEBUG_H__
-
-#define LITEXCNC_DEBUG_NAME    "litexcnc_debug"
-#define LITEXCNC_DEBUG_VERSION "0.01"
-#define MAX_DEBUG_BOARDS 1
-
-typedef struct {
-    // Definition of the FPGA (containing pins, steppers, PWM, ec.)
-    litexcnc_fpga_t fpga;
-} litexcnc_debug_t;
-
-#endif
\ No newline at end of file
@@ -16,6 +16,8 @@
 //    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
 //
 #include <stdio.h>
+#include <limits.h>
+#include <time.h>
 
 #include <rtapi_slab.h>
 #include <rtapi_list.h>
@@ -31,8 +33,19 @@
 #include "litexcnc_eth.h"
 
 
-static char *config_file[MAX_ETH_BOARDS];
-RTAPI_MP_ARRAY_STRING(config_file, MAX_ETH_BOARDS, "Path to the config-file for the given board.")
+static char *config_file[MAX_ETH_CONFIG_FILES];
+RTAPI_MP_ARRAY_STRING(config_file, MAX_ETH_CONFIG_FILES, "Path to the config-file for the given board. Multiple paths in a single entry can be separated with ';'.")
+
+static char *discover = "";
+RTAPI_MP_STRING(discover, "Network on which the boards are discovered (i.e. 192.168.2.0/24). When set, each config-file is matched to a board by its fingerprint instead of its ip-address.")
+
+static char *capture_directory = "";
+RTAPI_MP_STRING(capture_directory, "Directory in which the datagrams exchanged with each board are captured (<board_name>.ring), to be drained with 'litexcnc capture'. Capturing is disabled when empty.")
+static int capture_slots = EB_CAPTURE_DEFAULT_SLOTS;
+RTAPI_MP_INT(capture_slots, "Number of datagrams in the capture ring of each board.")
+
+static int benchmark = 0;
+RTAPI_MP_INT(benchmark, "When set, the round trip of each board is measured when it is registered. Boards with 'high_rate' are always measured.")
 
 // This keeps track of the component id. Required for setup and tear down.
 static int comp_id;
@@ -40,7 +53,11 @@ static int comp_id;
 static int boards_count = 0;
 static struct rtapi_list_head board_num;
 static struct rtapi_list_head ifnames;
-static litexcnc_eth_t* boards[MAX_ETH_BOARDS];
+static struct rtapi_list_head boards;
+
+// Boards found on the network when the driver is in discovery mode
+static struct eb_discovered_board discovered_boards[LITEXCNC_ETH_MAX_DISCOVERED_BOARDS];
+static int discovered_boards_count = 0;
 
 
 // Create a dictionary structure to store card information and being able
@@ -79,44 +96,134 @@ static void dict_free(struct rtapi_list_head *head) {
     }
 }
 
+static void litexcnc_eth_put_word(uint8_t *buffer, uint32_t value) {
+    value = htobe32(value);
+    memcpy(buffer, &value, sizeof(uint32_t));
+}
+
+static uint32_t litexcnc_eth_get_word(const uint8_t *buffer) {
+    uint32_t value;
+    memcpy(&value, buffer, sizeof(uint32_t));
+    return be32toh(value);
+}
+
+static int litexcnc_eth_transact(litexcnc_fpga_t *this, uint32_t write_address, const uint32_t *write_data, size_t write_count, const uint32_t *read_addresses, uint32_t *read_data, size_t read_count) {
+    /*
+     * Exchanges a single record with the board: the given words are written starting at
+     * the write address, after which the given addresses are read. The board executes
+     * the writes before the reads, so the reads confirm the writes within the same round
+     * trip. The base return address of the record is a tag which is unique for each
+     * attempt, so a late response to an earlier attempt is never taken as the response
+     * to this attempt. When no valid response is received within the receive timeout,
+     * the record is sent again (writing the same values twice is harmless), up to the
+     * number of attempts of the handshake (see `litexcnc_eth_t`).
+     *
+     * The data is given and returned in host byte order. Returns 0 on success and -1 when
+     * the board did not respond.
+     */
+    litexcnc_eth_t *board = this->private;
+    uint8_t request[LITEXCNC_ETH_HANDSHAKE_MAX_PACKET_SIZE];
+    uint8_t response[LITEXCNC_ETH_HANDSHAKE_MAX_PACKET_SIZE];
+
+    if ((write_count > LITEXCNC_ETH_HANDSHAKE_MAX_WORDS) || (read_count == 0) || (read_count > LITEXCNC_ETH_HANDSHAKE_MAX_WORDS)) {
+        LITEXCNC_ERR_NO_DEVICE("Invalid handshake (%zu writes, %zu reads)\n", write_count, read_count);
+        return -1;
+    }
+
+    // Create the record, the writes are followed by the reads
+    memcpy(request, etherbone_header, 10);
+    request[10] = write_count;
+    request[11] = read_count;
+    size_t size = 12;
+    if (write_count) {
+        litexcnc_eth_put_word(&request[size], write_address);
+        size += sizeof(uint32_t);
+        for (size_t i = 0; i < write_count; i++) {
+            litexcnc_eth_put_word(&request[size], write_data[i]);
+            size += sizeof(uint32_t);
+        }
+    }
+    size_t tag_offset = size;
+    size += sizeof(uint32_t);
+    for (size_t i = 0; i < read_count; i++) {
+        litexcnc_eth_put_word(&request[size], read_addresses[i]);
+        size += sizeof(uint32_t);
+    }
+    size_t response_size = 16 + read_count * sizeof(uint32_t);
+
+    for (int attempt = 1; attempt <= board->handshake.attempts; attempt++) {
+        uint32_t tag = LITEXCNC_ETH_HANDSHAKE_TAG | board->handshake.sequence++;
+        litexcnc_eth_put_word(&request[tag_offset], tag);
+        // Responses to earlier attempts which arrived after their timeout
+        eb_discard_pending_packets(board->connection, response, sizeof(response));
+        if (eb_send(board->connection, request, size) < 0) {
+            continue;
+        }
+        // The response echoes the tag as the address it writes to
+        for (size_t i = 0; i < LITEXCNC_ETH_MAX_STRAY_RESPONSES; i++) {
+            int count = eb_recv(board->connection, response, sizeof(response));
+            if (count < 0) {
+                break;
+            }
+            if ((count != response_size) || (litexcnc_eth_get_word(&response[12]) != tag)) {
+                continue;
+            }
+            for (size_t j = 0; j < read_count; j++) {
+                read_data[j] = litexcnc_eth_get_word(&response[16 + j * sizeof(uint32_t)]);
+            }
+            if (board->handshake.failed_attempts) {
+                LITEXCNC_WARN_NO_DEVICE("Board responded after %u attempts\n", board->handshake.failed_attempts + 1);
+                board->handshake.failed_attempts = 0;
+            }
+            return 0;
+        }
+        board->handshake.failed_attempts++;
+    }
+
+    return -1;
+}
+
+static bool litexcnc_eth_report_handshake(litexcnc_eth_t *board) {
+    /*
+     * Returns true when a handshake without response has to be reported. In the
+     * servo-thread the handshake is retried every cycle, so only the first failure and
+     * then every LITEXCNC_ETH_HANDSHAKE_REPORT_INTERVAL attempts are reported.
+     */
+    return 
+        (board->handshake.failed_attempts <= board->handshake.attempts) || 
+        (board->handshake.failed_attempts % LITEXCNC_ETH_HANDSHAKE_REPORT_INTERVAL == 0);
+}
+
 static int litexcnc_eth_verify_config(litexcnc_fpga_t *this) {
     /*
-     * This function reads the magic code (should be equal to 0x18052022) and if the
-     * received magic code is valied, it stores the fingerprint on the FPGA in the
+     * This function reads the magic code (should be equal to LITEXCNC_ETH_MAGIC) and if
+     * the received magic code is valid, it stores the fingerprint on the FPGA in the
      * datastruct on the computer. The comparison between the used config for the driver
      * stored fingerprint is done by the LitexCNC driver
      */
+    const uint32_t addresses[3] = {
+        LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS + offsetof(litexcnc_header_data_read_t, magic),
+        LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS + offsetof(litexcnc_header_data_read_t, version),
+        LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS + offsetof(litexcnc_header_data_read_t, fingerprint),
+    };
     litexcnc_eth_t *board = this->private;
-
-    // Create a buffer to contain both the magic number and the config fingerprint. Both
-    // parameters are stored in as 32-bit unsigned integers
-    uint8_t *read_buffer = rtapi_kmalloc(LITEXCNC_HEADER_DATA_READ_SIZE, RTAPI_GFP_KERNEL);
-
-    // Read the magic and fingerprint. These are the first registers on the card
-    int r = eb_read8(
-        board->connection, 
-        LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS(this), 
-        read_buffer, 
-        LITEXCNC_HEADER_DATA_READ_SIZE, 
-        0);
-    if (r < 0){
-        LITEXCNC_ERR_NO_DEVICE("Cannot read from FPGA\n");
-        return r;
+    uint32_t header[3];
+    if (litexcnc_eth_transact(this, 0, NULL, 0, addresses, header, 3) < 0) {
+        if (litexcnc_eth_report_handshake(board)) {
+            LITEXCNC_ERR_NO_DEVICE("Cannot read from FPGA, no response (attempt %u)\n", board->handshake.failed_attempts);
+        }
+        return -1;
     }
 
-    // Convert received data to header
-    litexcnc_header_data_read_t header;
-    memcpy(&header, read_buffer, sizeof header);
-
     // Check magic
-    if (be32toh(header.magic) != 0x18052022) {
-        LITEXCNC_ERR_NO_DEVICE("Invalid magic received '%08X'\n", be32toh(header.magic));
+    if (header[0] != LITEXCNC_ETH_MAGIC) {
+        LITEXCNC_ERR_NO_DEVICE("Invalid magic received '%08X'\n", header[0]);
         return -1;
     }
 
     // Store version and fingerprint
-    this->version = be32toh(header.version);
-    this->fingerprint = be32toh(header.fingerprint);
+    this->version = header[1];
+    this->fingerprint = header[2];
 
     // Succesfull finish
     return 0;
@@ -124,182 +231,491 @@ static int litexcnc_eth_verify_config(litexcnc_fpga_t *this) {
 
 static int litexcnc_eth_reset(litexcnc_fpga_t *this) {
     /*
-     * This function resets the card to its initial state. Because this resetting is
-     * very important to prevent uncommanded moves, this function will write the reset
-     * code to the card, read back the value to assure it is set and then set the card
-     * to working mode. Whenever a disruption of this sequence occurs, this function
-     * will return an error and the component will fail to load.
-     *
-     * This function will retry to reset the card a maximum of MAX_RESET_RETRIES when
-     * the reset fails. Failure of the reset can happen when for example a disruption
-     * in communication occurs.
+     * This function asserts the reset of the card. Because this resetting is very
+     * important to prevent uncommanded moves, the card is kept in reset until it has
+     * been configured in the first cycle of the servo-thread (see
+     * `litexcnc_eth_write_config`). The record which asserts the reset also reads back
+     * the magic and the fingerprint, to confirm the card is still the card which has
+     * been verified, and the reset register, to confirm the reset has been asserted.
+     * Whenever this fails, the component will fail to load.
      */
+    const uint32_t reset = 1;
+    const uint32_t addresses[3] = {
+        LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS + offsetof(litexcnc_header_data_read_t, magic),
+        LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS + offsetof(litexcnc_header_data_read_t, fingerprint),
+        this->reset_address,
+    };
     litexcnc_eth_t *board = this->private;
+    uint32_t values[3];
 
-    // Create a buffer to contain both the magic number and the config fingerprint. Both
-    // parameters are stored in as 32-bit unsigned integers
-    uint8_t *buffer = rtapi_kmalloc(LITEXCNC_RESET_HEADER_SIZE, RTAPI_GFP_KERNEL);
-
-    // Initialize a variables for resetting the card and the current status
-    size_t i;
-    uint32_t reset_flag;
-    uint32_t reset_status;
-
-    // Write reset bit to the card.
-    i = 1;
-    reset_flag = htobe32(0x01);
-    reset_status = htobe32(0x00); // Make sure the loop below is run at least once
-    while (reset_flag != reset_status) {
-        // Check whether we didn't try too many times
-        if (i > MAX_RESET_RETRIES) {
-            LITEXCNC_ERR_NO_DEVICE("Reset of the card failed after %d times\n", MAX_RESET_RETRIES);
-            return -1;
+    if (litexcnc_eth_transact(this, this->reset_address, &reset, 1, addresses, values, 3) < 0) {
+        if (litexcnc_eth_report_handshake(board)) {
+            LITEXCNC_ERR("Reset of the card failed, no response (attempt %u)\n", this->name, board->handshake.failed_attempts);
         }
-        // Write the data to the card
-        memcpy(buffer, &reset_flag, LITEXCNC_RESET_HEADER_SIZE);
-        eb_write8(
-            board->connection, 
-            LITEXCNC_ETH_RESET_DATA_BASE_ADDRESS(this), 
-            buffer, 
-            LITEXCNC_RESET_HEADER_SIZE,
-            0
-        );
-        // Wait for a bit before requesting the data
-        usecSleep(10);
-        // Read the data back
-        eb_read8(
-            board->connection, 
-            LITEXCNC_ETH_RESET_DATA_BASE_ADDRESS(this), 
-            buffer, 
-            LITEXCNC_RESET_HEADER_SIZE,
-            0
-        );
-        memcpy(&reset_status, buffer, LITEXCNC_RESET_HEADER_SIZE);
-        // Proceed counter
-        i++;
-    }
-
-    // Finish reset procedure
-    i = 1;
-    reset_flag = htobe32(0);
-    while (reset_flag != reset_status) {
-        // Check whether we didn't try too many times
-        if (i > MAX_RESET_RETRIES) {
-            LITEXCNC_ERR_NO_DEVICE("FPGA did not respond after reset for %d times\n", MAX_RESET_RETRIES);
+        return -1;
+    }
+    if ((values[0] != LITEXCNC_ETH_MAGIC) || (values[1] != this->fingerprint)) {
+        LITEXCNC_ERR("Card changed since it has been verified (magic %08X, fingerprint %08X)\n", this->name, values[0], values[1]);
+        return -1;
+    }
+    if (!(values[2] & 0x01)) {
+        LITEXCNC_ERR("Reset of the card failed, reset not asserted\n", this->name);
+        return -1;
+    }
+
+    // Card is in reset
+    return 0;
+}
+
+static int litexcnc_eth_write_config(litexcnc_fpga_t *this, uint8_t *data, size_t size) {
+    /*
+     * This function sends the configuration to the FPGA and releases the reset, which
+     * has been asserted when the card was registered. This takes two records:
+     *  1. the configuration is written and the reset register and the configuration are
+     *     read back. When the configuration directly follows the reset register (which
+     *     is the layout of the firmware), the reset is asserted again in the same write,
+     *     so a card which has been reset in the meantime is still configured in reset;
+     *  2. the reset is released and the reset register is read back.
+     * The reset is only released when the read back configuration equals the written
+     * configuration. Firmware without LITEXCNC_DESCRIPTOR_FEATURE_CONFIG_READBACK
+     * cannot read back `loop_cycles` (the first word of the configuration), which is
+     * then not compared.
+     */
+    litexcnc_eth_t *board = this->private;
+    size_t words = size / sizeof(uint32_t);
+    uint32_t values[LITEXCNC_ETH_HANDSHAKE_MAX_WORDS];
+    uint32_t addresses[LITEXCNC_ETH_HANDSHAKE_MAX_WORDS];
+    uint32_t read_back[LITEXCNC_ETH_HANDSHAKE_MAX_WORDS];
+
+    if (words + 1 > LITEXCNC_ETH_HANDSHAKE_MAX_WORDS) {
+        LITEXCNC_ERR("Configuration too large (%zu bytes)\n", this->name, size);
+        return -1;
+    }
+    values[0] = 1;
+    addresses[0] = this->reset_address;
+    for (size_t i = 0; i < words; i++) {
+        values[i + 1] = litexcnc_eth_get_word(&data[i * sizeof(uint32_t)]);
+        addresses[i + 1] = this->config_address + i * sizeof(uint32_t);
+    }
+
+    bool with_reset = this->config_address == this->reset_address + sizeof(uint32_t);
+    int r = litexcnc_eth_transact(
+        this,
+        with_reset ? this->reset_address : this->config_address,
+        with_reset ? values : &values[1],
+        with_reset ? words + 1 : words,
+        addresses,
+        read_back,
+        words + 1);
+    if (r < 0) {
+        if (litexcnc_eth_report_handshake(board)) {
+            LITEXCNC_ERR("Cannot write config, no response (attempt %u)\n", this->name, board->handshake.failed_attempts);
+        }
+        return -1;
+    }
+    if (!(read_back[0] & 0x01)) {
+        LITEXCNC_ERR("Card left reset before it has been configured\n", this->name);
+        return -1;
+    }
+    size_t first = (this->features & LITEXCNC_DESCRIPTOR_FEATURE_CONFIG_READBACK) ? 1 : 2;
+    for (size_t i = first; i < words + 1; i++) {
+        if (read_back[i] != values[i]) {
+            LITEXCNC_ERR("Config not written correctly (word %zu: written %08X, read %08X)\n", this->name, i - 1, values[i], read_back[i]);
             return -1;
         }
-        // Write the data to the card
-        memcpy(buffer, &reset_flag, LITEXCNC_RESET_HEADER_SIZE);
-        eb_write8(
-            board->connection, 
-            LITEXCNC_ETH_RESET_DATA_BASE_ADDRESS(this), 
-            buffer, 
-            LITEXCNC_RESET_HEADER_SIZE,
-            0
-        );
-        // Wait for a bit before requesting the data
-        usecSleep(10);
-        // Read the data back
-        eb_read8(
-            board->connection, 
-            LITEXCNC_ETH_RESET_DATA_BASE_ADDRESS(this), 
-            buffer, 
-            LITEXCNC_RESET_HEADER_SIZE,
-            0
-        );
-        memcpy(&reset_status, buffer, LITEXCNC_RESET_HEADER_SIZE);
-        // Proceed counter
-        i++;
     }
 
-    // Card has been reset
+    // Release the reset
+    const uint32_t release = 0;
+    uint32_t status;
+    if (litexcnc_eth_transact(this, this->reset_address, &release, 1, &this->reset_address, &status, 1) < 0) {
+        if (litexcnc_eth_report_handshake(board)) {
+            LITEXCNC_ERR("Cannot release reset, no response (attempt %u)\n", this->name, board->handshake.failed_attempts);
+        }
+        return -1;
+    }
+    if (status & 0x01) {
+        LITEXCNC_ERR("Card did not leave reset\n", this->name);
+        return -1;
+    }
+
     return 0;
 }
 
-static int litexcnc_eth_write_config(litexcnc_fpga_t *this, uint8_t *data, size_t size) {
+static int litexcnc_eth_read_memory(litexcnc_fpga_t *this, uint32_t address, uint8_t *data, size_t size) {
     /*
-     * This function sends the configuration to the FPGA.
+     * Reads a block of memory from the FPGA. Large blocks are split in multiple
+     * requests, as a single Etherbone packet can contain a limited number of reads.
      */
     litexcnc_eth_t *board = this->private;
+    size_t chunk;
+    int r;
+
+    while (size) {
+        chunk = size < LITEXCNC_ETH_READ_MEMORY_CHUNK_SIZE ? size : LITEXCNC_ETH_READ_MEMORY_CHUNK_SIZE;
+        r = eb_read8(board->connection, address, data, chunk, 0);
+        if (r < 0) {
+            return r;
+        }
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+    }
 
-    eb_write8(
-        board->connection, 
-        LITEXCNC_ETH_CONFIG_DATA_BASE_ADDRESS(this), 
-        data, 
-        LITEXCNC_CONFIG_HEADER_SIZE,
-        board->hal.param.debug
-    );
-    // if (r < 0) {
-    //     fprintf(stderr, "Could not write config to device `%s`, error code %d", this->name, r);
-    //     return -1;
-    // }
-
-    // It is not (yet) implemented to read back the configuration from the device
-    // in order to check whether the write has been successful.
     return 0;
 }
 
-static int litexcnc_eth_read(litexcnc_fpga_t *this) {
+static int litexcnc_eth_read_window(litexcnc_fpga_t *this, uint8_t *request, size_t request_size, uint8_t *buffer, size_t size) {
+    /*
+     * Reads a window of the MMIO (the data of a rate group) into the given buffer, using
+     * the pre-built request.
+     */
     litexcnc_eth_t *board = this->private;
-    static int r;
+    int r;
     
     // This is essential as the colorlight card crashes when two packets come close to each other.
 	// This prevents crashes in the litex eth core. 
 	// Also turn of mDNS request from linux to the colorlight card. (avahi-daemon)
-	eb_wait_for_tx_buffer_empty(board->connection);
+    // In high-rate mode this is skipped: the last packet has been sent in the write of the
+    // previous cycle, which has long left the socket.
+    if (!this->high_rate) {
+	    eb_wait_for_tx_buffer_empty(board->connection);
+    }
+
+    // If we missed a packet earlier with timeout AND this packet arrived later, it would
+    // be taken as the reply to this request. Discard these packets to avoid such a queue.
+    eb_discard_pending_packets(board->connection, this->scratch_buffer, this->scratch_buffer_size);
 
     // Read the data (etherbone.h)
     // - send request
     r = eb_send(
         board->connection,
-        board->read_request_buffer,
-        this->read_buffer_size);
+        request,
+        request_size);
     if (r < 0) {
         fprintf(stderr, "Could not write addresses to read to device `%s`, error code %d", this->name, r);
         return -1;
     }
-    // - get response
-    int count = eb_recv(
-        board->connection, 
-        this->read_buffer,
-        this->read_buffer_size);
-    // - check size is expexted size
-    if (count != this->read_buffer_size) {
-        fprintf(stderr, "Unexpected read length: %d, expected %zu\n", count, this->read_buffer_size);
-        return -1;
+    // - get response. The response echoes the base return address of the request, which
+    //   is the address of the window. A late response to an earlier request is skipped.
+    for (size_t i = 0; i < LITEXCNC_ETH_MAX_STRAY_RESPONSES; i++) {
+        int count = eb_recv(
+            board->connection, 
+            buffer,
+            size);
+        if (count < 0) {
+            break;
+        }
+        if ((count == size) && (memcmp(&buffer[12], &request[12], 4) == 0)) {
+            // Successful read
+            return 0;
+        }
     }
-    
-    // Successful read
-    return 0;
+    fprintf(stderr, "No valid response of %zu bytes received from device `%s`\n", size, this->name);
+    return -1;
 }
 
-static int litexcnc_eth_write(litexcnc_fpga_t *this) {
+static int litexcnc_eth_write_window(litexcnc_fpga_t *this, uint8_t *buffer, size_t size) {
+    /*
+     * Writes a window of the MMIO (the data of a rate group). The header of the buffer
+     * contains the address of the window.
+     */
     litexcnc_eth_t *board = this->private;
-    static int r;
+    int r;
     
     // This is essential as the colorlight card crashes when two packets come close
     // to each other. This prevents crashes in the litex eth core. 
 	// Also turn of mDNS request from linux to the colorlight card. (avahi-daemon)
-	eb_wait_for_tx_buffer_empty(board->connection);
+    // In high-rate mode this is skipped: the request of the read has already been
+    // answered, so it has left the socket.
+    if (!this->high_rate) {
+	    eb_wait_for_tx_buffer_empty(board->connection);
+    }
 
     // Write the data (etberbone.h)
     r = eb_send(
         board->connection,
-        this->write_buffer,
-        this->write_buffer_size);
+        buffer,
+        size);
     if (r < 0) {
         fprintf(stderr, "Could not write data to device `%s`, error code %d", this->name, r);
         return -1;
     }
 
-    // If we missed a paket earlier with timeout AND this packet arrives later, there 
-    // can be a queue of packet. Test here if anoter packet is ready ( no delay) and 
-    // discard that packet to avoid such a queue.
-	//eb_discard_pending_packet(board->connection, this->write_buffer_size);
+    return r;
+}
+
+static void litexcnc_eth_send_mailbox(litexcnc_fpga_t *this) {
+    /*
+     * Sends the write and the request of the read posted by the slow rate group. Called
+     * by the fast rate group after its write, so the packets are sent one after the
+     * other. The response to the read is not waited for.
+     */
+    litexcnc_eth_t *board = this->private;
+
+    if (__atomic_load_n(&board->mailbox.write_state, __ATOMIC_ACQUIRE) == LITEXCNC_ETH_MAILBOX_POSTED) {
+        litexcnc_eth_write_window(this, board->mailbox.write_buffer, this->slow_write_buffer_size);
+        __atomic_store_n(&board->mailbox.write_state, LITEXCNC_ETH_MAILBOX_IDLE, __ATOMIC_RELEASE);
+    }
+    if (__atomic_load_n(&board->mailbox.read_state, __ATOMIC_ACQUIRE) == LITEXCNC_ETH_MAILBOX_POSTED) {
+        int r = litexcnc_eth_write_window(this, board->slow_read_request_buffer, board->slow_read_request_buffer_size);
+        __atomic_store_n(
+            &board->mailbox.read_state, 
+            (r < 0) ? LITEXCNC_ETH_MAILBOX_FAILED : LITEXCNC_ETH_MAILBOX_SENT, 
+            __ATOMIC_RELEASE);
+    }
+}
+
+static void litexcnc_eth_collect_mailbox(litexcnc_fpga_t *this) {
+    /*
+     * Collects the response to the read of the slow rate group, which has been sent in
+     * the previous cycle. Only the packets which have already been received are checked,
+     * so the fast rate group never waits for the response. The response is recognized by
+     * the base return address of the request. When it has not arrived (yet), the read
+     * fails and a late response is discarded by the read of the fast rate group.
+     */
+    litexcnc_eth_t *board = this->private;
+
+    if (__atomic_load_n(&board->mailbox.read_state, __ATOMIC_ACQUIRE) != LITEXCNC_ETH_MAILBOX_SENT) {
+        return;
+    }
+    int state = LITEXCNC_ETH_MAILBOX_FAILED;
+    int count;
+    while ((count = eb_recv_pending(board->connection, board->mailbox.read_buffer, this->slow_read_buffer_size)) >= 0) {
+        if ((count == this->slow_read_buffer_size) && (memcmp(&board->mailbox.read_buffer[12], &board->slow_read_request_buffer[12], 4) == 0)) {
+            state = LITEXCNC_ETH_MAILBOX_DONE;
+            break;
+        }
+    }
+    __atomic_store_n(&board->mailbox.read_state, state, __ATOMIC_RELEASE);
+}
+
+static int litexcnc_eth_read(litexcnc_fpga_t *this) {
+    litexcnc_eth_t *board = this->private;
+    litexcnc_eth_collect_mailbox(this);
+    return litexcnc_eth_read_window(
+        this, 
+        board->read_request_buffer, 
+        board->read_request_buffer_size, 
+        this->read_buffer, 
+        this->read_buffer_size);
+}
 
+static int litexcnc_eth_write(litexcnc_fpga_t *this) {
+    int r = litexcnc_eth_write_window(this, this->write_buffer, this->write_buffer_size);
+    litexcnc_eth_send_mailbox(this);
     return r;
 }
 
+static int litexcnc_eth_read_slow(litexcnc_fpga_t *this) {
+    /*
+     * Posts the read of the slow rate group in the mailbox and returns the data of the
+     * read posted in an earlier cycle. Returns 1 when that read has not been exchanged
+     * by the fast rate group yet.
+     */
+    litexcnc_eth_t *board = this->private;
+    int r;
+
+    switch (__atomic_load_n(&board->mailbox.read_state, __ATOMIC_ACQUIRE)) {
+    case LITEXCNC_ETH_MAILBOX_POSTED:
+    case LITEXCNC_ETH_MAILBOX_SENT:
+        return 1;
+    case LITEXCNC_ETH_MAILBOX_DONE:
+        memcpy(this->slow_read_buffer, board->mailbox.read_buffer, this->slow_read_buffer_size);
+        r = 0;
+        break;
+    case LITEXCNC_ETH_MAILBOX_FAILED:
+        r = -1;
+        break;
+    default:
+        r = 1;
+    }
+    __atomic_store_n(&board->mailbox.read_state, LITEXCNC_ETH_MAILBOX_POSTED, __ATOMIC_RELEASE);
+    return r;
+}
+
+static int litexcnc_eth_write_slow(litexcnc_fpga_t *this) {
+    /*
+     * Posts the write of the slow rate group in the mailbox. When the previous write has
+     * not been sent yet, it is kept and this write is skipped.
+     */
+    litexcnc_eth_t *board = this->private;
+
+    if (__atomic_load_n(&board->mailbox.write_state, __ATOMIC_ACQUIRE) == LITEXCNC_ETH_MAILBOX_POSTED) {
+        return 0;
+    }
+    memcpy(board->mailbox.write_buffer, this->slow_write_buffer, this->slow_write_buffer_size);
+    __atomic_store_n(&board->mailbox.write_state, LITEXCNC_ETH_MAILBOX_POSTED, __ATOMIC_RELEASE);
+    return 0;
+}
+
+
+static int litexcnc_eth_set_period(litexcnc_fpga_t *this, long period) {
+    /*
+     * In high-rate mode, scales the receive timeout to the period of the servo thread,
+     * unless the timeout has been set explicitly in the config. The default timeout
+     * would block the thread for several periods at high servo rates. Other boards keep
+     * the timeout of the config. From now on the handshake is done in the servo-thread,
+     * so a single attempt is made for each handshake.
+     */
+    litexcnc_eth_t *board = this->private;
+
+    // Called each cycle until the configuration succeeds
+    board->handshake.attempts = 1;
+    if (period == board->period) {
+        return 0;
+    }
+    board->period = period;
+
+    // The round trip is only known when it has been measured
+    if (board->round_trip.p99_ns > period * LITEXCNC_ETH_ROUND_TRIP_FRACTION) {
+        LITEXCNC_WARN(
+            "Period of %ld ns is too short for the measured round trip of %ld ns, the maximum servo rate is %.0f Hz\n", 
+            this->name, period, board->round_trip.p99_ns, board->round_trip.max_rate);
+    }
+    if (!this->high_rate || board->settings.receive_timeout_fixed) {
+        return 0;
+    }
+    board->settings.receive_timeout_us = period * LITEXCNC_ETH_ROUND_TRIP_FRACTION / 1000;
+    if (board->settings.receive_timeout_us < 1) {
+        board->settings.receive_timeout_us = 1;
+    }
+    if (eb_set_timeouts(board->connection, board->settings.receive_timeout_us, board->settings.send_timeout_us) < 0) {
+        LITEXCNC_ERR("Cannot set the receive timeout\n", this->name);
+        return -1;
+    }
+    LITEXCNC_PRINT("Receive timeout set to %ld us (period %ld ns)\n", this->name, board->settings.receive_timeout_us, period);
+    return 0;
+}
+
+
+static int compare_long(const void *a, const void *b) {
+    return (*(const long *)a > *(const long *)b) - (*(const long *)a < *(const long *)b);
+}
+
+
+static void litexcnc_eth_measure_round_trip(litexcnc_eth_t *board) {
+    /*
+     * Measures the round trip of the read of the board and reports the maximum servo
+     * rate for the configuration of the board. The size of the packets depends on the
+     * configuration, so the rate is determined for each board separately. The rate is
+     * based on the 99th percentile of the round trip, a single excursion is handled by
+     * the receive timeout.
+     */
+    struct timespec start, end;
+    long round_trips[LITEXCNC_ETH_BENCHMARK_CYCLES];
+    double sum = 0;
+    int succeeded = 0;
+
+    memset(&board->round_trip, 0, sizeof(board->round_trip));
+    for (size_t i = 0; i < LITEXCNC_ETH_BENCHMARK_CYCLES; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (litexcnc_eth_read(&board->fpga) < 0) {
+            board->round_trip.failed++;
+            continue;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        round_trips[succeeded] = (end.tv_sec - start.tv_sec) * 1000000000L + (end.tv_nsec - start.tv_nsec);
+        sum += round_trips[succeeded];
+        succeeded++;
+    }
+    if (!succeeded) {
+        LITEXCNC_WARN("Round trip could not be measured, all %d reads failed\n", board->fpga.name, LITEXCNC_ETH_BENCHMARK_CYCLES);
+        return;
+    }
+    qsort(round_trips, succeeded, sizeof(long), compare_long);
+    board->round_trip.mean_ns = sum / succeeded;
+    board->round_trip.p99_ns  = round_trips[(succeeded * 99 + 99) / 100 - 1];
+    board->round_trip.max_ns  = round_trips[succeeded - 1];
+    board->round_trip.max_rate = LITEXCNC_ETH_ROUND_TRIP_FRACTION * 1e9 / board->round_trip.p99_ns;
+    LITEXCNC_PRINT(
+        "Round trip (request %zu bytes, response %zu bytes): mean %ld us, 99%% %ld us, max %ld us, %d of %d failed\n", 
+        board->fpga.name,
+        board->read_request_buffer_size,
+        board->fpga.read_buffer_size,
+        board->round_trip.mean_ns / 1000,
+        board->round_trip.p99_ns / 1000,
+        board->round_trip.max_ns / 1000,
+        board->round_trip.failed,
+        LITEXCNC_ETH_BENCHMARK_CYCLES);
+    LITEXCNC_PRINT("Maximum servo rate: %.0f Hz\n", board->fpga.name, board->round_trip.max_rate);
+}
+
+
+static size_t litexcnc_eth_read_request_size(litexcnc_fpga_t *this, size_t read_buffer_size) {
+    /*
+     * With a block read, the request of the read only contains the header. Otherwise it
+     * contains the header and an address for each word read, which has the same size as
+     * the response.
+     */
+    if (!read_buffer_size) {
+        return 0;
+    }
+    if (this->features & LITEXCNC_DESCRIPTOR_FEATURE_BLOCK_READ) {
+        return LITEXCNC_ETH_BLOCK_READ_REQUEST_SIZE;
+    }
+    return read_buffer_size;
+}
+
+
+static size_t litexcnc_eth_arena_size(litexcnc_fpga_t *this) {
+    /*
+     * The arena contains the requests of the read of both rate groups and the mailbox of
+     * the slow rate group.
+     */
+    return 
+        LITEXCNC_ARENA_ALIGN(litexcnc_eth_read_request_size(this, this->read_buffer_size)) +
+        LITEXCNC_ARENA_ALIGN(litexcnc_eth_read_request_size(this, this->slow_read_buffer_size)) +
+        LITEXCNC_ARENA_ALIGN(this->slow_read_buffer_size) +
+        LITEXCNC_ARENA_ALIGN(this->slow_write_buffer_size);
+}
+
+
+static uint8_t *litexcnc_eth_create_read_request(litexcnc_fpga_t *this, uint32_t read_address, size_t read_buffer_size, size_t *size) {
+    /*
+     * Creates the request for reading a window of the MMIO, starting at the given address.
+     * The base return address is set to the address of the window, so the response can
+     * be matched with the request.
+     */
+    uint32_t address;
+    *size = litexcnc_eth_read_request_size(this, read_buffer_size);
+    uint8_t *request = litexcnc_arena_alloc(&this->arena, *size);
+    if (request == NULL) {
+        LITEXCNC_ERR("Cannot create the buffer for the read request\n", this->name);
+        return NULL;
+    }
+    memcpy(request, etherbone_header, sizeof(etherbone_header));
+    // - size
+    size_t words = (read_buffer_size - 16) >> 2;
+    request[11] = words; // Read count (in WORD-count, bitshift to divide by 4)
+    // - base return address
+    address = htobe32(read_address);
+    memcpy(&request[12], &address, sizeof(address));
+    // - addresses. With a block read the words are read starting at the base return
+    //   address, so the request has the same size independent of the number of words
+    if (!(this->features & LITEXCNC_DESCRIPTOR_FEATURE_BLOCK_READ)) {
+        for (size_t i=0; i<words; i++) {
+            address = htobe32(read_address + (i << 2));
+            memcpy(&request[16 + (i << 2)], &address, sizeof(address));
+        }
+    }
+    return request;
+}
+
+
+static void litexcnc_eth_init_write_buffer(uint8_t *buffer, uint32_t write_address, size_t write_buffer_size) {
+    /*
+     * Sets the header of a write buffer for writing a window of the MMIO, starting at the
+     * given address.
+     */
+    memcpy(buffer, etherbone_header, sizeof(etherbone_header));
+    // - size
+    buffer[10] = (write_buffer_size - 16) >> 2; // Write count (in WORD-count, bitshift to divide by 4)
+    // - address
+    uint32_t address = htobe32(write_address);
+    memcpy(&buffer[12], &address, sizeof(address));
+}
+
 
 static int litexcnc_post_register(litexcnc_fpga_t *this) {
     litexcnc_eth_t *board = this->private;
@@ -315,17 +731,248 @@ static int litexcnc_post_register(litexcnc_fpga_t *this) {
 }
 
 
-static int init_board(litexcnc_eth_t *board, const char *config_file) {
+static int read_profile_int(const cJSON *etherbone, const char *key, int minimum, int maximum, int *value) {
+    /*
+     * Reads an optional integer of the latency profile. The value is left untouched when
+     * the key is not present.
+     */
+    const cJSON *item = cJSON_GetObjectItemCaseSensitive(etherbone, key);
+    if (!item) {
+        return 0;
+    }
+    if (!cJSON_IsNumber(item) || (item->valuedouble < minimum) || (item->valuedouble > maximum)) {
+        LITEXCNC_ERR_NO_DEVICE("Invalid value for JSON key '%s'\n", key);
+        return -EINVAL;
+    }
+    *value = item->valueint;
+    return 0;
+}
+
+
+static int read_latency_profile(litexcnc_eth_t *board, const cJSON *etherbone) {
+    /*
+     * Reads the optional latency profile of the sockets from the `etherbone` section of
+     * the config. Settings which are not present are left at the system default.
+     */
+    struct eb_latency_profile *profile = &board->settings.profile;
+    eb_default_latency_profile(profile);
+
+    if ((read_profile_int(etherbone, "busy_poll_us", 1, INT_MAX, &profile->busy_poll_us) < 0) ||
+        (read_profile_int(etherbone, "priority", 0, INT_MAX, &profile->priority) < 0) ||
+        (read_profile_int(etherbone, "tos", 0, 255, &profile->tos) < 0) ||
+        (read_profile_int(etherbone, "receive_buffer", 1, INT_MAX, &profile->receive_buffer) < 0) ||
+        (read_profile_int(etherbone, "send_buffer", 1, INT_MAX, &profile->send_buffer) < 0)) {
+        return -EINVAL;
+    }
+
+    const cJSON *interface = cJSON_GetObjectItemCaseSensitive(etherbone, "interface");
+    if (interface) {
+        if (!cJSON_IsString(interface) || (interface->valuestring == NULL) || 
+            (strlen(interface->valuestring) == 0) || (strlen(interface->valuestring) >= sizeof(profile->interface))) {
+            LITEXCNC_ERR_NO_DEVICE("Invalid value for JSON key '%s'\n", "interface");
+            return -EINVAL;
+        }
+        rtapi_snprintf(profile->interface, sizeof(profile->interface), "%s", interface->valuestring);
+    }
+
+    const cJSON *static_arp = cJSON_GetObjectItemCaseSensitive(etherbone, "static_arp");
+    if (cJSON_IsTrue(static_arp)) {
+        // The MAC address is the one the firmware has been built with
+        const cJSON *mac_address = cJSON_GetObjectItemCaseSensitive(etherbone, "mac_address");
+        unsigned long long mac = 0;
+        char *end = NULL;
+        if (cJSON_IsString(mac_address) && mac_address->valuestring) {
+            mac = strtoull(mac_address->valuestring, &end, 16);
+        }
+        if (!end || *end != '\0' || mac == 0 || mac > 0xFFFFFFFFFFFFULL) {
+            LITEXCNC_ERR_NO_DEVICE("Invalid value for JSON key '%s', required for '%s'\n", "mac_address", "static_arp");
+            return -EINVAL;
+        }
+        for (size_t i = 0; i < sizeof(profile->mac_address); i++) {
+            profile->mac_address[i] = (mac >> (8 * (sizeof(profile->mac_address) - 1 - i))) & 0xFF;
+        }
+        profile->static_arp = true;
+    }
+
+    return 0;
+}
+
+
+static void log_latency_profile(litexcnc_eth_t *board) {
+    /*
+     * Prints the latency profile as it is effective on the sockets, which may differ
+     * from the requested profile (e.g. the kernel caps the buffers), and warns about
+     * interrupt coalescing of the network interface.
+     */
+    struct eb_latency_profile effective;
+    if (eb_get_latency_profile(board->connection, &effective) < 0) {
+        LITEXCNC_WARN_NO_DEVICE("Cannot read the effective socket settings: %s\n", strerror(errno));
+        return;
+    }
+    LITEXCNC_PRINT_NO_DEVICE(" - socket: interface %s%s, busy poll %d us, priority %d, tos 0x%02X, buffers receive %d / send %d bytes\n",
+        effective.interface[0] ? effective.interface : "unknown",
+        board->settings.profile.interface[0] ? " (bound)" : "",
+        effective.busy_poll_us,
+        effective.priority,
+        effective.tos,
+        effective.receive_buffer,
+        effective.send_buffer);
+    if (effective.mac_address[0] | effective.mac_address[1] | effective.mac_address[2] |
+        effective.mac_address[3] | effective.mac_address[4] | effective.mac_address[5]) {
+        LITEXCNC_PRINT_NO_DEVICE(" - ARP: %02x:%02x:%02x:%02x:%02x:%02x (%s)\n", 
+            effective.mac_address[0], effective.mac_address[1], effective.mac_address[2],
+            effective.mac_address[3], effective.mac_address[4], effective.mac_address[5],
+            effective.static_arp ? "static" : "learned");
+    }
+
+    if (!effective.interface[0]) {
+        return;
+    }
+    struct eb_coalescing coalescing;
+    if (eb_get_coalescing(board->connection, effective.interface, &coalescing) < 0) {
+        LITEXCNC_PRINT_NO_DEVICE(" - interrupt coalescing of %s: not reported by the driver\n", effective.interface);
+        return;
+    }
+    LITEXCNC_PRINT_NO_DEVICE(" - interrupt coalescing of %s: rx %u us / %u frames%s, tx %u us / %u frames%s\n",
+        effective.interface,
+        coalescing.rx_usecs, coalescing.rx_frames, coalescing.adaptive_rx ? " (adaptive)" : "",
+        coalescing.tx_usecs, coalescing.tx_frames, coalescing.adaptive_tx ? " (adaptive)" : "");
+    if (coalescing.adaptive_rx) {
+        LITEXCNC_WARN_NO_DEVICE("Adaptive interrupt coalescing on %s makes the round trip unpredictable, disable with 'ethtool -C %s adaptive-rx off rx-usecs 0'\n", 
+            effective.interface, effective.interface);
+    } else if (coalescing.rx_usecs > LITEXCNC_ETH_MAX_COALESCING_US) {
+        LITEXCNC_WARN_NO_DEVICE("Interrupt coalescing of %u us on %s delays every reply of the board, reduce with 'ethtool -C %s rx-usecs 0'\n", 
+            coalescing.rx_usecs, effective.interface, effective.interface);
+    }
+    if (coalescing.rx_frames > 1) {
+        LITEXCNC_WARN_NO_DEVICE("Interrupt coalescing of %u frames on %s delays the replies of the board, reduce with 'ethtool -C %s rx-frames 1'\n", 
+            coalescing.rx_frames, effective.interface, effective.interface);
+    }
+}
+
+
+static int read_transport_settings(litexcnc_eth_t *board, const cJSON *etherbone) {
+    /*
+     * Reads the optional settings for the transport from the `etherbone` section of
+     * the config. When a setting is not present, the default is used.
+     */
+    const cJSON *port = cJSON_GetObjectItemCaseSensitive(etherbone, "port");
+    if (cJSON_IsNumber(port)) {
+        if ((port->valueint <= 0) || (port->valueint > 65535)) {
+            LITEXCNC_ERR_NO_DEVICE("Invalid value for JSON key '%s': %d\n", "port", port->valueint);
+            return -EINVAL;
+        }
+        rtapi_snprintf(board->settings.port, sizeof(board->settings.port), "%d", port->valueint);
+    } else {
+        rtapi_snprintf(board->settings.port, sizeof(board->settings.port), "%s", ETHERBONE_DEFAULT_PORT);
+    }
+
+    const cJSON *receive_timeout = cJSON_GetObjectItemCaseSensitive(etherbone, "receive_timeout_us");
+    board->settings.receive_timeout_us = RECEIVE_TIMEOUT_US;
+    if (cJSON_IsNumber(receive_timeout)) {
+        if (receive_timeout->valuedouble <= 0) {
+            LITEXCNC_ERR_NO_DEVICE("Invalid value for JSON key '%s': %f\n", "receive_timeout_us", receive_timeout->valuedouble);
+            return -EINVAL;
+        }
+        board->settings.receive_timeout_us = (long) receive_timeout->valuedouble;
+        board->settings.receive_timeout_fixed = true;
+    }
+
+    const cJSON *send_timeout = cJSON_GetObjectItemCaseSensitive(etherbone, "send_timeout_us");
+    board->settings.send_timeout_us = SEND_TIMEOUT_US;
+    if (cJSON_IsNumber(send_timeout)) {
+        if (send_timeout->valuedouble <= 0) {
+            LITEXCNC_ERR_NO_DEVICE("Invalid value for JSON key '%s': %f\n", "send_timeout_us", send_timeout->valuedouble);
+            return -EINVAL;
+        }
+        board->settings.send_timeout_us = (long) send_timeout->valuedouble;
+    }
+
+    return read_latency_profile(board, etherbone);
+}
+
+
+static int discover_boards(void) {
+    /*
+     * Discovers all boards on the network given by the module parameter `discover`.
+     */
+    LITEXCNC_PRINT_NO_DEVICE("Discovering boards on network %s...\n", discover);
+    discovered_boards_count = eb_discover(
+        discover, 
+        ETHERBONE_DEFAULT_PORT, 
+        LITEXCNC_ETH_DISCOVERY_TIMEOUT_US, 
+        discovered_boards, 
+        LITEXCNC_ETH_MAX_DISCOVERED_BOARDS);
+    if (discovered_boards_count < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Discovery of boards on network '%s' failed\n", discover);
+        return -EINVAL;
+    }
+    for (int i = 0; i < discovered_boards_count; i++) {
+        if (discovered_boards[i].magic != LITEXCNC_ETH_MAGIC) {
+            LITEXCNC_PRINT_NO_DEVICE(" - %s: not a LitexCNC board (magic %08X)\n", 
+                discovered_boards[i].ip_address, 
+                discovered_boards[i].magic);
+            continue;
+        }
+        LITEXCNC_PRINT_NO_DEVICE(" - %s: version %u.%u.%u, fingerprint %08X\n", 
+            discovered_boards[i].ip_address,
+            (discovered_boards[i].version >> 16) & 0xff, 
+            (discovered_boards[i].version >> 8) & 0xff, 
+            discovered_boards[i].version & 0xff,
+            discovered_boards[i].fingerprint);
+    }
+    return 0;
+}
+
+
+static const char *find_discovered_board(uint32_t fingerprint, const char *preferred_address) {
+    /*
+     * Returns the ip-address of the discovered board with the given fingerprint, or
+     * NULL when no such board has been found. When multiple boards have the same
+     * fingerprint, the board at the preferred address (optional) is selected, otherwise
+     * the first board found.
+     */
+    const char *found = NULL;
+    for (int i = 0; i < discovered_boards_count; i++) {
+        if ((discovered_boards[i].magic != LITEXCNC_ETH_MAGIC) || (discovered_boards[i].fingerprint != fingerprint)) {
+            continue;
+        }
+        if (preferred_address && (strcmp(discovered_boards[i].ip_address, preferred_address) == 0)) {
+            return discovered_boards[i].ip_address;
+        }
+        if (!found) {
+            found = discovered_boards[i].ip_address;
+        }
+    }
+    return found;
+}
+
+
+static int init_board(const char *config_file) {
+
+    litexcnc_eth_t *board;
+    int ret = -1;
   
     // Skip leading spaces from the config paths
     while( *config_file == ' ' ) {
         config_file++;
     }
 
+    // Allocate the memory for the board. This has to be HAL memory, because the
+    // board contains parameters
+    board = (litexcnc_eth_t *)hal_malloc(sizeof(litexcnc_eth_t));
+    if (board == NULL) {
+        LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+        return -ENOMEM;
+    }
+    memset(board, 0, sizeof(litexcnc_eth_t));
+
     // Open the json-file for the configuration
     uint32_t fingerprint;
     cJSON *config = NULL;
-    litexcnc_load_config(config_file, &config, &fingerprint);
+    if (litexcnc_load_config(config_file, &config, &fingerprint) < 0) {
+        return -1;
+    }
 
     // Create a connection with the board
     const cJSON *etherbone = NULL;
@@ -334,28 +981,57 @@ static int init_board(litexcnc_eth_t *board, const char *config_file) {
         LITEXCNC_ERR_NO_DEVICE("Missing required JSON key: '%s'\n", "etherbone");
         goto fail_without_disconnect;
     }
+    // The ip-address is only required when the boards are not discovered. In discovery
+    // mode it is only used to choose between boards with the same fingerprint.
     const cJSON *ip_address = NULL;
+    const char *config_address = NULL;
     ip_address = cJSON_GetObjectItemCaseSensitive(etherbone, "ip_address");
-    if (!(cJSON_IsString(ip_address)) || (ip_address->valuestring == NULL)) {
+    if (cJSON_IsString(ip_address) && (ip_address->valuestring != NULL)) {
+        config_address = ip_address->valuestring;
+    } else if (!*discover) {
         LITEXCNC_ERR_NO_DEVICE("Missing required JSON key: '%s'\n", "ip_address");
         goto fail_without_disconnect;
     }
-    LITEXCNC_PRINT_NO_DEVICE("Connecting to board at address: %s:1234 \n", ip_address->valuestring);
-    board->connection = eb_connect(ip_address->valuestring, "1234", 1);
+    if (read_transport_settings(board, etherbone) < 0) {
+        goto fail_without_disconnect;
+    }
+    const char *board_address = config_address;
+    if (*discover) {
+        // In discovery mode the board is selected by the fingerprint of the config
+        board_address = find_discovered_board(fingerprint, config_address);
+        if (board_address == NULL) {
+            LITEXCNC_ERR_NO_DEVICE("No board found on network %s with fingerprint %08X of config-file '%s'\n", discover, fingerprint, config_file);
+            goto fail_without_disconnect;
+        }
+    }
+    LITEXCNC_PRINT_NO_DEVICE("Connecting to board at address: %s:%s \n", board_address, board->settings.port);
+    board->connection = eb_connect(board_address, board->settings.port, 1);
     if (!board->connection) {
-        rtapi_print_msg(RTAPI_MSG_ERR,"colorcnc: ERROR: failed to connect to board on ip-address '%s:1234'\n", ip_address->valuestring);
+        LITEXCNC_ERR_NO_DEVICE("Failed to connect to board on ip-address '%s:%s'\n", board_address, board->settings.port);
+        goto fail_without_disconnect;
+    }
+    if (eb_set_timeouts(board->connection, board->settings.receive_timeout_us, board->settings.send_timeout_us) < 0) {
+        goto fail_disconnect;
+    }
+    LITEXCNC_PRINT_NO_DEVICE(" - timeouts: receive %ld us, send %ld us\n", board->settings.receive_timeout_us, board->settings.send_timeout_us);
+    if (eb_set_latency_profile(board->connection, &board->settings.profile) < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot apply the socket settings for board at '%s'\n", board_address);
         goto fail_disconnect;
     }
+    log_latency_profile(board);
 
     // Continue process
     goto success_continue;
 
+fail_unregister:
+    // The board is released by LitexCNC before the connection is closed
+    litexcnc_unregister(&board->fpga);
 fail_disconnect:
 	eb_disconnect(&board->connection);
 fail_without_disconnect:
     // Free memory
     cJSON_Delete(config);
-    return -1;
+    return ret;
 
 success_continue:
     // Connect the functions for reading and writing the data to the device
@@ -363,60 +1039,161 @@ success_continue:
     board->fpga.verify_config     = litexcnc_eth_verify_config;
     board->fpga.reset             = litexcnc_eth_reset;
     board->fpga.write_config      = litexcnc_eth_write_config;
+    board->fpga.set_period        = litexcnc_eth_set_period;
+    board->fpga.read_memory       = litexcnc_eth_read_memory;
     board->fpga.read              = litexcnc_eth_read;
     board->fpga.read_header_size  = 16;
     board->fpga.write             = litexcnc_eth_write;
+    board->fpga.read_slow         = litexcnc_eth_read_slow;
+    board->fpga.write_slow        = litexcnc_eth_write_slow;
     board->fpga.write_header_size = 16;
     board->fpga.post_register     = litexcnc_post_register;
+    board->fpga.arena_size        = litexcnc_eth_arena_size;
     board->fpga.private           = board;
+    board->handshake.attempts     = LITEXCNC_ETH_HANDSHAKE_ATTEMPTS;
 
     // Register the board with the main function
-    size_t ret = litexcnc_register(&board->fpga, config, fingerprint);
+    ret = litexcnc_register(&board->fpga, config, fingerprint);
     if (ret != 0) {
         rtapi_print("board fails LitexCNC registration\n");
-        return ret;
+        goto fail_disconnect;
     }
-    boards_count++;
 
     // Free memory (no need to read more data from the config file)
     cJSON_Delete(config);
+    config = NULL;
+    ret = -ENOMEM;
 
     // Set the header of the read and write buffer
     // WRITE BUFFER
-    memcpy(board->fpga.write_buffer, etherbone_header, sizeof(etherbone_header));
-    // - size
-    board->fpga.write_buffer[10] = (board->fpga.write_buffer_size - 16) >> 2; // Write count (in WORD-count, bitshift to divide by 4)
-    // - address
-    uint32_t address = htobe32(LITEXCNC_ETH_WRITE_DATA_BASE_ADDRESS(board->fpga));
-    memcpy(&board->fpga.write_buffer[12], &address, sizeof(address));
+    litexcnc_eth_init_write_buffer(board->fpga.write_buffer, board->fpga.write_address, board->fpga.write_buffer_size);
+    if (board->fpga.slow_write_buffer_size) {
+        litexcnc_eth_init_write_buffer(board->fpga.slow_write_buffer, board->fpga.slow_write_address, board->fpga.slow_write_buffer_size);
+    }
     // READ REQUEST BUFFER 
-    uint8_t *read_request_buffer = rtapi_kmalloc(board->fpga.read_buffer_size, RTAPI_GFP_KERNEL);
-    memcpy(read_request_buffer, etherbone_header, sizeof(etherbone_header));
-    // - size
-    size_t words = (board->fpga.read_buffer_size - 16) >> 2;
-    read_request_buffer[11] = words; // Write count (in WORD-count, bitshift to divide by 4)
-    // - addresses
-    uint32_t addresses[words];
-    for (size_t i=0; i<words; i++) {
-        addresses[i] = htobe32(LITEXCNC_ETH_READ_DATA_BASE_ADDRESS(board->fpga) + (i << 2));
-    }
-    memcpy(&read_request_buffer[16], addresses, words * 4);
-    // Store the created buffer
-    board->read_request_buffer = read_request_buffer;
+    board->read_request_header_size = 16;
+    board->read_request_buffer = litexcnc_eth_create_read_request(
+        &board->fpga, 
+        board->fpga.read_address, 
+        board->fpga.read_buffer_size, 
+        &board->read_request_buffer_size);
+    if (board->read_request_buffer == NULL) {
+        goto fail_unregister;
+    }
+    LITEXCNC_PRINT_NO_DEVICE(" - Read request: %zu bytes\n", board->read_request_buffer_size);
+    if (board->fpga.slow_read_buffer_size) {
+        board->slow_read_request_buffer = litexcnc_eth_create_read_request(
+            &board->fpga, 
+            board->fpga.slow_read_address, 
+            board->fpga.slow_read_buffer_size, 
+            &board->slow_read_request_buffer_size);
+        if (board->slow_read_request_buffer == NULL) {
+            goto fail_unregister;
+        }
+    }
+    // MAILBOX of the slow rate group
+    if (board->fpga.slow_read_buffer_size) {
+        board->mailbox.read_buffer = litexcnc_arena_alloc(&board->fpga.arena, board->fpga.slow_read_buffer_size);
+        if (board->mailbox.read_buffer == NULL) {
+            goto fail_unregister;
+        }
+    }
+    if (board->fpga.slow_write_buffer_size) {
+        board->mailbox.write_buffer = litexcnc_arena_alloc(&board->fpga.arena, board->fpga.slow_write_buffer_size);
+        if (board->mailbox.write_buffer == NULL) {
+            goto fail_unregister;
+        }
+    }
+
+    // Capture the datagrams exchanged with the board (optional)
+    if (*capture_directory) {
+        char path[PATH_MAX];
+        rtapi_snprintf(path, sizeof(path), "%s/%s.ring", capture_directory, board->fpga.name);
+        if (eb_capture_start(board->connection, path, capture_slots) < 0) {
+            ret = -1;
+            goto fail_unregister;
+        }
+        LITEXCNC_PRINT_NO_DEVICE("Capturing to '%s' (%d datagrams)\n", path, capture_slots);
+    }
+
+    // Determine the maximum servo rate for this board. This takes 100 reads, so it is
+    // only done when requested or required for the high-rate mode.
+    if (benchmark || board->fpga.high_rate) {
+        litexcnc_eth_measure_round_trip(board);
+    }
+
+    // Store the board
+    rtapi_list_add_tail(&board->list, &boards);
+    boards_count++;
     
     return 0;
 }
 
 
+static int init_boards(const char *config_files) {
+    /*
+     * Initializes all boards in a single entry of the module parameter `config_file`.
+     * Multiple paths can be given in a single entry by separating them with
+     * LITEXCNC_ETH_CONFIG_FILE_SEPARATOR.
+     */
+    char path[PATH_MAX];
+    const char *start = config_files;
+    const char *end;
+    size_t length;
+    int ret;
+
+    while (*start) {
+        // Find the end of the current path
+        end = strchr(start, LITEXCNC_ETH_CONFIG_FILE_SEPARATOR);
+        length = end ? (size_t)(end - start) : strlen(start);
+        if (length >= sizeof(path)) {
+            LITEXCNC_ERR_NO_DEVICE("Path to config-file too long\n");
+            return -EINVAL;
+        }
+        // Initialize the board, empty paths are skipped
+        memcpy(path, start, length);
+        path[length] = '\0';
+        if (strspn(path, " ") != length) {
+            ret = init_board(path);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        // Proceed to the next path
+        if (!end) {
+            break;
+        }
+        start = end + 1;
+    }
+
+    return 0;
+}
+
+
 static int close_board(litexcnc_eth_t *board) {
+    // The board is released by LitexCNC before the connection is closed
+    litexcnc_unregister(&board->fpga);
     eb_disconnect(&board->connection);
     return 0;
 }
 
 
+static void close_boards(void) {
+    struct rtapi_list_head *ptr, *next;
+    for (ptr = boards.next; ptr != &boards; ptr = next) {
+        next = ptr->next;
+        litexcnc_eth_t *board = rtapi_list_entry(ptr, litexcnc_eth_t, list);
+        close_board(board);
+        rtapi_list_del(ptr);
+    }
+    boards_count = 0;
+}
+
+
 int rtapi_app_main(void) {
     RTAPI_INIT_LIST_HEAD(&ifnames);
     RTAPI_INIT_LIST_HEAD(&board_num);
+    RTAPI_INIT_LIST_HEAD(&boards);
 
     int ret, i;
 
@@ -429,12 +1206,25 @@ int rtapi_app_main(void) {
     }
     comp_id = ret;
 
-    // STEP 2: Initialize the board(s)
-    for(i = 0, ret = 0; ret == 0 && i<MAX_ETH_BOARDS && config_file[i] && *config_file[i]; i++) {
-        boards[i] = (litexcnc_eth_t *)hal_malloc(sizeof(litexcnc_eth_t));
-        ret = init_board(boards[i], config_file[i]);
+    // STEP 2: Discover the boards on the network (optional)
+    if (*discover) {
+        ret = discover_boards();
+        if (ret < 0) goto error;
+    }
+
+    // STEP 3: Initialize the board(s)
+    for(i = 0; i<MAX_ETH_CONFIG_FILES && config_file[i] && *config_file[i]; i++) {
+        ret = init_boards(config_file[i]);
         if(ret < 0) goto error;
     }
+    LITEXCNC_PRINT_NO_DEVICE("Registered %d board(s)\n", boards_count);
+
+    // All buffers have been created, from this point on no memory is allocated anymore
+    struct rtapi_list_head *ptr;
+    rtapi_list_for_each(ptr, &boards) {
+        litexcnc_eth_t *board = rtapi_list_entry(ptr, litexcnc_eth_t, list);
+        litexcnc_arena_seal(&board->fpga.arena);
+    }
 
     // Report the board as ready
     hal_ready(comp_id);
@@ -442,8 +1232,7 @@ int rtapi_app_main(void) {
 
 error:
     // Close all the boards
-    for(i = 0; i<MAX_ETH_BOARDS && config_file[i] && config_file[i][0]; i++)
-        close_board(boards[i]);
+    close_boards();
     // Free up the used memory
     dict_free(&board_num);
     dict_free(&ifnames);
@@ -455,8 +1244,7 @@ error:
 
 void rtapi_app_exit(void) {
     // Close all the boards
-    for(int i = 0; i<MAX_ETH_BOARDS && config_file[i] && config_file[i][0]; i++)
-        close_board(boards[i]);
+    close_boards();
     // Free up the used memory
     dict_free(&board_num);
     dict_free(&ifnames);
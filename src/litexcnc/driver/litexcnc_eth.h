@@ -20,12 +20,35 @@
 
 #define LITEXCNC_ETH_NAME    "litexcnc_eth"
 #define LITEXCNC_ETH_VERSION "0.02"
-#define MAX_ETH_BOARDS 4
-#define MAX_RESET_RETRIES 5
+#define MAX_ETH_CONFIG_FILES 16
 
+// Magic code in the first register of the board
+#define LITEXCNC_ETH_MAGIC 0x18052022
+
+// Separator which can be used to put multiple config-files in a single entry of the
+// module parameter `config_file`, i.e. config_file="board1.json;board2.json"
+#define LITEXCNC_ETH_CONFIG_FILE_SEPARATOR ';'
+
+// Settings for discovering the boards on the network
+#define LITEXCNC_ETH_MAX_DISCOVERED_BOARDS 64
+#define LITEXCNC_ETH_DISCOVERY_TIMEOUT_US 200000
+
+// Maximum part of the period which may be used by the round trip of the read. Unless set
+// explicitly, the receive timeout is this fraction of the period.
+#define LITEXCNC_ETH_ROUND_TRIP_FRACTION 0.5
+// Number of round trips measured when the board is registered, to determine the maximum
+// servo rate
+#define LITEXCNC_ETH_BENCHMARK_CYCLES 100
+// Interrupt coalescing of the network interface above which a warning is given. Every
+// reply of the board is delayed up to this time before the host sees it.
+#define LITEXCNC_ETH_MAX_COALESCING_US 10
+
+#include <rtapi_list.h>
 #include "etherbone.h"
 
 typedef struct {
+    // Boards are stored in a list, so there is no limit on the number of boards
+    struct rtapi_list_head list;
 
     struct {
         struct {
@@ -36,19 +59,88 @@ typedef struct {
     // Connection by etherbone, required for sending/receiving data.
     struct eb_connection* connection;
 
+    // Settings for the transport, read from the optional keys in the `etherbone` section
+    // of the configuration file of the board.
+    struct {
+        char port[6];
+        long receive_timeout_us;
+        bool receive_timeout_fixed;  // The receive timeout is not scaled to the period
+        long send_timeout_us;
+        struct eb_latency_profile profile;
+    } settings;
+
     // Buffer for requesting a read from the device
     uint8_t *read_request_buffer;
     size_t read_request_header_size;
     size_t read_request_buffer_size;
+    // Buffer for requesting a read of the slow rate group from the device
+    uint8_t *slow_read_request_buffer;
+    size_t slow_read_request_buffer_size;
+
+    // Mailbox for the data of the slow rate group. Only the fast rate group exchanges
+    // packets with the board, so the socket is never used by two threads at once. The
+    // slow rate group posts its read and write, which are sent after the write of the
+    // fast rate group. The response to the read is collected at the start of the next
+    // read of the fast rate group, without waiting for it.
+    struct {
+        uint8_t *read_buffer;
+        int read_state;
+        uint8_t *write_buffer;
+        int write_state;
+    } mailbox;
+
+    // State of the handshake with the board (verify, reset and configuration). When the
+    // board is registered, a handshake is attempted up to LITEXCNC_ETH_HANDSHAKE_ATTEMPTS
+    // times. Once the period is known the handshake is done in the servo-thread, so only
+    // a single attempt is made for each handshake and a failed handshake is retried in
+    // the next cycle.
+    struct {
+        uint16_t sequence;          // Sequence number of the records
+        int attempts;               // Maximum number of attempts for each handshake
+        uint32_t failed_attempts;   // Number of consecutive attempts without response
+    } handshake;
+
+    // Period of the servo-thread, 0 until it is known
+    long period;
+
+    // Round trip of the read, as measured when the board is registered
+    struct {
+        long mean_ns;
+        long p99_ns;
+        long max_ns;
+        int failed;
+        float max_rate;
+    } round_trip;
 
     // Definition of the FPGA (containing pins, steppers, PWM, ec.)
     litexcnc_fpga_t fpga;
 } litexcnc_eth_t;
 
-#define LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS(fpga)    0x0
-#define LITEXCNC_ETH_RESET_DATA_BASE_ADDRESS(fpga)   LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS(fpga) + LITEXCNC_HEADER_DATA_READ_SIZE
-#define LITEXCNC_ETH_CONFIG_DATA_BASE_ADDRESS(fpga)  LITEXCNC_ETH_RESET_DATA_BASE_ADDRESS(fpga) + LITEXCNC_RESET_HEADER_SIZE
-#define LITEXCNC_ETH_WRITE_DATA_BASE_ADDRESS(fpga)   LITEXCNC_ETH_CONFIG_DATA_BASE_ADDRESS(fpga) + LITEXCNC_CONFIG_HEADER_SIZE
-#define LITEXCNC_ETH_READ_DATA_BASE_ADDRESS(fpga)    LITEXCNC_ETH_WRITE_DATA_BASE_ADDRESS(fpga) + fpga.write_buffer_size - fpga.write_header_size
+// Address of the header (magic, version and fingerprint). The addresses of all other
+// registers are read from the descriptor on the FPGA.
+#define LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS    0x0
+// Maximum number of bytes read in a single Etherbone packet by `read_memory`
+#define LITEXCNC_ETH_READ_MEMORY_CHUNK_SIZE    240
+// Size of the request of a block read, which only consists of the header
+#define LITEXCNC_ETH_BLOCK_READ_REQUEST_SIZE   16
+// Maximum number of responses received for a single read. Late responses to an earlier
+// request are skipped.
+#define LITEXCNC_ETH_MAX_STRAY_RESPONSES       2
+// States of the read and write in the mailbox of the slow rate group
+#define LITEXCNC_ETH_MAILBOX_IDLE              0
+#define LITEXCNC_ETH_MAILBOX_POSTED            1
+#define LITEXCNC_ETH_MAILBOX_SENT              2
+#define LITEXCNC_ETH_MAILBOX_DONE              3
+#define LITEXCNC_ETH_MAILBOX_FAILED            4
+// Handshake with the board (verify, reset and configuration). Each step is a single
+// record, which is sent again when no valid response is received within the receive
+// timeout. The base return address of the record is the tag, of which the lower 16 bits
+// are a sequence number to recognize the response to each attempt.
+#define LITEXCNC_ETH_HANDSHAKE_ATTEMPTS        5
+// Number of failed attempts between the messages when the board keeps not responding
+#define LITEXCNC_ETH_HANDSHAKE_REPORT_INTERVAL 1000
+#define LITEXCNC_ETH_HANDSHAKE_MAX_WORDS       32
+#define LITEXCNC_ETH_HANDSHAKE_MAX_PACKET_SIZE (16 + 8 * LITEXCNC_ETH_HANDSHAKE_MAX_WORDS)
+#define LITEXCNC_ETH_HANDSHAKE_TAG             0x4C580000
 
 #endif
\ No newline at end of file
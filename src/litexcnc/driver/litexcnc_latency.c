@@ -0,0 +1,455 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+// Characterises the latency of the host (kernel and network interface) to a board,
+// before the host is commissioned. The tool runs the same cyclic pattern as the driver
+// (wait for the period, request the read, receive the response, send the write) for
+// the configuration of the board, at the given rate, without LinuxCNC. The histograms
+// of the latencies are printed in the same format as cyclictest, followed by the
+// recommended settings for the driver.
+//
+// The written image is all zeros: the watchdog is not enabled, so the outputs of the
+// board stay inactive.
+//
+// USAGE:
+//    litexcnc_latency [-r rate] [-m minutes] [-p priority] [-b bins] [-h] config.json
+#include <getopt.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include <rtapi_list.h>
+
+#include "hal.h"
+#include "rtapi.h"
+
+#include "cJSON/cJSON.h"
+#include "etherbone.h"
+#include "litexcnc.h"
+#include "litexcnc_eth.h"
+#include "crc.h"
+
+#define LATENCY_DEFAULT_RATE     1000
+#define LATENCY_DEFAULT_MINUTES  1.0
+#define LATENCY_DEFAULT_PRIORITY 80
+#define LATENCY_DEFAULT_BINS     1000  // Bins of 1 us
+
+// The stepgen applies the data of a cycle at least this fraction of the period after
+// the wall clock has been read (see `litexcnc_stepgen_process_read`)
+#define LATENCY_APPLY_TIME_MIN   0.81
+
+typedef struct {
+    const char *name;
+    unsigned long *bins;
+    size_t bin_count;
+    unsigned long overflows;
+    unsigned long count;
+    long min_ns;
+    long max_ns;
+    double sum_ns;
+} latency_histogram_t;
+
+enum {
+    LATENCY_WAKEUP,
+    LATENCY_ROUND_TRIP,
+    LATENCY_JITTER,
+    LATENCY_READ_TO_WRITE,
+    LATENCY_HISTOGRAMS
+};
+
+
+static long latency_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+
+static int latency_histogram_init(latency_histogram_t *histogram, const char *name, size_t bin_count) {
+    memset(histogram, 0, sizeof(latency_histogram_t));
+    histogram->name = name;
+    histogram->bin_count = bin_count;
+    histogram->min_ns = LONG_MAX;
+    histogram->bins = calloc(bin_count, sizeof(unsigned long));
+    return histogram->bins ? 0 : -ENOMEM;
+}
+
+
+static void latency_histogram_add(latency_histogram_t *histogram, long value_ns) {
+    if (value_ns < 0) {
+        value_ns = 0;
+    }
+    size_t bin = value_ns / 1000;
+    if (bin < histogram->bin_count) {
+        histogram->bins[bin]++;
+    } else {
+        histogram->overflows++;
+    }
+    if (value_ns < histogram->min_ns) histogram->min_ns = value_ns;
+    if (value_ns > histogram->max_ns) histogram->max_ns = value_ns;
+    histogram->sum_ns += value_ns;
+    histogram->count++;
+}
+
+
+static double latency_histogram_percentile(const latency_histogram_t *histogram, double fraction) {
+    /*
+     * Returns the upper bound (in us) of the bin containing the given fraction of the
+     * values. Values in the overflow are reported as the maximum.
+     */
+    unsigned long target = fraction * histogram->count;
+    unsigned long sum = 0;
+    for (size_t bin = 0; bin < histogram->bin_count; bin++) {
+        sum += histogram->bins[bin];
+        if (sum > target) {
+            return bin + 1;
+        }
+    }
+    return histogram->max_ns / 1000.0;
+}
+
+
+static void latency_print_histograms(latency_histogram_t *histograms, size_t count) {
+    /*
+     * Prints the histograms in the format of cyclictest: a line per bin with the count
+     * of each histogram, followed by the summary.
+     */
+    printf("# Histogram (1 us per bin):");
+    for (size_t i = 0; i < count; i++) printf(" %s", histograms[i].name);
+    printf("\n");
+    for (size_t bin = 0; bin < histograms[0].bin_count; bin++) {
+        bool empty = true;
+        for (size_t i = 0; i < count; i++) empty &= !histograms[i].bins[bin];
+        if (empty) continue;
+        printf("%06zu", bin);
+        for (size_t i = 0; i < count; i++) printf(" %06lu", histograms[i].bins[bin]);
+        printf("\n");
+    }
+    printf("# Total:");
+    for (size_t i = 0; i < count; i++) printf(" %09lu", histograms[i].count);
+    printf("\n# Min Latencies:");
+    for (size_t i = 0; i < count; i++) printf(" %05ld", histograms[i].count ? histograms[i].min_ns / 1000 : 0);
+    printf("\n# Avg Latencies:");
+    for (size_t i = 0; i < count; i++) printf(" %05.0f", histograms[i].count ? histograms[i].sum_ns / histograms[i].count / 1000 : 0);
+    printf("\n# Max Latencies:");
+    for (size_t i = 0; i < count; i++) printf(" %05ld", histograms[i].max_ns / 1000);
+    printf("\n# Histogram Overflows:");
+    for (size_t i = 0; i < count; i++) printf(" %05lu", histograms[i].overflows);
+    printf("\n");
+}
+
+
+static int latency_load_config(const char *path, cJSON **config, uint32_t *fingerprint) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Cannot open config-file '%s'\n", path);
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *buffer = malloc(size + 1);
+    if (!buffer || fread(buffer, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "Cannot read config-file '%s'\n", path);
+        fclose(file);
+        free(buffer);
+        return -1;
+    }
+    fclose(file);
+    buffer[size] = '\0';
+    *fingerprint = crc32((unsigned char *) buffer, size, 0);
+    *config = cJSON_Parse(buffer);
+    free(buffer);
+    if (!*config) {
+        fprintf(stderr, "Config-file '%s' is not valid JSON\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+
+static void latency_usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s [options] config.json\n"
+        "  -r RATE      servo rate in Hz (default %d)\n"
+        "  -m MINUTES   duration of the test (default %.0f)\n"
+        "  -p PRIORITY  real-time priority (SCHED_FIFO) of the loop, 0 for none (default %d)\n"
+        "  -b BINS      number of bins of 1 us in the histograms (default %d)\n"
+        "  -h           print the histograms\n",
+        program, LATENCY_DEFAULT_RATE, LATENCY_DEFAULT_MINUTES, LATENCY_DEFAULT_PRIORITY, LATENCY_DEFAULT_BINS);
+}
+
+
+int main(int argc, char **argv) {
+    double rate = LATENCY_DEFAULT_RATE;
+    double minutes = LATENCY_DEFAULT_MINUTES;
+    int priority = LATENCY_DEFAULT_PRIORITY;
+    size_t bin_count = LATENCY_DEFAULT_BINS;
+    bool print_histograms = false;
+    int option;
+
+    while ((option = getopt(argc, argv, "r:m:p:b:h")) != -1) {
+        switch (option) {
+            case 'r': rate = atof(optarg); break;
+            case 'm': minutes = atof(optarg); break;
+            case 'p': priority = atoi(optarg); break;
+            case 'b': bin_count = atol(optarg); break;
+            case 'h': print_histograms = true; break;
+            default:
+                latency_usage(argv[0]);
+                return 2;
+        }
+    }
+    if ((optind != argc - 1) || (rate <= 0) || (minutes <= 0) || (bin_count == 0)) {
+        latency_usage(argv[0]);
+        return 2;
+    }
+
+    // Read the settings of the board from the config-file
+    cJSON *config;
+    uint32_t fingerprint;
+    if (latency_load_config(argv[optind], &config, &fingerprint) < 0) {
+        return 1;
+    }
+    const cJSON *board_name = cJSON_GetObjectItemCaseSensitive(config, "board_name");
+    const cJSON *etherbone = cJSON_GetObjectItemCaseSensitive(config, "etherbone");
+    const cJSON *ip_address = cJSON_GetObjectItemCaseSensitive(etherbone, "ip_address");
+    const cJSON *port = cJSON_GetObjectItemCaseSensitive(etherbone, "port");
+    const cJSON *receive_timeout = cJSON_GetObjectItemCaseSensitive(etherbone, "receive_timeout_us");
+    const cJSON *send_timeout = cJSON_GetObjectItemCaseSensitive(etherbone, "send_timeout_us");
+    bool high_rate = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(config, "high_rate"));
+    if (!cJSON_IsString(ip_address)) {
+        fprintf(stderr, "Missing required JSON key: '%s'\n", "ip_address");
+        return 1;
+    }
+    char port_string[6];
+    snprintf(port_string, sizeof(port_string), "%s", ETHERBONE_DEFAULT_PORT);
+    if (cJSON_IsNumber(port)) {
+        snprintf(port_string, sizeof(port_string), "%d", port->valueint);
+    }
+    long period_ns = 1e9 / rate;
+    // The receive timeout is the same as the driver would use for this rate
+    long receive_timeout_us = cJSON_IsNumber(receive_timeout) ? receive_timeout->valueint :
+        (high_rate ? period_ns * LITEXCNC_ETH_ROUND_TRIP_FRACTION / 1000 : RECEIVE_TIMEOUT_US);
+    long send_timeout_us = cJSON_IsNumber(send_timeout) ? send_timeout->valueint : SEND_TIMEOUT_US;
+
+    // Connect to the board and check it contains the firmware for the config
+    struct eb_connection *connection = eb_connect(ip_address->valuestring, port_string, 1);
+    if (!connection || eb_set_timeouts(connection, receive_timeout_us, send_timeout_us) < 0) {
+        fprintf(stderr, "Failed to connect to board on ip-address '%s:%s'\n", ip_address->valuestring, port_string);
+        return 1;
+    }
+    uint32_t header[ETHERBONE_DISCOVERY_HEADER_WORDS];
+    if (eb_read8(connection, LITEXCNC_ETH_INIT_DATA_BASE_ADDRESS, (uint8_t *) header, sizeof(header), 0) < 0) {
+        fprintf(stderr, "Cannot read from board on ip-address '%s:%s'\n", ip_address->valuestring, port_string);
+        return 1;
+    }
+    uint32_t version = be32toh(header[1]);
+    if (be32toh(header[2]) != fingerprint) {
+        fprintf(stderr, "WARNING: fingerprint of the board (%08X) differs from the config-file (%08X)\n", be32toh(header[2]), fingerprint);
+    }
+
+    // Read the layout of the MMIO, the packets have the same size as in the driver
+    uint32_t descriptor[LITEXCNC_DESCRIPTOR_HEADER_WORDS];
+    if (eb_read8(connection, LITEXCNC_DESCRIPTOR_ADDRESS, (uint8_t *) descriptor, sizeof(descriptor), 0) < 0) {
+        fprintf(stderr, "Cannot read the descriptor from the board\n");
+        return 1;
+    }
+    for (size_t i = 0; i < LITEXCNC_DESCRIPTOR_HEADER_WORDS; i++) {
+        descriptor[i] = be32toh(descriptor[i]);
+    }
+    if (descriptor[0] != LITEXCNC_DESCRIPTOR_MAGIC) {
+        fprintf(stderr, "Invalid descriptor magic received '%08X'\n", descriptor[0]);
+        return 1;
+    }
+    uint32_t write_address = descriptor[4] >> 16;
+    size_t write_size      = 16 + (descriptor[4] & 0xFFFF);
+    uint32_t read_address  = descriptor[5] >> 16;
+    size_t read_size       = 16 + (descriptor[5] & 0xFFFF);
+    bool block_read        = descriptor[6] & LITEXCNC_DESCRIPTOR_FEATURE_BLOCK_READ;
+
+    // Create the packets, in the same way as `litexcnc_eth_create_read_request` and
+    // `litexcnc_eth_init_write_buffer`
+    size_t request_size = block_read ? LITEXCNC_ETH_BLOCK_READ_REQUEST_SIZE : read_size;
+    uint8_t *request = calloc(1, request_size);
+    uint8_t *response = calloc(1, read_size);
+    uint8_t *write = calloc(1, write_size);
+    if (!request || !response || !write) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    uint32_t address;
+    memcpy(request, etherbone_header, sizeof(etherbone_header));
+    request[11] = (read_size - 16) >> 2;
+    address = htobe32(read_address);
+    memcpy(&request[12], &address, sizeof(address));
+    if (!block_read) {
+        for (size_t i = 0; i < (read_size - 16) >> 2; i++) {
+            address = htobe32(read_address + (i << 2));
+            memcpy(&request[16 + (i << 2)], &address, sizeof(address));
+        }
+    }
+    memcpy(write, etherbone_header, sizeof(etherbone_header));
+    write[10] = (write_size - 16) >> 2;
+    address = htobe32(write_address);
+    memcpy(&write[12], &address, sizeof(address));
+
+    latency_histogram_t histograms[LATENCY_HISTOGRAMS];
+    if (latency_histogram_init(&histograms[LATENCY_WAKEUP], "wakeup", bin_count) < 0 ||
+        latency_histogram_init(&histograms[LATENCY_ROUND_TRIP], "round-trip", bin_count) < 0 ||
+        latency_histogram_init(&histograms[LATENCY_JITTER], "send-jitter", bin_count) < 0 ||
+        latency_histogram_init(&histograms[LATENCY_READ_TO_WRITE], "read-to-write", bin_count) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // Run the loop as a real-time thread, as the servo-thread of LinuxCNC does
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        fprintf(stderr, "WARNING: cannot lock memory, the results might contain page faults\n");
+    }
+    if (priority > 0) {
+        struct sched_param param = { .sched_priority = priority };
+        if (sched_setscheduler(0, SCHED_FIFO, &param) < 0) {
+            fprintf(stderr, "WARNING: cannot run with real-time priority %d, run as root for representative results\n", priority);
+        }
+    }
+
+    printf("Board '%s' at %s:%s, firmware %u.%u.%u, fingerprint %08X\n",
+        cJSON_IsString(board_name) ? board_name->valuestring : "", ip_address->valuestring, port_string,
+        (version >> 16) & 0xff, (version >> 8) & 0xff, version & 0xff, be32toh(header[2]));
+    printf("Read request %zu bytes, response %zu bytes, write %zu bytes, receive timeout %ld us%s\n",
+        request_size, read_size, write_size, receive_timeout_us, high_rate ? ", high-rate mode" : "");
+    fflush(stdout);
+
+    unsigned long cycles = minutes * 60 * rate;
+    unsigned long failed = 0, discarded = 0, overruns = 0;
+    long max_gap_ns = 0, previous_write_ns = 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    for (unsigned long cycle = 0; cycle < cycles; cycle++) {
+        // Wait for the start of the period
+        next.tv_nsec += period_ns;
+        while (next.tv_nsec >= 1000000000) {
+            next.tv_nsec -= 1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        long start_ns = next.tv_sec * 1000000000L + next.tv_nsec;
+        latency_histogram_add(&histograms[LATENCY_WAKEUP], latency_now_ns() - start_ns);
+
+        // Read, in the same way as `litexcnc_eth_read_window`
+        if (!high_rate) {
+            eb_wait_for_tx_buffer_empty(connection);
+        }
+        discarded += eb_discard_pending_packets(connection, response, read_size);
+        long request_ns = latency_now_ns();
+        bool success = false;
+        if (eb_send(connection, request, request_size) >= 0) {
+            for (size_t i = 0; i < LITEXCNC_ETH_MAX_STRAY_RESPONSES; i++) {
+                int count = eb_recv(connection, response, read_size);
+                if (count < 0) {
+                    break;
+                }
+                if ((count == (int) read_size) && (memcmp(&response[12], &request[12], 4) == 0)) {
+                    success = true;
+                    break;
+                }
+            }
+        }
+        if (success) {
+            latency_histogram_add(&histograms[LATENCY_ROUND_TRIP], latency_now_ns() - request_ns);
+        } else {
+            failed++;
+        }
+
+        // Write, in the same way as `litexcnc_eth_write_window`
+        if (!high_rate) {
+            eb_wait_for_tx_buffer_empty(connection);
+        }
+        long write_ns = latency_now_ns();
+        eb_send(connection, write, write_size);
+        latency_histogram_add(&histograms[LATENCY_READ_TO_WRITE], write_ns - request_ns);
+        if (cycle) {
+            long gap_ns = write_ns - previous_write_ns;
+            latency_histogram_add(&histograms[LATENCY_JITTER], labs(gap_ns - period_ns));
+            if (gap_ns > max_gap_ns) max_gap_ns = gap_ns;
+        }
+        previous_write_ns = write_ns;
+        if (latency_now_ns() - start_ns > period_ns) {
+            overruns++;
+        }
+    }
+    eb_disconnect(&connection);
+
+    // Report
+    if (print_histograms) {
+        latency_print_histograms(histograms, LATENCY_HISTOGRAMS);
+    }
+    printf("%lu cycles at %.0f Hz: %lu reads failed, %lu late responses discarded, %lu overruns\n", cycles, rate, failed, discarded, overruns);
+    printf("%-14s %9s %9s %9s %9s %9s  (us)\n", "", "min", "avg", "99%", "99.9%", "max");
+    for (size_t i = 0; i < LATENCY_HISTOGRAMS; i++) {
+        latency_histogram_t *histogram = &histograms[i];
+        if (!histogram->count) continue;
+        printf("%-14s %9.1f %9.1f %9.0f %9.0f %9.1f\n", histogram->name,
+            histogram->min_ns / 1000.0, histogram->sum_ns / histogram->count / 1000.0,
+            latency_histogram_percentile(histogram, 0.99), latency_histogram_percentile(histogram, 0.999),
+            histogram->max_ns / 1000.0);
+    }
+    if (!histograms[LATENCY_ROUND_TRIP].count) {
+        printf("All reads failed, no recommendations can be made\n");
+        return 1;
+    }
+
+    // Recommendations. The maximum rate is determined in the same way as the driver does
+    // when a board is registered, but on the 99.9th percentile of the long test.
+    double round_trip_us = latency_histogram_percentile(&histograms[LATENCY_ROUND_TRIP], 0.999);
+    double max_rate = LITEXCNC_ETH_ROUND_TRIP_FRACTION * 1e6 / round_trip_us;
+    printf("\nMaximum servo rate: %.0f Hz (99.9%% of the round trips within %.0f%% of the period)\n", max_rate, LITEXCNC_ETH_ROUND_TRIP_FRACTION * 100);
+    // The watchdog must not bite on the longest gap between two writes
+    long watchdog_ns = 1.5 * max_gap_ns;
+    if (watchdog_ns < 2 * period_ns) watchdog_ns = 2 * period_ns;
+    watchdog_ns = (watchdog_ns + 99999) / 100000 * 100000;
+    printf("Watchdog: longest gap between writes %.1f us, recommended timeout_ns %ld\n", max_gap_ns / 1000.0, watchdog_ns);
+    // The data of the stepgen is applied at least LATENCY_APPLY_TIME_MIN of the period
+    // after the wall clock is read; the write must arrive before that
+    double read_to_write_us = latency_histogram_percentile(&histograms[LATENCY_READ_TO_WRITE], 0.999);
+    double margin_us = LATENCY_APPLY_TIME_MIN * period_ns / 1000.0 - read_to_write_us;
+    printf("Apply time: 99.9%% of the writes sent %.0f us after the read, margin %.0f us to %.0f%% of the period%s\n",
+        read_to_write_us, margin_us, LATENCY_APPLY_TIME_MIN * 100, margin_us < 0 ? " (INSUFFICIENT, lower the rate)" : "");
+    // The stepgen accepts a deviation of the period up to the loop window
+    double jitter = latency_histogram_percentile(&histograms[LATENCY_JITTER], 0.999) * 1000.0 / period_ns;
+    printf("Loop window: 99.9%% of the periods within %.1f%% of the nominal period", jitter * 100);
+    if (jitter > STEPGEN_LOOP_WINDOW_HIGH_RATE) {
+        printf(" (exceeds the window of %.0f%% in high-rate mode, lower the rate)\n", STEPGEN_LOOP_WINDOW_HIGH_RATE * 100);
+    } else if (jitter > STEPGEN_LOOP_WINDOW) {
+        printf(" (exceeds the window of %.0f%%, set \"high_rate\": true in the config)\n", STEPGEN_LOOP_WINDOW * 100);
+    } else {
+        printf(" (OK)\n");
+    }
+
+    cJSON_Delete(config);
+    return 0;
+}
+
+
+// Include other c-files, because LinuxCNC Makefile cannot handle loose files
+#include "etherbone.c"
+#include "cJSON/cJSON.c"
+#include "crc.c"
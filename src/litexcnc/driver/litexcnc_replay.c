@@ -0,0 +1,340 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+#include <stdio.h>
+
+#include <rtapi_slab.h>
+#include <rtapi_list.h>
+
+#include "hal.h"
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "rtapi_string.h"
+
+#include "cJSON/cJSON.h"
+#include "litexcnc.h"
+#include "litexcnc_replay.h"
+
+
+// The board driver replays a recording of the data exchanged with a board (see the
+// module parameter `record_directory` of litexcnc) instead of communicating with the
+// board. The recorded reads are fed to the driver in the order they were recorded, one
+// per cycle of the HAL thread, so the recording can be replayed faster than real-time
+// by using a thread with a shorter period. The writes of the driver are compared with
+// the recorded writes, which only match when the HAL configuration and the period of
+// the thread are the same as when the recording was made.
+static char *config_file[MAX_REPLAY_BOARDS];
+RTAPI_MP_ARRAY_STRING(config_file, MAX_REPLAY_BOARDS, "Path to the config-file for the given board.")
+static char *trace_file[MAX_REPLAY_BOARDS];
+RTAPI_MP_ARRAY_STRING(trace_file, MAX_REPLAY_BOARDS, "Path to the recording of the given board (<record_directory>/<board_name>.trace).")
+
+// This keeps track of the component id. Required for setup and tear down.
+static int comp_id;
+
+static int boards_count = 0;
+static struct rtapi_list_head boards;
+
+
+static int litexcnc_replay_verify_config(litexcnc_fpga_t *this) {
+    litexcnc_replay_t *board = this->private;
+    const litexcnc_trace_header_t *header = (const litexcnc_trace_header_t *) board->trace.memory;
+
+    // The board is the board which has been recorded
+    this->version = header->fpga_version;
+    this->fingerprint = header->fingerprint;
+    return 0;
+}
+
+
+static int litexcnc_replay_reset(litexcnc_fpga_t *this) {
+    // Nothing to reset, the recording starts with the board in its reset state
+    return 0;
+}
+
+
+static void litexcnc_replay_compare(litexcnc_replay_t *board, const litexcnc_trace_record_t *record, const uint8_t *data, size_t size) {
+    /*
+     * Compares the data written by the driver with the recorded data. Only the first
+     * difference is reported, the pin `write-mismatches` counts all of them.
+     */
+    if (record && (record->size == size) && (memcmp(LITEXCNC_TRACE_DATA(record), data, size) == 0)) {
+        return;
+    }
+    (*board->hal.pin.write_mismatches)++;
+    if (*board->hal.pin.write_mismatches == 1) {
+        LITEXCNC_WARN("Written data differs from the recording in cycle %u\n", board->fpga.name, *board->hal.pin.cycle);
+    }
+}
+
+
+static int litexcnc_replay_write_config(litexcnc_fpga_t *this, uint8_t *data, size_t size) {
+    litexcnc_replay_t *board = this->private;
+    const litexcnc_trace_record_t *record = litexcnc_trace_next(&board->trace, &board->cursor.config, LITEXCNC_TRACE_CONFIG);
+    litexcnc_replay_compare(board, record, data, size);
+    return 0;
+}
+
+
+static int litexcnc_replay_read_memory(litexcnc_fpga_t *this, uint32_t address, uint8_t *data, size_t size) {
+    litexcnc_replay_t *board = this->private;
+
+    // The memory is only read when the board is registered, so the complete trace is
+    // searched for the requested block
+    size_t cursor = 0;
+    const litexcnc_trace_record_t *record;
+    while ((record = litexcnc_trace_next(&board->trace, &cursor, LITEXCNC_TRACE_MEMORY)) != NULL) {
+        if ((record->address == address) && (record->size >= size)) {
+            memcpy(data, LITEXCNC_TRACE_DATA(record), size);
+            return 0;
+        }
+    }
+    LITEXCNC_ERR("Memory at address %08X (%zu bytes) not in recording\n", this->name, address, size);
+    return -1;
+}
+
+
+static int litexcnc_replay_read_record(litexcnc_replay_t *board, size_t *cursor, uint16_t type, uint8_t *data, size_t size) {
+    const litexcnc_trace_record_t *record = litexcnc_trace_next(&board->trace, cursor, type);
+    if (record == NULL) {
+        // End of the recording, the driver keeps the state of the last cycle
+        *board->hal.pin.done = true;
+        return -1;
+    }
+    if (record->flags & LITEXCNC_TRACE_FLAG_FAILED) {
+        // The read failed during the recording, so it fails during the replay as well
+        return -1;
+    }
+    if (record->size != size) {
+        LITEXCNC_ERR("Size of the recorded data (%u bytes) differs from the buffer (%zu bytes)\n", board->fpga.name, record->size, size);
+        return -1;
+    }
+    memcpy(data, LITEXCNC_TRACE_DATA(record), size);
+    return 0;
+}
+
+
+static int litexcnc_replay_read(litexcnc_fpga_t *this) {
+    litexcnc_replay_t *board = this->private;
+    int r = litexcnc_replay_read_record(
+        board, &board->cursor.read, LITEXCNC_TRACE_READ,
+        this->read_buffer + this->read_header_size,
+        this->read_buffer_size - this->read_header_size
+    );
+    if (!*board->hal.pin.done) {
+        (*board->hal.pin.cycle)++;
+    }
+    return r;
+}
+
+
+static int litexcnc_replay_read_slow(litexcnc_fpga_t *this) {
+    litexcnc_replay_t *board = this->private;
+    return litexcnc_replay_read_record(
+        board, &board->cursor.read_slow, LITEXCNC_TRACE_READ_SLOW,
+        this->slow_read_buffer + this->read_header_size,
+        this->slow_read_buffer_size - this->read_header_size
+    );
+}
+
+
+static int litexcnc_replay_write(litexcnc_fpga_t *this) {
+    litexcnc_replay_t *board = this->private;
+    if (*board->hal.pin.done) {
+        return 0;
+    }
+    const litexcnc_trace_record_t *record = litexcnc_trace_next(&board->trace, &board->cursor.write, LITEXCNC_TRACE_WRITE);
+    litexcnc_replay_compare(
+        board, record,
+        this->write_buffer + this->write_header_size,
+        this->write_buffer_size - this->write_header_size
+    );
+    return 0;
+}
+
+
+static int litexcnc_replay_write_slow(litexcnc_fpga_t *this) {
+    litexcnc_replay_t *board = this->private;
+    if (*board->hal.pin.done) {
+        return 0;
+    }
+    const litexcnc_trace_record_t *record = litexcnc_trace_next(&board->trace, &board->cursor.write_slow, LITEXCNC_TRACE_WRITE_SLOW);
+    litexcnc_replay_compare(
+        board, record,
+        this->slow_write_buffer + this->write_header_size,
+        this->slow_write_buffer_size - this->write_header_size
+    );
+    return 0;
+}
+
+
+static int litexcnc_replay_post_register(litexcnc_fpga_t *this) {
+    litexcnc_replay_t *board = this->private;
+    int r;
+
+    // Create the pins which show the progress of the replay
+    r = hal_pin_u32_newf(HAL_OUT, &(board->hal.pin.cycle), this->comp_id, "%s.replay.cycle", this->name);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.replay.cycle', aborting\n", this->name);
+        return r;
+    }
+    r = hal_pin_u32_newf(HAL_OUT, &(board->hal.pin.write_mismatches), this->comp_id, "%s.replay.write-mismatches", this->name);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.replay.write-mismatches', aborting\n", this->name);
+        return r;
+    }
+    r = hal_pin_bit_newf(HAL_OUT, &(board->hal.pin.done), this->comp_id, "%s.replay.done", this->name);
+    if (r < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s.replay.done', aborting\n", this->name);
+        return r;
+    }
+    *board->hal.pin.cycle = 0;
+    *board->hal.pin.write_mismatches = 0;
+    *board->hal.pin.done = false;
+
+    return 0;
+}
+
+
+static int init_board(const char *config_file, const char *trace_file) {
+
+    litexcnc_replay_t *board;
+
+    // Allocate the memory for the board. This has to be HAL memory, because the
+    // board contains pins
+    board = (litexcnc_replay_t *)hal_malloc(sizeof(litexcnc_replay_t));
+    if (board == NULL) {
+        LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+        return -ENOMEM;
+    }
+    memset(board, 0, sizeof(litexcnc_replay_t));
+
+    // Open the recording
+    if (litexcnc_trace_open(&board->trace, trace_file) < 0) {
+        return -1;
+    }
+    const litexcnc_trace_header_t *header = (const litexcnc_trace_header_t *) board->trace.memory;
+    LITEXCNC_PRINT_NO_DEVICE("Replaying '%s' (%llu records)\n", trace_file, (unsigned long long) header->records);
+
+    // Open the json-file for the configuration
+    uint32_t fingerprint;
+    cJSON *config = NULL;
+    if (litexcnc_load_config(config_file, &config, &fingerprint) < 0) {
+        goto fail_close;
+    }
+
+    // Connect the functions for reading and writing the data to the device. The data
+    // is copied from the recording, so the buffers have no header.
+    board->fpga.comp_id           = comp_id;
+    board->fpga.verify_config     = litexcnc_replay_verify_config;
+    board->fpga.reset             = litexcnc_replay_reset;
+    board->fpga.write_config      = litexcnc_replay_write_config;
+    board->fpga.read_memory       = litexcnc_replay_read_memory;
+    board->fpga.read              = litexcnc_replay_read;
+    board->fpga.read_header_size  = 0;
+    board->fpga.write             = litexcnc_replay_write;
+    board->fpga.read_slow         = litexcnc_replay_read_slow;
+    board->fpga.write_slow        = litexcnc_replay_write_slow;
+    board->fpga.write_header_size = 0;
+    board->fpga.post_register     = litexcnc_replay_post_register;
+    board->fpga.private           = board;
+
+    // Register the board with the main function
+    int ret = litexcnc_register(&board->fpga, config, fingerprint);
+    cJSON_Delete(config);
+    if (ret != 0) {
+        rtapi_print("board fails LitexCNC registration\n");
+        goto fail_close;
+    }
+
+    // Store the board
+    rtapi_list_add_tail(&board->list, &boards);
+    boards_count++;
+
+    return 0;
+
+fail_close:
+    litexcnc_trace_close(&board->trace);
+    return -1;
+}
+
+
+static void close_boards(void) {
+    struct rtapi_list_head *ptr, *next;
+    for (ptr = boards.next; ptr != &boards; ptr = next) {
+        next = ptr->next;
+        litexcnc_replay_t *board = rtapi_list_entry(ptr, litexcnc_replay_t, list);
+        litexcnc_unregister(&board->fpga);
+        litexcnc_trace_close(&board->trace);
+        rtapi_list_del(ptr);
+    }
+    boards_count = 0;
+}
+
+
+int rtapi_app_main(void) {
+    RTAPI_INIT_LIST_HEAD(&boards);
+
+    int ret, i;
+
+    LITEXCNC_PRINT_NO_DEVICE("loading litexCNC replay driver version " LITEXCNC_REPLAY_VERSION "\n");
+
+    // STEP 1: Initialize component
+    ret = hal_init(LITEXCNC_REPLAY_NAME);
+    if (ret < 0) {
+        goto error;
+    }
+    comp_id = ret;
+
+    // STEP 2: Initialize the board(s), each config-file requires a recording
+    for(i = 0; i<MAX_REPLAY_BOARDS && config_file[i] && *config_file[i]; i++) {
+        if (!trace_file[i] || !*trace_file[i]) {
+            LITEXCNC_ERR_NO_DEVICE("No recording given for config-file '%s'\n", config_file[i]);
+            ret = -EINVAL;
+            goto error;
+        }
+        ret = init_board(config_file[i], trace_file[i]);
+        if(ret < 0) goto error;
+    }
+    LITEXCNC_PRINT_NO_DEVICE("Registered %d board(s)\n", boards_count);
+
+    // All buffers have been created, from this point on no memory is allocated anymore
+    struct rtapi_list_head *ptr;
+    rtapi_list_for_each(ptr, &boards) {
+        litexcnc_replay_t *board = rtapi_list_entry(ptr, litexcnc_replay_t, list);
+        litexcnc_arena_seal(&board->fpga.arena);
+    }
+
+    // Report the board as ready
+    hal_ready(comp_id);
+    return 0;
+
+error:
+    close_boards();
+    hal_exit(comp_id);
+    return ret;
+}
+
+
+void rtapi_app_exit(void) {
+    close_boards();
+    hal_exit(comp_id);
+    LITEXCNC_PRINT_NO_DEVICE("LitexCNC replay driver unloaded \n");
+}
+
+
+// Include other c-files, because LinuxCNC Makefile cannot handle loose files
+#include "cJSON/cJSON.c"
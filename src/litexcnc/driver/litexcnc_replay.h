@@ -0,0 +1,58 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+#ifndef __INCLUDE_LITEXCNC_REPLAY_H__
+#define __INCLUDE_LITEXCNC_REPLAY_H__
+
+#define LITEXCNC_REPLAY_NAME    "litexcnc_replay"
+#define LITEXCNC_REPLAY_VERSION "0.01"
+#define MAX_REPLAY_BOARDS 16
+
+#include <rtapi_list.h>
+#include "trace.h"
+
+typedef struct {
+    // Boards are stored in a list, so there is no limit on the number of boards
+    struct rtapi_list_head list;
+
+    // Definition of the FPGA (containing pins, steppers, PWM, ec.)
+    litexcnc_fpga_t fpga;
+
+    struct {
+        struct {
+            hal_u32_t *cycle;            // Number of read cycles replayed
+            hal_u32_t *write_mismatches; // Number of writes which differ from the recording
+            hal_bit_t *done;             // All read cycles have been replayed
+        } pin;
+    } hal;
+
+    // The recording which is replayed
+    litexcnc_trace_t trace;
+
+    // Position in the trace for each type of record. Each type is replayed in the
+    // order it was recorded, independent of the other types.
+    struct {
+        size_t config;
+        size_t memory;
+        size_t read;
+        size_t write;
+        size_t read_slow;
+        size_t write_slow;
+    } cursor;
+} litexcnc_replay_t;
+
+#endif
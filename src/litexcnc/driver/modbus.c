@@ -0,0 +1,263 @@
+/********************************************************************
+* Description:  modbus.c
+*               A Litex-CNC component for Modbus RTU masters on the
+*               FPGA, which poll the registers of for example a VFD.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+
+#include <stdio.h>
+
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "modbus.h"
+
+
+int litexcnc_modbus_init(litexcnc_t *litexcnc, cJSON *config) {
+
+    // Declarations
+    int r = 0;
+    size_t i, j;
+    const cJSON *modbus_config = NULL;
+    const cJSON *modbus_instance_config = NULL;
+    const cJSON *modbus_instance_name = NULL;
+    const cJSON *modbus_registers = NULL;
+    const cJSON *modbus_register_config = NULL;
+    const cJSON *modbus_register_name = NULL;
+    const cJSON *modbus_register_function = NULL;
+    char base_name[HAL_NAME_LEN + 1];   // i.e. <board_name>.<board_index>.modbus.<modbus_name>
+    char name[HAL_NAME_LEN + 1];        // i.e. <base_name>.<register_name>.<pin_name>
+
+    // Parse the contents of the config-json
+    modbus_config = cJSON_GetObjectItemCaseSensitive(config, "modbus");
+    if (cJSON_IsArray(modbus_config)) {
+        // Store the amount of Modbus instances on this board
+        litexcnc->modbus.num_instances = cJSON_GetArraySize(modbus_config);
+
+        // Allocate the module-global HAL shared memory
+        litexcnc->modbus.instances = (litexcnc_modbus_instance_t *)hal_malloc(litexcnc->modbus.num_instances * sizeof(litexcnc_modbus_instance_t));
+        if (litexcnc->modbus.instances == NULL) {
+            LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+            r = -ENOMEM;
+            return r;
+        }
+
+        // Create the pins in the HAL
+        i = 0;
+        cJSON_ArrayForEach(modbus_instance_config, modbus_config) {
+            // Get pointer to the Modbus instance
+            litexcnc_modbus_instance_t *instance = &(litexcnc->modbus.instances[i]);
+
+            // Create the basename
+            modbus_instance_name = cJSON_GetObjectItemCaseSensitive(modbus_instance_config, "name");
+            if (cJSON_IsString(modbus_instance_name) && (modbus_instance_name->valuestring != NULL)) {
+                rtapi_snprintf(base_name, sizeof(base_name), "%s.modbus.%s", litexcnc->fpga->name, modbus_instance_name->valuestring);
+            } else {
+                rtapi_snprintf(base_name, sizeof(base_name), "%s.modbus.%02zu", litexcnc->fpga->name, i);
+            }
+
+            // The registers polled by this Modbus
+            modbus_registers = cJSON_GetObjectItemCaseSensitive(modbus_instance_config, "registers");
+            instance->num_registers = cJSON_GetArraySize(modbus_registers);
+            if (!cJSON_IsArray(modbus_registers) || (instance->num_registers < 1) || (instance->num_registers > LITEXCNC_MODBUS_MAX_REGISTERS)) {
+                LITEXCNC_ERR_NO_DEVICE("Invalid registers for Modbus %zu\n", i);
+                return -EINVAL;
+            }
+            instance->registers = (litexcnc_modbus_register_t *)hal_malloc(instance->num_registers * sizeof(litexcnc_modbus_register_t));
+            if (instance->registers == NULL) {
+                LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+                r = -ENOMEM;
+                return r;
+            }
+
+            // Create the pins of the Modbus
+            // - enable
+            rtapi_snprintf(name, sizeof(name), "%s.enable", base_name);
+            r = hal_pin_bit_new(name, HAL_IN, &(instance->hal.pin.enable), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - errors
+            rtapi_snprintf(name, sizeof(name), "%s.errors", base_name);
+            r = hal_pin_u32_new(name, HAL_OUT, &(instance->hal.pin.errors), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+
+            // Create the pins of the registers
+            j = 0;
+            cJSON_ArrayForEach(modbus_register_config, modbus_registers) {
+                litexcnc_modbus_register_t *reg = &(instance->registers[j]);
+                modbus_register_name = cJSON_GetObjectItemCaseSensitive(modbus_register_config, "name");
+                modbus_register_function = cJSON_GetObjectItemCaseSensitive(modbus_register_config, "function");
+                if (!cJSON_IsString(modbus_register_name) || (modbus_register_name->valuestring == NULL) || !cJSON_IsNumber(modbus_register_function)) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid register %zu for Modbus %zu\n", j, i);
+                    return -EINVAL;
+                }
+                if ((modbus_register_function->valueint != LITEXCNC_MODBUS_READ_HOLDING_REGISTER) &&
+                    (modbus_register_function->valueint != LITEXCNC_MODBUS_READ_INPUT_REGISTER) &&
+                    (modbus_register_function->valueint != LITEXCNC_MODBUS_WRITE_SINGLE_REGISTER)) {
+                    LITEXCNC_ERR_NO_DEVICE("Unsupported function %d of register %zu for Modbus %zu\n", modbus_register_function->valueint, j, i);
+                    return -EINVAL;
+                }
+                reg->data.write = (modbus_register_function->valueint == LITEXCNC_MODBUS_WRITE_SINGLE_REGISTER);
+                reg->data.is_signed = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(modbus_register_config, "signed"));
+                if (reg->data.write) {
+                    litexcnc->modbus.num_writes++;
+                } else {
+                    litexcnc->modbus.num_reads++;
+                }
+                // - value
+                rtapi_snprintf(name, sizeof(name), "%s.%s.value", base_name, modbus_register_name->valuestring);
+                r = hal_pin_float_new(name, reg->data.write ? HAL_IN : HAL_OUT, &(reg->hal.pin.value), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                // - scale
+                rtapi_snprintf(name, sizeof(name), "%s.%s.scale", base_name, modbus_register_name->valuestring);
+                r = hal_pin_float_new(name, HAL_IN, &(reg->hal.pin.scale), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                *(reg->hal.pin.scale) = 1.0;
+                // - valid
+                rtapi_snprintf(name, sizeof(name), "%s.%s.valid", base_name, modbus_register_name->valuestring);
+                r = hal_pin_bit_new(name, HAL_OUT, &(reg->hal.pin.valid), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+
+                j++;
+            }
+
+            // Increase counter to proceed to the next Modbus instance
+            i++;
+        }
+    }
+
+    return 0;
+
+fail_pins:
+    LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s', aborting\n", name);
+    return r;
+}
+
+
+static double litexcnc_modbus_scale(const litexcnc_modbus_register_t *reg) {
+    // A scale of zero is interpreted as 1.0, just like the position scale of the encoder
+    double scale = *(reg->hal.pin.scale);
+    if ((scale > -1e-20) && (scale < 1e-20)) {
+        return 1.0;
+    }
+    return scale;
+}
+
+
+uint8_t litexcnc_modbus_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period) {
+
+    if (!litexcnc->modbus.num_instances) {
+        return 0;
+    }
+
+    // The enable flags of all Modbus instances (shared register, the first instance in
+    // the least significant bit)
+    size_t enable_size = LITEXCNC_BOARD_MODBUS_ENABLE_WRITE_SIZE(litexcnc);
+    memset(*data, 0, enable_size);
+    for (size_t i=0; i<litexcnc->modbus.num_instances; i++) {
+        if (*(litexcnc->modbus.instances[i].hal.pin.enable)) {
+            (*data)[enable_size - 1 - (i >> 3)] |= 1 << (i & 0x07);
+        }
+    }
+    *data += enable_size;
+
+    // The values of the registers which are written, converted to counts of the register
+    for (size_t i=0; i<litexcnc->modbus.num_instances; i++) {
+        litexcnc_modbus_instance_t *instance = &(litexcnc->modbus.instances[i]);
+        for (size_t j=0; j<instance->num_registers; j++) {
+            litexcnc_modbus_register_t *reg = &(instance->registers[j]);
+            if (!reg->data.write) {
+                continue;
+            }
+            double value = floor(*(reg->hal.pin.value) / litexcnc_modbus_scale(reg) + 0.5);
+            double minimum = reg->data.is_signed ? INT16_MIN : 0;
+            double maximum = reg->data.is_signed ? INT16_MAX : UINT16_MAX;
+            if ((value < minimum) || (value > maximum)) {
+                value = (value < minimum) ? minimum : maximum;
+                if (!reg->memo.error_range_printed) {
+                    LITEXCNC_ERR("Modbus %zu: value of register %zu out of range, value has been clipped\n", litexcnc->fpga->name, i, j);
+                    reg->memo.error_range_printed = true;
+                }
+            }
+            uint32_t register_data = htobe32((uint32_t)(uint16_t)(int32_t) value);
+            memcpy(*data, &register_data, sizeof(register_data));
+            *data += sizeof(register_data);
+        }
+    }
+
+    return 0;
+}
+
+
+uint8_t litexcnc_modbus_process_read(litexcnc_t *litexcnc, uint8_t** data, long period) {
+
+    for (size_t i=0; i<litexcnc->modbus.num_instances; i++) {
+        litexcnc_modbus_instance_t *instance = &(litexcnc->modbus.instances[i]);
+
+        // Status: the valid flags and the number of failed exchanges
+        uint32_t status;
+        memcpy(&status, *data, sizeof(status));
+        *data += sizeof(status);
+        status = be32toh(status);
+        uint16_t errors = status >> 16;
+        if (!litexcnc->modbus.data.reseed) {
+            *(instance->hal.pin.errors) += (uint16_t)(errors - instance->memo.errors);
+        }
+        instance->memo.errors = errors;
+
+        // The registers, of which only the values of the registers which are read are
+        // received. The value is only updated after a successful exchange.
+        for (size_t j=0; j<instance->num_registers; j++) {
+            litexcnc_modbus_register_t *reg = &(instance->registers[j]);
+            *(reg->hal.pin.valid) = (status >> j) & 1;
+            if (reg->data.write) {
+                continue;
+            }
+            uint32_t register_data;
+            memcpy(&register_data, *data, sizeof(register_data));
+            *data += sizeof(register_data);
+            uint16_t value = be32toh(register_data) & 0xFFFF;
+            if (*(reg->hal.pin.valid)) {
+                *(reg->hal.pin.value) = (reg->data.is_signed ? (double)(int16_t) value : (double) value) * litexcnc_modbus_scale(reg);
+            }
+        }
+    }
+    litexcnc->modbus.data.reseed = false;
+
+    return 0;
+}
+
+
+void litexcnc_modbus_reseed(litexcnc_t *litexcnc) {
+    // The number of errors is continued from its last value in the next read
+    litexcnc->modbus.data.reseed = true;
+}
@@ -0,0 +1,133 @@
+/********************************************************************
+* Description:  modbus.h
+*               A Litex-CNC component for Modbus RTU masters on the
+*               FPGA, which poll the registers of for example a VFD.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+
+#ifndef __INCLUDE_LITEXCNC_MODBUS_H__
+#define __INCLUDE_LITEXCNC_MODBUS_H__
+
+#include "cJSON/cJSON.h"
+
+// These values MUST coincide with the firmware (see `modbus.py`)
+// - the supported function codes
+#define LITEXCNC_MODBUS_READ_HOLDING_REGISTER 3
+#define LITEXCNC_MODBUS_READ_INPUT_REGISTER   4
+#define LITEXCNC_MODBUS_WRITE_SINGLE_REGISTER 6
+// - the maximum number of registers polled by a single Modbus
+#define LITEXCNC_MODBUS_MAX_REGISTERS 16
+
+// Defines the structure of a single register polled by the Modbus
+typedef struct {
+    struct {
+
+        struct {
+            hal_float_t *value;  /* The value written to (function 6) or read from the register, in scaled units */
+            hal_float_t *scale;  /* The value of a single count of the register, in scaled units */
+            hal_bit_t   *valid;  /* True when the last exchange of the register was successful */
+        } pin;
+
+    } hal;
+
+    // This struct holds all old values (memoization)
+    struct {
+        bool error_range_printed;
+    } memo;
+
+    // This struct contains the data from the configuration
+    struct {
+        bool write;      /* True when the register is written (function 6), otherwise it is read */
+        bool is_signed;  /* True when the register contains a signed 16-bit value */
+    } data;
+
+} litexcnc_modbus_register_t;
+
+
+// Defines the structure of the Modbus instance
+typedef struct {
+    struct {
+
+        struct {
+            hal_bit_t *enable;  /* When true, the registers are polled by the FPGA */
+            hal_u32_t *errors;  /* The number of failed exchanges */
+        } pin;
+
+    } hal;
+
+    // This struct holds all old values (memoization)
+    struct {
+        uint16_t errors;  /* The number of failed exchanges as counted by the FPGA */
+    } memo;
+
+    int num_registers;
+    litexcnc_modbus_register_t *registers;
+
+} litexcnc_modbus_instance_t;
+
+
+// Defines the Modbus, contains a collection of Modbus instances
+typedef struct {
+    int num_instances;
+    int num_writes;  /* The number of registers written, over all instances */
+    int num_reads;   /* The number of registers read, over all instances */
+    litexcnc_modbus_instance_t *instances;
+
+    struct {
+        // When true, the FPGA has been restarted (i.e. the board has been power-cycled)
+        // and the number of errors is taken as is in the next read
+        bool reseed;
+    } data;
+
+} litexcnc_modbus_t;
+
+
+// Defines the data-package for sending the settings for the Modbus. The order of this
+// package MUST coincide with the order in the MMIO definition.
+// - write: the enable flags, followed by the value for each register which is written
+//   (lower 16 bits)
+#define LITEXCNC_BOARD_MODBUS_ENABLE_WRITE_SIZE(litexcnc) (((litexcnc->modbus.num_instances)>>5) + ((litexcnc->modbus.num_instances & 0x1F)?1:0)) *4
+#define LITEXCNC_BOARD_MODBUS_DATA_WRITE_SIZE(litexcnc) (litexcnc->modbus.num_instances?(LITEXCNC_BOARD_MODBUS_ENABLE_WRITE_SIZE(litexcnc) + litexcnc->modbus.num_writes * sizeof(uint32_t)):0)
+// - read: for each instance the status (the valid flags in the lower 16 bits and the
+//   number of errors in the upper 16 bits), followed by the value for each register
+//   which is read (lower 16 bits)
+#define LITEXCNC_BOARD_MODBUS_DATA_READ_SIZE(litexcnc) ((litexcnc->modbus.num_instances + litexcnc->modbus.num_reads) * sizeof(uint32_t))
+
+
+// Functions for creating, reading and writing Modbus pins
+int litexcnc_modbus_init(litexcnc_t *litexcnc, cJSON *config);
+uint8_t litexcnc_modbus_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period);
+uint8_t litexcnc_modbus_process_read(litexcnc_t *litexcnc, uint8_t** data, long period);
+// Continues the number of errors from its last value after the board has been power-cycled
+void litexcnc_modbus_reseed(litexcnc_t *litexcnc);
+
+#endif
@@ -0,0 +1,330 @@
+/********************************************************************
+* Description:  pid.c
+*               A Litex-CNC component for PID-loops running on the
+*               FPGA, with an encoder as feedback and a PWM generator
+*               or stepgen as output.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#include <stdio.h>
+
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "pid.h"
+
+
+int litexcnc_pid_init(litexcnc_t *litexcnc, cJSON *config) {
+
+    // Declarations
+    int r = 0;
+    size_t i;
+    const cJSON *pid_config = NULL;
+    const cJSON *pid_instance_config = NULL;
+    const cJSON *pid_instance_name = NULL;
+    const cJSON *pid_encoder = NULL;
+    const cJSON *pid_output = NULL;
+    const cJSON *pid_output_module = NULL;
+    const cJSON *pid_output_index = NULL;
+    char base_name[HAL_NAME_LEN + 1];   // i.e. <board_name>.<board_index>.pid.<pid_name>
+    char name[HAL_NAME_LEN + 1];        // i.e. <base_name>.<pin_name>
+
+    // The loops are calculated each 2^n clock-cycles, the same as in the firmware
+    int8_t shift = 0;
+    while (litexcnc->clock_frequency / (1 << shift) > LITEXCNC_PID_MAX_RATE)
+        shift += 1;
+    litexcnc->pid.data.rate = (double) litexcnc->clock_frequency / (1 << shift);
+
+    // Parse the contents of the config-json
+    pid_config = cJSON_GetObjectItemCaseSensitive(config, "pid");
+    if (cJSON_IsArray(pid_config)) {
+        // Store the amount of PID instances on this board
+        litexcnc->pid.num_instances = cJSON_GetArraySize(pid_config);
+
+        // Allocate the module-global HAL shared memory
+        litexcnc->pid.instances = (litexcnc_pid_instance_t *)hal_malloc(litexcnc->pid.num_instances * sizeof(litexcnc_pid_instance_t));
+        if (litexcnc->pid.instances == NULL) {
+            LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+            r = -ENOMEM;
+            return r;
+        }
+
+        // Create the pins in the HAL
+        i = 0;
+        cJSON_ArrayForEach(pid_instance_config, pid_config) {
+            // Get pointer to the PID instance
+            litexcnc_pid_instance_t *instance = &(litexcnc->pid.instances[i]);
+
+            // The feedback and the output of the loop
+            pid_encoder = cJSON_GetObjectItemCaseSensitive(pid_instance_config, "encoder");
+            if (!cJSON_IsNumber(pid_encoder) || (pid_encoder->valueint < 0) || (pid_encoder->valueint >= litexcnc->encoder.num_instances)) {
+                LITEXCNC_ERR_NO_DEVICE("Invalid encoder for PID-loop %zu\n", i);
+                return -EINVAL;
+            }
+            instance->data.encoder = pid_encoder->valueint;
+            pid_output = cJSON_GetObjectItemCaseSensitive(pid_instance_config, "output");
+            pid_output_module = cJSON_GetObjectItemCaseSensitive(pid_output, "module");
+            pid_output_index = cJSON_GetObjectItemCaseSensitive(pid_output, "index");
+            if (!cJSON_IsString(pid_output_module) || !cJSON_IsNumber(pid_output_index) || (pid_output_index->valueint < 0)) {
+                LITEXCNC_ERR_NO_DEVICE("Invalid output for PID-loop %zu\n", i);
+                return -EINVAL;
+            }
+            if (strcmp(pid_output_module->valuestring, "stepgen") == 0) {
+                instance->data.output_stepgen = true;
+                if (pid_output_index->valueint >= litexcnc->stepgen.num_instances) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid output for PID-loop %zu\n", i);
+                    return -EINVAL;
+                }
+            } else if (strcmp(pid_output_module->valuestring, "pwm") == 0) {
+                instance->data.output_stepgen = false;
+                if (pid_output_index->valueint >= litexcnc->pwm.num_instances) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid output for PID-loop %zu\n", i);
+                    return -EINVAL;
+                }
+            } else {
+                LITEXCNC_ERR_NO_DEVICE("Invalid output for PID-loop %zu\n", i);
+                return -EINVAL;
+            }
+            instance->data.output_index = pid_output_index->valueint;
+
+            // Create the basename
+            pid_instance_name = cJSON_GetObjectItemCaseSensitive(pid_instance_config, "name");
+            if (cJSON_IsString(pid_instance_name) && (pid_instance_name->valuestring != NULL)) {
+                rtapi_snprintf(base_name, sizeof(base_name), "%s.pid.%s", litexcnc->fpga->name, pid_instance_name->valuestring);
+            } else {
+                rtapi_snprintf(base_name, sizeof(base_name), "%s.pid.%02zu", litexcnc->fpga->name, i);
+            }
+
+            // Create the pins, the names are equal to the `pid` component of LinuxCNC
+            // - enable
+            rtapi_snprintf(name, sizeof(name), "%s.enable", base_name);
+            r = hal_pin_bit_new(name, HAL_IN, &(instance->hal.pin.enable), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - command
+            rtapi_snprintf(name, sizeof(name), "%s.command", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.command), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - command-deriv
+            rtapi_snprintf(name, sizeof(name), "%s.command-deriv", base_name);
+            r = hal_pin_float_new(name, HAL_OUT, &(instance->hal.pin.command_deriv), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - feedback
+            rtapi_snprintf(name, sizeof(name), "%s.feedback", base_name);
+            r = hal_pin_float_new(name, HAL_OUT, &(instance->hal.pin.feedback), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - error
+            rtapi_snprintf(name, sizeof(name), "%s.error", base_name);
+            r = hal_pin_float_new(name, HAL_OUT, &(instance->hal.pin.error), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - output
+            rtapi_snprintf(name, sizeof(name), "%s.output", base_name);
+            r = hal_pin_float_new(name, HAL_OUT, &(instance->hal.pin.output), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - saturated
+            rtapi_snprintf(name, sizeof(name), "%s.saturated", base_name);
+            r = hal_pin_bit_new(name, HAL_OUT, &(instance->hal.pin.saturated), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - gains
+            rtapi_snprintf(name, sizeof(name), "%s.Pgain", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.pgain), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.Igain", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.igain), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.Dgain", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.dgain), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - bias and feedforward
+            rtapi_snprintf(name, sizeof(name), "%s.bias", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.bias), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.FF0", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.ff0), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.FF1", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.ff1), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.FF2", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.ff2), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            // - limits
+            rtapi_snprintf(name, sizeof(name), "%s.deadband", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.deadband), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.maxerror", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.maxerror), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.maxerrorI", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.maxerror_i), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+            rtapi_snprintf(name, sizeof(name), "%s.maxoutput", base_name);
+            r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.maxoutput), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+
+            // Increase counter to proceed to the next PID instance
+            i++;
+        }
+    }
+
+    return 0;
+
+fail_pins:
+    LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s', aborting\n", name);
+    return r;
+}
+
+
+static uint32_t litexcnc_pid_to_fpga(double value, bool *clipped) {
+    // Converts the value to a signed 32-bit value for the FPGA, rounded to the nearest
+    // integer. Values outside the range are clipped.
+    value = floor(value + 0.5);
+    if (value > INT32_MAX) {
+        *clipped = true;
+        return (uint32_t) INT32_MAX;
+    }
+    if (value < INT32_MIN) {
+        *clipped = true;
+        return (uint32_t) INT32_MIN;
+    }
+    return (uint32_t)(int32_t) value;
+}
+
+
+uint8_t litexcnc_pid_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period) {
+
+    if (!litexcnc->pid.num_instances) {
+        return 0;
+    }
+
+    // The enable flags of all PID-loops (shared register, the first loop in the least
+    // significant bit)
+    size_t enable_size = LITEXCNC_BOARD_PID_ENABLE_WRITE_SIZE(litexcnc);
+    uint8_t *enable_data = *data;
+    memset(enable_data, 0, enable_size);
+    for (size_t i=0; i<litexcnc->pid.num_instances; i++) {
+        if (*(litexcnc->pid.instances[i].hal.pin.enable)) {
+            enable_data[enable_size - 1 - (i >> 3)] |= 1 << (i & 0x07);
+        }
+    }
+    *data += enable_size;
+
+    double period_recip = 1e9 / period;
+    for (size_t i=0; i<litexcnc->pid.num_instances; i++) {
+        litexcnc_pid_instance_t *instance = &(litexcnc->pid.instances[i]);
+        litexcnc_encoder_instance_t *encoder = &(litexcnc->encoder.instances[instance->data.encoder]);
+        litexcnc_pid_instance_write_data_t instance_data;
+        bool clipped = false;
+
+        // The scales of the input (counts of the encoder, in the mode of the encoder) and the
+        // output (a duty cycle of 100% or the velocity of the stepgen in units per second).
+        // Just like the encoder, a position scale of zero is interpreted as 1.0.
+        double position_scale = encoder->hal.param.position_scale;
+        if ((position_scale > -1e-20) && (position_scale < 1e-20)) {
+            position_scale = 1.0;
+        }
+        instance->data.counts_scale = position_scale;
+        if (instance->data.output_stepgen) {
+            instance->data.output_scale = litexcnc->stepgen.instances[instance->data.output_index].data.fpga_speed_scale / (1 << LITEXCNC_PID_STEPGEN_OUTPUT_SHIFT);
+        } else {
+            instance->data.output_scale = 1 << LITEXCNC_PID_PWM_OUTPUT_FRACTION;
+        }
+        // The scale of the stepgen is not known until its position scale has been set, the
+        // loop is disabled (all gains zero) until then
+        if (instance->data.output_scale == 0.0) {
+            enable_data[enable_size - 1 - (i >> 3)] &= ~(1 << (i & 0x07));
+            memset(*data, 0, sizeof(litexcnc_pid_instance_write_data_t));
+            *data += sizeof(litexcnc_pid_instance_write_data_t);
+            continue;
+        }
+        double gain_scale = instance->data.output_scale / instance->data.counts_scale * (1 << LITEXCNC_PID_GAIN_FRACTION);
+
+        // The feedforward only depends on the command and is therefore calculated here
+        double command_deriv = (*(instance->hal.pin.command) - instance->memo.command) * period_recip;
+        double command_deriv2 = (command_deriv - instance->memo.command_deriv) * period_recip;
+        instance->memo.command = *(instance->hal.pin.command);
+        instance->memo.command_deriv = command_deriv;
+        *(instance->hal.pin.command_deriv) = command_deriv;
+        double feedforward = *(instance->hal.pin.bias)
+            + *(instance->hal.pin.ff0) * *(instance->hal.pin.command)
+            + *(instance->hal.pin.ff1) * command_deriv
+            + *(instance->hal.pin.ff2) * command_deriv2;
+
+        // The setpoint in counts of the FPGA. After the board has been power-cycled, the
+        // counts of the encoder continue from the last value, which is corrected here.
+        int64_t setpoint = (int64_t) floor(*(instance->hal.pin.command) * instance->data.counts_scale + 0.5) - encoder->data.counts_offset;
+        instance_data.setpoint = htobe32((uint32_t) setpoint);
+
+        // Convert the gains and limits. The integral is the sum of the error in each loop
+        // and the derivative the difference between two loops.
+        instance_data.feedforward = htobe32(litexcnc_pid_to_fpga(feedforward * instance->data.output_scale, &clipped));
+        instance_data.pgain = htobe32(litexcnc_pid_to_fpga(*(instance->hal.pin.pgain) * gain_scale, &clipped));
+        instance_data.igain = htobe32(litexcnc_pid_to_fpga(*(instance->hal.pin.igain) * gain_scale / litexcnc->pid.data.rate, &clipped));
+        instance_data.dgain = htobe32(litexcnc_pid_to_fpga(*(instance->hal.pin.dgain) * gain_scale * litexcnc->pid.data.rate, &clipped));
+        instance_data.deadband = htobe32(litexcnc_pid_to_fpga(fabs(*(instance->hal.pin.deadband) * instance->data.counts_scale), &clipped));
+        instance_data.max_error = htobe32(litexcnc_pid_to_fpga(fabs(*(instance->hal.pin.maxerror) * instance->data.counts_scale), &clipped));
+        instance_data.max_error_i = htobe32(litexcnc_pid_to_fpga(fabs(*(instance->hal.pin.maxerror_i) * instance->data.counts_scale * litexcnc->pid.data.rate), &clipped));
+        instance->data.fpga_max_output = litexcnc_pid_to_fpga(fabs(*(instance->hal.pin.maxoutput) * instance->data.output_scale), &clipped);
+        instance_data.max_output = htobe32(instance->data.fpga_max_output);
+        if (clipped && !instance->memo.error_gain_printed) {
+            LITEXCNC_ERR("PID-loop %zu: gain or limit out of range, value has been clipped\n", litexcnc->fpga->name, i);
+            instance->memo.error_gain_printed = true;
+        }
+
+        memcpy(*data, &instance_data, sizeof(litexcnc_pid_instance_write_data_t));
+        *data += sizeof(litexcnc_pid_instance_write_data_t);
+    }
+
+    return 0;
+}
+
+
+uint8_t litexcnc_pid_process_read(litexcnc_t *litexcnc, uint8_t** data, long period) {
+
+    for (size_t i=0; i<litexcnc->pid.num_instances; i++) {
+        litexcnc_pid_instance_t *instance = &(litexcnc->pid.instances[i]);
+        litexcnc_pid_instance_read_data_t instance_data;
+        memcpy(&instance_data, *data, sizeof(litexcnc_pid_instance_read_data_t));
+        *data += sizeof(litexcnc_pid_instance_read_data_t);
+
+        int32_t output = (int32_t) be32toh((uint32_t) instance_data.output);
+        *(instance->hal.pin.feedback) = *(litexcnc->encoder.instances[instance->data.encoder].hal.pin.position);
+        // The scales are not known until the first write
+        if ((instance->data.counts_scale == 0.0) || (instance->data.output_scale == 0.0)) {
+            continue;
+        }
+        *(instance->hal.pin.error) = (int32_t) be32toh((uint32_t) instance_data.error) / instance->data.counts_scale;
+        *(instance->hal.pin.output) = output / instance->data.output_scale;
+        *(instance->hal.pin.saturated) = (instance->data.fpga_max_output != 0) && ((output >= instance->data.fpga_max_output) || (output <= -instance->data.fpga_max_output));
+    }
+
+    return 0;
+}
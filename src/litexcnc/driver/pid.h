@@ -0,0 +1,146 @@
+/********************************************************************
+* Description:  pid.h
+*               A Litex-CNC component for PID-loops running on the
+*               FPGA, with an encoder as feedback and a PWM generator
+*               or stepgen as output.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+
+#ifndef __INCLUDE_LITEXCNC_PID_H__
+#define __INCLUDE_LITEXCNC_PID_H__
+
+#include "cJSON/cJSON.h"
+
+// These values MUST coincide with the constants of `PIDModule` in the firmware
+// - number of fractional bits of the gains
+#define LITEXCNC_PID_GAIN_FRACTION 16
+// - number of fractional bits of the output to a PWM generator (a duty cycle of 100%)
+#define LITEXCNC_PID_PWM_OUTPUT_FRACTION 16
+// - shift of the output to a stepgen with respect to the speed of the stepgen
+#define LITEXCNC_PID_STEPGEN_OUTPUT_SHIFT 8
+// - the maximum rate of the loops, the loops are run each 2^n clock-cycles
+#define LITEXCNC_PID_MAX_RATE 50e3
+
+// Defines the structure of the PID instance
+typedef struct {
+    struct {
+
+        struct {
+            hal_bit_t   *enable;         /* When true, the output of the loop drives its output module */
+            hal_float_t *command;        /* The commanded position, in length units of the encoder */
+            hal_float_t *command_deriv;  /* The derivative of the command (calculated, used for the feedforward) */
+            hal_float_t *feedback;       /* The position of the encoder, in length units of the encoder */
+            hal_float_t *error;          /* The error of the loop as calculated by the FPGA */
+            hal_float_t *output;         /* The output of the loop as calculated by the FPGA */
+            hal_bit_t   *saturated;      /* True when the output is at its maximum */
+            hal_float_t *pgain;          /* Proportional gain */
+            hal_float_t *igain;          /* Integral gain */
+            hal_float_t *dgain;          /* Derivative gain */
+            hal_float_t *bias;           /* Constant offset of the output */
+            hal_float_t *ff0;            /* Zeroth order feedforward, output proportional to the command */
+            hal_float_t *ff1;            /* First order feedforward, output proportional to the derivative of the command */
+            hal_float_t *ff2;            /* Second order feedforward, output proportional to the second derivative of the command */
+            hal_float_t *deadband;       /* The amount of error that will be ignored */
+            hal_float_t *maxerror;       /* Limit on the error (0 is no limit) */
+            hal_float_t *maxerror_i;     /* Limit on the integrated error (0 is no limit) */
+            hal_float_t *maxoutput;      /* Limit on the output (0 is no limit) */
+        } pin;
+
+    } hal;
+
+    // This struct holds all old values (memoization)
+    struct {
+        double command;
+        double command_deriv;
+        bool error_gain_printed;
+    } memo;
+
+    // This struct contains data, both calculated and direct received from the FPGA
+    struct {
+        int encoder;           /* The index of the encoder used as feedback */
+        bool output_stepgen;   /* True when the output drives a stepgen, otherwise a PWM generator */
+        int output_index;      /* The index of the PWM generator or stepgen */
+        double counts_scale;   /* Counts of the encoder per length unit */
+        double output_scale;   /* Output of the FPGA per unit of output */
+        int32_t fpga_max_output;
+    } data;
+
+} litexcnc_pid_instance_t;
+
+
+// Defines the PID, contains a collection of PID instances
+typedef struct {
+    int num_instances;
+    litexcnc_pid_instance_t *instances;
+
+    // The rate of the loops on the FPGA
+    struct {
+        double rate;
+    } data;
+
+} litexcnc_pid_t;
+
+
+// Defines the data-package for sending the settings for a single PID-loop. The
+// order of this package MUST coincide with the order in the MMIO definition.
+// - write
+#define LITEXCNC_BOARD_PID_ENABLE_WRITE_SIZE(litexcnc) (((litexcnc->pid.num_instances)>>5) + ((litexcnc->pid.num_instances & 0x1F)?1:0)) *4
+#pragma pack(push,4)
+typedef struct {
+    int32_t setpoint;
+    int32_t feedforward;
+    int32_t pgain;
+    int32_t igain;
+    int32_t dgain;
+    uint32_t deadband;
+    uint32_t max_error;
+    uint32_t max_error_i;
+    uint32_t max_output;
+} litexcnc_pid_instance_write_data_t;
+#pragma pack(pop)
+#define LITEXCNC_BOARD_PID_DATA_WRITE_SIZE(litexcnc) (litexcnc->pid.num_instances?(LITEXCNC_BOARD_PID_ENABLE_WRITE_SIZE(litexcnc) + litexcnc->pid.num_instances * sizeof(litexcnc_pid_instance_write_data_t)):0)
+// - read
+#pragma pack(push,4)
+typedef struct {
+    int32_t error;
+    int32_t output;
+} litexcnc_pid_instance_read_data_t;
+#pragma pack(pop)
+#define LITEXCNC_BOARD_PID_DATA_READ_SIZE(litexcnc) (litexcnc->pid.num_instances * sizeof(litexcnc_pid_instance_read_data_t))
+
+
+// Functions for creating, reading and writing PID pins
+int litexcnc_pid_init(litexcnc_t *litexcnc, cJSON *config);
+uint8_t litexcnc_pid_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period);
+uint8_t litexcnc_pid_process_read(litexcnc_t *litexcnc, uint8_t** data, long period);
+
+#endif
@@ -0,0 +1,210 @@
+/********************************************************************
+* Description:  recovery.c
+*               Detects a lost connection or a power-cycled board and
+*               brings the board back into use without reloading.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "recovery.h"
+
+
+int litexcnc_recovery_init(litexcnc_t *litexcnc) {
+
+    // Declarations
+    int r = 0;
+    char name[HAL_NAME_LEN + 1];
+
+    // Allocate memory
+    litexcnc->recovery = (litexcnc_recovery_t *)hal_malloc(sizeof(litexcnc_recovery_t));
+    if (!litexcnc->recovery) {
+        LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+        return -ENOMEM;
+    }
+    memset(litexcnc->recovery, 0, sizeof(litexcnc_recovery_t));
+
+    // Create pins
+    // - connected
+    rtapi_snprintf(name, sizeof(name), "%s.connection.connected", litexcnc->fpga->name);
+    r = hal_pin_bit_new(name, HAL_OUT, &(litexcnc->recovery->hal.pin.connected), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - state
+    rtapi_snprintf(name, sizeof(name), "%s.connection.state", litexcnc->fpga->name);
+    r = hal_pin_s32_new(name, HAL_OUT, &(litexcnc->recovery->hal.pin.state), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - reconnects
+    rtapi_snprintf(name, sizeof(name), "%s.connection.reconnects", litexcnc->fpga->name);
+    r = hal_pin_u32_new(name, HAL_OUT, &(litexcnc->recovery->hal.pin.reconnects), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+    // - read-errors
+    rtapi_snprintf(name, sizeof(name), "%s.connection.read-errors", litexcnc->fpga->name);
+    r = hal_pin_u32_new(name, HAL_OUT, &(litexcnc->recovery->hal.pin.read_errors), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_pins; }
+
+    // Create params
+    // - lost-cycles (including setting the default value)
+    rtapi_snprintf(name, sizeof(name), "%s.connection.lost-cycles", litexcnc->fpga->name);
+    r = hal_param_u32_new(name, HAL_RW, &(litexcnc->recovery->hal.param.lost_cycles), litexcnc->fpga->comp_id);
+    if (r < 0) { goto fail_params; }
+    litexcnc->recovery->hal.param.lost_cycles = LITEXCNC_RECOVERY_DEFAULT_LOST_CYCLES;
+
+    // The board has been verified when it is registered
+    *(litexcnc->recovery->hal.pin.connected) = true;
+    *(litexcnc->recovery->hal.pin.state) = LITEXCNC_CONNECTION_CONNECTED;
+
+    return 0;
+
+fail_pins:
+    LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s', aborting\n", name);
+    return r;
+
+fail_params:
+    LITEXCNC_ERR_NO_DEVICE("Error adding param '%s', aborting\n", name);
+    return r;
+}
+
+
+static void litexcnc_recovery_set_state(litexcnc_t *litexcnc, hal_s32_t state) {
+    *(litexcnc->recovery->hal.pin.state) = state;
+    *(litexcnc->recovery->hal.pin.connected) = (state == LITEXCNC_CONNECTION_CONNECTED);
+}
+
+
+static bool litexcnc_recovery_restarted(litexcnc_t *litexcnc, uint64_t wallclock_ticks, long long now) {
+    /*
+     * Determines whether the board has been power-cycled since the last successful read.
+     * The wall-clock of the board only runs backwards when the board has restarted. When
+     * the connection has been lost for a longer time, the wall-clock of the restarted
+     * board can have passed its last value again. The wall-clock of a board which kept
+     * running advances as much as the clock of the computer, a board which has been
+     * power-cycled misses the time it was off and booting.
+     */
+    litexcnc_recovery_t *recovery = litexcnc->recovery;
+
+    if (wallclock_ticks < recovery->memo.wallclock_ticks) {
+        return true;
+    }
+    if (!recovery->memo.read_time || (*(recovery->hal.pin.state) == LITEXCNC_CONNECTION_CONNECTED)) {
+        return false;
+    }
+    double elapsed = (now - recovery->memo.read_time) * 1e-9;
+    double advanced = (wallclock_ticks - recovery->memo.wallclock_ticks) * litexcnc->clock_frequency_recip;
+    return advanced < elapsed * (1.0 - LITEXCNC_RECOVERY_CLOCK_TOLERANCE);
+}
+
+
+bool litexcnc_recovery_process_read(litexcnc_t *litexcnc, bool success) {
+    litexcnc_recovery_t *recovery = litexcnc->recovery;
+    litexcnc_fpga_t *fpga = litexcnc->fpga;
+
+    // A single failed read is bridged, the modules keep the state of the previous cycle.
+    // When the board does not respond for several cycles, the connection is lost.
+    if (!success) {
+        (*(recovery->hal.pin.read_errors))++;
+        recovery->failed_reads++;
+        if ((*(recovery->hal.pin.state) == LITEXCNC_CONNECTION_CONNECTED) && (recovery->failed_reads >= recovery->hal.param.lost_cycles)) {
+            LITEXCNC_ERR("Connection lost, no response for %u cycles\n", fpga->name, recovery->failed_reads);
+            litexcnc_recovery_set_state(litexcnc, LITEXCNC_CONNECTION_LOST);
+        }
+        return false;
+    }
+    recovery->failed_reads = 0;
+
+    // Check whether the board has restarted, using the wall-clock which is always part
+    // of the fast rate group. The fast path is a single comparison.
+    uint64_t wallclock_ticks;
+    memcpy(&wallclock_ticks, litexcnc->read_data[LITEXCNC_MODULE_WALLCLOCK], sizeof wallclock_ticks);
+    wallclock_ticks = be64toh(wallclock_ticks);
+    long long now = rtapi_get_time();
+    // A restart is remembered until the board has been reset
+    if (litexcnc_recovery_restarted(litexcnc, wallclock_ticks, now)) {
+        recovery->memo.restarted = true;
+    }
+    recovery->memo.wallclock_ticks = wallclock_ticks;
+    recovery->memo.read_time = now;
+    if (!recovery->memo.restarted && (*(recovery->hal.pin.state) == LITEXCNC_CONNECTION_CONNECTED)) {
+        return true;
+    }
+
+    // The board responds again, or it has restarted. Check it is still the same board with
+    // the same firmware before it is used.
+    if (fpga->verify_config(fpga) < 0) {
+        if (*(recovery->hal.pin.state) == LITEXCNC_CONNECTION_CONNECTED) {
+            LITEXCNC_ERR("Connection lost, the board cannot be verified\n", fpga->name);
+        }
+        litexcnc_recovery_set_state(litexcnc, LITEXCNC_CONNECTION_LOST);
+        return false;
+    }
+    if (fpga->fingerprint != litexcnc->config_fingerprint) {
+        if (*(recovery->hal.pin.state) != LITEXCNC_CONNECTION_FAULT) {
+            LITEXCNC_ERR(
+                "Board responds with fingerprint %08X instead of %08X, the board is not used\n", 
+                fpga->name, 
+                fpga->fingerprint,
+                litexcnc->config_fingerprint);
+        }
+        fpga->fingerprint = litexcnc->config_fingerprint;
+        litexcnc_recovery_set_state(litexcnc, LITEXCNC_CONNECTION_FAULT);
+        return false;
+    }
+
+    // The board kept running, the data can be used directly. The timing of the stepgens
+    // is restarted, as the wall-clock has advanced many periods.
+    if (!recovery->memo.restarted) {
+        LITEXCNC_PRINT("Connection restored\n", fpga->name);
+        litexcnc->stepgen.memo.apply_time = 0;
+        litexcnc_recovery_set_state(litexcnc, LITEXCNC_CONNECTION_CONNECTED);
+        return true;
+    }
+
+    // The board has been power-cycled, it has lost its configuration. It is reset now
+    // and configured in the write of this cycle, just like at start-up. The data read
+    // in this cycle comes from an unconfigured board and is not used.
+    LITEXCNC_ERR("Board has restarted, configuring it again\n", fpga->name);
+    if (fpga->reset(fpga) < 0) {
+        litexcnc_recovery_set_state(litexcnc, LITEXCNC_CONNECTION_LOST);
+        return false;
+    }
+    litexcnc_stepgen_reseed(litexcnc);
+    litexcnc_encoder_reseed(litexcnc);
+    litexcnc_modbus_reseed(litexcnc);
+    litexcnc->write_loop_has_run = false;
+    // The wall-clock can have been restarted by the reset as well
+    recovery->memo.restarted = false;
+    recovery->memo.wallclock_ticks = 0;
+    recovery->memo.read_time = 0;
+    (*(recovery->hal.pin.reconnects))++;
+    litexcnc_recovery_set_state(litexcnc, LITEXCNC_CONNECTION_CONNECTED);
+    return false;
+}
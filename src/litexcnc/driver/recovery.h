@@ -0,0 +1,79 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+#ifndef __INCLUDE_LITEXCNC_RECOVERY_H__
+#define __INCLUDE_LITEXCNC_RECOVERY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A board which has been power-cycled, or of which the connection has been lost, is
+// recovered without reloading the component:
+//  - the connection is lost when the given number of consecutive reads fail (the param
+//    `<BoardName>.connection.lost-cycles`);
+//  - the board has been power-cycled when its wall-clock runs backwards.
+// When the board responds again, the magic and the fingerprint are verified. A board
+// which kept running is used again directly. A board which has been power-cycled is
+// reset and configured again in the same cycle, just like at start-up. The position of
+// the stepgens and the counts of the encoders continue from their last value, so the
+// feedback does not jump. A board with a different fingerprint is not used.
+#define LITEXCNC_RECOVERY_DEFAULT_LOST_CYCLES 3
+// Fraction of the time the connection has been lost which the wall-clock of the board may
+// lag behind the clock of the computer before the board is considered power-cycled
+#define LITEXCNC_RECOVERY_CLOCK_TOLERANCE 0.01
+
+// States of the connection, as shown on the pin `<BoardName>.connection.state`
+#define LITEXCNC_CONNECTION_CONNECTED 0
+#define LITEXCNC_CONNECTION_LOST      1
+#define LITEXCNC_CONNECTION_FAULT     2  // A board with a different fingerprint responds
+
+typedef struct {
+    struct {
+
+        struct {
+            hal_bit_t *connected;   /* The board responds and is configured */
+            hal_s32_t *state;       /* State of the connection (LITEXCNC_CONNECTION_*) */
+            hal_u32_t *reconnects;  /* Number of times the board has been recovered */
+            hal_u32_t *read_errors; /* Number of failed reads */
+        } pin;
+
+        struct {
+            hal_u32_t lost_cycles;  /* Number of consecutive failed reads after which the connection is lost */
+        } param;
+
+    } hal;
+
+    // Number of consecutive failed reads
+    uint32_t failed_reads;
+
+    // This struct holds the values of the last successful read (memoization)
+    struct {
+        uint64_t wallclock_ticks;  /* Wall-clock of the board */
+        long long read_time;       /* Time of the computer (ns) */
+        bool restarted;            /* The board has restarted and has not been reset yet */
+    } memo;
+
+} litexcnc_recovery_t;
+
+// Creates the pins for the status of the connection
+int litexcnc_recovery_init(litexcnc_t *litexcnc);
+// Updates the state of the connection after the read of the fast rate group. When the
+// board has been power-cycled, it is reset and it is configured again in the write of
+// the same cycle. Returns true when the read data can be processed.
+bool litexcnc_recovery_process_read(litexcnc_t *litexcnc, bool success);
+
+#endif
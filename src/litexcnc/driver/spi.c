@@ -0,0 +1,256 @@
+/********************************************************************
+* Description:  spi.c
+*               A Litex-CNC component for SPI masters on the FPGA,
+*               which run a list of transactions at a fixed rate.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+
+#include <stdio.h>
+
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "spi.h"
+
+
+int litexcnc_spi_init(litexcnc_t *litexcnc, cJSON *config) {
+
+    // Declarations
+    int r = 0;
+    size_t i, j;
+    const cJSON *spi_config = NULL;
+    const cJSON *spi_instance_config = NULL;
+    const cJSON *spi_instance_name = NULL;
+    const cJSON *spi_transactions = NULL;
+    const cJSON *spi_transaction_config = NULL;
+    const cJSON *spi_transaction_name = NULL;
+    const cJSON *spi_transaction_channel = NULL;
+    const cJSON *spi_transaction_bits = NULL;
+    char base_name[HAL_NAME_LEN + 1];   // i.e. <board_name>.<board_index>.spi.<spi_name>
+    char name[HAL_NAME_LEN + 1];        // i.e. <base_name>.<transaction_name>.<pin_name>
+
+    // Parse the contents of the config-json
+    spi_config = cJSON_GetObjectItemCaseSensitive(config, "spi");
+    if (cJSON_IsArray(spi_config)) {
+        // Store the amount of SPI instances on this board
+        litexcnc->spi.num_instances = cJSON_GetArraySize(spi_config);
+
+        // Allocate the module-global HAL shared memory
+        litexcnc->spi.instances = (litexcnc_spi_instance_t *)hal_malloc(litexcnc->spi.num_instances * sizeof(litexcnc_spi_instance_t));
+        if (litexcnc->spi.instances == NULL) {
+            LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+            r = -ENOMEM;
+            return r;
+        }
+
+        // Create the pins in the HAL
+        i = 0;
+        cJSON_ArrayForEach(spi_instance_config, spi_config) {
+            // Get pointer to the SPI instance
+            litexcnc_spi_instance_t *instance = &(litexcnc->spi.instances[i]);
+
+            // Create the basename
+            spi_instance_name = cJSON_GetObjectItemCaseSensitive(spi_instance_config, "name");
+            if (cJSON_IsString(spi_instance_name) && (spi_instance_name->valuestring != NULL)) {
+                rtapi_snprintf(base_name, sizeof(base_name), "%s.spi.%s", litexcnc->fpga->name, spi_instance_name->valuestring);
+            } else {
+                rtapi_snprintf(base_name, sizeof(base_name), "%s.spi.%02zu", litexcnc->fpga->name, i);
+            }
+
+            // Create the pins of the SPI
+            // - enable
+            rtapi_snprintf(name, sizeof(name), "%s.enable", base_name);
+            r = hal_pin_bit_new(name, HAL_IN, &(instance->hal.pin.enable), litexcnc->fpga->comp_id);
+            if (r != 0) { goto fail_pins; }
+
+            // The transactions run by this SPI, of which only the transactions with a
+            // channel are exchanged with LinuxCNC
+            spi_transactions = cJSON_GetObjectItemCaseSensitive(spi_instance_config, "transactions");
+            if (!cJSON_IsArray(spi_transactions) || (cJSON_GetArraySize(spi_transactions) < 1) || (cJSON_GetArraySize(spi_transactions) > LITEXCNC_SPI_MAX_TRANSACTIONS)) {
+                LITEXCNC_ERR_NO_DEVICE("Invalid transactions for SPI %zu\n", i);
+                return -EINVAL;
+            }
+            cJSON_ArrayForEach(spi_transaction_config, spi_transactions) {
+                if (cJSON_IsString(cJSON_GetObjectItemCaseSensitive(spi_transaction_config, "channel"))) {
+                    instance->num_channels++;
+                }
+            }
+            if (instance->num_channels == 0) {
+                i++;
+                continue;
+            }
+            instance->channels = (litexcnc_spi_channel_t *)hal_malloc(instance->num_channels * sizeof(litexcnc_spi_channel_t));
+            if (instance->channels == NULL) {
+                LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+                r = -ENOMEM;
+                return r;
+            }
+
+            // Create the pins of the channels
+            j = 0;
+            cJSON_ArrayForEach(spi_transaction_config, spi_transactions) {
+                spi_transaction_channel = cJSON_GetObjectItemCaseSensitive(spi_transaction_config, "channel");
+                if (!cJSON_IsString(spi_transaction_channel)) {
+                    continue;
+                }
+                litexcnc_spi_channel_t *channel = &(instance->channels[j]);
+                spi_transaction_name = cJSON_GetObjectItemCaseSensitive(spi_transaction_config, "name");
+                if (!cJSON_IsString(spi_transaction_name) || (spi_transaction_name->valuestring == NULL)) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid name of channel %zu for SPI %zu\n", j, i);
+                    return -EINVAL;
+                }
+                if ((spi_transaction_channel->valuestring == NULL) || ((strcmp(spi_transaction_channel->valuestring, "in") != 0) && (strcmp(spi_transaction_channel->valuestring, "out") != 0))) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid direction of channel %zu for SPI %zu, possible values are: in, out\n", j, i);
+                    return -EINVAL;
+                }
+                channel->data.write = (strcmp(spi_transaction_channel->valuestring, "out") == 0);
+                channel->data.is_signed = cJSON_IsTrue(cJSON_GetObjectItemCaseSensitive(spi_transaction_config, "signed"));
+                channel->data.bits = 16;
+                spi_transaction_bits = cJSON_GetObjectItemCaseSensitive(spi_transaction_config, "bits");
+                if (cJSON_IsNumber(spi_transaction_bits)) {
+                    channel->data.bits = spi_transaction_bits->valueint;
+                }
+                if ((channel->data.bits < 1) || (channel->data.bits > LITEXCNC_SPI_MAX_BITS)) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid number of bits of channel %zu for SPI %zu\n", j, i);
+                    return -EINVAL;
+                }
+                if (channel->data.write) {
+                    litexcnc->spi.num_writes++;
+                } else {
+                    litexcnc->spi.num_reads++;
+                }
+                // - value
+                rtapi_snprintf(name, sizeof(name), "%s.%s.value", base_name, spi_transaction_name->valuestring);
+                r = hal_pin_float_new(name, channel->data.write ? HAL_IN : HAL_OUT, &(channel->hal.pin.value), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                // - scale
+                rtapi_snprintf(name, sizeof(name), "%s.%s.scale", base_name, spi_transaction_name->valuestring);
+                r = hal_pin_float_new(name, HAL_IN, &(channel->hal.pin.scale), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                *(channel->hal.pin.scale) = 1.0;
+                // - offset
+                rtapi_snprintf(name, sizeof(name), "%s.%s.offset", base_name, spi_transaction_name->valuestring);
+                r = hal_pin_float_new(name, HAL_IN, &(channel->hal.pin.offset), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+
+                j++;
+            }
+
+            // Increase counter to proceed to the next SPI instance
+            i++;
+        }
+    }
+
+    return 0;
+
+fail_pins:
+    LITEXCNC_ERR_NO_DEVICE("Error adding pin '%s', aborting\n", name);
+    return r;
+}
+
+
+static double litexcnc_spi_scale(const litexcnc_spi_channel_t *channel) {
+    // A scale of zero is interpreted as 1.0, just like the scale of the Modbus
+    double scale = *(channel->hal.pin.scale);
+    if ((scale > -1e-20) && (scale < 1e-20)) {
+        return 1.0;
+    }
+    return scale;
+}
+
+
+uint8_t litexcnc_spi_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period) {
+
+    if (!litexcnc->spi.num_instances) {
+        return 0;
+    }
+
+    // The enable flags of all SPI instances (shared register, the first instance in the
+    // least significant bit)
+    size_t enable_size = LITEXCNC_BOARD_SPI_ENABLE_WRITE_SIZE(litexcnc);
+    memset(*data, 0, enable_size);
+    for (size_t i=0; i<litexcnc->spi.num_instances; i++) {
+        if (*(litexcnc->spi.instances[i].hal.pin.enable)) {
+            (*data)[enable_size - 1 - (i >> 3)] |= 1 << (i & 0x07);
+        }
+    }
+    *data += enable_size;
+
+    // The values of the channels which are sent, converted to counts of the channel
+    for (size_t i=0; i<litexcnc->spi.num_instances; i++) {
+        litexcnc_spi_instance_t *instance = &(litexcnc->spi.instances[i]);
+        for (size_t j=0; j<instance->num_channels; j++) {
+            litexcnc_spi_channel_t *channel = &(instance->channels[j]);
+            if (!channel->data.write) {
+                continue;
+            }
+            double value = floor((*(channel->hal.pin.value) - *(channel->hal.pin.offset)) / litexcnc_spi_scale(channel) + 0.5);
+            double minimum = channel->data.is_signed ? -ldexp(1.0, channel->data.bits - 1) : 0;
+            double maximum = (channel->data.is_signed ? ldexp(1.0, channel->data.bits - 1) : ldexp(1.0, channel->data.bits)) - 1;
+            if ((value < minimum) || (value > maximum)) {
+                value = (value < minimum) ? minimum : maximum;
+                if (!channel->memo.error_range_printed) {
+                    LITEXCNC_ERR("SPI %zu: value of channel %zu out of range, value has been clipped\n", litexcnc->fpga->name, i, j);
+                    channel->memo.error_range_printed = true;
+                }
+            }
+            // Only the lower bits are used by the FPGA, so a negative value can be sent as is
+            uint32_t channel_data = htobe32((uint32_t)(int64_t) value);
+            memcpy(*data, &channel_data, sizeof(channel_data));
+            *data += sizeof(channel_data);
+        }
+    }
+
+    return 0;
+}
+
+
+uint8_t litexcnc_spi_process_read(litexcnc_t *litexcnc, uint8_t** data, long period) {
+
+    for (size_t i=0; i<litexcnc->spi.num_instances; i++) {
+        litexcnc_spi_instance_t *instance = &(litexcnc->spi.instances[i]);
+        for (size_t j=0; j<instance->num_channels; j++) {
+            litexcnc_spi_channel_t *channel = &(instance->channels[j]);
+            if (channel->data.write) {
+                continue;
+            }
+            uint32_t channel_data;
+            memcpy(&channel_data, *data, sizeof(channel_data));
+            *data += sizeof(channel_data);
+            channel_data = be32toh(channel_data);
+            *(channel->hal.pin.value) = (channel->data.is_signed ? (double)(int32_t) channel_data : (double) channel_data) * litexcnc_spi_scale(channel) + *(channel->hal.pin.offset);
+        }
+    }
+
+    return 0;
+}
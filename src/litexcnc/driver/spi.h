@@ -0,0 +1,115 @@
+/********************************************************************
+* Description:  spi.h
+*               A Litex-CNC component for SPI masters on the FPGA,
+*               which run a list of transactions at a fixed rate.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+
+#ifndef __INCLUDE_LITEXCNC_SPI_H__
+#define __INCLUDE_LITEXCNC_SPI_H__
+
+#include "cJSON/cJSON.h"
+
+// These values MUST coincide with the firmware (see `spi.py`)
+// - the maximum number of transactions of a single SPI
+#define LITEXCNC_SPI_MAX_TRANSACTIONS 16
+// - the maximum number of bits of a channel
+#define LITEXCNC_SPI_MAX_BITS 32
+
+// Defines the structure of a single channel, i.e. a transaction of which a part of the
+// word is sent by or received for LinuxCNC
+typedef struct {
+    struct {
+
+        struct {
+            hal_float_t *value;   /* The value sent (channel 'out') or received (channel 'in'), in scaled units */
+            hal_float_t *scale;   /* The value of a single count of the channel, in scaled units */
+            hal_float_t *offset;  /* The value of the channel when the count is zero, in scaled units */
+        } pin;
+
+    } hal;
+
+    // This struct holds all old values (memoization)
+    struct {
+        bool error_range_printed;
+    } memo;
+
+    // This struct contains the data from the configuration
+    struct {
+        bool write;      /* True when the value is sent (channel 'out'), otherwise it is received */
+        bool is_signed;  /* True when the channel contains a signed value */
+        int bits;        /* The number of bits of the channel */
+    } data;
+
+} litexcnc_spi_channel_t;
+
+
+// Defines the structure of the SPI instance
+typedef struct {
+    struct {
+
+        struct {
+            hal_bit_t *enable;  /* When true, the transactions are run by the FPGA */
+        } pin;
+
+    } hal;
+
+    int num_channels;
+    litexcnc_spi_channel_t *channels;
+
+} litexcnc_spi_instance_t;
+
+
+// Defines the SPI, contains a collection of SPI instances
+typedef struct {
+    int num_instances;
+    int num_writes;  /* The number of channels sent, over all instances */
+    int num_reads;   /* The number of channels received, over all instances */
+    litexcnc_spi_instance_t *instances;
+} litexcnc_spi_t;
+
+
+// Defines the data-package for sending the settings for the SPI. The order of this
+// package MUST coincide with the order in the MMIO definition.
+// - write: the enable flags, followed by the value for each channel which is sent
+#define LITEXCNC_BOARD_SPI_ENABLE_WRITE_SIZE(litexcnc) (((litexcnc->spi.num_instances)>>5) + ((litexcnc->spi.num_instances & 0x1F)?1:0)) *4
+#define LITEXCNC_BOARD_SPI_DATA_WRITE_SIZE(litexcnc) (litexcnc->spi.num_instances?(LITEXCNC_BOARD_SPI_ENABLE_WRITE_SIZE(litexcnc) + litexcnc->spi.num_writes * sizeof(uint32_t)):0)
+// - read: the value for each channel which is received (sign extended by the FPGA)
+#define LITEXCNC_BOARD_SPI_DATA_READ_SIZE(litexcnc) (litexcnc->spi.num_reads * sizeof(uint32_t))
+
+
+// Functions for creating, reading and writing SPI pins
+int litexcnc_spi_init(litexcnc_t *litexcnc, cJSON *config);
+uint8_t litexcnc_spi_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period);
+uint8_t litexcnc_spi_process_read(litexcnc_t *litexcnc, uint8_t** data, long period);
+
+#endif
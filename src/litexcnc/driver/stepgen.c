@@ -41,6 +41,129 @@
 
 #include "stepgen.h"
 
+
+static int litexcnc_stepgen_load_compensation(litexcnc_stepgen_compensation_t *compensation, const char *file_name, double *backlash) {
+    /*
+     * Reads the compensation file. Each line contains the nominal position, the position
+     * when moving in positive direction and the position when moving in negative direction,
+     * just like the compensation files of LinuxCNC. Lines which cannot be parsed (comments)
+     * are skipped. The nominal positions must be increasing. The compensation is the mean
+     * of both directions, the mean difference between both directions is returned as the
+     * backlash.
+     */
+    FILE *file;
+    char line[256];
+    double nominal, forward, reverse;
+    double backlash_sum = 0.0;
+    size_t count = 0;
+    size_t i = 0;
+
+    file = fopen(file_name, "r");
+    if (file == NULL) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot open compensation file '%s'\n", file_name);
+        return -ENOENT;
+    }
+    // First pass: count the points, so the memory can be allocated at once
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "%lf %lf %lf", &nominal, &forward, &reverse) == 3) {
+            count++;
+        }
+    }
+    if (count < 2) {
+        LITEXCNC_ERR_NO_DEVICE("Compensation file '%s' should contain at least 2 points\n", file_name);
+        fclose(file);
+        return -EINVAL;
+    }
+    compensation->data.nominal = (double *)hal_malloc(count * sizeof(double));
+    compensation->data.compensation = (double *)hal_malloc(count * sizeof(double));
+    if ((compensation->data.nominal == NULL) || (compensation->data.compensation == NULL)) {
+        LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+        fclose(file);
+        return -ENOMEM;
+    }
+    // Second pass: store the points
+    rewind(file);
+    while ((fgets(line, sizeof(line), file) != NULL) && (i < count)) {
+        if (sscanf(line, "%lf %lf %lf", &nominal, &forward, &reverse) != 3) {
+            continue;
+        }
+        if ((i > 0) && (nominal <= compensation->data.nominal[i - 1])) {
+            LITEXCNC_ERR_NO_DEVICE("The nominal positions in compensation file '%s' should be increasing\n", file_name);
+            fclose(file);
+            return -EINVAL;
+        }
+        compensation->data.nominal[i] = nominal;
+        compensation->data.compensation[i] = 0.5 * (forward + reverse) - nominal;
+        backlash_sum += forward - reverse;
+        i++;
+    }
+    fclose(file);
+    compensation->data.num_points = count;
+    *backlash = backlash_sum / count;
+    return 0;
+}
+
+
+static void litexcnc_stepgen_calculate_compensation(litexcnc_stepgen_compensation_t *compensation, double position_scale) {
+    /*
+     * Resamples the points of the compensation file to the table on the FPGA, which has
+     * equally spaced entries (2^shift steps) covering the range of the file. Outside the
+     * range the compensation of the first or last point is used. The table is sent again to
+     * the FPGA.
+     */
+    size_t num_points = compensation->data.num_points;
+    size_t j = 0;
+
+    compensation->data.next_entry = 0;
+    compensation->data.entries_sent = 0;
+    if (num_points < 2) {
+        memset(compensation->data.table, 0, compensation->data.entries * sizeof(int32_t));
+        compensation->data.start = 0;
+        compensation->data.shift = 0;
+        return;
+    }
+
+    // The points in steps in increasing order, with a negative scale the order of the
+    // points is reversed
+    #define POINT(m) ((position_scale > 0) ? (m) : (num_points - 1 - (m)))
+    #define POSITION(m) (compensation->data.nominal[POINT(m)] * position_scale)
+    #define COMPENSATION(m) (compensation->data.compensation[POINT(m)] * position_scale)
+    double low = POSITION(0);
+    double high = POSITION(num_points - 1);
+    uint8_t shift = 0;
+    while ((shift < 31) && ((high - low) / (1LL << shift) > compensation->data.entries - 1)) {
+        shift++;
+    }
+    compensation->data.shift = shift;
+    compensation->data.start = (int64_t) floor(low);
+
+    for (size_t k=0; k<compensation->data.entries; k++) {
+        double position = compensation->data.start + (double) k * (1LL << shift);
+        double value;
+        while ((j < num_points - 2) && (POSITION(j + 1) < position)) {
+            j++;
+        }
+        if (position <= POSITION(0)) {
+            value = COMPENSATION(0);
+        } else if (position >= POSITION(num_points - 1)) {
+            value = COMPENSATION(num_points - 1);
+        } else {
+            value = COMPENSATION(j) + (position - POSITION(j)) / (POSITION(j + 1) - POSITION(j)) * (COMPENSATION(j + 1) - COMPENSATION(j));
+        }
+        value = floor(value * (1 << LITEXCNC_STEPGEN_COMPENSATION_FRACTION) + 0.5);
+        if (value > INT32_MAX) {
+            value = INT32_MAX;
+        } else if (value < INT32_MIN) {
+            value = INT32_MIN;
+        }
+        compensation->data.table[k] = (int32_t) value;
+    }
+    #undef POINT
+    #undef POSITION
+    #undef COMPENSATION
+}
+
+
 int litexcnc_stepgen_init(litexcnc_t *litexcnc, cJSON *config) {
 
     // Declarations
@@ -49,6 +172,15 @@ int litexcnc_stepgen_init(litexcnc_t *litexcnc, cJSON *config) {
     const cJSON *stepgen_config = NULL;
     const cJSON *stepgen_instance_config = NULL;
     const cJSON *stepgen_instance_name = NULL;
+    const cJSON *stepgen_instance_gearing = NULL;
+    const cJSON *gearing_encoder = NULL;
+    const cJSON *stepgen_instance_slaves = NULL;
+    const cJSON *slave_config = NULL;
+    const cJSON *slave_name = NULL;
+    const cJSON *stepgen_instance_compensation = NULL;
+    const cJSON *compensation_entries = NULL;
+    const cJSON *compensation_file = NULL;
+    int num_encoders = cJSON_GetArraySize(cJSON_GetObjectItemCaseSensitive(config, "encoders"));
     char base_name[HAL_NAME_LEN + 1];   // i.e. <board_name>.<board_index>.stepgen.<stepgen_name>
     char name[HAL_NAME_LEN + 1];        // i.e. <base_name>.<pin_name>
 
@@ -179,6 +311,133 @@ int litexcnc_stepgen_init(litexcnc_t *litexcnc, cJSON *config) {
             rtapi_snprintf(name, sizeof(name), "%s.acceleration-cmd", base_name);
             r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.acceleration_cmd), litexcnc->fpga->comp_id);
             if (r != 0) { goto fail_pins; }
+
+            // Electronic gearing (optional), the stepgen is slaved to an encoder on the FPGA
+            instance->data.gearing_encoder = -1;
+            stepgen_instance_gearing = cJSON_GetObjectItemCaseSensitive(stepgen_instance_config, "gearing");
+            if (cJSON_IsObject(stepgen_instance_gearing)) {
+                gearing_encoder = cJSON_GetObjectItemCaseSensitive(stepgen_instance_gearing, "encoder");
+                if (!cJSON_IsNumber(gearing_encoder) || (gearing_encoder->valueint < 0) || (gearing_encoder->valueint >= num_encoders)) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid encoder for the gearing of stepgen %zu\n", i);
+                    return -EINVAL;
+                }
+                instance->data.gearing_encoder = gearing_encoder->valueint;
+                litexcnc->stepgen.num_geared++;
+                // - gearing enable
+                rtapi_snprintf(name, sizeof(name), "%s.gearing.enable", base_name);
+                r = hal_pin_bit_new(name, HAL_IN, &(instance->hal.pin.gearing_enable), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                // - gearing ratio
+                rtapi_snprintf(name, sizeof(name), "%s.gearing.ratio", base_name);
+                r = hal_pin_float_new(name, HAL_IN, &(instance->hal.pin.gearing_ratio), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                // - gearing velocity
+                rtapi_snprintf(name, sizeof(name), "%s.gearing.velocity", base_name);
+                r = hal_pin_float_new(name, HAL_OUT, &(instance->hal.pin.gearing_velocity), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+            }
+
+            // Slaves (optional), additional step outputs driven by the speed of this stepgen
+            instance->num_slaves = 0;
+            instance->slaves = NULL;
+            stepgen_instance_slaves = cJSON_GetObjectItemCaseSensitive(stepgen_instance_config, "slaves");
+            if (cJSON_IsArray(stepgen_instance_slaves) && cJSON_GetArraySize(stepgen_instance_slaves)) {
+                instance->num_slaves = cJSON_GetArraySize(stepgen_instance_slaves);
+                litexcnc->stepgen.num_slaves += instance->num_slaves;
+                instance->slaves = (litexcnc_stepgen_slave_t *)hal_malloc(instance->num_slaves * sizeof(litexcnc_stepgen_slave_t));
+                if (instance->slaves == NULL) {
+                    LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+                    r = -ENOMEM;
+                    return r;
+                }
+                size_t j = 0;
+                cJSON_ArrayForEach(slave_config, stepgen_instance_slaves) {
+                    litexcnc_stepgen_slave_t *slave = &(instance->slaves[j]);
+                    char slave_base_name[HAL_NAME_LEN + 1];
+                    // Create the basename, the slaves are numbered after their master (which is the
+                    // first motor of the gang)
+                    slave_name = cJSON_GetObjectItemCaseSensitive(slave_config, "name");
+                    if (cJSON_IsString(slave_name) && (slave_name->valuestring != NULL)) {
+                        rtapi_snprintf(slave_base_name, sizeof(slave_base_name), "%s.stepgen.%s", litexcnc->fpga->name, slave_name->valuestring);
+                    } else {
+                        rtapi_snprintf(slave_base_name, sizeof(slave_base_name), "%s-%zu", base_name, j + 1);
+                    }
+                    // - latch
+                    rtapi_snprintf(name, sizeof(name), "%s.latch", slave_base_name);
+                    r = hal_pin_bit_new(name, HAL_IN, &(slave->hal.pin.latch), litexcnc->fpga->comp_id);
+                    if (r != 0) { goto fail_pins; }
+                    // - counts
+                    rtapi_snprintf(name, sizeof(name), "%s.counts", slave_base_name);
+                    r = hal_pin_u32_new(name, HAL_OUT, &(slave->hal.pin.counts), litexcnc->fpga->comp_id);
+                    if (r != 0) { goto fail_pins; }
+                    // - position_fb
+                    rtapi_snprintf(name, sizeof(name), "%s.position-feedback", slave_base_name);
+                    r = hal_pin_float_new(name, HAL_OUT, &(slave->hal.pin.position_fb), litexcnc->fpga->comp_id);
+                    if (r != 0) { goto fail_pins; }
+                    // - position_prediction
+                    rtapi_snprintf(name, sizeof(name), "%s.position_prediction", slave_base_name);
+                    r = hal_pin_float_new(name, HAL_OUT, &(slave->hal.pin.position_prediction), litexcnc->fpga->comp_id);
+                    if (r != 0) { goto fail_pins; }
+                    // - offset
+                    rtapi_snprintf(name, sizeof(name), "%s.offset", slave_base_name);
+                    r = hal_pin_float_new(name, HAL_OUT, &(slave->hal.pin.offset), litexcnc->fpga->comp_id);
+                    if (r != 0) { goto fail_pins; }
+                    j++;
+                }
+            }
+
+            // Compensation (optional), of the pitch error of the screw and backlash
+            instance->compensation = NULL;
+            stepgen_instance_compensation = cJSON_GetObjectItemCaseSensitive(stepgen_instance_config, "compensation");
+            if (cJSON_IsObject(stepgen_instance_compensation)) {
+                litexcnc_stepgen_compensation_t *compensation = (litexcnc_stepgen_compensation_t *)hal_malloc(sizeof(litexcnc_stepgen_compensation_t));
+                double backlash = 0.0;
+                if (compensation == NULL) {
+                    LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+                    r = -ENOMEM;
+                    return r;
+                }
+                // - the table, the default size is equal to the firmware
+                compensation_entries = cJSON_GetObjectItemCaseSensitive(stepgen_instance_compensation, "entries");
+                compensation->data.entries = cJSON_IsNumber(compensation_entries) ? compensation_entries->valueint : 256;
+                if ((compensation->data.entries < 2) || (compensation->data.entries > 4096)) {
+                    LITEXCNC_ERR_NO_DEVICE("Invalid number of entries for the compensation of stepgen %zu\n", i);
+                    return -EINVAL;
+                }
+                compensation->data.table = (int32_t *)hal_malloc(compensation->data.entries * sizeof(int32_t));
+                if (compensation->data.table == NULL) {
+                    LITEXCNC_ERR_NO_DEVICE("Out of memory!\n");
+                    r = -ENOMEM;
+                    return r;
+                }
+                // - the compensation file (optional)
+                compensation_file = cJSON_GetObjectItemCaseSensitive(stepgen_instance_compensation, "file");
+                if (cJSON_IsString(compensation_file) && (compensation_file->valuestring != NULL)) {
+                    r = litexcnc_stepgen_load_compensation(compensation, compensation_file->valuestring, &backlash);
+                    if (r != 0) {
+                        return r;
+                    }
+                }
+                // - enable
+                rtapi_snprintf(name, sizeof(name), "%s.compensation.enable", base_name);
+                r = hal_pin_bit_new(name, HAL_IN, &(compensation->hal.pin.enable), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                // - backlash
+                rtapi_snprintf(name, sizeof(name), "%s.compensation.backlash", base_name);
+                r = hal_pin_float_new(name, HAL_IN, &(compensation->hal.pin.backlash), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                *(compensation->hal.pin.backlash) = backlash;
+                // - offset
+                rtapi_snprintf(name, sizeof(name), "%s.compensation.offset", base_name);
+                r = hal_pin_float_new(name, HAL_IN, &(compensation->hal.pin.offset), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                // - loaded
+                rtapi_snprintf(name, sizeof(name), "%s.compensation.loaded", base_name);
+                r = hal_pin_bit_new(name, HAL_OUT, &(compensation->hal.pin.loaded), litexcnc->fpga->comp_id);
+                if (r != 0) { goto fail_pins; }
+                instance->compensation = compensation;
+                litexcnc->stepgen.num_compensated++;
+            }
             
             // Increase counter to proceed to the next pwm instance
             i++;
@@ -200,11 +459,14 @@ fail_params:
 uint8_t litexcnc_stepgen_config(litexcnc_t *litexcnc, uint8_t **data, long period) {
     
     // Initialize the averaging of the FPGA wall-clock. This is the first loop, so
-    // the array is filled with 'ideal' data based on the period.
+    // the array is filled with 'ideal' data based on the period. The board is configured
+    // again after it has been power-cycled, so the running average is restarted.
     *(litexcnc->stepgen.hal->pin.period_s) = 1e-9 * period;
     *(litexcnc->stepgen.hal->pin.period_s_recip) = 1.0f / *(litexcnc->stepgen.hal->pin.period_s);
     litexcnc->stepgen.memo.cycles_per_period = *(litexcnc->stepgen.hal->pin.period_s) * litexcnc->clock_frequency;
     // Initialize the running average
+    litexcnc->stepgen.data.wallclock_buffer_sum = 0.0;
+    litexcnc->stepgen.data.wallclock_buffer_pos = 0;
     for (size_t i=0; i<STEPGEN_WALLCLOCK_BUFFER; i++){
         litexcnc->stepgen.data.wallclock_buffer[i] = (double) *(litexcnc->stepgen.hal->pin.period_s);
         litexcnc->stepgen.data.wallclock_buffer_sum += *(litexcnc->stepgen.hal->pin.period_s);
@@ -284,9 +546,11 @@ uint8_t litexcnc_stepgen_config(litexcnc_t *litexcnc, uint8_t **data, long perio
 uint8_t litexcnc_stepgen_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period) {
 
     // Declarations
-    static litexcnc_stepgen_general_write_data_t data_general;
-    static litexcnc_stepgen_pin_t *instance;
-    static litexcnc_stepgen_instance_write_data_t instance_data;
+    litexcnc_stepgen_general_write_data_t data_general;
+    litexcnc_stepgen_pin_t *instance;
+    litexcnc_stepgen_instance_write_data_t instance_data;
+    uint32_t apply_time_compact;
+    uint8_t *data_start = *data;
 
     // Check whether there are stepgen instances. If no instances, no need to write any
     // data (NOTE: when this guard is not in place, the apply_time would be written out
@@ -297,10 +561,17 @@ uint8_t litexcnc_stepgen_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
 
     // STEP 1: Timing
     // ==============
-    // Put the data on the data-stream and advance the pointer
-    data_general.apply_time = htobe64(litexcnc->stepgen.memo.apply_time);
-    memcpy(*data, &data_general, LITEXCNC_STEPGEN_GENERAL_WRITE_DATA_SIZE);
-    *data += LITEXCNC_STEPGEN_GENERAL_WRITE_DATA_SIZE;
+    // Put the data on the data-stream and advance the pointer. The compact image only
+    // contains the lower 32 bits of the apply time, the FPGA compares it modulo 2^32.
+    if (litexcnc->compact_image) {
+        apply_time_compact = htobe32((uint32_t) litexcnc->stepgen.memo.apply_time);
+        memcpy(*data, &apply_time_compact, LITEXCNC_STEPGEN_COMPACT_APPLY_TIME_SIZE);
+        *data += LITEXCNC_STEPGEN_COMPACT_APPLY_TIME_SIZE;
+    } else {
+        data_general.apply_time = htobe64(litexcnc->stepgen.memo.apply_time);
+        memcpy(*data, &data_general, LITEXCNC_STEPGEN_GENERAL_WRITE_DATA_SIZE);
+        *data += LITEXCNC_STEPGEN_GENERAL_WRITE_DATA_SIZE;
+    }
 
     // STEP 2: Speed per stepgen
     // =========================
@@ -372,13 +643,64 @@ uint8_t litexcnc_stepgen_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
         instance->data.fpga_acc = instance->data.flt_acc * instance->data.fpga_acc_scale;
         instance->data.fpga_time = instance->data.flt_time * litexcnc->clock_frequency;
 
-        // Convert the integers used and scale it to the FPGA
-        instance_data.speed_target = htobe32(instance->data.fpga_speed);
-        instance_data.acceleration = htobe32(instance->data.fpga_acc);
+        // The compact image limits the acceleration to 24 bits. The clipped acceleration
+        // is also used for the prediction, so the prediction follows the FPGA.
+        if (litexcnc->compact_image && (instance->data.flt_acc * instance->data.fpga_acc_scale > LITEXCNC_STEPGEN_COMPACT_MAX_ACCELERATION)) {
+            instance->data.fpga_acc = LITEXCNC_STEPGEN_COMPACT_MAX_ACCELERATION;
+            instance->data.flt_acc = instance->data.fpga_acc * instance->data.fpga_acc_scale_inv;
+            instance->data.flt_time = fabs((*(instance->hal.pin.velocity_cmd) - *(instance->hal.pin.speed_prediction)) / instance->data.flt_acc);
+            instance->data.fpga_time = instance->data.flt_time * litexcnc->clock_frequency;
+            if (!instance->memo.error_max_acceleration_printed) {
+                LITEXCNC_ERR("Acceleration too large for the compact image and is clipped to %f units/s^2. Reduce max-acceleration or position-scale, or disable the compact image.\n", litexcnc->fpga->name, instance->data.flt_acc);
+                instance->memo.error_max_acceleration_printed = true;
+            }
+        }
 
-        // Put the data on the data-stream and advance the pointer
-        memcpy(*data, &instance_data, LITEXCNC_STEPGEN_INSTANCE_WRITE_DATA_SIZE);
-        *data += LITEXCNC_STEPGEN_INSTANCE_WRITE_DATA_SIZE;
+        if (litexcnc->compact_image) {
+            // Compact image: only the upper 24 bits of the speed are sent (rounded to
+            // the nearest value) and the acceleration is limited to 24 bits (see above).
+            // Both are written big-endian, 3 bytes each.
+            uint32_t speed = (instance->data.fpga_speed < 0xFFFFFF80) ? (instance->data.fpga_speed + 0x80) >> 8 : 0xFFFFFF;
+            uint32_t acc = instance->data.fpga_acc;
+            (*data)[0] = speed >> 16;
+            (*data)[1] = speed >> 8;
+            (*data)[2] = speed;
+            (*data)[3] = acc >> 16;
+            (*data)[4] = acc >> 8;
+            (*data)[5] = acc;
+            *data += LITEXCNC_STEPGEN_COMPACT_INSTANCE_WRITE_DATA_SIZE;
+        } else {
+            // Convert the integers used and scale it to the FPGA
+            instance_data.speed_target = htobe32(instance->data.fpga_speed);
+            instance_data.acceleration = htobe32(instance->data.fpga_acc);
+
+            // Put the data on the data-stream and advance the pointer
+            memcpy(*data, &instance_data, LITEXCNC_STEPGEN_INSTANCE_WRITE_DATA_SIZE);
+            *data += LITEXCNC_STEPGEN_INSTANCE_WRITE_DATA_SIZE;
+        }
+
+        // Convert the gearing ratio to steps per count of the encoder (fixed point)
+        if (instance->data.gearing_encoder >= 0) {
+            litexcnc_encoder_instance_t *encoder = &(litexcnc->encoder.instances[instance->data.gearing_encoder]);
+            // The FPGA counts in the mode of the encoder, just like the counts reported in HAL
+            float counts_per_unit = encoder->hal.param.position_scale;
+            float ratio = 0.0;
+            if ((counts_per_unit < -1e-20) || (counts_per_unit > 1e-20)) {
+                ratio = *(instance->hal.pin.gearing_ratio) * instance->hal.param.position_scale / counts_per_unit * (1LL << LITEXCNC_STEPGEN_GEARING_RATIO_FRACTION);
+            }
+            if ((ratio > INT32_MAX) || (ratio < INT32_MIN)) {
+                if (!instance->memo.error_gearing_ratio_printed) {
+                    LITEXCNC_ERR("Gearing ratio too large and is clipped. The maximum is 128 steps per count of the encoder.\n", litexcnc->fpga->name);
+                    instance->memo.error_gearing_ratio_printed = true;
+                }
+                ratio = (ratio > 0) ? INT32_MAX : INT32_MIN;
+            }
+            instance->data.fpga_gearing_ratio = ratio;
+            instance->data.gearing_enabled = *(instance->hal.pin.gearing_enable);
+            // The velocity per count in a window, which is used to determine the velocity
+            // resulting from the gearing when the data is read
+            instance->data.gearing_scale = (float) instance->data.fpga_gearing_ratio / (1LL << LITEXCNC_STEPGEN_GEARING_RATIO_FRACTION) * litexcnc->clock_frequency / LITEXCNC_ENCODER_GEARING_WINDOW * instance->data.scale_recip;
+        }
 
         if (*(instance->hal.pin.debug)) {
             LITEXCNC_PRINT_NO_DEVICE("Stepgen: data sent to FPGA %" PRIu64 ", %" PRIu64 ", %" PRIu32 ", %" PRIu32 ", %" PRIu32 "\n", 
@@ -391,6 +713,123 @@ uint8_t litexcnc_stepgen_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lon
         }
     }
 
+    // Skip the padding at the end of the compact image
+    *data = data_start + LITEXCNC_BOARD_STEPGEN_SPEED_WRITE_SIZE(litexcnc);
+
+    // STEP 3: Gearing
+    // ===============
+    // The enable flags of all stepgens (shared register, the first stepgen in the least
+    // significant bit), followed by the ratio of each stepgen with gearing
+    if (litexcnc->stepgen.num_geared) {
+        size_t enable_size = LITEXCNC_BOARD_STEPGEN_SHARED_GEARING_ENABLE_WRITE_SIZE(litexcnc);
+        memset(*data, 0, enable_size);
+        for (size_t i=0; i<litexcnc->stepgen.num_instances; i++) {
+            if (litexcnc->stepgen.instances[i].data.gearing_enabled) {
+                (*data)[enable_size - 1 - (i >> 3)] |= 1 << (i & 0x07);
+            }
+        }
+        *data += enable_size;
+        for (size_t i=0; i<litexcnc->stepgen.num_instances; i++) {
+            instance = &(litexcnc->stepgen.instances[i]);
+            if (instance->data.gearing_encoder < 0) {
+                continue;
+            }
+            uint32_t ratio = htobe32((uint32_t) instance->data.fpga_gearing_ratio);
+            memcpy(*data, &ratio, sizeof ratio);
+            *data += sizeof ratio;
+        }
+    }
+
+    // STEP 4: Slaves
+    // ==============
+    // The latch flags of all slaves (shared register, numbered consecutively over all 
+    // stepgens, the first slave in the least significant bit)
+    if (litexcnc->stepgen.num_slaves) {
+        size_t latch_size = LITEXCNC_BOARD_STEPGEN_SHARED_SLAVE_LATCH_WRITE_SIZE(litexcnc);
+        size_t index = 0;
+        memset(*data, 0, latch_size);
+        for (size_t i=0; i<litexcnc->stepgen.num_instances; i++) {
+            instance = &(litexcnc->stepgen.instances[i]);
+            for (size_t j=0; j<instance->num_slaves; j++) {
+                instance->slaves[j].data.latched = *(instance->slaves[j].hal.pin.latch);
+                if (instance->slaves[j].data.latched) {
+                    (*data)[latch_size - 1 - (index >> 3)] |= 1 << (index & 0x07);
+                }
+                index++;
+            }
+        }
+        *data += latch_size;
+    }
+
+    // STEP 5: Compensation
+    // ====================
+    // A single entry of one of the tables is sent each period, the stepgens with 
+    // compensation take turns. The table is sent over and over again, so it is restored
+    // automatically when the board has been power-cycled. The compensation is only enabled
+    // after the complete table has been sent.
+    if (litexcnc->stepgen.num_compensated) {
+        litexcnc_stepgen_compensation_t *compensation;
+        litexcnc_stepgen_compensation_write_data_t compensation_data;
+        // - recalculate the tables when the position scale has changed
+        for (size_t i=0; i<litexcnc->stepgen.num_instances; i++) {
+            instance = &(litexcnc->stepgen.instances[i]);
+            compensation = instance->compensation;
+            if ((compensation != NULL) && (compensation->memo.position_scale != instance->hal.param.position_scale)) {
+                litexcnc_stepgen_calculate_compensation(compensation, instance->hal.param.position_scale);
+                compensation->memo.position_scale = instance->hal.param.position_scale;
+            }
+        }
+        // - the entry to write
+        size_t index = litexcnc->stepgen.data.compensation_next;
+        while (litexcnc->stepgen.instances[index].compensation == NULL) {
+            index = (index + 1) % litexcnc->stepgen.num_instances;
+        }
+        compensation = litexcnc->stepgen.instances[index].compensation;
+        uint64_t entry = htobe64(
+            (1ULL << 63) |
+            ((uint64_t) index << 48) |
+            ((uint64_t) compensation->data.next_entry << 32) |
+            (uint32_t) compensation->data.table[compensation->data.next_entry]
+        );
+        memcpy(*data, &entry, sizeof entry);
+        *data += sizeof entry;
+        compensation->data.next_entry = (compensation->data.next_entry + 1) % compensation->data.entries;
+        if (compensation->data.entries_sent < compensation->data.entries) {
+            compensation->data.entries_sent++;
+        }
+        litexcnc->stepgen.data.compensation_next = (index + 1) % litexcnc->stepgen.num_instances;
+        // - the start and configuration of each stepgen with compensation
+        for (size_t i=0; i<litexcnc->stepgen.num_instances; i++) {
+            instance = &(litexcnc->stepgen.instances[i]);
+            compensation = instance->compensation;
+            if (compensation == NULL) {
+                continue;
+            }
+            *(compensation->hal.pin.loaded) = compensation->data.entries_sent >= compensation->data.entries;
+            // The start is converted to the position on the FPGA, which restarts at zero 
+            // after the board has been power-cycled
+            int64_t start = compensation->data.start 
+                + (int64_t) floor(*(compensation->hal.pin.offset) * instance->hal.param.position_scale + 0.5) 
+                - (instance->data.position_offset >> instance->data.pick_off_pos);
+            double backlash = floor(fabs(*(compensation->hal.pin.backlash) * instance->hal.param.position_scale) * (1 << LITEXCNC_STEPGEN_COMPENSATION_FRACTION) + 0.5);
+            if (backlash > LITEXCNC_STEPGEN_COMPENSATION_MAX_BACKLASH) {
+                if (!compensation->memo.error_backlash_printed) {
+                    LITEXCNC_ERR("Backlash too large and is clipped. The maximum is 1023 steps.\n", litexcnc->fpga->name);
+                    compensation->memo.error_backlash_printed = true;
+                }
+                backlash = LITEXCNC_STEPGEN_COMPENSATION_MAX_BACKLASH;
+            }
+            compensation_data.start = htobe32((uint32_t) start);
+            compensation_data.config = htobe32(
+                (uint32_t) backlash |
+                ((uint32_t) compensation->data.shift << 26) |
+                ((*(compensation->hal.pin.enable) && *(compensation->hal.pin.loaded)) ? (1U << 31) : 0)
+            );
+            memcpy(*data, &compensation_data, sizeof compensation_data);
+            *data += sizeof compensation_data;
+        }
+    }
+
     return 0;
 }
 
@@ -407,17 +846,19 @@ float movingAvg(float *ptrArrNumbers, float *ptrSum, size_t pos, size_t len, flo
 uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long period) {
 
     // Declarations
-    static uint64_t next_apply_time;
-    static int32_t loop_cycles;
-    static litexcnc_stepgen_pin_t *instance;
+    uint64_t next_apply_time;
+    int32_t loop_cycles;
+    litexcnc_stepgen_pin_t *instance;
     //  - parameters for retrieving data from FPGA
-    static int64_t pos;
-    static uint32_t speed;
+    int64_t pos;
+    uint32_t speed;
+    uint64_t feedback;
     // - parameters for determining the position end start of next loop
-    static uint64_t min_time;
-    static uint64_t max_time;
-    static float fraction;
-    static float speed_end;
+    uint64_t min_time;
+    uint64_t max_time;
+    float fraction;
+    float speed_end;
+    float window;
 
     // Check for the first cycle and calculate some fake timings. This has to be done at
     // this location, because in the init the wallclock_ticks is still zero and this would
@@ -438,24 +879,28 @@ uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long
     loop_cycles = litexcnc->wallclock->memo.wallclock_ticks - litexcnc->stepgen.memo.prev_wall_clock;
 
     // Check whether the loop-cycles are within the limits
-    if (loop_cycles < (0.9 * litexcnc->stepgen.memo.cycles_per_period)) {
+    window = litexcnc->high_rate ? STEPGEN_LOOP_WINDOW_HIGH_RATE : STEPGEN_LOOP_WINDOW;
+    if (loop_cycles < ((1.0 - window) * litexcnc->stepgen.memo.cycles_per_period)) {
         // The previous loop was way too short
-        next_apply_time += (loop_cycles - 0.9 * litexcnc->stepgen.memo.cycles_per_period);
-        loop_cycles = 0.9 * litexcnc->stepgen.memo.cycles_per_period;
-    } else if (loop_cycles > (1.1 * litexcnc->stepgen.memo.cycles_per_period)) {
+        next_apply_time += (loop_cycles - (1.0 - window) * litexcnc->stepgen.memo.cycles_per_period);
+        loop_cycles = (1.0 - window) * litexcnc->stepgen.memo.cycles_per_period;
+    } else if (loop_cycles > ((1.0 + window) * litexcnc->stepgen.memo.cycles_per_period)) {
         // The previous loop was way too long, possibly a latency excursion
-        next_apply_time += (loop_cycles - 1.1 * litexcnc->stepgen.memo.cycles_per_period);
-        loop_cycles = 1.1 * litexcnc->stepgen.memo.cycles_per_period;
+        next_apply_time += (loop_cycles - (1.0 + window) * litexcnc->stepgen.memo.cycles_per_period);
+        loop_cycles = (1.0 + window) * litexcnc->stepgen.memo.cycles_per_period;
     }
 
     // Check whether the nex_apply_time is within the expected range. When outside of the range, 
     // the value is clipped and a warning is shown to the user. The warning is only shown once.
     if (next_apply_time < litexcnc->wallclock->memo.wallclock_ticks + 0.81 * litexcnc->stepgen.memo.cycles_per_period) {
-        rtapi_print("Apply time exceeding limits (too short): %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
-            litexcnc->wallclock->memo.wallclock_ticks,
-            litexcnc->stepgen.memo.apply_time,
-            next_apply_time
-        );  
+        // Printing each occurrence costs too much time at high servo rates
+        if (!litexcnc->high_rate) {
+            rtapi_print("Apply time exceeding limits (too short): %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
+                litexcnc->wallclock->memo.wallclock_ticks,
+                litexcnc->stepgen.memo.apply_time,
+                next_apply_time
+            );
+        }
         next_apply_time = litexcnc->wallclock->memo.wallclock_ticks + 0.85 * litexcnc->stepgen.memo.cycles_per_period;
         // Show warning
         if (!litexcnc->stepgen.data.warning_apply_time_exceeded_shown) {
@@ -464,11 +909,14 @@ uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long
         }
     }
     if (next_apply_time > litexcnc->wallclock->memo.wallclock_ticks + 0.99 * litexcnc->stepgen.memo.cycles_per_period){
-        rtapi_print("Apply time exceeding limits (too long): %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
-            litexcnc->wallclock->memo.wallclock_ticks,
-            litexcnc->stepgen.memo.apply_time,
-            next_apply_time
-        );     
+        // Printing each occurrence costs too much time at high servo rates
+        if (!litexcnc->high_rate) {
+            rtapi_print("Apply time exceeding limits (too long): %" PRIu64 ", %" PRIu64 ", %" PRIu64 "\n",
+                litexcnc->wallclock->memo.wallclock_ticks,
+                litexcnc->stepgen.memo.apply_time,
+                next_apply_time
+            );
+        }
         next_apply_time = litexcnc->wallclock->memo.wallclock_ticks + 0.95 * litexcnc->stepgen.memo.cycles_per_period;
         // Show warning
         if (!litexcnc->stepgen.data.warning_apply_time_exceeded_shown) {
@@ -517,18 +965,40 @@ uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long
         // Store the old data
         instance->memo.position = instance->data.position;
         // Read data and proceed the buffer
-        memcpy(&pos, *data, sizeof pos);
-        instance->data.position = be64toh(pos);
-        *data += 8;  // The data read is 64 bit-wide. The buffer is 8-bit wide
-        memcpy(&speed, *data, sizeof speed);
-        instance->data.speed = (int64_t) be32toh(speed) -  0x80000000;
-        *data += 4;  // The data read is 32 bit-wide. The buffer is 8-bit wide
+        if (litexcnc->compact_image) {
+            // Compact image: bits 16-47 of the position and the upper 24 bits of the 
+            // speed. The full position is restored by adding the difference with the
+            // previous position, which is valid as long as the stepgen moves less than
+            // 2^15 steps per period.
+            memcpy(&feedback, *data, sizeof feedback);
+            feedback = be64toh(feedback);
+            if (litexcnc->stepgen.data.reseed) {
+                instance->data.position = (int64_t)(int32_t)(uint32_t)(feedback >> 32) << 16;
+            } else {
+                instance->data.position += (int64_t)((int32_t)((uint32_t)(feedback >> 32) - (uint32_t)(instance->data.position >> 16))) << 16;
+            }
+            instance->data.speed = (int64_t) (((uint32_t) feedback) & 0xFFFFFF00) - 0x80000000;
+            *data += sizeof(litexcnc_stepgen_instance_compact_read_data_t);
+        } else {
+            memcpy(&pos, *data, sizeof pos);
+            instance->data.position = be64toh(pos);
+            *data += 8;  // The data read is 64 bit-wide. The buffer is 8-bit wide
+            memcpy(&speed, *data, sizeof speed);
+            instance->data.speed = (int64_t) be32toh(speed) -  0x80000000;
+            *data += 4;  // The data read is 32 bit-wide. The buffer is 8-bit wide
+        }
+        // After the board has been power-cycled, the position on the FPGA starts at zero
+        // again. The position continues from the last value, so the feedback does not jump.
+        if (litexcnc->stepgen.data.reseed) {
+            instance->data.position_offset += instance->memo.position - instance->data.position;
+        }
+        pos = instance->data.position + instance->data.position_offset;
         // Convert the received position to HAL pins for counts and floating-point position
-        *(instance->hal.pin.counts) = instance->data.position >> instance->data.pick_off_pos;
+        *(instance->hal.pin.counts) = pos >> instance->data.pick_off_pos;
         // Check: why is a half step subtracted from the position. Will case a possible problem 
         // when the power is cycled -> will lead to a moving reference frame  
         // *(instance->hal.pin.position_fb) = (double)(instance->data.position-(1LL<<(instance->data.pick_off_pos-1))) * instance->data.scale_recip / (1LL << instance->data.pick_off_pos);
-        *(instance->hal.pin.position_fb) = (double) instance->data.position * instance->data.fpga_pos_scale_inv;
+        *(instance->hal.pin.position_fb) = (double) pos * instance->data.fpga_pos_scale_inv;
         *(instance->hal.pin.speed_fb) = (double) instance->data.speed * instance->data.fpga_speed_scale_inv;
 
         /* -------------------
@@ -548,6 +1018,12 @@ uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long
         *(instance->hal.pin.speed_prediction) = *(instance->hal.pin.speed_fb);
         *(instance->hal.pin.position_prediction) =  *(instance->hal.pin.position_fb);
         
+        // The velocity resulting from the gearing, based on the counts of the encoder as
+        // measured by the FPGA in the previous cycle
+        if (instance->data.gearing_encoder >= 0) {
+            *(instance->hal.pin.gearing_velocity) = instance->data.gearing_enabled ? litexcnc->encoder.instances[instance->data.gearing_encoder].data.gearing_rate * instance->data.gearing_scale : 0.0;
+        }
+
         // Add the different phases to the speed and position prediction
         if (*(instance->hal.pin.debug)) {
             rtapi_print("Timings: %.6f, %" PRIu64 ", %" PRIu64 ", %" PRIu32 ", %" PRIu64 "\n",
@@ -558,28 +1034,41 @@ uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long
                 next_apply_time
             );
         }
-        if (litexcnc->wallclock->memo.wallclock_ticks <= litexcnc->stepgen.memo.apply_time + instance->data.fpga_time) {
-            min_time = litexcnc->wallclock->memo.wallclock_ticks;
-            if (litexcnc->stepgen.memo.apply_time > min_time) {
-                min_time = litexcnc->stepgen.memo.apply_time;
-            }
-            max_time = litexcnc->stepgen.memo.apply_time + instance->data.fpga_time;
-            if (next_apply_time < max_time) {
-                max_time = next_apply_time;
-            }
-            if ((litexcnc->stepgen.memo.apply_time + instance->data.fpga_time - min_time) <= 0) {
-                fraction = 1.0;
+        if (instance->data.gearing_enabled) {
+            // While geared, the FPGA directly applies the speed without acceleration limits.
+            // The velocity of the gearing is assumed constant during the next period.
+            speed_end = instance->data.flt_speed + *(instance->hal.pin.gearing_velocity);
+            if (litexcnc->stepgen.memo.apply_time > litexcnc->wallclock->memo.wallclock_ticks) {
+                *(instance->hal.pin.position_prediction) += *(instance->hal.pin.speed_prediction) * (litexcnc->stepgen.memo.apply_time - litexcnc->wallclock->memo.wallclock_ticks) * litexcnc->clock_frequency_recip;
+                *(instance->hal.pin.position_prediction) += speed_end * (next_apply_time - litexcnc->stepgen.memo.apply_time) * litexcnc->clock_frequency_recip;
             } else {
-                fraction = (float) (max_time - min_time) / (litexcnc->stepgen.memo.apply_time + instance->data.fpga_time - min_time);
+                *(instance->hal.pin.position_prediction) += speed_end * (next_apply_time - litexcnc->wallclock->memo.wallclock_ticks) * litexcnc->clock_frequency_recip;
             }
-            speed_end = (1.0 - fraction) * *(instance->hal.pin.speed_prediction) + fraction * instance->data.flt_speed;
-            *(instance->hal.pin.position_prediction) += 0.5 * (*(instance->hal.pin.speed_prediction) + speed_end) * (max_time - min_time) * litexcnc->clock_frequency_recip;
             *(instance->hal.pin.speed_prediction) = speed_end;
-        }
-        if (next_apply_time > litexcnc->stepgen.memo.apply_time + instance->data.fpga_time) {
-            // Some constant speed should be added
-            *(instance->hal.pin.speed_prediction) = instance->data.flt_speed;
-            *(instance->hal.pin.position_prediction) += instance->data.flt_speed * (next_apply_time - (litexcnc->stepgen.memo.apply_time + instance->data.fpga_time)) * litexcnc->clock_frequency_recip;
+        } else {
+            if (litexcnc->wallclock->memo.wallclock_ticks <= litexcnc->stepgen.memo.apply_time + instance->data.fpga_time) {
+                min_time = litexcnc->wallclock->memo.wallclock_ticks;
+                if (litexcnc->stepgen.memo.apply_time > min_time) {
+                    min_time = litexcnc->stepgen.memo.apply_time;
+                }
+                max_time = litexcnc->stepgen.memo.apply_time + instance->data.fpga_time;
+                if (next_apply_time < max_time) {
+                    max_time = next_apply_time;
+                }
+                if ((litexcnc->stepgen.memo.apply_time + instance->data.fpga_time - min_time) <= 0) {
+                    fraction = 1.0;
+                } else {
+                    fraction = (float) (max_time - min_time) / (litexcnc->stepgen.memo.apply_time + instance->data.fpga_time - min_time);
+                }
+                speed_end = (1.0 - fraction) * *(instance->hal.pin.speed_prediction) + fraction * instance->data.flt_speed;
+                *(instance->hal.pin.position_prediction) += 0.5 * (*(instance->hal.pin.speed_prediction) + speed_end) * (max_time - min_time) * litexcnc->clock_frequency_recip;
+                *(instance->hal.pin.speed_prediction) = speed_end;
+            }
+            if (next_apply_time > litexcnc->stepgen.memo.apply_time + instance->data.fpga_time) {
+                // Some constant speed should be added
+                *(instance->hal.pin.speed_prediction) = instance->data.flt_speed;
+                *(instance->hal.pin.position_prediction) += instance->data.flt_speed * (next_apply_time - (litexcnc->stepgen.memo.apply_time + instance->data.fpga_time)) * litexcnc->clock_frequency_recip;
+            }
         }
         if (*(instance->hal.pin.debug)) {
             rtapi_print("Stepgen speed feedback result: %" PRIu64 ", %" PRIu64 ", %.6f, %.6f, %.6f, %.6f \n",
@@ -593,8 +1082,47 @@ uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long
         }
     }
 
+    // Receive and process the offsets of the slaves. The position of the slave is 
+    // reconstructed from the position of its master, so it shares the same reference
+    // frame (also after the board has been power-cycled)
+    for (size_t i=0; i<litexcnc->stepgen.num_instances; i++) {
+        instance = &(litexcnc->stepgen.instances[i]);
+        for (size_t j=0; j<instance->num_slaves; j++) {
+            litexcnc_stepgen_slave_t *slave = &(instance->slaves[j]);
+            uint32_t offset;
+            memcpy(&offset, *data, sizeof offset);
+            slave->data.offset = (int64_t)(int32_t) be32toh(offset) << 16;
+            *data += sizeof offset;
+            pos = instance->data.position + instance->data.position_offset + slave->data.offset;
+            *(slave->hal.pin.counts) = pos >> instance->data.pick_off_pos;
+            *(slave->hal.pin.position_fb) = (double) pos * instance->data.fpga_pos_scale_inv;
+            *(slave->hal.pin.offset) = (double) slave->data.offset * instance->data.fpga_pos_scale_inv;
+            // A latched slave holds its position, otherwise it follows the prediction of the master
+            if (slave->data.latched) {
+                *(slave->hal.pin.position_prediction) = *(slave->hal.pin.position_fb);
+            } else {
+                *(slave->hal.pin.position_prediction) = *(instance->hal.pin.position_prediction) + *(slave->hal.pin.offset);
+            }
+        }
+    }
+
     // Push the apply for the write loop
     litexcnc->stepgen.memo.apply_time = next_apply_time;
+    litexcnc->stepgen.data.reseed = false;
 
     return 0;
 }
+
+
+void litexcnc_stepgen_reseed(litexcnc_t *litexcnc) {
+    // The timing is restarted from the wall-clock of the board, as in the first cycle,
+    // and the position is continued from its last value in the next read
+    litexcnc->stepgen.memo.apply_time = 0;
+    litexcnc->stepgen.data.reseed = true;
+    // The compensation tables are lost and are sent again
+    for (size_t i=0; i<litexcnc->stepgen.num_instances; i++) {
+        if (litexcnc->stepgen.instances[i].compensation != NULL) {
+            litexcnc->stepgen.instances[i].compensation->data.entries_sent = 0;
+        }
+    }
+}
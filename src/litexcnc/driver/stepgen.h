@@ -41,6 +41,81 @@
 #define STEPGEN_WALLCLOCK_BUFFER 10
 #define STEPGEN_WALLCLOCK_BUFFER_RECIP 1.0 / STEPGEN_WALLCLOCK_BUFFER
 
+// Allowed deviation of the measured loop time with respect to the period, as a fraction of
+// the period. Longer or shorter loops are clipped. At high servo rates the jitter of the
+// host is a larger fraction of the period, so the window is wider.
+#define STEPGEN_LOOP_WINDOW 0.1
+#define STEPGEN_LOOP_WINDOW_HIGH_RATE 0.5
+
+// Number of fractional bits of the gearing ratio on the FPGA (steps per encoder count).
+// This value MUST coincide with `StepgenModule.GEARING_RATIO_FRACTION`.
+#define LITEXCNC_STEPGEN_GEARING_RATIO_FRACTION 24
+
+// Number of fractional bits of the compensation and backlash on the FPGA (steps). This
+// value MUST coincide with `StepgenModule.COMPENSATION_FRACTION`.
+#define LITEXCNC_STEPGEN_COMPENSATION_FRACTION 16
+// The maximum backlash on the FPGA (26 bits, including the fraction)
+#define LITEXCNC_STEPGEN_COMPENSATION_MAX_BACKLASH ((1 << 26) - 1)
+
+// Defines the compensation of the pitch error and backlash of a stepgen. The table on the
+// FPGA is equally spaced (2^shift steps) and is resampled from the points of the 
+// compensation file when the position scale changes.
+typedef struct {
+    struct {
+
+        struct {
+            hal_bit_t   *enable;              /* When true, the position is compensated for the pitch error and backlash */
+            hal_float_t *backlash;            /* The backlash, in length units. Initialized with the mean backlash of the compensation file */
+            hal_float_t *offset;              /* The position of the stepgen at the nominal position 0 of the compensation file, i.e. joint.N.motor-offset */
+            hal_bit_t   *loaded;              /* True when the complete table has been sent to the FPGA */
+        } pin;
+
+    } hal;
+
+    // This struct holds all old values (memoization)
+    struct {
+        hal_float_t position_scale;
+        bool error_backlash_printed;
+    } memo;
+
+    // This struct contains the table, both as read from the file and as sent to the FPGA
+    struct {
+        size_t num_points;
+        double *nominal;        /* The nominal positions of the compensation file, in length units */
+        double *compensation;   /* The compensation at the nominal positions, in length units */
+        size_t entries;         /* The number of entries in the table on the FPGA */
+        int32_t *table;         /* The compensation in steps (fixed point) for each entry */
+        int64_t start;          /* The position of the first entry, in steps */
+        uint8_t shift;          /* The distance between the entries is 2^shift steps */
+        size_t next_entry;      /* The next entry to be sent to the FPGA */
+        size_t entries_sent;    /* The number of entries sent since the table has been (re)calculated */
+    } data;
+
+} litexcnc_stepgen_compensation_t;
+
+// Defines the structure of a slave of a stepgen (ganged stepgen), which is driven by the
+// speed of its master
+typedef struct {
+    struct {
+
+        struct {
+            hal_bit_t   *latch;               /* When true, the position of the slave is held while the master continues to move (squaring) */
+            hal_u32_t   *counts;              /* The current position, in counts */
+            hal_float_t *position_fb;         /* The current position, in length units (see parameter position-scale of the master) */
+            hal_float_t *position_prediction; /* The predicted position, in length units, at the start of the next position command execution */
+            hal_float_t *offset;              /* The difference between the position of the slave and the master, in length units */
+        } pin;
+
+    } hal;
+
+    // This struct contains data, both calculated and direct received from the FPGA
+    struct {
+        int64_t offset;   /* The difference with the position of the master, in the units of the FPGA */
+        bool latched;     /* The latch as sent to the FPGA */
+    } data;
+
+} litexcnc_stepgen_slave_t;
+
 // Defines the structure of the PWM instance
 typedef struct {
     struct {
@@ -57,6 +132,9 @@ typedef struct {
             hal_bit_t   *debug;               /* Flag indicating whether all positional data will be printed to the command line */
             hal_float_t *period_s;            /* The calculated period (averaged over 10 cycles) based on the FPGA wall clock */ 
             hal_float_t *period_s_recip;      /* The reciprocal of the calculated period. Calculated here once, to prevent slow division on multiple locations */ 
+            hal_bit_t   *gearing_enable;      /* When true, the speed follows the encoder times gearing-ratio, added to the velocity-cmd (only with gearing) */
+            hal_float_t *gearing_ratio;       /* The gearing ratio, in length units of the stepgen per length unit of the encoder (only with gearing) */
+            hal_float_t *gearing_velocity;    /* The velocity resulting from the gearing, in length units per second (only with gearing) */
         } pin;
 
         struct {
@@ -85,11 +163,14 @@ typedef struct {
         hal_float_t maxaccel;       
         hal_float_t maxvel;
         bool error_max_speed_printed;
+        bool error_max_acceleration_printed;
+        bool error_gearing_ratio_printed;
     } memo;
 
     // This struct contains data, both calculated and direct received from the FPGA
     struct {
         int64_t position;
+        int64_t position_offset;  /* Added to the position, so the position continues after the board has been power-cycled */
         int32_t speed;
         float acceleration;
         float speed_float;
@@ -116,7 +197,21 @@ typedef struct {
         float fpga_speed_scale_inv;
         float fpga_acc_scale;
         float fpga_acc_scale_inv;
+        // Electronic gearing: the index of the encoder driving this stepgen (-1 when the
+        // stepgen has no gearing), the ratio as sent to the FPGA and the velocity per
+        // count of the encoder in a window
+        int gearing_encoder;
+        bool gearing_enabled;
+        int32_t fpga_gearing_ratio;
+        float gearing_scale;
     } data;
+
+    // The slaves driven by the speed of this stepgen
+    int num_slaves;
+    litexcnc_stepgen_slave_t *slaves;
+
+    // The compensation of the pitch error and backlash (NULL when not compensated)
+    litexcnc_stepgen_compensation_t *compensation;
     
 } litexcnc_stepgen_pin_t;
 
@@ -138,6 +233,9 @@ typedef struct {
 typedef struct {
     // Input pins
     int num_instances;
+    int num_geared;
+    int num_slaves;
+    int num_compensated;
     litexcnc_stepgen_pin_t *instances;
     litexcnc_stepgen_hal_t *hal;
 
@@ -156,6 +254,11 @@ typedef struct {
     struct {
         float max_frequency;
         bool warning_apply_time_exceeded_shown;
+        // When true, the position on the FPGA has been restarted (i.e. the board has
+        // been power-cycled) and the position is taken as is in the next read
+        bool reseed;
+        // The stepgen of which an entry of the compensation table is sent next
+        size_t compensation_next;
         // Data for calculating the average period_s
         size_t wallclock_buffer_pos;
         float wallclock_buffer_sum;
@@ -188,7 +291,32 @@ typedef struct {
 } litexcnc_stepgen_instance_write_data_t;
 #pragma pack(pop)
 #define LITEXCNC_STEPGEN_INSTANCE_WRITE_DATA_SIZE sizeof(litexcnc_stepgen_instance_write_data_t)
-#define LITEXCNC_BOARD_STEPGEN_DATA_WRITE_SIZE(litexcnc) ((litexcnc->stepgen.num_instances?sizeof(litexcnc_stepgen_general_write_data_t):0) + LITEXCNC_STEPGEN_INSTANCE_WRITE_DATA_SIZE*litexcnc->stepgen.num_instances)
+#define LITEXCNC_BOARD_STEPGEN_FULL_DATA_WRITE_SIZE(litexcnc) ((litexcnc->stepgen.num_instances?sizeof(litexcnc_stepgen_general_write_data_t):0) + LITEXCNC_STEPGEN_INSTANCE_WRITE_DATA_SIZE*litexcnc->stepgen.num_instances)
+// - write (compact image): 32-bit apply time, followed by 24-bit speed and 24-bit
+//   acceleration for each stepgen, padded to a multiple of 4 bytes
+#define LITEXCNC_STEPGEN_COMPACT_APPLY_TIME_SIZE 4
+#define LITEXCNC_STEPGEN_COMPACT_INSTANCE_WRITE_DATA_SIZE 6
+// - the maximum acceleration in the compact image (24 bits)
+#define LITEXCNC_STEPGEN_COMPACT_MAX_ACCELERATION 0xFFFFFF
+#define LITEXCNC_BOARD_STEPGEN_COMPACT_DATA_WRITE_SIZE(litexcnc) ((litexcnc->stepgen.num_instances?LITEXCNC_STEPGEN_COMPACT_APPLY_TIME_SIZE:0) + ((LITEXCNC_STEPGEN_COMPACT_INSTANCE_WRITE_DATA_SIZE*litexcnc->stepgen.num_instances + 3) & ~3))
+#define LITEXCNC_BOARD_STEPGEN_SPEED_WRITE_SIZE(litexcnc) (litexcnc->compact_image?LITEXCNC_BOARD_STEPGEN_COMPACT_DATA_WRITE_SIZE(litexcnc):LITEXCNC_BOARD_STEPGEN_FULL_DATA_WRITE_SIZE(litexcnc))
+// - write (gearing): the shared enable register, followed by the ratio of each stepgen
+//   with gearing. Only present when at least one stepgen has gearing.
+#define LITEXCNC_BOARD_STEPGEN_SHARED_GEARING_ENABLE_WRITE_SIZE(litexcnc) (((litexcnc->stepgen.num_instances)>>5) + ((litexcnc->stepgen.num_instances & 0x1F)?1:0)) *4
+#define LITEXCNC_BOARD_STEPGEN_GEARING_WRITE_SIZE(litexcnc) (litexcnc->stepgen.num_geared?(LITEXCNC_BOARD_STEPGEN_SHARED_GEARING_ENABLE_WRITE_SIZE(litexcnc) + 4*litexcnc->stepgen.num_geared):0)
+// - write (slaves): the shared latch register of all slaves
+#define LITEXCNC_BOARD_STEPGEN_SHARED_SLAVE_LATCH_WRITE_SIZE(litexcnc) (((litexcnc->stepgen.num_slaves)>>5) + ((litexcnc->stepgen.num_slaves & 0x1F)?1:0)) *4
+// - write (compensation): the shared register for writing an entry of a table, followed
+//   by the start and configuration of each stepgen with compensation. Only present when at
+//   least one stepgen has compensation.
+#pragma pack(push,4)
+typedef struct {
+    uint32_t start;
+    uint32_t config;
+} litexcnc_stepgen_compensation_write_data_t;
+#pragma pack(pop)
+#define LITEXCNC_BOARD_STEPGEN_COMPENSATION_WRITE_SIZE(litexcnc) (litexcnc->stepgen.num_compensated?(sizeof(uint64_t) + sizeof(litexcnc_stepgen_compensation_write_data_t)*litexcnc->stepgen.num_compensated):0)
+#define LITEXCNC_BOARD_STEPGEN_DATA_WRITE_SIZE(litexcnc) (LITEXCNC_BOARD_STEPGEN_SPEED_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_STEPGEN_GEARING_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_STEPGEN_SHARED_SLAVE_LATCH_WRITE_SIZE(litexcnc) + LITEXCNC_BOARD_STEPGEN_COMPENSATION_WRITE_SIZE(litexcnc))
 // - read
 #pragma pack(push,4)
 typedef struct {
@@ -196,7 +324,16 @@ typedef struct {
     uint32_t speed;
 } litexcnc_stepgen_instance_read_data_t;
 #pragma pack(pop)
-#define LITEXCNC_BOARD_STEPGEN_DATA_READ_SIZE(litexcnc) litexcnc->stepgen.num_instances*sizeof(litexcnc_stepgen_instance_read_data_t)
+// - read (compact image): bits 16-47 of the position (bit 63-32) and the upper 24 bits of
+//   the speed (bit 31-8)
+#pragma pack(push,4)
+typedef struct {
+    uint64_t feedback;
+} litexcnc_stepgen_instance_compact_read_data_t;
+#pragma pack(pop)
+// - read (slaves): bits 16-47 of the offset of each slave with respect to its master
+#define LITEXCNC_BOARD_STEPGEN_SLAVE_READ_SIZE(litexcnc) (litexcnc->stepgen.num_slaves * 4)
+#define LITEXCNC_BOARD_STEPGEN_DATA_READ_SIZE(litexcnc) (litexcnc->stepgen.num_instances*(litexcnc->compact_image?sizeof(litexcnc_stepgen_instance_compact_read_data_t):sizeof(litexcnc_stepgen_instance_read_data_t)) + LITEXCNC_BOARD_STEPGEN_SLAVE_READ_SIZE(litexcnc))
 
 
 // Functions for creating, reading and writing stepgen pins
@@ -204,5 +341,7 @@ int litexcnc_stepgen_init(litexcnc_t *litexcnc, cJSON *config);
 uint8_t litexcnc_stepgen_config(litexcnc_t *litexcnc, uint8_t **data, long period);
 uint8_t litexcnc_stepgen_prepare_write(litexcnc_t *litexcnc, uint8_t **data, long period);
 uint8_t litexcnc_stepgen_process_read(litexcnc_t *litexcnc, uint8_t** data, long period);
+// Continues the position from its last value after the board has been power-cycled
+void litexcnc_stepgen_reseed(litexcnc_t *litexcnc);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,210 @@
+/********************************************************************
+* Description:  trace.c
+*               Records the data exchanged with a board in a memory
+*               mapped file, so it can be replayed without the board.
+*
+* Author: Peter van Tol <petertgvantol AT gmail DOT com>
+* License: GPL Version 2
+*
+* Copyright (c) 2022 All rights reserved.
+*
+********************************************************************/
+
+/** This program is free software; you can redistribute it and/or
+    modify it under the terms of version 2 of the GNU General
+    Public License as published by the Free Software Foundation.
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+    THE AUTHORS OF THIS LIBRARY ACCEPT ABSOLUTELY NO LIABILITY FOR
+    ANY HARM OR LOSS RESULTING FROM ITS USE.  IT IS _EXTREMELY_ UNWISE
+    TO RELY ON SOFTWARE ALONE FOR SAFETY.  Any machinery capable of
+    harming persons must have provisions for completely removing power
+    from all motors, etc, before persons enter any danger area.  All
+    machinery must be designed to comply with local and national safety
+    codes, and the authors of this software can not, and do not, take
+    any responsibility for such compliance.
+
+    This code was written as part of the LiteX-CNC project.
+*/
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rtapi.h"
+#include "rtapi_app.h"
+#include "litexcnc.h"
+
+#include "trace.h"
+
+#define LITEXCNC_TRACE_ALIGN(size) (((size) + LITEXCNC_TRACE_ALIGNMENT - 1) & ~((size_t) LITEXCNC_TRACE_ALIGNMENT - 1))
+
+
+EXPORT_SYMBOL_GPL(litexcnc_trace_create);
+int litexcnc_trace_create(litexcnc_trace_t *trace, const char *path, size_t size, uint32_t fpga_version, uint32_t fingerprint) {
+    memset(trace, 0, sizeof(litexcnc_trace_t));
+    if (size < sizeof(litexcnc_trace_header_t)) {
+        LITEXCNC_ERR_NO_DEVICE("Trace '%s' too small\n", path);
+        return -EINVAL;
+    }
+
+    // The file is given its final size before it is mapped, so all pages exist and
+    // recording never has to grow the file
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot create trace '%s': %s\n", path, strerror(errno));
+        return -errno;
+    }
+    if (ftruncate(fd, size) < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot allocate %zu bytes for trace '%s': %s\n", size, path, strerror(errno));
+        close(fd);
+        return -errno;
+    }
+    uint8_t *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot map trace '%s': %s\n", path, strerror(errno));
+        return -errno;
+    }
+    // Fault in all pages now, otherwise the first cycles which touch a page stall the
+    // thread
+    memset(memory, 0, size);
+
+    litexcnc_trace_header_t *header = (litexcnc_trace_header_t *) memory;
+    header->magic        = LITEXCNC_TRACE_MAGIC;
+    header->version      = LITEXCNC_TRACE_VERSION;
+    header->fpga_version = fpga_version;
+    header->fingerprint  = fingerprint;
+    header->size         = size;
+    header->used         = LITEXCNC_TRACE_ALIGN(sizeof(litexcnc_trace_header_t));
+    header->records      = 0;
+
+    trace->memory = memory;
+    trace->size = size;
+    return 0;
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_trace_open);
+int litexcnc_trace_open(litexcnc_trace_t *trace, const char *path) {
+    memset(trace, 0, sizeof(litexcnc_trace_t));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot open trace '%s': %s\n", path, strerror(errno));
+        return -errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(litexcnc_trace_header_t)) {
+        LITEXCNC_ERR_NO_DEVICE("Trace '%s' is not a valid trace\n", path);
+        close(fd);
+        return -EINVAL;
+    }
+    uint8_t *memory = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        LITEXCNC_ERR_NO_DEVICE("Cannot map trace '%s': %s\n", path, strerror(errno));
+        return -errno;
+    }
+    trace->memory = memory;
+    trace->size = st.st_size;
+
+    const litexcnc_trace_header_t *header = (const litexcnc_trace_header_t *) memory;
+    if (header->magic != LITEXCNC_TRACE_MAGIC) {
+        LITEXCNC_ERR_NO_DEVICE("Trace '%s' is not a valid trace (magic %08X)\n", path, header->magic);
+        goto fail;
+    }
+    if (header->version != LITEXCNC_TRACE_VERSION) {
+        LITEXCNC_ERR_NO_DEVICE("Unsupported version %u of trace '%s' (driver: %u)\n", header->version, path, LITEXCNC_TRACE_VERSION);
+        goto fail;
+    }
+    if (header->used > trace->size) {
+        LITEXCNC_ERR_NO_DEVICE("Trace '%s' is truncated\n", path);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    litexcnc_trace_close(trace);
+    return -EINVAL;
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_trace_record);
+void litexcnc_trace_record(litexcnc_trace_t *trace, uint16_t type, uint16_t flags, uint32_t address, const uint8_t *data, size_t size) {
+    if (!trace->memory || __atomic_load_n(&trace->full, __ATOMIC_RELAXED)) {
+        return;
+    }
+    litexcnc_trace_header_t *header = (litexcnc_trace_header_t *) trace->memory;
+    size_t length = sizeof(litexcnc_trace_record_t) + LITEXCNC_TRACE_ALIGN(size);
+
+    // Reserve the space for the record. The fast and the slow rate group record from
+    // different threads, so the space is reserved atomically.
+    uint64_t offset = __atomic_load_n(&header->used, __ATOMIC_RELAXED);
+    do {
+        if (offset + length > trace->size) {
+            // The header is still valid, the trace contains all cycles up to this point
+            if (!__atomic_exchange_n(&trace->full, true, __ATOMIC_RELAXED)) {
+                LITEXCNC_WARN_NO_DEVICE("Trace full after %llu records, recording stopped\n", (unsigned long long) __atomic_load_n(&header->records, __ATOMIC_RELAXED));
+            }
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&header->used, &offset, offset + length, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    litexcnc_trace_record_t *record = (litexcnc_trace_record_t *)(trace->memory + offset);
+    record->flags     = flags;
+    record->size      = size;
+    record->address   = address;
+    record->reserved  = 0;
+    record->timestamp = rtapi_get_time();
+    if (size) {
+        memcpy((uint8_t *) record + sizeof(litexcnc_trace_record_t), data, size);
+    }
+    // The record is only made part of the trace when it is complete, by setting its type
+    __atomic_store_n(&record->type, type, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&header->records, 1, __ATOMIC_RELAXED);
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_trace_next);
+const litexcnc_trace_record_t *litexcnc_trace_next(const litexcnc_trace_t *trace, size_t *cursor, uint16_t type) {
+    const litexcnc_trace_header_t *header = (const litexcnc_trace_header_t *) trace->memory;
+    if (*cursor < LITEXCNC_TRACE_ALIGN(sizeof(litexcnc_trace_header_t))) {
+        *cursor = LITEXCNC_TRACE_ALIGN(sizeof(litexcnc_trace_header_t));
+    }
+    while (*cursor + sizeof(litexcnc_trace_record_t) <= header->used) {
+        const litexcnc_trace_record_t *record = (const litexcnc_trace_record_t *)(trace->memory + *cursor);
+        // The space of the record is reserved, but the record is not complete yet
+        if (__atomic_load_n(&record->type, __ATOMIC_ACQUIRE) == 0) {
+            break;
+        }
+        size_t length = sizeof(litexcnc_trace_record_t) + LITEXCNC_TRACE_ALIGN(record->size);
+        if (*cursor + length > header->used) {
+            break;
+        }
+        *cursor += length;
+        if (record->type == type) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+
+EXPORT_SYMBOL_GPL(litexcnc_trace_close);
+void litexcnc_trace_close(litexcnc_trace_t *trace) {
+    if (!trace->memory) {
+        return;
+    }
+    msync(trace->memory, trace->size, MS_SYNC);
+    munmap(trace->memory, trace->size);
+    trace->memory = NULL;
+    trace->size = 0;
+}
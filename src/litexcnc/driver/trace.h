@@ -0,0 +1,100 @@
+//
+//    Copyright (C) 2022 Peter van Tol
+//
+//    This program is free software; you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation; either version 2 of the License, or
+//    (at your option) any later version.
+//
+//    This program is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+//
+//    You should have received a copy of the GNU General Public License
+//    along with this program; if not, write to the Free Software
+//    Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+//
+#ifndef __INCLUDE_LITEXCNC_TRACE_H__
+#define __INCLUDE_LITEXCNC_TRACE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A trace contains all data exchanged with a board: the config, each write and read
+// image and the memory read when the board is registered (i.e. the descriptor). The
+// trace is a file which is mapped in memory. The size of the file is fixed when the
+// trace is created, so recording a cycle only copies the data and does not require any
+// system call. When the file is full, recording stops.
+//
+// The fast and the slow rate group record from different threads. The space of a record
+// is reserved atomically and the record is completed by setting its type, so a record
+// with type 0 is still being written.
+//
+// The trace is written in the byte order of the host. All records are aligned to
+// LITEXCNC_TRACE_ALIGNMENT bytes. These values MUST coincide with `trace.py`.
+#define LITEXCNC_TRACE_MAGIC     0x4C585452  // LXTR
+#define LITEXCNC_TRACE_VERSION   1
+#define LITEXCNC_TRACE_ALIGNMENT 8
+
+// Types of the records
+#define LITEXCNC_TRACE_CONFIG     1
+#define LITEXCNC_TRACE_WRITE      2
+#define LITEXCNC_TRACE_READ       3
+#define LITEXCNC_TRACE_WRITE_SLOW 4
+#define LITEXCNC_TRACE_READ_SLOW  5
+#define LITEXCNC_TRACE_MEMORY     6
+
+// Flags of the records
+#define LITEXCNC_TRACE_FLAG_FAILED 0x01  // The read or write failed, the record has no data
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    // Version and fingerprint of the firmware on the board
+    uint32_t fpga_version;
+    uint32_t fingerprint;
+    // Size of the file and the number of bytes used by the header and the records
+    uint64_t size;
+    uint64_t used;
+    uint64_t records;
+} litexcnc_trace_header_t;
+
+typedef struct {
+    uint16_t type;
+    uint16_t flags;
+    // Size of the data following the record (without the padding for the alignment)
+    uint32_t size;
+    // Address of the data on the board (only for LITEXCNC_TRACE_MEMORY)
+    uint32_t address;
+    uint32_t reserved;
+    // Time (rtapi_get_time) at which the data was exchanged, in nanoseconds
+    int64_t timestamp;
+} litexcnc_trace_record_t;
+
+typedef struct {
+    uint8_t *memory;
+    size_t size;
+    // Set when the trace is full, to warn only once
+    bool full;
+} litexcnc_trace_t;
+
+// Creates a trace of the given size (in bytes) for recording. Returns 0 on success and
+// a negative value on failure.
+int litexcnc_trace_create(litexcnc_trace_t *trace, const char *path, size_t size, uint32_t fpga_version, uint32_t fingerprint);
+// Opens an existing trace for replaying. Returns 0 on success and a negative value on
+// failure.
+int litexcnc_trace_open(litexcnc_trace_t *trace, const char *path);
+// Adds a record to the trace. Does nothing when the trace is not open or is full.
+void litexcnc_trace_record(litexcnc_trace_t *trace, uint16_t type, uint16_t flags, uint32_t address, const uint8_t *data, size_t size);
+// Returns the first record of the given type at or after the cursor (the offset in the
+// trace, which starts at 0) and advances the cursor past it. Returns NULL at the end of
+// the trace.
+const litexcnc_trace_record_t *litexcnc_trace_next(const litexcnc_trace_t *trace, size_t *cursor, uint16_t type);
+// Returns the data of the record
+#define LITEXCNC_TRACE_DATA(record) ((const uint8_t *)(record) + sizeof(litexcnc_trace_record_t))
+// Closes the trace, the recorded data is written to the file
+void litexcnc_trace_close(litexcnc_trace_t *trace);
+
+#endif
@@ -81,9 +81,9 @@ uint8_t litexcnc_wallclock_prepare_write(litexcnc_t *litexcnc, uint8_t **data) {
 
 uint8_t litexcnc_wallclock_process_read(litexcnc_t *litexcnc, uint8_t** data) {
 
-    static uint64_t ticks;
-    static uint32_t msb;
-    static uint32_t lsb;
+    uint64_t ticks;
+    uint32_t msb;
+    uint32_t lsb;
 
     // Get the full value (fool-proof way ;) )
     memcpy(&ticks , *data, sizeof ticks);
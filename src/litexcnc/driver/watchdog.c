@@ -137,8 +137,11 @@ uint8_t litexcnc_watchdog_prepare_write(litexcnc_t *litexcnc, uint8_t **data, lo
 
 uint8_t litexcnc_watchdog_process_read(litexcnc_t *litexcnc, uint8_t** data) {
 
-    // Check whether the watchdog did bite
-    if (*(*data)) {
+    // Check whether the watchdog did bite. The flag is in the least significant bit of
+    // the (big-endian) word.
+    litexcnc_watchdog_data_read_t input;
+    memcpy(&input, *data, LITEXCNC_WATCHDOG_DATA_READ_SIZE);
+    if (be32toh(input.has_bitten) & 0x01) {
         LITEXCNC_ERR_NO_DEVICE("Watchdog has bitten.");
         *(litexcnc->watchdog->hal.pin.has_bitten) = 1;
     }
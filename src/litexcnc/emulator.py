@@ -0,0 +1,504 @@
+"""
+Software emulator of a LitexCNC board. The emulator answers the Etherbone packets
+of the driver in the same way as the firmware would do for the given config-file,
+so the driver can be tested and benchmarked without an FPGA.
+
+The layout of the MMIO is derived from the config-file in the same order as in
+``firmware/mmio.py``. The modules are modelled at the level of the registers:
+- the wall clock runs at the clock frequency of the config-file;
+- the watchdog bites when it is not fed in time;
+- the stepgens integrate the position with the commanded speed and acceleration,
+  starting at the apply time;
+- the inputs (GPIO and encoders) are always zero. Stepgens with gearing enabled thus
+  only move with the commanded speed, without acceleration limits;
+- the slaves of a stepgen follow their master, except while latched;
+- the compensation tables of the stepgens are stored, but not applied, as the reported
+  position does not include the compensation;
+- the PID-loops only apply the proportional gain and the feedforward to the setpoint,
+  as the feedback is always zero;
+- the Modbus slaves do not respond, so none of the registers is reported as valid;
+- the SPI devices do not respond, so all channels read zero.
+
+The emulator must listen on a different ip-address than the driver, as both use the
+same port, i.e. ``127.0.0.2``.
+"""
+import binascii
+import json
+import math
+import os
+import re
+import socket
+import struct
+import time
+from typing import Dict, List, Optional
+
+from litexcnc.etherbone import ETHERBONE_DEFAULT_PORT, ETHERBONE_MAGIC, ETHERBONE_PROBE_FLAG, ETHERBONE_PROBE_REPLY, LITEXCNC_MAGIC
+
+# These values MUST coincide with the values in `firmware/mmio.py`
+DESCRIPTOR_ADDRESS = 0x00010000
+DESCRIPTOR_MAGIC = 0x4C584344
+DESCRIPTOR_VERSION = 1
+FEATURE_COMPACT_IMAGE = 0x01
+FEATURE_BLOCK_READ = 0x02
+FEATURE_CONFIG_READBACK = 0x04
+MODULE_FLAG_COMPACT = 0x01
+MODULE_FLAG_SLOW = 0x02
+
+MODULE_WATCHDOG = 1
+MODULE_WALLCLOCK = 2
+MODULE_GPIO_OUT = 3
+MODULE_GPIO_IN = 4
+MODULE_PWM = 5
+MODULE_STEPGEN = 6
+MODULE_ENCODER = 7
+MODULE_PID = 8
+MODULE_MODBUS = 9
+MODULE_SPI = 10
+
+SLOW_MODULES = {
+    'gpio_out': MODULE_GPIO_OUT,
+    'gpio_in': MODULE_GPIO_IN,
+    'pwm': MODULE_PWM,
+    'encoder': MODULE_ENCODER,
+    'modbus': MODULE_MODBUS,
+    'spi': MODULE_SPI,
+}
+
+
+def _words(bits: int) -> int:
+    """Returns the number of 32-bit words required for the given number of bits."""
+    return int(math.ceil(bits / 32))
+
+
+def _signed(value: int) -> int:
+    """Returns the 32-bit value as a signed integer."""
+    return value - 2**32 if value & 0x8000_0000 else value
+
+
+def _firmware_version() -> int:
+    """Returns the version of the firmware as stored on the board. The version is read
+    from the source, as importing the firmware requires Litex to be installed."""
+    with open(os.path.join(os.path.dirname(__file__), 'firmware', '__init__.py'), 'r') as file:
+        version = re.search(r'^__version__ = "(\d+)\.(\d+)\.(\d+)"', file.read(), re.MULTILINE)
+    major, minor, patch = (int(part) for part in version.groups())
+    return (major << 16) + (minor << 8) + patch
+
+
+class Layout:
+    """
+    The location of the registers of the MMIO, derived from the config-file. The
+    addresses and sizes are in bytes.
+    """
+
+    def __init__(self, config: dict):
+        self.compact_image = bool(config.get('compact_image', False))
+        self.slow_modules = [SLOW_MODULES[name] for name in config.get('slow_modules', [])]
+        gpio_out = len(config.get('gpio_out', []))
+        gpio_in = len(config.get('gpio_in', []))
+        pwm = len(config.get('pwm', []))
+        stepgen = len(config.get('stepgen', []))
+        encoders = len(config.get('encoders', []))
+        pid = len(config.get('pid', []))
+        modbus = len(config.get('modbus', []))
+        # Modbus: the registers which are written and read (function 6 is a write)
+        modbus_writes = sum(register['function'] == 6 for bus in config.get('modbus', []) for register in bus['registers'])
+        modbus_reads = sum(register['function'] != 6 for bus in config.get('modbus', []) for register in bus['registers'])
+        # SPI: the channels which are written and read
+        spi = len(config.get('spi', []))
+        spi_writes = sum(transaction.get('channel') == 'out' for bus in config.get('spi', []) for transaction in bus['transactions'])
+        spi_reads = sum(transaction.get('channel') == 'in' for bus in config.get('spi', []) for transaction in bus['transactions'])
+        # Electronic gearing: the stepgens slaved to an encoder and the encoders driving them
+        self.geared = [index for index, stepgen_config in enumerate(config.get('stepgen', [])) if stepgen_config.get('gearing')]
+        gearing_sources = len({config['stepgen'][index]['gearing']['encoder'] for index in self.geared})
+        # Ganged stepgens: the master of each slave, numbered over all stepgens
+        self.slaves = [index for index, stepgen_config in enumerate(config.get('stepgen', [])) for _ in stepgen_config.get('slaves', [])]
+        # Compensation: the stepgens with a compensation table
+        self.compensated = [index for index, stepgen_config in enumerate(config.get('stepgen', [])) if stepgen_config.get('compensation')]
+        self.instances = {
+            MODULE_WATCHDOG: 1,
+            MODULE_WALLCLOCK: 1,
+            MODULE_GPIO_OUT: gpio_out,
+            MODULE_GPIO_IN: gpio_in,
+            MODULE_PWM: pwm,
+            MODULE_STEPGEN: stepgen,
+            MODULE_ENCODER: encoders,
+            MODULE_PID: pid,
+            MODULE_MODBUS: modbus,
+            MODULE_SPI: spi,
+        }
+
+        # Header (magic, version, fingerprint) and reset
+        self.reset_address = 0x0C
+        # Config: loop_cycles and stepgen_stepdata
+        self.config = (0x10, 8)
+
+        # Write block
+        self.write_data = {}
+        address = self.config[0] + self.config[1]
+        write_start = address
+        for module_id, size in self._ordered(
+                (MODULE_WATCHDOG, 4),
+                (MODULE_GPIO_OUT, 4 * _words(gpio_out) if gpio_out else 0),
+                (MODULE_PWM, (4 * _words(pwm) + 8 * pwm) if pwm else 0),
+                (MODULE_STEPGEN, ((4 + 4 * _words(48 * stepgen) if self.compact_image else 8 + 8 * stepgen)
+                                  + (4 * _words(stepgen) + 4 * len(self.geared) if self.geared else 0)
+                                  + (4 * _words(len(self.slaves)) if self.slaves else 0)
+                                  + (8 + 8 * len(self.compensated) if self.compensated else 0)) if stepgen else 0),
+                (MODULE_ENCODER, 12 * _words(encoders) if encoders else 0),
+                (MODULE_PID, (4 * _words(pid) + 36 * pid) if pid else 0),
+                (MODULE_MODBUS, (4 * _words(modbus) + 4 * modbus_writes) if modbus else 0),
+                (MODULE_SPI, (4 * _words(spi) + 4 * spi_writes) if spi else 0)):
+            self.write_data[module_id] = (address, size)
+            address += size
+        self.write = (write_start, address - write_start)
+
+        # Read block
+        self.read_data = {}
+        read_start = address
+        for module_id, size in self._ordered(
+                (MODULE_WATCHDOG, 4),
+                (MODULE_WALLCLOCK, 8),
+                (MODULE_GPIO_IN, 4 * _words(gpio_in) if gpio_in else 0),
+                (MODULE_STEPGEN, (8 if self.compact_image else 12) * stepgen + 4 * len(self.slaves)),
+                (MODULE_ENCODER, (4 * _words(encoders) + (4 * _words(16 * encoders) if self.compact_image else 4 * encoders) + 4 * gearing_sources) if encoders else 0),
+                (MODULE_PID, 8 * pid),
+                (MODULE_MODBUS, 4 * modbus + 4 * modbus_reads),
+                (MODULE_SPI, 4 * spi_reads)):
+            self.read_data[module_id] = (address, size)
+            address += size
+        self.read = (read_start, address - read_start)
+
+    def _ordered(self, *modules):
+        """Returns the modules in the order of the MMIO: the modules in the slow rate
+        group are placed last."""
+        return sorted(modules, key=lambda module: module[0] in self.slow_modules)
+
+    def descriptor(self) -> List[int]:
+        """Returns the contents of the descriptor ROM."""
+        words = [
+            DESCRIPTOR_MAGIC,
+            (DESCRIPTOR_VERSION << 16) | len(self.instances),
+            self.reset_address,
+            (self.config[0] << 16) | self.config[1],
+            (self.write[0] << 16) | self.write[1],
+            (self.read[0] << 16) | self.read[1],
+            FEATURE_BLOCK_READ | FEATURE_CONFIG_READBACK | (FEATURE_COMPACT_IMAGE if self.compact_image else 0),
+        ]
+        for module_id, instances in sorted(self.instances.items()):
+            flags = MODULE_FLAG_COMPACT if self.compact_image and module_id in (MODULE_STEPGEN, MODULE_ENCODER) else 0
+            flags |= MODULE_FLAG_SLOW if module_id in self.slow_modules else 0
+            write = self.write_data.get(module_id, (0, 0))
+            read = self.read_data.get(module_id, (0, 0))
+            words += [
+                (module_id << 24) | (flags << 16) | instances,
+                ((write[0] - self.write[0] if write[1] else 0) << 16) | write[1],
+                ((read[0] - self.read[0] if read[1] else 0) << 16) | read[1],
+            ]
+        return words
+
+
+class Stepgen:
+    """Model of a single stepgen, at the resolution of the registers."""
+
+    SPEED_RESET = 0x8000_0000
+
+    def __init__(self, shift: int):
+        self.shift = shift
+        self.reset()
+
+    def reset(self):
+        # The position contains `shift` additional bits, the speed 8 additional bits
+        # with respect to the registers (see the pick-off in `firmware/stepgen.py`)
+        self.position = 0
+        self.speed = self.SPEED_RESET << 8
+        self.speed_target = self.SPEED_RESET << 8
+        self.max_acceleration = 0
+
+    def advance(self, cycles: int, enabled: bool):
+        """Advances the stepgen with the given number of clock cycles."""
+        target = self.speed_target if enabled else self.SPEED_RESET << 8
+        if self.max_acceleration == 0 or cycles * self.max_acceleration >= abs(target - self.speed):
+            # Target speed is reached within the given cycles
+            ramp = 0 if self.max_acceleration == 0 else abs(target - self.speed) // self.max_acceleration
+            self.position += ramp * (((self.speed + target) >> 9) - self.SPEED_RESET)
+            self.position += (cycles - ramp) * ((target >> 8) - self.SPEED_RESET)
+            self.speed = target
+        else:
+            # Still accelerating at the end of the cycles
+            end = self.speed + (cycles * self.max_acceleration if target > self.speed else -cycles * self.max_acceleration)
+            self.position += cycles * (((self.speed + end) >> 9) - self.SPEED_RESET)
+            self.speed = end
+
+    @property
+    def reported_position(self) -> int:
+        return (self.position >> self.shift) & 0xFFFF_FFFF_FFFF_FFFF
+
+    @property
+    def reported_speed(self) -> int:
+        return (self.speed >> 8) & 0xFFFF_FFFF
+
+
+class Emulator:
+    """Emulates a LitexCNC board for the given config-file."""
+
+    def __init__(self, config_file: str, delay: float = 0.0):
+        with open(config_file, 'rb') as file:
+            contents = file.read()
+        self.fingerprint = binascii.crc32(contents)
+        self.config = json.loads(contents)
+        self.clock_frequency = int(self.config['clock_frequency'])
+        self.layout = Layout(self.config)
+        self.delay = delay
+        self.version = _firmware_version()
+        self.descriptor = self.layout.descriptor()
+
+        # Same pick-off as `StepgenModule.create_from_config`
+        shift = 0
+        while self.clock_frequency / (1 << shift) > 400e3:
+            shift += 1
+        self.stepgens = [Stepgen(shift) for _ in range(self.layout.instances[MODULE_STEPGEN])]
+        self.shift = shift
+        # The difference in position of each slave with its master, same resolution as the
+        # position of the stepgen
+        self.slave_offsets = [0] * len(self.layout.slaves)
+        self.slave_latch = 0
+        # The compensation tables, which are written one entry at a time
+        self.compensation_tables = {
+            index: [0] * self.config['stepgen'][index]['compensation'].get('entries', 256) for index in self.layout.compensated
+        }
+
+        self.storage: Dict[int, int] = {}
+        self.start = time.monotonic_ns()
+        self.last_update = 0
+        self.apply_time = 0
+        self.pending: Optional[List] = None
+        self.watchdog_deadline: Optional[int] = None
+        self.watchdog_has_bitten = False
+        self.statistics = {'reads': 0, 'writes': 0, 'bitten': 0}
+        self.reset()
+
+    # ------------------------------------------------------------------------------
+    # Model
+    # ------------------------------------------------------------------------------
+    def wall_clock(self) -> int:
+        """Returns the number of clock cycles since the start of the emulator."""
+        return (time.monotonic_ns() - self.start) * self.clock_frequency // 1_000_000_000
+
+    def reset(self):
+        for stepgen in self.stepgens:
+            stepgen.reset()
+        self.slave_offsets = [0] * len(self.layout.slaves)
+        self.slave_latch = 0
+        self.pending = None
+        self.watchdog_deadline = None
+        self.watchdog_has_bitten = False
+
+    def update(self):
+        """Advances the model to the current wall clock."""
+        now = self.wall_clock()
+        # Watchdog
+        if self.watchdog_deadline is not None and now >= self.watchdog_deadline and not self.watchdog_has_bitten:
+            self.watchdog_has_bitten = True
+            self.statistics['bitten'] += 1
+        enabled = not self.watchdog_has_bitten
+        positions = [stepgen.position for stepgen in self.stepgens]
+        # Stepgen: the pending settings are applied at the apply time
+        if self.pending is not None and now >= self.apply_time:
+            for stepgen in self.stepgens:
+                stepgen.advance(max(self.apply_time - self.last_update, 0), enabled)
+            self.last_update = max(self.apply_time, self.last_update)
+            for stepgen, (speed_target, max_acceleration) in zip(self.stepgens, self.pending):
+                stepgen.speed_target = speed_target
+                stepgen.max_acceleration = max_acceleration
+            self.pending = None
+        for stepgen in self.stepgens:
+            stepgen.advance(now - self.last_update, enabled)
+        self.last_update = now
+        # Slaves: a latched slave holds its position, so the offset changes with the master
+        for index, master in enumerate(self.layout.slaves):
+            if self.slave_latch & (1 << index):
+                self.slave_offsets[index] -= self.stepgens[master].position - positions[master]
+        return now
+
+    def process_write(self, address: int, values: List[int]):
+        """Stores the written values and processes the data for the modules."""
+        now = self.update()
+        for index, value in enumerate(values):
+            self.storage[address + 4 * index] = value
+        if address == self.layout.reset_address:
+            if values[0] & 0x01:
+                self.reset()
+                # The apply time is reset by the FPGA
+                self.apply_time = now & 0xFFFF_FFFF if self.layout.compact_image else 0x8000_0000
+            return
+        if address != self.layout.write[0]:
+            return
+        self.statistics['writes'] += 1
+        # Watchdog: bit 31 is the enable flag, bits 30-0 the timeout in clock cycles. Just
+        # like the firmware, the flag is cleared as soon as a new timeout is written.
+        watchdog = self.storage[self.layout.write_data[MODULE_WATCHDOG][0]]
+        self.watchdog_deadline = now + (watchdog & 0x7FFF_FFFF) if watchdog & 0x8000_0000 else None
+        self.watchdog_has_bitten = False
+        # Stepgen: the settings are applied at the apply time
+        if self.stepgens:
+            start, size = self.layout.write_data[MODULE_STEPGEN]
+            data = b''.join(struct.pack('>I', self.storage.get(start + 4 * i, 0)) for i in range(size // 4))
+            if self.layout.compact_image:
+                apply_time = struct.unpack('>I', data[:4])[0]
+                # Extend the lower 32 bits of the apply time with respect to the wall clock
+                apply_time = now + ((apply_time - now + 0x8000_0000) & 0xFFFF_FFFF) - 0x8000_0000
+                settings = []
+                for index in range(len(self.stepgens)):
+                    field = data[4 + 6 * index:10 + 6 * index]
+                    speed = int.from_bytes(field[:3], 'big') << 16
+                    settings.append((speed, int.from_bytes(field[3:], 'big')))
+            else:
+                apply_time = struct.unpack('>Q', data[:8])[0]
+                settings = []
+                for index in range(len(self.stepgens)):
+                    speed, acceleration = struct.unpack('>II', data[8 + 8 * index:16 + 8 * index])
+                    settings.append((speed << 8, acceleration))
+            # Gearing: the encoders do not move, but the speed is applied directly
+            if self.layout.geared:
+                offset = 4 + 4 * _words(48 * len(self.stepgens)) if self.layout.compact_image else 8 + 8 * len(self.stepgens)
+                enable = int.from_bytes(data[offset:offset + 4 * _words(len(self.stepgens))], 'big')
+                for index in self.layout.geared:
+                    if enable & (1 << index):
+                        settings[index] = (settings[index][0], 0)
+            # Slaves: the latch is applied directly
+            if self.layout.slaves:
+                offset = size - 4 * _words(len(self.layout.slaves))
+                if self.layout.compensated:
+                    offset -= 8 + 8 * len(self.layout.compensated)
+                self.slave_latch = int.from_bytes(data[offset:offset + 4 * _words(len(self.layout.slaves))], 'big')
+            # Compensation: the entry is written to the table
+            if self.layout.compensated:
+                offset = size - 8 - 8 * len(self.layout.compensated)
+                entry = int.from_bytes(data[offset:offset + 8], 'big')
+                table = self.compensation_tables.get((entry >> 48) & 0x7FFF)
+                if entry >> 63 and table is not None and ((entry >> 32) & 0xFFFF) < len(table):
+                    table[(entry >> 32) & 0xFFFF] = _signed(entry & 0xFFFF_FFFF)
+            self.apply_time = apply_time
+            self.pending = settings
+            self.update()
+
+    def read_block(self, now: int) -> Dict[int, int]:
+        """Returns the status registers of the read block."""
+        registers = {}
+        layout = self.layout
+        registers[layout.read_data[MODULE_WATCHDOG][0]] = int(self.watchdog_has_bitten)
+        address = layout.read_data[MODULE_WALLCLOCK][0]
+        registers[address] = (now >> 32) & 0xFFFF_FFFF
+        registers[address + 4] = now & 0xFFFF_FFFF
+        address = layout.read_data[MODULE_STEPGEN][0]
+        for stepgen in self.stepgens:
+            if layout.compact_image:
+                registers[address] = (stepgen.reported_position >> 16) & 0xFFFF_FFFF
+                registers[address + 4] = stepgen.reported_speed & 0xFFFF_FF00
+                address += 8
+            else:
+                registers[address] = stepgen.reported_position >> 32
+                registers[address + 4] = stepgen.reported_position & 0xFFFF_FFFF
+                registers[address + 8] = stepgen.reported_speed
+                address += 12
+        for offset in self.slave_offsets:
+            registers[address] = (offset >> (self.shift + 16)) & 0xFFFF_FFFF
+            address += 4
+        # PID: the error is the setpoint, as the encoders do not move
+        pid = layout.instances[MODULE_PID]
+        if pid:
+            start = layout.write_data[MODULE_PID][0]
+            enable = 0
+            for word in range(_words(pid)):
+                enable = (enable << 32) | self.storage.get(start + 4 * word, 0)
+            start += 4 * _words(pid)
+            address = layout.read_data[MODULE_PID][0]
+            for index in range(pid):
+                setpoint, feedforward, pgain = (_signed(self.storage.get(start + 36 * index + 4 * word, 0)) for word in range(3))
+                max_output = self.storage.get(start + 36 * index + 32, 0) or 2**31 - 1
+                output = max(-max_output, min(max_output, feedforward + ((pgain * setpoint) >> 16))) if enable & (1 << index) else 0
+                registers[address] = setpoint & 0xFFFF_FFFF
+                registers[address + 4] = output & 0xFFFF_FFFF
+                address += 8
+        return registers
+
+    def read(self, addresses: List[int]) -> List[int]:
+        """Returns the values of the requested registers."""
+        now = self.update()
+        registers = self.read_block(now)
+        if addresses and addresses[0] == self.layout.read[0]:
+            self.statistics['reads'] += 1
+        values = []
+        for address in addresses:
+            if address == 0x00:
+                values.append(LITEXCNC_MAGIC)
+            elif address == 0x04:
+                values.append(self.version)
+            elif address == 0x08:
+                values.append(self.fingerprint)
+            elif DESCRIPTOR_ADDRESS <= address < DESCRIPTOR_ADDRESS + 4 * len(self.descriptor):
+                values.append(self.descriptor[(address - DESCRIPTOR_ADDRESS) // 4])
+            elif address in registers:
+                values.append(registers[address])
+            else:
+                values.append(self.storage.get(address, 0))
+        return values
+
+    # ------------------------------------------------------------------------------
+    # Transport
+    # ------------------------------------------------------------------------------
+    def handle_packet(self, packet: bytes) -> Optional[bytes]:
+        """Processes a single Etherbone packet and returns the reply (if any)."""
+        if len(packet) < 8 or packet[:2] != ETHERBONE_MAGIC:
+            return None
+        if packet[2] & ETHERBONE_PROBE_FLAG:
+            return ETHERBONE_MAGIC + bytes([0x10 | ETHERBONE_PROBE_REPLY]) + packet[3:8]
+        if len(packet) < 16:
+            return None
+        write_count, read_count = packet[10], packet[11]
+        # A record contains the writes followed by the reads, which are executed in
+        # that order
+        offset = 12
+        if write_count:
+            address = struct.unpack('>I', packet[offset:offset + 4])[0]
+            values = struct.unpack(f'>{write_count}I', packet[offset + 4:offset + 4 + 4 * write_count])
+            self.process_write(address, list(values))
+            offset += 4 + 4 * write_count
+        if read_count:
+            base = packet[offset:offset + 4]
+            if not write_count and len(packet) == 16:
+                # Block read: no addresses given, the words are read starting at the
+                # base return address (see `firmware/block_read.py`)
+                start = struct.unpack('>I', base)[0]
+                addresses = tuple(start + 4 * index for index in range(read_count))
+            else:
+                addresses = struct.unpack(f'>{read_count}I', packet[offset + 4:offset + 4 + 4 * read_count])
+            values = self.read(list(addresses))
+            # The reply is a write-record to the base return address containing the
+            # requested values
+            header = bytearray(packet[:12]) + base
+            header[10], header[11] = read_count, 0
+            return bytes(header) + b''.join(struct.pack('>I', value) for value in values)
+        return None
+
+    def serve(self, ip_address: str, port: int = ETHERBONE_DEFAULT_PORT, callback=None, interval: float = 1.0):
+        """Answers the packets received on the given address until interrupted. The
+        replies are sent to the same port on the host, just like the firmware does."""
+        with socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP) as sock:
+            sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+            sock.bind((ip_address, port))
+            sock.settimeout(interval)
+            next_report = time.monotonic() + interval
+            while True:
+                try:
+                    packet, (host, _) = sock.recvfrom(2048)
+                    reply = self.handle_packet(packet)
+                    if reply is not None:
+                        if self.delay:
+                            time.sleep(self.delay)
+                        sock.sendto(reply, (host, port))
+                except socket.timeout:
+                    pass
+                if callback and time.monotonic() >= next_report:
+                    callback(self)
+                    next_report += interval
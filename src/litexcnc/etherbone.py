@@ -0,0 +1,172 @@
+"""
+Minimal Etherbone client in pure Python, used by the command-line tools to talk
+to a LitexCNC board without LinuxCNC. The packet layout is the same as used by
+the driver (see ``driver/etherbone.h``): a 16 byte header, followed by either
+the data to write or the addresses to read.
+"""
+import binascii
+import ipaddress
+import select
+import socket
+import struct
+import time
+from typing import Dict, Iterable, List, Optional
+
+ETHERBONE_MAGIC = b'\x4e\x6f'
+ETHERBONE_DEFAULT_PORT = 1234
+ETHERBONE_PROBE_FLAG = 0x01
+ETHERBONE_PROBE_REPLY = 0x02
+
+LITEXCNC_MAGIC = 0x18052022
+
+
+def probe_packet() -> bytes:
+    """Returns an Etherbone probe packet."""
+    return ETHERBONE_MAGIC + bytes([0x10 | ETHERBONE_PROBE_FLAG, 0x44, 0, 0, 0, 0])
+
+
+def read_request(address: int, words: int) -> bytes:
+    """Returns a packet which requests ``words`` consecutive registers, starting at
+    ``address``."""
+    header = ETHERBONE_MAGIC + bytes([0x10, 0x44, 0, 0, 0, 0, 0x00, 0x0f, 0, words])
+    header += struct.pack('>I', 0)
+    return header + b''.join(struct.pack('>I', address + 4 * i) for i in range(words))
+
+
+def write_request(address: int, data: bytes) -> bytes:
+    """Returns a packet which writes ``data`` to the consecutive registers, starting
+    at ``address``."""
+    header = ETHERBONE_MAGIC + bytes([0x10, 0x44, 0, 0, 0, 0, 0x00, 0x0f, len(data) // 4, 0])
+    return header + struct.pack('>I', address) + data
+
+
+def parse_read_response(packet: bytes) -> List[int]:
+    """Returns the registers in the response to a read request."""
+    return list(struct.unpack(f'>{(len(packet) - 16) // 4}I', packet[16:]))
+
+
+def config_fingerprint(path: str) -> int:
+    """Returns the fingerprint of the config-file, equal to the one stored in the
+    firmware and calculated by the driver."""
+    with open(path, 'rb') as config_file:
+        return binascii.crc32(config_file.read())
+
+
+def format_version(version: int) -> str:
+    """Formats the version as stored on the board."""
+    return f"{(version >> 16) & 0xff}.{(version >> 8) & 0xff}.{version & 0xff}"
+
+
+class DiscoveredBoard:
+    """A board which responded to the Etherbone probe."""
+
+    def __init__(self, ip_address: str):
+        self.ip_address = ip_address
+        self.magic: Optional[int] = None
+        self.version: Optional[int] = None
+        self.fingerprint: Optional[int] = None
+
+    @property
+    def is_litexcnc(self) -> bool:
+        return self.magic == LITEXCNC_MAGIC
+
+
+def _create_socket(port: int) -> socket.socket:
+    """Creates a socket bound to the port the boards reply to."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+    sock.bind(('', port))
+    return sock
+
+
+def _receive(sock: socket.socket, timeout: float):
+    """Yields all packets received on the socket until the timeout expires."""
+    end = time.monotonic() + timeout
+    while True:
+        remaining = end - time.monotonic()
+        if remaining <= 0:
+            return
+        readable, _, _ = select.select([sock], [], [], remaining)
+        if not readable:
+            return
+        yield sock.recvfrom(2048)
+
+
+def discover(network: str, port: int = ETHERBONE_DEFAULT_PORT, timeout: float = 0.2) -> List[DiscoveredBoard]:
+    """Discovers the boards on the given network (i.e. ``192.168.2.0/24``).
+
+    An Etherbone probe is sent to the broadcast address and to every host on the
+    network. The header (magic, version and fingerprint) of all boards which reply
+    is then read in parallel.
+    """
+    network = ipaddress.IPv4Network(network, strict=False)
+    boards: Dict[str, DiscoveredBoard] = {}
+
+    with _create_socket(port) as sock:
+        # Phase 1: probe the network
+        probe = probe_packet()
+        sock.sendto(probe, (str(network.broadcast_address), port))
+        for host in network.hosts():
+            sock.sendto(probe, (str(host), port))
+        for packet, (address, _) in _receive(sock, timeout):
+            if packet[:2] != ETHERBONE_MAGIC or not packet[2] & ETHERBONE_PROBE_REPLY:
+                continue
+            if ipaddress.IPv4Address(address) not in network:
+                continue
+            boards.setdefault(address, DiscoveredBoard(address))
+
+        # Phase 2: read the header of all boards in parallel
+        request = read_request(0x0, 3)
+        for address in boards:
+            sock.sendto(request, (address, port))
+        pending = set(boards)
+        for packet, (address, _) in _receive(sock, timeout):
+            if address not in pending or len(packet) != len(request):
+                continue
+            board = boards[address]
+            board.magic, board.version, board.fingerprint = parse_read_response(packet)
+            pending.discard(address)
+            if not pending:
+                break
+
+    return sorted(boards.values(), key=lambda board: ipaddress.IPv4Address(board.ip_address))
+
+
+class EtherboneConnection:
+    """A connection with a single board."""
+
+    def __init__(self, ip_address: str, port: int = ETHERBONE_DEFAULT_PORT, timeout: float = 0.01):
+        self.address = (ip_address, port)
+        self.sock = _create_socket(port)
+        self.sock.connect(self.address)
+        self.sock.settimeout(timeout)
+
+    def close(self):
+        self.sock.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def read(self, address: int, words: int) -> List[int]:
+        """Reads ``words`` consecutive registers, starting at ``address``. Large
+        reads are split in multiple packets."""
+        result = []
+        while words:
+            chunk = min(words, 63)
+            self.sock.send(read_request(address, chunk))
+            result += parse_read_response(self.sock.recv(2048))
+            address += 4 * chunk
+            words -= chunk
+        return result
+
+    def write(self, address: int, values: Iterable[int]):
+        """Writes the values to the consecutive registers, starting at ``address``."""
+        values = list(values)
+        while values:
+            chunk, values = values[:63], values[63:]
+            self.sock.send(write_request(address, b''.join(struct.pack('>I', value) for value in chunk)))
+            address += 4 * len(chunk)
@@ -0,0 +1,74 @@
+"""
+Extension of the Etherbone core of LiteEth with a block read. In the Etherbone protocol
+each read in a record is given by its own address, which makes the request to read the
+status of the FPGA as large as the response. With this extension, a read-only record
+without any read addresses reads ``rcount`` consecutive words, starting at the base
+return address of the record. The request to read the whole status block of the FPGA
+therefore is a fixed 16-byte packet, independent of the size of the status block.
+
+The base return address is echoed in the response. The driver uses it to match each
+response with its request, so a late response to the read of the slow group is not
+mistaken for the status block. All other records are handled exactly as by the original
+Etherbone core, so the FPGA can still be accessed with standard Etherbone tools.
+"""
+# Import from litex
+from migen import *
+from liteeth.frontend import etherbone
+
+
+class LiteEthEtherboneBlockReadReceiver(etherbone.LiteEthEtherboneRecordReceiver):
+    """
+    Record receiver which adds the block read to the record receiver of LiteEth. The
+    states of the original receiver are extended; the statements added here take
+    precedence over the original statements in the same state.
+    """
+
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+
+        fifo = self.fifo
+        source = self.source
+
+        # # #
+
+        # A record without any writes and with only the base return address (the first
+        # word is also the last word of the packet) is a block read.
+        block_read = Signal()
+        block_base = Signal(32)
+        block_count = Signal(8)
+        block_rcount = Signal(8)
+        self.sync += [
+            If(self.fsm.ongoing("IDLE") & fifo.source.valid,
+                block_read.eq(fifo.source.last & (fifo.source.wcount == 0) & (fifo.source.rcount != 0)),
+                block_base.eq(fifo.source.data),
+                block_rcount.eq(fifo.source.rcount),
+                block_count.eq(0),
+            ).Elif(self.fsm.ongoing("RECEIVE_READS") & block_read & source.valid & source.ready,
+                block_count.eq(block_count + 1),
+                If(source.last,
+                    block_read.eq(0),
+                )
+            )
+        ]
+
+        # The addresses are generated instead of taken from the packet. The packet has
+        # already been consumed completely, so nothing is read from the FIFO.
+        self.fsm.act("RECEIVE_READS",
+            If(block_read,
+                source.valid.eq(1),
+                source.last.eq(block_count == block_rcount - 1),
+                source.count.eq(block_rcount),
+                source.base_addr.eq(block_base),
+                source.addr.eq(block_base[2:] + block_count),
+                fifo.source.ready.eq(0),
+            )
+        )
+
+
+def add_block_read():
+    """
+    Replaces the record receiver of the Etherbone core of LiteEth with the receiver
+    supporting the block read. This function must be called before Etherbone is added
+    to the SoC.
+    """
+    etherbone.LiteEthEtherboneRecordReceiver = LiteEthEtherboneBlockReadReceiver
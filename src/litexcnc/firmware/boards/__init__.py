@@ -6,6 +6,7 @@ from .colorlight import (
     ColorLight_5A_75E_V6_0,
     ColorLight_5A_75E_V7_1
 )
+from .sim import Simulation
 
 
 __all__ = [
@@ -14,5 +15,6 @@ __all__ = [
     'ColorLight_5A_75B_V7_0',
     'ColorLight_5A_75B_V8_0',
     'ColorLight_5A_75E_V6_0',
-    'ColorLight_5A_75E_V7_1'
+    'ColorLight_5A_75E_V7_1',
+    'Simulation'
 ]
\ No newline at end of file
@@ -44,6 +44,7 @@ class ColorLightBase(SoCMini):
             phy=self.ethphy,
             mac_address=config.etherbone.mac_address,
             ip_address=str(config.etherbone.ip_address),
+            udp_port=config.etherbone.port,
             buffer_depth=255,
             data_width=32
         )
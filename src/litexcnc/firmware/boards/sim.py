@@ -0,0 +1,111 @@
+"""
+Simulation of the firmware with Verilator. The complete SoC (MMIO, watchdog, stepgen,
+PWM, encoder, GPIO and the Etherbone core of LiteEth) is simulated cycle-accurately.
+The ethernet of the simulated board is connected to a tap-interface on the host, so
+the unmodified driver `litexcnc_eth` communicates with the simulation over UDP, in
+exactly the same way as with a real board.
+
+The pins in the config are created as ports of the simulation. Pins on a connector
+(i.e. `j9:0`) are resolved with connectors which are derived from the config, so the
+config of an existing board can be simulated without changing the pins.
+"""
+import re
+from typing import Any, Dict, List, Tuple
+
+# Imports for defining the board
+from liteeth.phy.model import LiteEthPHYModel
+from litex.build.generic_platform import Pins, Subsignal
+from litex.build.io import CRG
+from litex.build.sim import SimPlatform
+from litex.build.sim.config import SimConfig
+from litex.soc.integration.soc_core import *
+
+from ..soc import LitexCNC_Firmware
+
+
+# IOs ---------------------------------------------------------------
+_io = [
+    # clock and reset
+    ("sys_clk", 0, Pins(1)),
+    ("sys_rst", 0, Pins(1)),
+
+    # ethernet (connected to the tap-interface by the simulator)
+    ("eth_clocks", 0,
+        Subsignal("tx", Pins(1)),
+        Subsignal("rx", Pins(1)),
+    ),
+    ("eth", 0,
+        Subsignal("source_valid", Pins(1)),
+        Subsignal("source_ready", Pins(1)),
+        Subsignal("source_data",  Pins(8)),
+
+        Subsignal("sink_valid",   Pins(1)),
+        Subsignal("sink_ready",   Pins(1)),
+        Subsignal("sink_data",    Pins(8)),
+    ),
+]
+
+# Pattern of a pin on a connector, i.e. `j9:0`
+CONNECTOR_PIN = re.compile(r"^(\w+):(\d+)$")
+
+
+def _pins(value: Any, key: str = "") -> List[str]:
+    """Returns all pins in the (part of the) config, recursively."""
+    if isinstance(value, dict):
+        return [pin for k, v in value.items() for pin in _pins(v, k)]
+    if isinstance(value, (list, tuple)):
+        return [pin for v in value for pin in _pins(v, key)]
+    if isinstance(value, str) and (key == "pin" or key.startswith("pin_") or key.endswith("_pin")):
+        return [value]
+    return []
+
+
+def _connectors(config: 'LitexCNC_Firmware') -> List[Tuple[str, str]]:
+    """Returns the connectors required for all pins on a connector in the config. Each
+    pin of a connector is a separate port of the simulation, i.e. `j9_0`."""
+    sizes: Dict[str, int] = {}
+    for pin in _pins(config.dict(exclude={'baseclass'})):
+        match = CONNECTOR_PIN.match(pin)
+        if match:
+            sizes[match[1]] = max(sizes.get(match[1], 0), int(match[2]) + 1)
+    return [
+        (name, " ".join(f"{name}_{index}" for index in range(size)))
+        for name, size in sorted(sizes.items())
+    ]
+
+
+class Simulation(SoCMini):
+
+    def __init__(self, config: 'LitexCNC_Firmware'):
+
+        platform = SimPlatform("SIM", _io, _connectors(config), toolchain="verilator")
+
+        # SoCMini ----------------------------------------------------------------------------------
+        self.clock_frequency = config.clock_frequency
+        SoCMini.__init__(self, platform, clk_freq=config.clock_frequency,
+            ident          = config.board_name,
+            ident_version  = True,
+        )
+
+        # CRG --------------------------------------------------------------------------------------
+        self.submodules.crg = CRG(platform.request("sys_clk"))
+
+        # Etherbone --------------------------------------------------------------------------------
+        self.submodules.ethphy = LiteEthPHYModel(self.platform.request("eth"))
+        self.add_etherbone(
+            phy=self.ethphy,
+            mac_address=config.etherbone.mac_address,
+            ip_address=str(config.etherbone.ip_address),
+            udp_port=config.etherbone.port,
+            buffer_depth=255,
+            data_width=32
+        )
+
+
+def sim_config(config: 'LitexCNC_Firmware', interface: str, host_ip_address: str) -> SimConfig:
+    """Returns the configuration of the simulator: the clock of the board and the
+    tap-interface on the host to which the ethernet of the board is connected."""
+    sim_config = SimConfig()
+    sim_config.add_clocker("sys_clk", freq_hz=config.clock_frequency)
+    sim_config.add_module("ethernet", "eth", args={"interface": interface, "ip": host_ip_address})
+    return sim_config
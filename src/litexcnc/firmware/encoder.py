@@ -3,7 +3,7 @@ import math
 import warnings
 
 # Imports for creating a json-definition
-from pydantic import BaseModel, Field, root_validator
+from pydantic import BaseModel, Field, root_validator, validator
 
 # Imports for creating a LiteX/Migen module
 from litex.soc.interconnect.csr import *
@@ -14,16 +14,18 @@ from litex.build.generic_platform import *
 
 
 class EncoderConfig(BaseModel):
-    """Configuration for hardware counting of quadrature encoder signals."""
+    """Configuration for hardware counting of quadrature encoder, up/down and step/dir signals."""
     name: str = Field(
         None,
         description="The name of the encoder as used in LinuxCNC HAL-file (optional). "
     )
     pin_A: str = Field(
-        description="The pin on the FPGA-card for Encoder A-signal."
+        description="The pin on the FPGA-card for Encoder A-signal. In `up_down` mode this is "
+        "the up-signal, in `step_dir` mode the step-signal."
     )
     pin_B: str = Field(
-        description="The pin on the FPGA-card for Encoder B-signal."
+        description="The pin on the FPGA-card for Encoder B-signal. In `up_down` mode this is "
+        "the down-signal, in `step_dir` mode the direction-signal."
     )
     pin_Z: str = Field(
         None,
@@ -51,13 +53,59 @@ class EncoderConfig(BaseModel):
         description="The value to which the counter will be resetted. This is also the initial value "
         "at which the counter is instantiated. The reset value should be between the minimum value "
         "and maximum value if these are defined. Default value: 0."
-        "NOTE: when the encoder has X4 set to False, the value reported in HAL will be this value "
-        "divided by 4."
     )
     io_standard: str = Field(
         "LVCMOS33",
         description="The IO Standard (voltage) to use for the pins."
     )
+    mode: str = Field(
+        "quadrature",
+        description="The counting mode of the encoder. Either `quadrature` (phase A and B), "
+        "`up_down` (counts up on each rising edge of A and down on each rising edge of B) or "
+        "`step_dir` (counts each rising edge of A, up when B is high and down when B is low). "
+        "The decoding and `x4_mode` only apply to the `quadrature` mode. Default value: quadrature."
+    )
+    mpg: bool = Field(
+        False,
+        description="When true, the driver exports the pins to use the encoder as a manual pulse "
+        "generator (MPG), which converts the counts into a jog velocity limited in acceleration "
+        "and jerk. Default value: False."
+    )
+    decode: str = Field(
+        "x1",
+        description="The decoding of the quadrature signal when `x4_mode` is turned off in HAL. "
+        "Either `x1` (one count per full cycle, on the edges of phase A while phase B is low) or "
+        "`x2` (two counts per full cycle, on each edge of phase A). When `x4_mode` is on, each edge "
+        "of both phases is counted. Default value: x1."
+    )
+    filter_length: int = Field(
+        1,
+        description="The number of samples of the majority filter on the inputs. A change of an "
+        "input is only passed to the decoder when the majority of the last samples has the new "
+        "level, which suppresses glitches shorter than half the length of the filter (in clock-cycles). "
+        "The length should be odd and at most 15. Default value: 1 (no filter)."
+    )
+
+    @validator('mode')
+    def check_mode(cls, value):
+        """Checks whether the counting mode is known."""
+        if value not in ('quadrature', 'up_down', 'step_dir'):
+            raise ValueError('Mode should be either `quadrature`, `up_down` or `step_dir`.')
+        return value
+
+    @validator('decode')
+    def check_decode(cls, value):
+        """Checks whether the decoding is known."""
+        if value not in ('x1', 'x2'):
+            raise ValueError('Decode should be either `x1` or `x2`.')
+        return value
+
+    @validator('filter_length')
+    def check_filter_length(cls, value):
+        """Checks whether the length of the filter is odd and not too long."""
+        if value < 1 or value > 15 or not value % 2:
+            raise ValueError('Filter length should be an odd number between 1 and 15.')
+        return value
 
     @root_validator(skip_on_failure=True)
     def check_min_max_reset_value(cls, values):
@@ -92,12 +140,15 @@ class EncoderConfig(BaseModel):
 
 
 class EncoderModule(Module, AutoDoc):
-    """Hardware counting of quadrature encoder signals."""
+    """Hardware counting of quadrature encoder, up/down and step/dir signals."""
     pads_layout = [("pin_A", 1), ("pin_B", 1), ("pin_Z", 1)]
 
     COUNTER_SIZE = 32
+    # The counts are measured in windows of 2^GEARING_WINDOW_BITS clock-cycles for the
+    # electronic gearing of the stepgens
+    GEARING_WINDOW_BITS = 10
 
-    def __init__(self, encoder_config: EncoderConfig, pads=None) -> None:
+    def __init__(self, encoder_config: EncoderConfig, pads=None, gearing=False) -> None:
 
         # AutoDoc implementation
         self.intro = ModuleDoc("""
@@ -117,6 +168,22 @@ class EncoderModule(Module, AutoDoc):
         that at a count-rate of 2.5 MHz (which is deemed the real practical upper
         limit). The counter will overflow in 858 seconds (just shy of 15 minutes)
         in case it is running at top speed and it is not reset.
+
+        When the encoder drives a stepgen (electronic gearing), the counts are also
+        measured in fixed windows, which start when the lower bits of the wall-clock
+        are zero. The counts in the last window are available as `gearing_rate`. As the
+        counts are measured directly, the rate is not affected by the index pulse.
+
+        The decoding can be changed at runtime between x4 (each edge of both phases
+        is counted) and the decoding of the configuration (x1 or x2). The counter is
+        not changed when switching, so the position of the index is kept. The inputs
+        can be filtered with a majority filter, which adds a delay of the length of
+        the filter to the signals.
+
+        Besides quadrature signals, the encoder can count up/down signals (up on
+        the rising edge of A, down on the rising edge of B, no count when both
+        rise in the same clock-cycle) or step/dir signals (the rising edges of A,
+        in the direction of B), for example from a manual pulse generator.
         """)
         # Require to test working with Verilog, basically creates extra signals not
         # connected to any pads.
@@ -135,6 +202,7 @@ class EncoderModule(Module, AutoDoc):
         self.index_pulse = Signal()
         self.reset_index_pulse = Signal()
         self.reset = Signal()
+        self.x4_mode = Signal(reset=1)
 
         # Internal fields
         pin_A_delayed = Signal(3)
@@ -143,25 +211,49 @@ class EncoderModule(Module, AutoDoc):
                                    # used to detect rising edges.
         count_ena = Signal()
         count_dir = Signal()
+        count = Signal()
+        count_x4 = Signal()
+        count_reduced = Signal()
 
         # Program
         # - Create the connections to the pads
         self.comb += [
-            pin_A.eq(pads.Encoder_A),
-            pin_B.eq(pads.Encoder_B),
+            pin_A.eq(self.create_majority_filter(pads.Encoder_A, encoder_config.filter_length)),
+            pin_B.eq(self.create_majority_filter(pads.Encoder_B, encoder_config.filter_length)),
         ]
         # - Add support for Z-index if pin is defined. If not, the Signal is set to be constant
         if hasattr(pads, 'Encoder_Z'):
-            self.comb += pin_Z.eq(pads.Encoder_Z)
+            self.comb += pin_Z.eq(self.create_majority_filter(pads.Encoder_Z, encoder_config.filter_length))
         else:
             self.comb += pin_Z.eq(Constant(0))
         # - In most cases, the "quadX" signals are not synchronous to the FPGA clock. The
         #   classical solution is to use 2 extra D flip-flops per input to avoid introducing
         #   metastability into the counter (src: https://www.fpga4fun.com/QuadratureDecoder.html)
-        self.comb += [
-            count_ena.eq(pin_A_delayed[1] ^ pin_A_delayed[2] ^ pin_B_delayed[1] ^ pin_B_delayed[2]),
-            count_dir.eq(pin_A_delayed[1] ^ pin_B_delayed[2])
-        ]
+        # - Up/down and step/dir signals are counted on the rising edges. For quadrature
+        #   signals the direction is the same for all decodings. In x4 mode each edge is
+        #   counted, in x2 mode only the edges of phase A and in x1 mode only the edges of
+        #   phase A while phase B is low (rising edge forward, falling edge backward).
+        if encoder_config.mode == 'up_down':
+            self.comb += [
+                count_ena.eq((pin_A_delayed[1] & ~pin_A_delayed[2]) ^ (pin_B_delayed[1] & ~pin_B_delayed[2])),
+                count_dir.eq(pin_A_delayed[1] & ~pin_A_delayed[2]),
+            ]
+        elif encoder_config.mode == 'step_dir':
+            self.comb += [
+                count_ena.eq(pin_A_delayed[1] & ~pin_A_delayed[2]),
+                count_dir.eq(pin_B_delayed[2]),
+            ]
+        else:
+            if encoder_config.decode == 'x2':
+                self.comb += count_reduced.eq(pin_A_delayed[1] ^ pin_A_delayed[2])
+            else:
+                self.comb += count_reduced.eq((pin_A_delayed[1] ^ pin_A_delayed[2]) & ~pin_B_delayed[2])
+            self.comb += [
+                count_x4.eq(pin_A_delayed[1] ^ pin_A_delayed[2] ^ pin_B_delayed[1] ^ pin_B_delayed[2]),
+                count_ena.eq(Mux(self.x4_mode, count_x4, count_reduced)),
+                count_dir.eq(pin_A_delayed[1] ^ pin_B_delayed[2]),
+            ]
+        self.comb += count.eq(count_ena & ~(self.index_enable & pin_Z_delayed[1] & ~pin_Z_delayed[2]))
         self.sync += [
             pin_A_delayed.eq(Cat(pin_A, pin_A_delayed[:2])),
             pin_B_delayed.eq(Cat(pin_B, pin_B_delayed[:2])),
@@ -190,7 +282,7 @@ class EncoderModule(Module, AutoDoc):
             # at exact the same clock-cycle, which (in simulations) showed the reset
             # would not happen.
             If(
-                count_ena & ~(self.index_enable & pin_Z_delayed[1] & ~pin_Z_delayed[2]),
+                count,
                 If(
                     count_dir,
                     self.create_counter_increase(encoder_config),
@@ -200,6 +292,48 @@ class EncoderModule(Module, AutoDoc):
             )
         ]
 
+        # Measure the counts in each window for the electronic gearing
+        if gearing:
+            self.gearing_strobe = Signal()
+            self.gearing_rate = Signal((16, True))
+            gearing_counts = Signal((16, True))
+            gearing_step = Signal((2, True))
+            self.comb += If(
+                count,
+                If(count_dir, gearing_step.eq(1)).Else(gearing_step.eq(-1))
+            ).Else(
+                gearing_step.eq(0)
+            )
+            self.sync += If(
+                self.reset,
+                gearing_counts.eq(0),
+                self.gearing_rate.eq(0)
+            ).Elif(
+                self.gearing_strobe,
+                self.gearing_rate.eq(gearing_counts + gearing_step),
+                gearing_counts.eq(0)
+            ).Else(
+                gearing_counts.eq(gearing_counts + gearing_step)
+            )
+
+    def create_majority_filter(self, pin, length):
+        """
+        Returns the input filtered by a majority filter over the last samples. The input
+        is first synchronized to the clock of the FPGA. When the length of the filter is
+        1, the input is returned as is, as it is synchronized by the decoder.
+        """
+        if length == 1:
+            return pin
+        synchronized = Signal(2)
+        samples = Signal(length)
+        filtered = Signal()
+        self.sync += [
+            synchronized.eq(Cat(pin, synchronized[0])),
+            samples.eq(Cat(synchronized[1], samples[:-1])),
+            filtered.eq(sum(samples[i] for i in range(length)) > (length >> 1))
+        ]
+        return filtered
+
     def create_counter_increase(self, encoder_config: EncoderConfig):
         """
         Creates the statements for increasing the counter. When a maximum
@@ -247,15 +381,39 @@ class EncoderModule(Module, AutoDoc):
             by writing a 1 for the given encoder to the `reset index pulse`-register.
             """
         )
-        for index in range(len(config)):
+        # Compact image: the lower 16 bits of the counters are packed in a single register,
+        # the driver extends these to the full count by adding the difference with the
+        # previous read. The first encoder is stored in the most significant bits.
+        if mmio.compact_image:
+            mmio.encoder_counters = CSRStatus(
+                size=int(math.ceil(float(len(config))/2))*32,
+                name='encoder_counters',
+                description="Encoder counters\n"
+                "Register containing the lower 16 bits of the count of all encoders."
+            )
+        else:
+            for index in range(len(config)):
+                setattr(
+                    mmio,
+                    f'encoder_{index}_counter',
+                    CSRStatus(
+                        size=cls.COUNTER_SIZE,
+                        name=f'encoder_{index}_counter',
+                        description="Encoder counter\n"
+                        f"Register containing the count for register {index}."
+                    )
+                )
+        # The counts in the last window of the encoders which drive a stepgen
+        for index in mmio.gearing_sources:
             setattr(
                 mmio,
-                f'encoder_{index}_counter',
+                f'encoder_{index}_gearing_rate',
                 CSRStatus(
-                    size=cls.COUNTER_SIZE,
-                    name=f'encoder_{index}_counter',
-                    description="Encoder counter\n"
-                    f"Register containing the count for register {index}."
+                    size=32,
+                    name=f'encoder_{index}_gearing_rate',
+                    description="Encoder gearing rate\n"
+                    f"Register containing the counts of encoder {index} in the last window of "
+                    f"{2**cls.GEARING_WINDOW_BITS} clock-cycles, as used by the electronic gearing."
                 )
             )
 
@@ -291,6 +449,15 @@ class EncoderModule(Module, AutoDoc):
             has processed it.
             """
         )
+        mmio.encoder_x4_mode = CSRStorage(
+            size=int(math.ceil(float(len(config))/32))*32,
+            name='encoder_x4_mode',
+            description="""X4 mode
+            Register containing the `x4 mode`-flags. When true, each edge of both phases is
+            counted, otherwise the decoding of the configuration (x1 or x2) is used.
+            """,
+            reset=2**(int(math.ceil(float(len(config))/32))*32) - 1
+        )
 
     @classmethod
     def create_from_config(cls, soc: SoC, config: List[EncoderConfig]):
@@ -299,13 +466,16 @@ class EncoderModule(Module, AutoDoc):
 
         NOTE: the configuration must be a list and should contain all the encoders at
         once. Otherwise naming conflicts will occur.
+
+        Returns the created encoders, so these can drive the stepgens with gearing.
         """
         # Don't create the module when the config is empty (no encoders 
         # defined in this case)
         if not config:
-            return
+            return []
         
         # At least 1 encoder exits, create the module(s).
+        encoders = []
         # - create a list of `index_pulse`-flags. These will be added later on
         #   outside the mainloop in a Cat-statement.
         index_pulse = []
@@ -329,9 +499,15 @@ class EncoderModule(Module, AutoDoc):
                 ])
             # Create the encoder
             pads = soc.platform.request("encoder", index)
-            encoder = cls(encoder_config=encoder_config, pads=pads)
+            encoder = cls(encoder_config=encoder_config, pads=pads, gearing=index in soc.MMIO_inst.gearing_sources)
             # Add the encoder to the soc
             soc.submodules += encoder
+            encoders.append(encoder)
+            # Measure the counts in the windows of the gearing, all encoders use the same
+            # windows based on the wall-clock
+            if index in soc.MMIO_inst.gearing_sources:
+                soc.comb += encoder.gearing_strobe.eq(soc.MMIO_inst.wall_clock.status[:cls.GEARING_WINDOW_BITS] == 0)
+                soc.sync += getattr(soc.MMIO_inst, f"encoder_{index}_gearing_rate").status.eq(encoder.gearing_rate)
             # Hookup the ynchronous logic for transferring the data from the CPU to FPGA
             soc.sync += [
                 # Reset the counter when LinuxCNC is started
@@ -343,11 +519,19 @@ class EncoderModule(Module, AutoDoc):
                 # `reset index pulse`-flag (indication data has been read by CPU)
                 encoder.reset_index_pulse.eq(
                     soc.MMIO_inst.encoder_reset_index_pulse.storage[index]
+                ),
+                # `x4 mode`-flag
+                encoder.x4_mode.eq(
+                    soc.MMIO_inst.encoder_x4_mode.storage[index]
                 )
             ]
             soc.sync += encoder.index_enable.eq(soc.MMIO_inst.encoder_index_enable.storage[index])
             # Add combination logic for getting the status of the encoders
-            soc.sync += getattr(soc.MMIO_inst, f"encoder_{index}_counter").status.eq(encoder.counter)
+            if soc.MMIO_inst.compact_image:
+                top = len(soc.MMIO_inst.encoder_counters.status) - 16 * index
+                soc.sync += soc.MMIO_inst.encoder_counters.status[top - 16:top].eq(encoder.counter[:16])
+            else:
+                soc.sync += getattr(soc.MMIO_inst, f"encoder_{index}_counter").status.eq(encoder.counter)
             # Add the index pulse flag to the output (if pin_Z is defined). Last step is to Cat this
             # list to a single output
             index_pulse.append(encoder.index_pulse if encoder_config.pin_Z is not None else Constant(0))
@@ -357,6 +541,7 @@ class EncoderModule(Module, AutoDoc):
         soc.comb += [
             soc.MMIO_inst.encoder_index_pulse.status.eq(Cat(index_pulse)),
         ]
+        return encoders
 
 
 if __name__ == "__main__":
@@ -40,6 +40,73 @@ class Etherbone(BaseModel):
         "192.168.0.50",
         help_text="The ip-address to communicate with the FPGA-card."
     )
+    port: int = Field(
+        1234,
+        help_text="The UDP-port on which the FPGA-card listens for Etherbone packets. "
+        "When multiple cards are connected to the same host, all cards can use the "
+        "same port as they are distinguished by their ip-address.",
+        gt=0,
+        lt=65536
+    )
+    receive_timeout_us: int = Field(
+        None,
+        help_text="Optional field for the driver to set the time (in microseconds) "
+        "it waits for a response of the FPGA-card. Defaults to 10000 us.",
+        gt=0
+    )
+    send_timeout_us: int = Field(
+        None,
+        help_text="Optional field for the driver to set the time (in microseconds) "
+        "it waits for a packet to be send to the FPGA-card. Defaults to 10 us.",
+        gt=0
+    )
+    busy_poll_us: int = Field(
+        None,
+        help_text="Optional field for the driver to let the socket poll the network "
+        "interface for the response of the FPGA-card for the given time (in "
+        "microseconds) before it sleeps (SO_BUSY_POLL). This reduces the latency at "
+        "the cost of CPU-time.",
+        gt=0
+    )
+    priority: int = Field(
+        None,
+        help_text="Optional field for the driver to set the priority of the packets "
+        "send to the FPGA-card in the queues of the host (SO_PRIORITY).",
+        ge=0
+    )
+    tos: int = Field(
+        None,
+        help_text="Optional field for the driver to set the type of service (DSCP "
+        "and ECN) of the packets send to the FPGA-card (IP_TOS). For example, 184 "
+        "marks the packets as expedited forwarding.",
+        ge=0,
+        lt=256
+    )
+    receive_buffer: int = Field(
+        None,
+        help_text="Optional field for the driver to set the size (in bytes) of the "
+        "receive buffer of the socket (SO_RCVBUF).",
+        gt=0
+    )
+    send_buffer: int = Field(
+        None,
+        help_text="Optional field for the driver to set the size (in bytes) of the "
+        "send buffer of the socket (SO_SNDBUF).",
+        gt=0
+    )
+    interface: str = Field(
+        None,
+        help_text="Optional field for the driver to only communicate with the "
+        "FPGA-card over the given network interface, for example a NIC dedicated to "
+        "the FPGA-card (SO_BINDTODEVICE).",
+        max_length=15
+    )
+    static_arp: bool = Field(
+        False,
+        help_text="When set, the driver pins the mac-address of the FPGA-card in the "
+        "ARP-table of the host, so the host never has to resolve the address while "
+        "the machine is running."
+    )
 
     @validator('mac_address', pre=True)
     def convert_mac_address(cls, value):
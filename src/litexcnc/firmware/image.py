@@ -0,0 +1,182 @@
+"""
+Generates a C header with pack and unpack functions for the driver, specialised for the
+configuration of a firmware. The bit-fields of the GPIO, PWM and encoder have a number
+of bits which the generic code of the driver only knows at runtime, so it loops over
+all bits each cycle. The generated functions are fully unrolled: each byte of a
+bit-field is assembled in a single statement from the pins of the instances.
+
+The header is generated from the descriptor of the MMIO (see ``mmio.py``), which is the
+same description the driver reads from the FPGA. The driver selects the image by the
+fingerprint of the board and only uses it when it matches the descriptor on the FPGA
+exactly, otherwise the generic code is used.
+
+The header is written in the directory ``images`` of the driver, together with the
+index ``images.h`` of all images in that directory. The images are compiled in the
+next time the driver is installed.
+"""
+import glob
+import os
+from typing import Dict, List, Tuple
+
+# These values MUST coincide with the values in `mmio.py`
+MODULE_GPIO_OUT = 3
+MODULE_GPIO_IN = 4
+MODULE_PWM = 5
+MODULE_ENCODER = 7
+
+DESCRIPTOR_HEADER_WORDS = 7
+DESCRIPTOR_MODULE_WORDS = 3
+
+IMAGE_DIRECTORY = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))), 'driver', 'images')
+IMAGE_INDEX = 'images.h'
+
+
+def image_name(fingerprint: int) -> str:
+    """Returns the name of the image (and of the symbols in it) for the fingerprint."""
+    return f"litexcnc_image_{fingerprint & 0xFFFFFFFF:08x}"
+
+
+def _decode(words: List[int]) -> Tuple[int, int, Dict[int, dict]]:
+    """Decodes the descriptor in the same way as the driver does, returning the sizes of
+    the write and read block and the modules by their id."""
+    modules = {}
+    for index in range(words[1] & 0xFFFF):
+        module, write, read = words[DESCRIPTOR_HEADER_WORDS + DESCRIPTOR_MODULE_WORDS * index:][:DESCRIPTOR_MODULE_WORDS]
+        modules[module >> 24] = {
+            "instances": module & 0xFFFF,
+            "write_size": write & 0xFFFF,
+            "read_size": read & 0xFFFF,
+        }
+    return words[4] & 0xFFFF, words[5] & 0xFFFF, modules
+
+
+def _bitfield_size(instances: int) -> int:
+    """Returns the size (in bytes) of a bit-field with one bit per instance."""
+    return 4 * ((instances + 31) // 32)
+
+
+def _pack(macro: str, instances: int, offset: int = 0) -> List[str]:
+    """Returns the statements packing a bit-field, starting at the given offset."""
+    size = _bitfield_size(instances)
+    lines = []
+    for byte in range(size):
+        # The bit-field is stored big-endian, so the last byte holds the first instances
+        first = 8 * (size - 1 - byte)
+        bits = [f"{macro}({n}, {n - first})" for n in range(first, min(first + 8, instances))]
+        lines.append(f"    (*data)[{offset + byte}] = {' | '.join(bits) if bits else '0'};")
+    return lines
+
+
+def _unpack(macro: str, instances: int) -> List[str]:
+    """Returns the statements unpacking a bit-field."""
+    size = _bitfield_size(instances)
+    return [f"    {macro}({n}, {size - 1 - n // 8}, {n % 8});" for n in range(instances)]
+
+
+def _function(name: str, statements: List[str], size: int) -> List[str]:
+    """Returns a pack or unpack function, which advances the data past the bit-field(s)."""
+    return [
+        f"static void {name}(litexcnc_t *litexcnc, uint8_t **data) {{",
+        *statements,
+        f"    *data += {size};",
+        "}",
+        "",
+    ]
+
+
+def generate_image(fingerprint: int, words: List[int]) -> str:
+    """Returns the contents of the header for the firmware with the given fingerprint
+    and descriptor (the contents of the descriptor ROM)."""
+    name = image_name(fingerprint)
+    write_size, read_size, modules = _decode(words)
+    instances = {module_id: module["instances"] for module_id, module in modules.items()}
+    gpio_out = instances.get(MODULE_GPIO_OUT, 0)
+    gpio_in = instances.get(MODULE_GPIO_IN, 0)
+    pwm = instances.get(MODULE_PWM, 0)
+    encoder = instances.get(MODULE_ENCODER, 0)
+
+    lines = [
+        f"// Generated by `litexcnc build_firmware` for the firmware with fingerprint {fingerprint & 0xFFFFFFFF:08X}.",
+        "// Do not edit, the file is overwritten when the firmware is built again.",
+        f"#ifndef __INCLUDE_{name.upper()}_H__",
+        f"#define __INCLUDE_{name.upper()}_H__",
+        "",
+        f"#define {name.upper()}_FINGERPRINT 0x{fingerprint & 0xFFFFFFFF:08X}",
+        f"#define {name.upper()}_WRITE_SIZE {write_size}",
+        f"#define {name.upper()}_READ_SIZE {read_size}",
+        f"#define {name.upper()}_NUM_GPIO_OUTPUTS {gpio_out}",
+        f"#define {name.upper()}_NUM_GPIO_INPUTS {gpio_in}",
+        f"#define {name.upper()}_NUM_PWM_INSTANCES {pwm}",
+        f"#define {name.upper()}_NUM_ENCODER_INSTANCES {encoder}",
+        "",
+    ]
+    lines += _function(
+        f"{name}_gpio_prepare_write",
+        _pack("LITEXCNC_IMAGE_GPIO_OUT", gpio_out),
+        _bitfield_size(gpio_out))
+    lines += _function(
+        f"{name}_gpio_process_read",
+        _unpack("LITEXCNC_IMAGE_GPIO_IN", gpio_in),
+        _bitfield_size(gpio_in))
+    lines += _function(
+        f"{name}_pwm_prepare_write",
+        _pack("LITEXCNC_IMAGE_PWM_ENABLE", pwm),
+        _bitfield_size(pwm))
+    lines += _function(
+        f"{name}_encoder_prepare_write",
+        _pack("LITEXCNC_IMAGE_ENCODER_INDEX_ENABLE", encoder)
+        + _pack("LITEXCNC_IMAGE_ENCODER_INDEX_PULSE", encoder, _bitfield_size(encoder))
+        + _pack("LITEXCNC_IMAGE_ENCODER_X4_MODE", encoder, 2 * _bitfield_size(encoder)),
+        3 * _bitfield_size(encoder))
+    lines += _function(
+        f"{name}_encoder_process_read",
+        _unpack("LITEXCNC_IMAGE_ENCODER_INDEX_PULSE_READ", encoder),
+        _bitfield_size(encoder))
+    lines += [
+        f"static const litexcnc_image_t {name} = {{",
+        f"    .fingerprint = {name.upper()}_FINGERPRINT,",
+        f"    .write_size = {name.upper()}_WRITE_SIZE,",
+        f"    .read_size = {name.upper()}_READ_SIZE,",
+        "    .instances = {",
+        *[f"        [{module_id}] = {count}," for module_id, count in sorted(instances.items())],
+        "    },",
+        f"    .gpio_prepare_write = {name}_gpio_prepare_write,",
+        f"    .gpio_process_read = {name}_gpio_process_read,",
+        f"    .pwm_prepare_write = {name}_pwm_prepare_write,",
+        f"    .encoder_prepare_write = {name}_encoder_prepare_write,",
+        f"    .encoder_process_read = {name}_encoder_process_read,",
+        "};",
+        "",
+        "#endif",
+        "",
+    ]
+    return "\n".join(lines)
+
+
+def write_image(fingerprint: int, words: List[int], directory: str = IMAGE_DIRECTORY) -> str:
+    """Writes the image to the directory and updates the index of the images in that
+    directory. Returns the path of the image."""
+    os.makedirs(directory, exist_ok=True)
+    path = os.path.join(directory, f"{image_name(fingerprint)}.h")
+    with open(path, 'w') as image:
+        image.write(generate_image(fingerprint, words))
+    write_index(directory)
+    return path
+
+
+def write_index(directory: str = IMAGE_DIRECTORY):
+    """Writes the index of all images in the directory, which is included by the driver."""
+    names = sorted(
+        os.path.splitext(os.path.basename(path))[0]
+        for path in glob.glob(os.path.join(directory, "litexcnc_image_*.h"))
+    )
+    lines = [
+        "// Generated by `litexcnc build_firmware`, do not edit.",
+        *[f'#include "{name}.h"' for name in names],
+        "",
+        "#define LITEXCNC_IMAGES \\",
+        *[f"    &{name}, \\" for name in names],
+        "",
+    ]
+    with open(os.path.join(directory, IMAGE_INDEX), 'w') as index:
+        index.write("\n".join(lines))
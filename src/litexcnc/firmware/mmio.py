@@ -11,7 +11,10 @@ from migen import *
 from . import __version__
 from .encoder import EncoderModule
 from .gpio import GPIO_Out, GPIO_In
+from .modbus import ModbusModule
+from .pid import PIDModule
 from .pwm import PwmPdmModule
+from .spi import SPIModule
 from .stepgen import StepgenModule
 from typing import TYPE_CHECKING
 if TYPE_CHECKING:
@@ -20,6 +23,107 @@ if TYPE_CHECKING:
 # Convert the version of the firmware to 
 version = Version(__version__)
 
+# The descriptor is stored in a ROM outside the CSR-region, so it does not alter the
+# addresses of the registers. These values MUST coincide with `litexcnc.h`.
+DESCRIPTOR_ADDRESS = 0x00010000
+DESCRIPTOR_MAGIC = 0x4C584344  # LXCD
+DESCRIPTOR_VERSION = 1
+
+# Flags in the features-word of the descriptor and in the flags of the modules
+FEATURE_COMPACT_IMAGE = 0x01
+FEATURE_BLOCK_READ = 0x02
+FEATURE_CONFIG_READBACK = 0x04
+MODULE_FLAG_COMPACT = 0x01
+MODULE_FLAG_SLOW = 0x02
+
+
+class ModuleId:
+    """Identifiers of the modules in the descriptor."""
+    WATCHDOG = 1
+    WALLCLOCK = 2
+    GPIO_OUT = 3
+    GPIO_IN = 4
+    PWM = 5
+    STEPGEN = 6
+    ENCODER = 7
+    PID = 8
+    MODBUS = 9
+    SPI = 10
+
+
+# Modules which can be placed in the slow rate group, by their name in the config. The
+# watchdog, wall-clock and stepgen are bound to the period of the servo-thread.
+SLOW_MODULES = {
+    "gpio_out": ModuleId.GPIO_OUT,
+    "gpio_in": ModuleId.GPIO_IN,
+    "pwm": ModuleId.PWM,
+    "encoder": ModuleId.ENCODER,
+    "modbus": ModuleId.MODBUS,
+    "spi": ModuleId.SPI,
+}
+
+
+class MMIODescriptor:
+    """
+    Self-description of the MMIO, stored in a ROM on the FPGA. The driver reads this
+    descriptor when the board is registered and uses the offsets in it to pack and
+    unpack the data, and to detect any mismatch with its configuration.
+
+    All fields are 32-bit words. All addresses, offsets and sizes are in bytes.
+    Header:
+    - magic (``DESCRIPTOR_MAGIC``);
+    - version of the descriptor (bit 31-16) and number of modules (bit 15-0);
+    - address of the reset register;
+    - address (bit 31-16) and size (bit 15-0) of the config block;
+    - address (bit 31-16) and size (bit 15-0) of the write block;
+    - address (bit 31-16) and size (bit 15-0) of the read block;
+    - features (see ``FEATURE_*``).
+    Followed by three words for each module:
+    - module id (bit 31-24), flags (bit 23-16) and number of instances (bit 15-0);
+    - offset in the write block (bit 31-16) and size of the write data (bit 15-0);
+    - offset in the read block (bit 31-16) and size of the read data (bit 15-0).
+    """
+
+    def __init__(self):
+        self.reset_address = 0
+        self.config = (0, 0)
+        self.write = (0, 0)
+        self.read = (0, 0)
+        self.features = 0
+        self.modules = {}
+
+    def module(self, module_id, instances):
+        """Returns the entry of the module, creating it when it does not yet exist."""
+        return self.modules.setdefault(
+            module_id, 
+            {"instances": instances, "flags": 0, "write": (0, 0), "read": (0, 0)}
+        )
+
+    def words(self):
+        """Returns the contents of the descriptor ROM."""
+        words = [
+            DESCRIPTOR_MAGIC,
+            (DESCRIPTOR_VERSION << 16) | len(self.modules),
+            self.reset_address,
+            (self.config[0] << 16) | self.config[1],
+            (self.write[0] << 16) | self.write[1],
+            (self.read[0] << 16) | self.read[1],
+            self.features,
+        ]
+        for module_id, module in sorted(self.modules.items()):
+            words += [
+                (module_id << 24) | (module["flags"] << 16) | module["instances"],
+                (self._offset(module["write"], self.write) << 16) | module["write"][1],
+                (self._offset(module["read"], self.read) << 16) | module["read"][1],
+            ]
+        return words
+
+    @staticmethod
+    def _offset(data, block):
+        """Returns the offset of the data of a module with respect to the start of the
+        block. Modules without data in the block are placed at the start of the block."""
+        return data[0] - block[0] if data[1] else 0
+
 
 class MMIO(Module, AutoCSR):
 
@@ -36,16 +140,54 @@ class MMIO(Module, AutoCSR):
           - GPIO;
           - PWM;
           - StepGen;
+          - Encoder;
+          - PID;
+          - Modbus;
+          - SPI;
         - READ:
           - Watchdog;
           - Wall clock;
           - GPIO;
           - StepGen;
+          - Encoder;
+          - PID;
+          - Modbus;
+          - SPI;
+
+        The location of the data of each module is stored in the descriptor, which is
+        placed in a ROM at ``DESCRIPTOR_ADDRESS`` by the SoC.
+
+        Modules in the slow rate group (see ``slow_modules`` in the config) are placed
+        after all other modules in both blocks, so the data of each rate group forms
+        a contiguous window which can be exchanged in a single packet.
 
         When the order of the MMIO is mis-aligned with respect to the driver this might
         lead to errors (writing to the wrong registers) or the FPGA being hung up (when
         writing to a read-only register).
         """
+        # Self-description of this MMIO, which is stored in a ROM on the FPGA
+        self.descriptor = MMIODescriptor()
+
+        # The Etherbone core supports reading the status block with a single block read
+        # (see `block_read.py`)
+        self.descriptor.features |= FEATURE_BLOCK_READ
+        # All registers of the config block can be read back, so the driver can check
+        # the config has been written correctly
+        self.descriptor.features |= FEATURE_CONFIG_READBACK
+
+        # When the compact image is used, the stepgen and encoder registers are packed
+        # in narrower words. The modules check this flag when adding their registers.
+        self.compact_image = config.compact_image
+        if self.compact_image:
+            self.descriptor.features |= FEATURE_COMPACT_IMAGE
+
+        # Modules of which the data is exchanged in a slower thread
+        self.slow_modules = [SLOW_MODULES[name] for name in config.slow_modules]
+
+        # The encoders which drive a stepgen (electronic gearing). The counts in the
+        # windows of the gearing are read for these encoders.
+        self.gearing_sources = sorted({stepgen.gearing.encoder for stepgen in config.stepgen if stepgen.gearing})
+
         # INITIALISATION
         self.magic = CSRStatus(
             size=32,
@@ -69,6 +211,7 @@ class MMIO(Module, AutoCSR):
             description="The CRC of the configuration file used to create this firmware. Used to "
             "ensure the driver uses the same configuration file for initiating the communication."
         )
+        self.descriptor.reset_address = self._size()
         self.reset = CSRStorage(
             size=1, 
             description="Reset.\nWhile True (set to 1) the card is being forced in reset-mode. In "
@@ -79,7 +222,8 @@ class MMIO(Module, AutoCSR):
         )
 
         # INIT - for stepgen
-        self.loop_cycles = CSRStatus(
+        config_start = self._size()
+        self.loop_cycles = CSRStorage(
             size=32,
             description="The number of clock cycles within the FPGA is normally updated. Due to jitter "
             "the actual number of cycles can be more or less then this value, but it is expected to be "
@@ -87,9 +231,10 @@ class MMIO(Module, AutoCSR):
             "segement."
         )
         StepgenModule.add_mmio_config_registers(self, config.stepgen)
-
+        self.descriptor.config = (config_start, self._size() - config_start)
 
         # OUTPUT (as seen from the PC!)
+        write_start = self._size()
         # - Watchdog
         self.watchdog_data = CSRStorage(
             size=32, 
@@ -98,20 +243,30 @@ class MMIO(Module, AutoCSR):
             name='watchdog_data',
             write_from_dev=True
         )
-        # - Modules
-        GPIO_Out.add_mmio_write_registers(self, config.gpio_out)
-        PwmPdmModule.add_mmio_write_registers(self, config.pwm)
-        StepgenModule.add_mmio_write_registers(self, config.stepgen)
-        EncoderModule.add_mmio_write_registers(self, config.encoders)
+        self.descriptor.module(ModuleId.WATCHDOG, 1)["write"] = (write_start, self._size() - write_start)
+        # - Modules, the modules in the slow rate group last
+        self._add_modules("write", [
+            (ModuleId.GPIO_OUT, GPIO_Out.add_mmio_write_registers, config.gpio_out),
+            (ModuleId.PWM, PwmPdmModule.add_mmio_write_registers, config.pwm),
+            (ModuleId.STEPGEN, StepgenModule.add_mmio_write_registers, config.stepgen),
+            (ModuleId.ENCODER, EncoderModule.add_mmio_write_registers, config.encoders),
+            (ModuleId.PID, PIDModule.add_mmio_write_registers, config.pid),
+            (ModuleId.MODBUS, ModbusModule.add_mmio_write_registers, config.modbus),
+            (ModuleId.SPI, SPIModule.add_mmio_write_registers, config.spi),
+        ])
+        self.descriptor.write = (write_start, self._size() - write_start)
 
         # INPUT (as seen from the PC!)
+        read_start = self._size()
         # - Watchdog
         self.watchdog_has_bitten = CSRStatus(
             size=1, 
             description="Watchdog has bitten.\nFlag which is set when timeout has occurred.", 
             name='watchdog_has_bitten'
         )
+        self.descriptor.module(ModuleId.WATCHDOG, 1)["read"] = (read_start, self._size() - read_start)
         # - Wall-clock
+        wall_clock_start = self._size()
         self.wall_clock = CSRStatus(
             size=64, 
             description="Wall-clock.\n Counter which contains the amount of clock cycles which have "
@@ -120,8 +275,42 @@ class MMIO(Module, AutoCSR):
             "machine (order of magnitude centuries at 1 GHz).",  
             name='wall_clock'
         )
-        # Modules
-        GPIO_In.add_mmio_read_registers(self, config.gpio_in)
-        StepgenModule.add_mmio_read_registers(self, config.stepgen)
-        EncoderModule.add_mmio_read_registers(self, config.encoders)
-        EncoderModule.add_mmio_read_registers(self, config.encoders)
+        self.descriptor.module(ModuleId.WALLCLOCK, 1)["read"] = (wall_clock_start, self._size() - wall_clock_start)
+        # Modules, the modules in the slow rate group last
+        self._add_modules("read", [
+            (ModuleId.GPIO_IN, GPIO_In.add_mmio_read_registers, config.gpio_in),
+            (ModuleId.STEPGEN, StepgenModule.add_mmio_read_registers, config.stepgen),
+            (ModuleId.ENCODER, EncoderModule.add_mmio_read_registers, config.encoders),
+            (ModuleId.PID, PIDModule.add_mmio_read_registers, config.pid),
+            (ModuleId.MODBUS, ModbusModule.add_mmio_read_registers, config.modbus),
+            (ModuleId.SPI, SPIModule.add_mmio_read_registers, config.spi),
+        ])
+        self.descriptor.read = (read_start, self._size() - read_start)
+        # Modules without read registers must still be present in the descriptor
+        self.descriptor.module(ModuleId.PWM, len(config.pwm))
+        # Mark the modules which use the compact image
+        if self.compact_image:
+            self.descriptor.module(ModuleId.STEPGEN, len(config.stepgen))["flags"] |= MODULE_FLAG_COMPACT
+            self.descriptor.module(ModuleId.ENCODER, len(config.encoders))["flags"] |= MODULE_FLAG_COMPACT
+        # Mark the modules in the slow rate group
+        for module_id in self.slow_modules:
+            self.descriptor.modules[module_id]["flags"] |= MODULE_FLAG_SLOW
+
+    def _size(self):
+        """Returns the size (in bytes) of all registers currently defined in the MMIO,
+        which is equal to the address of the next register."""
+        return sum(4 * ((csr.size + 31) // 32) for csr in self.get_csrs())
+
+    def _add_modules(self, direction, modules):
+        """Adds the registers of the given modules (tuples of the module id, the function
+        adding the registers and the config) to the MMIO. The order of the modules is
+        retained, except that the modules in the slow rate group are placed last."""
+        for module_id, add_registers, config in sorted(modules, key=lambda module: module[0] in self.slow_modules):
+            self._add_registers(module_id, direction, add_registers, config)
+
+    def _add_registers(self, module_id, direction, add_registers, config):
+        """Adds the registers of a module to the MMIO and stores the location of its
+        data in the descriptor."""
+        start = self._size()
+        add_registers(self, config)
+        self.descriptor.module(module_id, len(config))[direction] = (start, self._size() - start)
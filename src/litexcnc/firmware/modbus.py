@@ -0,0 +1,550 @@
+import math
+from functools import reduce
+from operator import or_, xor
+from typing import List
+
+# Imports for creating a json-definition
+from pydantic import BaseModel, Field, validator
+
+# Imports for creating a LiteX/Migen module
+from litex.soc.interconnect.csr import *
+from migen import *
+from migen.genlib.fifo import SyncFIFO
+from migen.genlib.fsm import FSM, NextState, NextValue
+from litex.soc.integration.soc import SoC
+from litex.soc.integration.doc import AutoDoc, ModuleDoc
+from litex.build.generic_platform import *
+
+
+# The supported function codes of Modbus
+MODBUS_READ_HOLDING_REGISTER = 3
+MODBUS_READ_INPUT_REGISTER = 4
+MODBUS_WRITE_SINGLE_REGISTER = 6
+
+
+class ModbusRegisterConfig(BaseModel):
+    """Configuration of a single register, which is polled continuously by the FPGA."""
+    name: str = Field(
+        ...,
+        description="The name of the register as used in LinuxCNC HAL-file."
+    )
+    slave: int = Field(
+        ...,
+        description="The address of the slave (1 - 247)."
+    )
+    function: int = Field(
+        ...,
+        description="The function code of the request: 3 (read holding register), 4 (read "
+        "input register) or 6 (write single register)."
+    )
+    address: int = Field(
+        ...,
+        description="The address of the register in the slave (0 - 65535)."
+    )
+    signed: bool = Field(
+        False,
+        description="When true, the value of the register is a signed 16-bit value. Default "
+        "value: False."
+    )
+    safe_value: int = Field(
+        None,
+        description="The value which is written instead of the value from LinuxCNC when the "
+        "watchdog has bitten (only for function 6), for example the stop-command of a VFD. "
+        "When not set, the last value from LinuxCNC is written."
+    )
+
+    @validator('slave')
+    def check_slave(cls, value):
+        if not 1 <= value <= 247:
+            raise ValueError("The address of the slave should be between 1 and 247.")
+        return value
+
+    @validator('function')
+    def check_function(cls, value):
+        if value not in (MODBUS_READ_HOLDING_REGISTER, MODBUS_READ_INPUT_REGISTER, MODBUS_WRITE_SINGLE_REGISTER):
+            raise ValueError(f"Unsupported function {value}, possible values are: 3, 4, 6.")
+        return value
+
+    @validator('address')
+    def check_address(cls, value):
+        if not 0 <= value <= 0xFFFF:
+            raise ValueError("The address of the register should be between 0 and 65535.")
+        return value
+
+    @validator('safe_value')
+    def check_safe_value(cls, value, values):
+        if value is None:
+            return value
+        if values.get('function') != MODBUS_WRITE_SINGLE_REGISTER:
+            raise ValueError("A safe value can only be set for a register which is written (function 6).")
+        if not -0x8000 <= value <= 0xFFFF:
+            raise ValueError("The safe value should fit in 16 bits.")
+        return value
+
+
+class ModbusConfig(BaseModel):
+    """Configuration of a Modbus RTU master on a UART (RS-485)."""
+    name: str = Field(
+        None,
+        description="The name of the Modbus as used in LinuxCNC HAL-file (optional). "
+    )
+    pin_tx: str = Field(
+        description="The pin on the FPGA-card for the transmitted data."
+    )
+    pin_rx: str = Field(
+        description="The pin on the FPGA-card for the received data."
+    )
+    pin_de: str = Field(
+        None,
+        description="The pin on the FPGA-card for the driver enable of the RS-485 transceiver "
+        "(optional). The pin is high while transmitting."
+    )
+    baudrate: int = Field(
+        19200,
+        description="The baudrate of the bus. Default value: 19200."
+    )
+    parity: str = Field(
+        "none",
+        description="The parity of the characters, either 'none', 'even' or 'odd'. Default "
+        "value: none."
+    )
+    stop_bits: int = Field(
+        1,
+        description="The number of stop bits, either 1 or 2. Default value: 1."
+    )
+    timeout: float = Field(
+        0.1,
+        description="The time in seconds to wait for the response of the slave. Default value: 0.1."
+    )
+    registers: List[ModbusRegisterConfig] = Field(
+        ...,
+        item_type=ModbusRegisterConfig,
+        min_items=1,
+        max_items=16,
+        description="The registers which are polled in turn by the FPGA."
+    )
+    io_standard: str = Field(
+        "LVCMOS33",
+        description="The IO Standard (voltage) to use for the pins."
+    )
+
+    @validator('parity')
+    def check_parity(cls, value):
+        if value not in ('none', 'even', 'odd'):
+            raise ValueError(f"Unknown parity '{value}', possible values are: none, even, odd.")
+        return value
+
+    @validator('stop_bits')
+    def check_stop_bits(cls, value):
+        if value not in (1, 2):
+            raise ValueError("The number of stop bits should be either 1 or 2.")
+        return value
+
+    @validator('baudrate')
+    def check_baudrate(cls, value):
+        if not 300 <= value <= 1_000_000:
+            raise ValueError("The baudrate should be between 300 and 1000000.")
+        return value
+
+    @validator('timeout')
+    def check_timeout(cls, value):
+        if not 0.001 <= value <= 1.0:
+            raise ValueError("The timeout should be between 0.001 and 1.0 seconds.")
+        return value
+
+
+def crc16_update(crc, byte):
+    """Returns the expression for the Modbus CRC16 (polynomial 0xA001, reflected) after
+    processing the byte. The eight shifts are unrolled, so a byte is processed in a
+    single clock-cycle."""
+    value = crc ^ byte
+    for _ in range(8):
+        value = Mux(value[0], (value >> 1) ^ 0xA001, value >> 1)
+    return value
+
+
+class ModbusModule(Module, AutoDoc):
+    """Modbus RTU master, polling a list of registers."""
+    pads_layout = [("tx", 1), ("rx", 1), ("de", 1)]
+
+    def __init__(self, modbus_config: ModbusConfig, clock_frequency, pads=None) -> None:
+
+        self.intro = ModuleDoc("""
+        Modbus RTU master on a UART, for example to control a VFD over RS-485. The
+        registers of the configuration are polled in turn by the FPGA: for each
+        register a request is sent, the response is received and checked (address
+        of the slave, function, CRC16, parity and framing). The values to write and
+        the values read are exchanged with LinuxCNC as part of the cyclic data, so
+        the latency of the bus does not affect the thread of LinuxCNC.
+
+        The bytes of the request are put in a TX FIFO, from which they are sent by
+        the UART. The received bytes are put in a RX FIFO, from which they are
+        checked. Between two requests the bus is idle for at least 3.5 characters
+        (1.75 ms above 19200 baud). Bytes received while transmitting (the echo of a
+        half duplex bus) are discarded.
+
+        The status contains a flag for each register, which is set when the last
+        exchange of that register was successful, and the number of failed exchanges
+        (timeouts, exception responses and corrupted responses).
+        """)
+
+        if pads is None:
+            pads = Record(self.pads_layout)
+        self.pads = pads
+
+        registers = modbus_config.registers
+        n = len(registers)
+
+        # Inputs
+        self.enable = Signal()
+        self.watchdog = Signal()
+        self.values = [Signal(16) for _ in registers]
+        # Outputs
+        self.results = [Signal(16) for _ in registers]
+        self.valid = Signal(n)
+        self.errors = Signal(16)
+
+        # Timing of the bus, in clock-cycles
+        bit_cycles = int(round(clock_frequency / modbus_config.baudrate))
+        char_bits = 1 + 8 + (modbus_config.parity != 'none') + modbus_config.stop_bits
+        if modbus_config.baudrate > 19200:
+            gap_cycles = int(round(1.75e-3 * clock_frequency))
+        else:
+            gap_cycles = int(round(3.5 * char_bits * bit_cycles))
+        timeout_cycles = int(round(modbus_config.timeout * clock_frequency))
+
+        def parity(data):
+            # The parity bit makes the number of ones even or odd
+            bit = Signal()
+            self.comb += bit.eq(reduce(xor, [data[i] for i in range(8)]) ^ (modbus_config.parity == 'odd'))
+            return [bit] if modbus_config.parity != 'none' else []
+
+        # UART - transmitter
+        self.submodules.tx_fifo = tx_fifo = SyncFIFO(8, 8)
+        tx_shift = Signal(char_bits)
+        tx_bits = Signal(max=char_bits + 1)
+        tx_timer = Signal(max=bit_cycles)
+        tx_busy = Signal()
+        self.comb += [
+            tx_fifo.re.eq((tx_bits == 0) & tx_fifo.readable),
+            tx_busy.eq((tx_bits != 0) | tx_fifo.readable),
+        ]
+        self.sync += If(
+            tx_bits == 0,
+            If(
+                tx_fifo.readable,
+                # Start bit, data (LSB first), parity and stop bits
+                tx_shift.eq(Cat(Constant(0, 1), tx_fifo.dout, *parity(tx_fifo.dout), Constant(2**modbus_config.stop_bits - 1, modbus_config.stop_bits))),
+                tx_bits.eq(char_bits),
+                tx_timer.eq(bit_cycles - 1)
+            )
+        ).Elif(
+            tx_timer == 0,
+            tx_shift.eq(tx_shift >> 1),
+            tx_bits.eq(tx_bits - 1),
+            tx_timer.eq(bit_cycles - 1)
+        ).Else(
+            tx_timer.eq(tx_timer - 1)
+        )
+        self.comb += pads.tx.eq(Mux(tx_bits != 0, tx_shift[0], 1))
+        if hasattr(pads, 'de'):
+            self.comb += pads.de.eq(tx_busy)
+
+        # UART - receiver. The input is synchronized with two flip-flops, the third is
+        # used to detect the falling edge of the start bit. Each bit is sampled in the
+        # middle.
+        self.submodules.rx_fifo = rx_fifo = SyncFIFO(9, 16)
+        rx_sync = Signal(3, reset=0b111)
+        rx_shift = Signal(char_bits)
+        rx_bits = Signal(max=char_bits + 1)
+        rx_timer = Signal(max=bit_cycles)
+        rx_done = Signal()
+        rx_error = Signal()
+        self.sync += [
+            rx_sync.eq(Cat(pads.rx, rx_sync[:2])),
+            rx_done.eq(0),
+            If(
+                rx_bits == 0,
+                If(
+                    ~rx_sync[1] & rx_sync[2],
+                    rx_bits.eq(char_bits),
+                    rx_timer.eq(bit_cycles // 2 - 1)
+                )
+            ).Elif(
+                rx_timer == 0,
+                If(
+                    (rx_bits == char_bits) & rx_sync[1],
+                    # False start bit (glitch)
+                    rx_bits.eq(0)
+                ).Else(
+                    rx_shift.eq(Cat(rx_shift[1:], rx_sync[1])),
+                    rx_bits.eq(rx_bits - 1),
+                    rx_done.eq(rx_bits == 1)
+                ),
+                rx_timer.eq(bit_cycles - 1)
+            ).Else(
+                rx_timer.eq(rx_timer - 1)
+            )
+        ]
+        # Framing error (first stop bit low) or parity error
+        rx_data = rx_shift[1:9]
+        rx_checks = [~rx_shift[9 + (modbus_config.parity != 'none')]]
+        if modbus_config.parity != 'none':
+            rx_checks.append(rx_shift[9] != parity(rx_data)[0])
+        self.comb += [
+            rx_error.eq(reduce(or_, rx_checks)),
+            rx_fifo.din.eq(Cat(rx_data, rx_error)),
+            rx_fifo.we.eq(rx_done),
+        ]
+
+        # Sequencer
+        index = Signal(max=max(n, 2))
+        count = Signal(4)
+        length = Signal(4)
+        crc = Signal(16)
+        timer = Signal(max=max(gap_cycles, timeout_cycles) + 1, reset=gap_cycles)
+        failed = Signal()
+        exception = Signal()
+        result = Signal(16)
+        tx_byte = Signal(8)
+        rx_byte = Signal(8)
+        done = Signal()
+        success = Signal()
+
+        # The properties of the register being polled. The quantity of a read request is
+        # a single register.
+        slave = Signal(8)
+        function = Signal(8)
+        address = Signal(16)
+        data = Signal(16)
+        is_read = Signal()
+        self.comb += Case(index, {
+            i: [
+                slave.eq(register.slave),
+                function.eq(register.function),
+                address.eq(register.address),
+                is_read.eq(register.function != MODBUS_WRITE_SINGLE_REGISTER),
+                data.eq(
+                    1 if register.function != MODBUS_WRITE_SINGLE_REGISTER else
+                    Mux(self.watchdog, register.safe_value & 0xFFFF, self.values[i]) if register.safe_value is not None else
+                    self.values[i]
+                ),
+            ] for i, register in enumerate(registers)
+        })
+        # The bytes of the request, followed by the CRC (low byte first)
+        self.comb += [
+            Case(count, {
+                0: tx_byte.eq(slave),
+                1: tx_byte.eq(function),
+                2: tx_byte.eq(address[8:]),
+                3: tx_byte.eq(address[:8]),
+                4: tx_byte.eq(data[8:]),
+                5: tx_byte.eq(data[:8]),
+                6: tx_byte.eq(crc[:8]),
+                "default": tx_byte.eq(crc[8:]),
+            }),
+            rx_byte.eq(rx_fifo.dout[:8]),
+        ]
+
+        self.submodules.fsm = fsm = FSM(reset_state="GAP")
+        fsm.act("GAP",
+            # The bus is idle between two requests
+            rx_fifo.re.eq(rx_fifo.readable),
+            If(
+                timer != 0,
+                NextValue(timer, timer - 1)
+            ).Elif(
+                self.enable,
+                NextValue(count, 0),
+                NextValue(crc, 0xFFFF),
+                NextState("SEND")
+            )
+        )
+        fsm.act("SEND",
+            rx_fifo.re.eq(rx_fifo.readable),
+            tx_fifo.din.eq(tx_byte),
+            tx_fifo.we.eq(1),
+            If(
+                tx_fifo.writable,
+                NextValue(count, count + 1),
+                If(count < 6, NextValue(crc, crc16_update(crc, tx_byte))),
+                If(count == 7, NextState("TRANSMIT"))
+            )
+        )
+        fsm.act("TRANSMIT",
+            # Discard the echo of the request
+            rx_fifo.re.eq(rx_fifo.readable),
+            If(
+                ~tx_busy,
+                NextValue(count, 0),
+                NextValue(crc, 0xFFFF),
+                NextValue(failed, 0),
+                NextValue(exception, 0),
+                # Response: slave, function, byte count, value, CRC (read) or the echo of
+                # the request (write)
+                NextValue(length, Mux(is_read, 7, 8)),
+                NextValue(timer, timeout_cycles),
+                NextState("RECEIVE")
+            )
+        )
+        fsm.act("RECEIVE",
+            rx_fifo.re.eq(rx_fifo.readable),
+            If(
+                rx_fifo.readable,
+                NextValue(count, count + 1),
+                NextValue(crc, crc16_update(crc, rx_byte)),
+                If(rx_fifo.dout[8], NextValue(failed, 1)),
+                Case(count, {
+                    0: If(rx_byte != slave, NextValue(failed, 1)),
+                    1: If(
+                        rx_byte == (function | 0x80),
+                        # Exception response: slave, function, exception code, CRC
+                        NextValue(exception, 1),
+                        NextValue(length, 5)
+                    ).Elif(
+                        rx_byte != function,
+                        NextValue(failed, 1)
+                    ),
+                    2: If(is_read & ~exception & (rx_byte != 2), NextValue(failed, 1)),
+                    3: NextValue(result[8:], rx_byte),
+                    4: NextValue(result[:8], rx_byte),
+                    "default": [],
+                }),
+                If(count + 1 == length, NextState("CHECK"))
+            ).Elif(
+                timer == 0,
+                NextValue(failed, 1),
+                NextState("CHECK")
+            ).Else(
+                NextValue(timer, timer - 1)
+            )
+        )
+        fsm.act("CHECK",
+            done.eq(1),
+            success.eq(~failed & ~exception & (crc == 0)),
+            NextValue(timer, gap_cycles),
+            NextState("GAP")
+        )
+
+        # Store the result of the exchange and proceed to the next register
+        self.sync += If(
+            done,
+            If(index == n - 1, index.eq(0)).Else(index.eq(index + 1)),
+            If(~success, self.errors.eq(self.errors + 1)),
+            Case(index, {
+                i: [
+                    self.valid[i].eq(success),
+                    If(success & is_read, self.results[i].eq(result)),
+                ] for i in range(n)
+            })
+        )
+
+    @classmethod
+    def add_mmio_read_registers(cls, mmio, config: List[ModbusConfig]):
+        """
+        Adds the status registers to the MMIO.
+        NOTE: Status registers are meant to be read by LinuxCNC and contain
+        the current status of the Modbus.
+        """
+        # Don't create the registers when the config is empty (no Modbus defined in
+        # this case)
+        if not config:
+            return
+
+        for index, modbus_config in enumerate(config):
+            setattr(
+                mmio,
+                f'modbus_{index}_status',
+                CSRStatus(
+                    fields=[
+                        CSRField("valid", size=16, offset=0, description="Flags which are set when the last exchange of the register was successful."),
+                        CSRField("errors", size=16, offset=16, description="The number of failed exchanges (rolls over)."),
+                    ],
+                    name=f'modbus_{index}_status',
+                    description=f'The status of Modbus {index}.'
+                )
+            )
+            for register_index, register in enumerate(modbus_config.registers):
+                if register.function == MODBUS_WRITE_SINGLE_REGISTER:
+                    continue
+                setattr(
+                    mmio,
+                    f'modbus_{index}_{register_index}_result',
+                    CSRStatus(
+                        size=32,
+                        name=f'modbus_{index}_{register_index}_result',
+                        description=f'Modbus {index}: the value of register {register_index} (lower 16 bits).'
+                    )
+                )
+
+    @classmethod
+    def add_mmio_write_registers(cls, mmio, config: List[ModbusConfig]):
+        """
+        Adds the storage registers to the MMIO.
+        NOTE: Storage registers are meant to be written by LinuxCNC and contain
+        the flags and configuration for the module.
+        """
+        # Don't create the registers when the config is empty (no Modbus defined in
+        # this case)
+        if not config:
+            return
+
+        mmio.modbus_enable = CSRStorage(
+            size=int(math.ceil(float(len(config))/32))*32,
+            name='modbus_enable',
+            description="Register containing the enable bits of the Modbus. The registers are "
+            "only polled while the Modbus is enabled.",
+            write_from_dev=False
+        )
+        for index, modbus_config in enumerate(config):
+            for register_index, register in enumerate(modbus_config.registers):
+                if register.function != MODBUS_WRITE_SINGLE_REGISTER:
+                    continue
+                setattr(
+                    mmio,
+                    f'modbus_{index}_{register_index}_value',
+                    CSRStorage(
+                        size=32,
+                        name=f'modbus_{index}_{register_index}_value',
+                        description=f'Modbus {index}: the value written to register {register_index} (lower 16 bits).',
+                        write_from_dev=False
+                    )
+                )
+
+    @classmethod
+    def create_from_config(cls, soc: SoC, watchdog, config: List[ModbusConfig]):
+        """
+        Adds the module as defined in the configuration to the SoC.
+        NOTE: the configuration must be a list and should contain all the module at
+        once. Otherwise naming conflicts will occur.
+        """
+        # Don't create the module when the config is empty (no Modbus defined in
+        # this case)
+        if not config:
+            return
+
+        for index, modbus_config in enumerate(config):
+            # Add the io to the FPGA
+            subsignals = [
+                Subsignal("tx", Pins(modbus_config.pin_tx), IOStandard(modbus_config.io_standard)),
+                Subsignal("rx", Pins(modbus_config.pin_rx), IOStandard(modbus_config.io_standard)),
+            ]
+            if modbus_config.pin_de is not None:
+                subsignals.append(Subsignal("de", Pins(modbus_config.pin_de), IOStandard(modbus_config.io_standard)))
+            soc.platform.add_extension([("modbus", index, *subsignals)])
+            pads = soc.platform.request("modbus", index)
+            # Create the Modbus
+            modbus = cls(modbus_config, soc.clock_frequency, pads)
+            soc.submodules += modbus
+            status = getattr(soc.MMIO_inst, f'modbus_{index}_status')
+            soc.sync += [
+                modbus.enable.eq(soc.MMIO_inst.modbus_enable.storage[index] & ~soc.MMIO_inst.reset.storage),
+                modbus.watchdog.eq(watchdog.has_bitten),
+                status.fields.valid.eq(modbus.valid),
+                status.fields.errors.eq(modbus.errors),
+            ]
+            for register_index, register in enumerate(modbus_config.registers):
+                if register.function == MODBUS_WRITE_SINGLE_REGISTER:
+                    soc.sync += modbus.values[register_index].eq(getattr(soc.MMIO_inst, f'modbus_{index}_{register_index}_value').storage[:16])
+                else:
+                    soc.sync += getattr(soc.MMIO_inst, f'modbus_{index}_{register_index}_result').status.eq(modbus.results[register_index])
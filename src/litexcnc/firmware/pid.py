@@ -0,0 +1,420 @@
+import math
+from typing import List
+
+# Imports for creating a json-definition
+from pydantic import BaseModel, Field, validator
+
+# Imports for creating a LiteX/Migen module
+from litex.soc.interconnect.csr import *
+from migen import *
+from litex.soc.integration.soc import SoC
+from litex.soc.integration.doc import AutoDoc, ModuleDoc
+from litex.build.generic_platform import *
+
+
+class PIDOutputConfig(BaseModel):
+    module: str = Field(
+        ...,
+        description="The module driven by the output of the PID-loop, either 'pwm' or 'stepgen'."
+    )
+    index: int = Field(
+        ...,
+        description="The index of the PWM generator or stepgen driven by the PID-loop."
+    )
+    dir_pin: str = Field(
+        None,
+        description="The pin on the FPGA-card for the direction signal (optional, only for "
+        "the output to a PWM generator). When set, the PWM generator outputs the magnitude "
+        "of the output and this pin the sign (sign-magnitude, i.e. for a H-bridge). When not "
+        "set, a duty cycle of 50% corresponds to an output of 0 (offset binary, i.e. for a "
+        "PWM to analog converter)."
+    )
+    io_standard: str = Field(
+        "LVCMOS33",
+        description="The IO Standard (voltage) to use for the direction pin."
+    )
+
+    @validator('module')
+    def check_module(cls, value):
+        if value not in ('pwm', 'stepgen'):
+            raise ValueError(f"Unknown output '{value}' for the PID-loop, possible values are: pwm, stepgen.")
+        return value
+
+
+class PIDConfig(BaseModel):
+    """Configuration of a PID-loop running on the FPGA."""
+    name: str = Field(
+        None,
+        description="The name of the PID-loop as used in LinuxCNC HAL-file (optional). "
+    )
+    encoder: int = Field(
+        ...,
+        description="The index of the encoder which is the feedback of the PID-loop."
+    )
+    output: PIDOutputConfig = Field(
+        ...,
+        description="The output of the PID-loop."
+    )
+
+
+class PIDModule(Module, AutoDoc):
+
+    # Number of fractional bits of the gains
+    GAIN_FRACTION = 16
+    # Number of fractional bits of the output to a PWM generator (a duty cycle of 100%)
+    PWM_OUTPUT_FRACTION = 16
+    # The output to a stepgen is shifted to the resolution of the speed of the stepgen
+    STEPGEN_OUTPUT_SHIFT = 8
+    # The maximum rate of the loop. The loop is run each 2^n clock-cycles, where n is the
+    # smallest value for which the rate does not exceed this maximum.
+    MAX_RATE = 50e3
+
+    def __init__(self) -> None:
+
+        self.intro = ModuleDoc("""
+        PID-loop with an encoder as feedback. The loop is calculated on each strobe, at a
+        rate of tens of kHz, which is too fast and too regular to be closed by LinuxCNC
+        over the network. The setpoint and the error are in counts of the encoder (x4).
+        The gains are signed fixed point values with `GAIN_FRACTION` fractional bits:
+        - P: output per count of error;
+        - I: output per count of error, integrated each loop;
+        - D: output per count of change in error between two loops.
+        The feedforward is calculated by the driver, as it only depends on the commanded
+        position, and is added to the output. The error is reduced with the deadband and
+        limited to the maximum error, the integrator is limited to the maximum integrated
+        error and the output to the maximum output. A maximum of zero means no limit. Just
+        like the `pid` component of LinuxCNC, the error is not integrated while the output
+        is saturated.
+        The calculation is done sequentially, with a single registered multiplier, in
+        eight clock-cycles after the strobe.
+        """)
+
+        # Inputs
+        self.reset = Signal()
+        self.enable = Signal()
+        self.strobe = Signal()
+        self.feedback = Signal((32, True))
+        self.setpoint = Signal((32, True))
+        self.feedforward = Signal((32, True))
+        self.pgain = Signal((32, True))
+        self.igain = Signal((32, True))
+        self.dgain = Signal((32, True))
+        self.deadband = Signal(32)
+        self.max_error = Signal(32)
+        self.max_error_i = Signal(32)
+        self.max_output = Signal(32)
+        # Outputs
+        self.error = Signal((32, True))
+        self.output = Signal((32, True))
+        self.saturated = Signal()
+
+        # Internal fields
+        step = Signal(3)
+        error_raw = Signal((32, True))
+        error_band = Signal((32, True))
+        error_prev = Signal((32, True))
+        error_d = Signal((32, True))
+        error_i = Signal((32, True))
+        error_i_next = Signal((34, True))
+        difference = Signal((33, True))
+        operand = Signal((32, True))
+        gain = Signal((32, True))
+        product = Signal((64, True))
+        term = Signal((48, True))
+        total = Signal((51, True))
+        limit_error_i = Signal(32)
+        limit_output = Signal(32)
+
+        # A limit of zero means no limit
+        self.comb += [
+            If(self.max_error_i == 0, limit_error_i.eq(2**31 - 1)).Else(limit_error_i.eq(self.max_error_i)),
+            If(self.max_output == 0, limit_output.eq(2**31 - 1)).Else(limit_output.eq(self.max_output)),
+            error_i_next.eq(error_i + self.error),
+            term.eq(product[self.GAIN_FRACTION:self.GAIN_FRACTION + 48]),
+        ]
+
+        self.sync += [
+            # The multiplier is registered, its operands are selected per step
+            product.eq(operand * gain),
+            If(
+                self.reset,
+                step.eq(0),
+                error_prev.eq(0),
+                error_i.eq(0),
+                self.error.eq(0),
+                self.output.eq(0),
+                self.saturated.eq(0),
+            ).Elif(
+                step == 0,
+                # Error with respect to the setpoint. The counter of the encoder can roll
+                # over, so the difference is taken modulo 2^32.
+                If(
+                    self.strobe,
+                    error_raw.eq(self.setpoint - self.feedback),
+                    step.eq(1)
+                )
+            ).Elif(
+                step == 1,
+                # Apply the deadband and the maximum error
+                If(
+                    error_raw > self.deadband,
+                    error_band.eq(error_raw - self.deadband)
+                ).Elif(
+                    error_raw < -self.deadband,
+                    error_band.eq(error_raw + self.deadband)
+                ).Else(
+                    error_band.eq(0)
+                ),
+                step.eq(2)
+            ).Elif(
+                step == 2,
+                If(
+                    (self.max_error != 0) & (error_band > self.max_error),
+                    self.error.eq(self.max_error)
+                ).Elif(
+                    (self.max_error != 0) & (error_band < -self.max_error),
+                    self.error.eq(-self.max_error)
+                ).Else(
+                    self.error.eq(error_band)
+                ),
+                step.eq(3)
+            ).Elif(
+                step == 3,
+                # Derivative and integral of the error. The integrator holds while the
+                # output is saturated (anti-windup).
+                difference.eq(self.error - error_prev),
+                error_prev.eq(self.error),
+                If(
+                    ~self.enable,
+                    error_i.eq(0)
+                ).Elif(
+                    ~self.saturated,
+                    If(
+                        error_i_next > limit_error_i,
+                        error_i.eq(limit_error_i)
+                    ).Elif(
+                        error_i_next < -limit_error_i,
+                        error_i.eq(-limit_error_i)
+                    ).Else(
+                        error_i.eq(error_i_next)
+                    )
+                ),
+                total.eq(self.feedforward),
+                step.eq(4)
+            ).Elif(
+                step == 4,
+                # Add the proportional term
+                total.eq(total + term),
+                If(
+                    difference > (2**31 - 1),
+                    error_d.eq(2**31 - 1)
+                ).Elif(
+                    difference < -2**31,
+                    error_d.eq(-2**31)
+                ).Else(
+                    error_d.eq(difference)
+                ),
+                step.eq(5)
+            ).Elif(
+                step == 5,
+                # Add the integral term
+                total.eq(total + term),
+                step.eq(6)
+            ).Elif(
+                step == 6,
+                # Add the derivative term
+                total.eq(total + term),
+                step.eq(7)
+            ).Else(
+                # Last step: limit the output
+                If(
+                    ~self.enable,
+                    self.output.eq(0),
+                    self.saturated.eq(0)
+                ).Elif(
+                    total > limit_output,
+                    self.output.eq(limit_output),
+                    self.saturated.eq(1)
+                ).Elif(
+                    total < -limit_output,
+                    self.output.eq(-limit_output),
+                    self.saturated.eq(1)
+                ).Else(
+                    self.output.eq(total),
+                    self.saturated.eq(0)
+                ),
+                step.eq(0)
+            )
+        ]
+        # Select the operands of the multiplier. The product is available one clock-cycle
+        # after the operands have been selected.
+        self.comb += Case(step, {
+            3: [operand.eq(self.error), gain.eq(self.pgain)],
+            4: [operand.eq(error_i), gain.eq(self.igain)],
+            5: [operand.eq(error_d), gain.eq(self.dgain)],
+            "default": [operand.eq(0), gain.eq(0)],
+        })
+
+    @classmethod
+    def rate_shift(cls, clock_frequency) -> int:
+        """Returns n, where the PID-loops are calculated each 2^n clock-cycles."""
+        shift = 0
+        while clock_frequency / (1 << shift) > cls.MAX_RATE:
+            shift += 1
+        return shift
+
+    @classmethod
+    def add_mmio_read_registers(cls, mmio, config: List[PIDConfig]):
+        """
+        Adds the status registers to the MMIO.
+        NOTE: Status registers are meant to be read by LinuxCNC and contain
+        the current status of the PID-loops.
+        """
+        # Don't create the registers when the config is empty (no PID-loops
+        # defined in this case)
+        if not config:
+            return
+
+        for index, _ in enumerate(config):
+            setattr(
+                mmio,
+                f'pid_{index}_error',
+                CSRStatus(
+                    size=32,
+                    name=f'pid_{index}_error',
+                    description=f'The error of PID-loop {index} in the last loop, in counts (signed).'
+                )
+            )
+            setattr(
+                mmio,
+                f'pid_{index}_output',
+                CSRStatus(
+                    size=32,
+                    name=f'pid_{index}_output',
+                    description=f'The output of PID-loop {index} in the last loop (signed).'
+                )
+            )
+
+    @classmethod
+    def add_mmio_write_registers(cls, mmio, config: List[PIDConfig]):
+        """
+        Adds the storage registers to the MMIO.
+        NOTE: Storage registers are meant to be written by LinuxCNC and contain
+        the flags and configuration for the module.
+        """
+        # Don't create the registers when the config is empty (no PID-loops
+        # defined in this case)
+        if not config:
+            return
+
+        mmio.pid_enable = CSRStorage(
+            size=int(math.ceil(float(len(config))/32))*32,
+            name='pid_enable',
+            description="Register containing the enable bits of the PID-loops.",
+            write_from_dev=False
+        )
+        for index, _ in enumerate(config):
+            for register, description in (
+                    ('setpoint', 'The setpoint, in counts (signed).'),
+                    ('feedforward', 'The feedforward, which is added to the output (signed).'),
+                    ('pgain', 'The proportional gain (signed fixed point).'),
+                    ('igain', 'The integral gain (signed fixed point).'),
+                    ('dgain', 'The derivative gain (signed fixed point).'),
+                    ('deadband', 'The deadband of the error, in counts.'),
+                    ('max_error', 'The maximum error, in counts (0 is no limit).'),
+                    ('max_error_i', 'The maximum integrated error, in counts (0 is no limit).'),
+                    ('max_output', 'The maximum output (0 is no limit).')):
+                setattr(
+                    mmio,
+                    f'pid_{index}_{register}',
+                    CSRStorage(
+                        size=32,
+                        name=f'pid_{index}_{register}',
+                        description=f'PID-loop {index}: {description}',
+                        write_from_dev=False
+                    )
+                )
+
+    @classmethod
+    def create_from_config(cls, soc: SoC, watchdog, config: List[PIDConfig], encoders, pwms, stepgens):
+        """
+        Adds the module as defined in the configuration to the SoC.
+        NOTE: the configuration must be a list and should contain all the module at
+        once. Otherwise naming conflicts will occur. The encoders, PWM generators and
+        stepgens are the modules as created by their `create_from_config`.
+        """
+        # Don't create the module when the config is empty (no PID-loops
+        # defined in this case)
+        if not config:
+            return
+
+        # All loops are calculated at the same moment, a fixed number of clock-cycles
+        shift = cls.rate_shift(soc.clock_frequency)
+        strobe = Signal()
+        soc.comb += strobe.eq(soc.MMIO_inst.wall_clock.status[:shift] == 0)
+
+        for index, pid_config in enumerate(config):
+            pid = cls()
+            soc.submodules += pid
+            soc.comb += [
+                pid.strobe.eq(strobe),
+                pid.feedback.eq(encoders[pid_config.encoder].counter),
+            ]
+            soc.sync += [
+                pid.reset.eq(soc.MMIO_inst.reset.storage),
+                pid.enable.eq(soc.MMIO_inst.pid_enable.storage[index] & ~watchdog.has_bitten),
+                *[getattr(pid, register).eq(getattr(soc.MMIO_inst, f'pid_{index}_{register}').storage)
+                  for register in ('setpoint', 'feedforward', 'pgain', 'igain', 'dgain', 'deadband', 'max_error', 'max_error_i', 'max_output')],
+                getattr(soc.MMIO_inst, f'pid_{index}_error').status.eq(pid.error),
+                getattr(soc.MMIO_inst, f'pid_{index}_output').status.eq(pid.output),
+            ]
+            if pid_config.output.module == 'stepgen':
+                stepgen = stepgens[pid_config.output.index]
+                soc.sync += [
+                    stepgen.pid_enable.eq(pid.enable),
+                    stepgen.pid_speed.eq(pid.output << cls.STEPGEN_OUTPUT_SHIFT),
+                ]
+                continue
+            # Output to a PWM generator, as a 16-bit duty cycle
+            pwm = pwms[pid_config.output.index]
+            duty = Signal(16)
+            magnitude = Signal(32)
+            if pid_config.output.dir_pin:
+                # Sign-magnitude
+                soc.platform.add_extension([
+                    ("pid_dir", index, Pins(pid_config.output.dir_pin), IOStandard(pid_config.output.io_standard))
+                ])
+                direction = soc.platform.request("pid_dir", index)
+                soc.comb += If(pid.output < 0, magnitude.eq(-pid.output)).Else(magnitude.eq(pid.output))
+                soc.sync += [
+                    direction.eq(pid.output < 0),
+                    If(
+                        magnitude[cls.PWM_OUTPUT_FRACTION:] != 0,
+                        duty.eq(2**16 - 1)
+                    ).Else(
+                        duty.eq(magnitude[cls.PWM_OUTPUT_FRACTION - 16:cls.PWM_OUTPUT_FRACTION])
+                    )
+                ]
+            else:
+                # Offset binary, the output is scaled to half the duty cycle
+                offset = Signal((33, True))
+                soc.comb += offset.eq((pid.output >> (cls.PWM_OUTPUT_FRACTION - 15)) + 2**15)
+                soc.sync += If(
+                    offset > 2**16 - 1,
+                    duty.eq(2**16 - 1)
+                ).Elif(
+                    offset < 0,
+                    duty.eq(0)
+                ).Else(
+                    duty.eq(offset)
+                )
+            soc.sync += [
+                pwm.pid_enable.eq(pid.enable),
+                If(
+                    pwm.period != 0,
+                    pwm.pid_width.eq((duty * pwm.period) >> 16)
+                ).Else(
+                    # PDM mode, the width is the duty cycle
+                    pwm.pid_width.eq(duty)
+                )
+            ]
@@ -136,8 +136,8 @@ class PwmPdmModule(Module, AutoCSR):
 
         mmio.pwm_enable = CSRStorage(
             size=int(math.ceil(float(len(config))/32))*32,
-            name='gpio_out',
-            description="Register containing the bits to be written to the GPIO out pins.", 
+            name='pwm_enable',
+            description="Register containing the enable bits of the PWM generators.", 
             write_from_dev=False
         )
 
@@ -165,16 +165,19 @@ class PwmPdmModule(Module, AutoCSR):
             )
 
     @classmethod
-    def create_from_config(cls, soc: SoC, watchdog, config: List[PWMConfig]):
+    def create_from_config(cls, soc: SoC, watchdog, config: List[PWMConfig], pid_outputs: List[int] = []):
         """
-        Adds the module as defined in the configuration to the SoC.
+        Adds the module as defined in the configuration to the SoC and returns the
+        created generators.
         NOTE: the configuration must be a list and should contain all the module at
-        once. Otherwise naming conflicts will occur.
+        once. Otherwise naming conflicts will occur. The width of the generators with
+        their index in `pid_outputs` is set by a PID-loop while the loop is enabled
+        (see `PIDModule.create_from_config`).
         """
         # Don't create the module when the config is empty (no stepgens 
         # defined in this case)
         if not config:
-            return
+            return []
 
         # Add module and create the pads
         soc.platform.add_extension([
@@ -185,12 +188,25 @@ class PwmPdmModule(Module, AutoCSR):
         soc.pwm_outputs = [pad for pad in soc.platform.request_all("pwm").l]
 
         # Create the generators
+        pwms = []
         for index, _ in enumerate(config):
             # Add the PWM-module to the platform
             _pwm = PwmPdmModule(soc.pwm_outputs[index], with_csr=False)
             soc.submodules += _pwm
+            pwms.append(_pwm)
             soc.comb += [
                 _pwm.enable.eq(soc.MMIO_inst.pwm_enable.storage[index] & ~watchdog.has_bitten),
                 _pwm.period.eq(getattr(soc.MMIO_inst, f'pwm_{index}_period').storage),
-                _pwm.width.eq(getattr(soc.MMIO_inst, f'pwm_{index}_width').storage)
             ]
+            if index in pid_outputs:
+                _pwm.pid_enable = Signal()
+                _pwm.pid_width = Signal(32)
+                soc.comb += If(
+                    _pwm.pid_enable,
+                    _pwm.width.eq(_pwm.pid_width)
+                ).Else(
+                    _pwm.width.eq(getattr(soc.MMIO_inst, f'pwm_{index}_width').storage)
+                )
+            else:
+                soc.comb += _pwm.width.eq(getattr(soc.MMIO_inst, f'pwm_{index}_width').storage)
+        return pwms
@@ -6,11 +6,15 @@ from typing import List, Type
 from pydantic import BaseModel, Field, validator
 
 # Local imports
+from .block_read import add_block_read
 from .encoder import EncoderConfig, EncoderModule
 from .etherbone import Etherbone, EthPhy
 from .gpio import GPIO, GPIO_Out, GPIO_In
-from .mmio import MMIO
+from .mmio import MMIO, DESCRIPTOR_ADDRESS, SLOW_MODULES
+from .modbus import ModbusConfig, ModbusModule
+from .pid import PIDConfig, PIDModule
 from .pwm import PWMConfig, PwmPdmModule
+from .spi import SPIConfig, SPIModule
 from .stepgen import StepgenConfig, StepgenModule
 from .watchdog import WatchDogModule
 
@@ -62,6 +66,49 @@ class LitexCNC_Firmware(BaseModel):
         max_items=32,
         unique_items=True
     )
+    pid: List[PIDConfig] = Field(
+        [],
+        item_type=PIDConfig,
+        max_items=32,
+        description="PID-loops running on the FPGA, with an encoder as feedback and a PWM "
+        "generator or stepgen as output. Default value: [] (no PID-loops)."
+    )
+    modbus: List[ModbusConfig] = Field(
+        [],
+        item_type=ModbusConfig,
+        max_items=8,
+        description="Modbus RTU masters on a UART (RS-485), which poll the registers of for "
+        "example a VFD. Default value: [] (no Modbus)."
+    )
+    spi: List[SPIConfig] = Field(
+        [],
+        item_type=SPIConfig,
+        max_items=8,
+        description="SPI masters, which run a list of transactions at a fixed rate, for "
+        "example to read an ADC or to configure stepper drivers. Default value: [] (no SPI)."
+    )
+    compact_image: bool = Field(
+        False,
+        description="When True, the data exchanged each cycle is packed in narrower words. "
+        "The stepgen sends the apply time as 32 bits and the speed and acceleration as "
+        "24 bits each, and reads the position as a 32-bit delta and the speed as 24 bits. "
+        "The encoders read their counts as a 16-bit delta. This reduces the size of the "
+        "packets, which is useful at high servo rates. Default value: False."
+    )
+    high_rate: bool = Field(
+        False,
+        description="When True, the driver is optimized for servo-threads running at "
+        "4 - 10 kHz. The time-outs of the communication are derived from the period of "
+        "the thread and the per-cycle checks and messages are reduced. This setting "
+        "only affects the driver and does not change the firmware. Default value: False."
+    )
+    slow_modules: List[str] = Field(
+        [],
+        description="The modules of which the data is exchanged in a slower thread, using "
+        "the functions `read-slow` and `write-slow` of the driver. Possible values are "
+        "'gpio_out', 'gpio_in', 'pwm' and 'encoder'. The data of all other modules is "
+        "exchanged in the servo-thread. Default value: [] (all modules in the servo-thread)."
+    )
 
     @validator('baseclass', pre=True)
     def import_baseclass(cls, value):
@@ -72,11 +119,46 @@ class LitexCNC_Firmware(BaseModel):
             mod = getattr(mod, comp)
         return mod
 
+    @validator('encoders')
+    def check_gearing_encoder(cls, value, values):
+        # NOTE: the encoders are validated after the stepgens, so the stepgens are known here
+        for index, stepgen in enumerate(values.get('stepgen', [])):
+            if stepgen.gearing and not 0 <= stepgen.gearing.encoder < len(value):
+                raise ValueError(f"Stepgen {index} is geared to encoder {stepgen.gearing.encoder}, which does not exist.")
+        return value
+
+    @validator('pid')
+    def check_pid(cls, value, values):
+        # NOTE: the PID-loops are validated after the modules they connect
+        outputs = set()
+        for index, pid in enumerate(value):
+            if not 0 <= pid.encoder < len(values.get('encoders', [])):
+                raise ValueError(f"PID-loop {index} uses encoder {pid.encoder} as feedback, which does not exist.")
+            modules = values.get('pwm' if pid.output.module == 'pwm' else 'stepgen', [])
+            if not 0 <= pid.output.index < len(modules):
+                raise ValueError(f"PID-loop {index} drives {pid.output.module} {pid.output.index}, which does not exist.")
+            if (pid.output.module, pid.output.index) in outputs:
+                raise ValueError(f"PID-loop {index} drives {pid.output.module} {pid.output.index}, which is already driven by another PID-loop.")
+            outputs.add((pid.output.module, pid.output.index))
+            if pid.output.module == 'stepgen' and modules[pid.output.index].gearing:
+                raise ValueError(f"PID-loop {index} drives stepgen {pid.output.index}, which has electronic gearing.")
+        return value
+
+    @validator('slow_modules', each_item=True)
+    def check_slow_module(cls, value):
+        if value not in SLOW_MODULES:
+            raise ValueError(f"Module '{value}' cannot be placed in the slow rate group, possible values are: {', '.join(SLOW_MODULES)}.")
+        return value
+
 
     def generate(self, fingerprint):
         """
         Function which generates the firmware
         """
+        # The status block is read with a block read, which has to be added to the
+        # Etherbone core before the board creates it
+        add_block_read()
+
         class _LitexCNC_SoC(self.baseclass):
 
             def __init__(
@@ -90,6 +172,16 @@ class LitexCNC_Firmware(BaseModel):
                 # Create memory mapping for IO
                 self.submodules.MMIO_inst = MMIO(config=config, fingerprint=fingerprint)
 
+                # Store the description of the MMIO in a ROM, so the driver can read the
+                # layout of the data from the FPGA
+                descriptor = self.MMIO_inst.descriptor.words()
+                self.add_rom(
+                    "litexcnc_descriptor",
+                    origin=DESCRIPTOR_ADDRESS,
+                    size=max(2**(4*len(descriptor) - 1).bit_length(), 0x100),
+                    contents=descriptor
+                )
+
                 # Create watchdog
                 watchdog = WatchDogModule(timeout=self.MMIO_inst.watchdog_data.storage[:31], with_csr=False)
                 self.submodules += watchdog
@@ -111,9 +203,12 @@ class LitexCNC_Firmware(BaseModel):
                 # Create modules
                 GPIO_In.create_from_config(self, config.gpio_in)
                 GPIO_Out.create_from_config(self, config.gpio_out)
-                PwmPdmModule.create_from_config(self, watchdog,config.pwm)
-                StepgenModule.create_from_config(self, watchdog, config.stepgen)
-                EncoderModule.create_from_config(self, config.encoders)
+                pwms = PwmPdmModule.create_from_config(self, watchdog,config.pwm, [pid.output.index for pid in config.pid if pid.output.module == 'pwm'])
+                encoders = EncoderModule.create_from_config(self, config.encoders)
+                stepgens = StepgenModule.create_from_config(self, watchdog, config.stepgen, encoders, [pid.output.index for pid in config.pid if pid.output.module == 'stepgen'])
+                PIDModule.create_from_config(self, watchdog, config.pid, encoders, pwms, stepgens)
+                ModbusModule.create_from_config(self, watchdog, config.modbus)
+                SPIModule.create_from_config(self, watchdog, config.spi)
                 
         return _LitexCNC_SoC(
             config=self)
@@ -0,0 +1,492 @@
+import math
+from typing import List
+
+# Imports for creating a json-definition
+from pydantic import BaseModel, Field, validator
+
+# Imports for creating a LiteX/Migen module
+from litex.soc.interconnect.csr import *
+from migen import *
+from migen.genlib.fsm import FSM, NextState, NextValue
+from litex.soc.integration.soc import SoC
+from litex.soc.integration.doc import AutoDoc, ModuleDoc
+from litex.build.generic_platform import *
+
+
+class SPITransactionConfig(BaseModel):
+    """Configuration of a single transaction, which is run by the FPGA on each strobe."""
+    name: str = Field(
+        ...,
+        description="The name of the transaction as used in LinuxCNC HAL-file."
+    )
+    cs: int = Field(
+        0,
+        description="The index of the chip select in `pins_cs` which is asserted during the "
+        "transaction. Default value: 0."
+    )
+    length: int = Field(
+        16,
+        description="The number of bits of the transaction (1 - 64), sent MSB first. Default "
+        "value: 16."
+    )
+    data: int = Field(
+        0,
+        description="The word sent to the device, for example the command of an ADC or the "
+        "address and data of a register of a stepper driver. Default value: 0."
+    )
+    once: bool = Field(
+        False,
+        description="When true, the transaction is only run once after the SPI is enabled, "
+        "for example to configure a stepper driver. Default value: False."
+    )
+    channel: str = Field(
+        None,
+        description="Either 'in' (part of the received word is read by LinuxCNC), 'out' (part "
+        "of the sent word is set by LinuxCNC) or not set (the transaction is only sent)."
+    )
+    shift: int = Field(
+        0,
+        description="The position of the least significant bit of the channel in the word. "
+        "Default value: 0."
+    )
+    bits: int = Field(
+        16,
+        description="The number of bits of the channel (1 - 32). Default value: 16."
+    )
+    signed: bool = Field(
+        False,
+        description="When true, the channel contains a signed (two's complement) value. "
+        "Default value: False."
+    )
+    safe_value: int = Field(
+        None,
+        description="The value which is sent instead of the value from LinuxCNC when the "
+        "watchdog has bitten (only for channel 'out'), for example zero speed. When not set, "
+        "the last value from LinuxCNC is sent."
+    )
+
+    @validator('length')
+    def check_length(cls, value):
+        if not 1 <= value <= 64:
+            raise ValueError("The length of a transaction should be between 1 and 64 bits.")
+        return value
+
+    @validator('data')
+    def check_data(cls, value, values):
+        if 'length' in values and not 0 <= value < (1 << values['length']):
+            raise ValueError("The data does not fit in the length of the transaction.")
+        return value
+
+    @validator('channel')
+    def check_channel(cls, value, values):
+        if value not in (None, 'in', 'out'):
+            raise ValueError(f"Unknown channel '{value}', possible values are: in, out.")
+        if value is not None and values.get('once'):
+            raise ValueError("A transaction which is only run once cannot have a channel.")
+        return value
+
+    @validator('bits')
+    def check_bits(cls, value, values):
+        if not 1 <= value <= 32:
+            raise ValueError("The number of bits of a channel should be between 1 and 32.")
+        if 'length' in values and values.get('shift', 0) + value > values['length']:
+            raise ValueError("The channel does not fit in the length of the transaction.")
+        return value
+
+    @validator('safe_value')
+    def check_safe_value(cls, value, values):
+        if value is None:
+            return value
+        if values.get('channel') != 'out':
+            raise ValueError("A safe value can only be set for a channel 'out'.")
+        if 'bits' in values:
+            bits = values['bits']
+            minimum = -(1 << (bits - 1)) if values.get('signed') else 0
+            if not minimum <= value < (1 << bits):
+                raise ValueError("The safe value does not fit in the number of bits of the channel.")
+        return value
+
+
+class SPIConfig(BaseModel):
+    """Configuration of a SPI master, running a list of transactions."""
+    name: str = Field(
+        None,
+        description="The name of the SPI as used in LinuxCNC HAL-file (optional). "
+    )
+    pin_sclk: str = Field(
+        description="The pin on the FPGA-card for the clock."
+    )
+    pin_mosi: str = Field(
+        description="The pin on the FPGA-card for the data sent to the devices."
+    )
+    pin_miso: str = Field(
+        None,
+        description="The pin on the FPGA-card for the data received from the devices "
+        "(optional, for example when only DACs are connected)."
+    )
+    pins_cs: List[str] = Field(
+        ...,
+        min_items=1,
+        max_items=8,
+        description="The pins on the FPGA-card for the chip selects (active low) of the devices."
+    )
+    frequency: int = Field(
+        1_000_000,
+        description="The frequency of the clock in Hz. The actual frequency is the clock "
+        "frequency of the FPGA divided by an even number. Default value: 1000000."
+    )
+    mode: int = Field(
+        0,
+        description="The SPI mode (0 - 3), i.e. the polarity (bit 1) and phase (bit 0) of "
+        "the clock. Default value: 0."
+    )
+    rate: float = Field(
+        1000,
+        description="The maximum rate in Hz at which the list of transactions is run. The "
+        "list is started each 2^n clock-cycles of the wall-clock, where n is the smallest "
+        "value for which the rate does not exceed this maximum. Default value: 1000."
+    )
+    transactions: List[SPITransactionConfig] = Field(
+        ...,
+        item_type=SPITransactionConfig,
+        min_items=1,
+        max_items=16,
+        description="The transactions which are run in turn by the FPGA."
+    )
+    io_standard: str = Field(
+        "LVCMOS33",
+        description="The IO Standard (voltage) to use for the pins."
+    )
+
+    @validator('frequency')
+    def check_frequency(cls, value):
+        if not 1_000 <= value <= 25_000_000:
+            raise ValueError("The frequency should be between 1 kHz and 25 MHz.")
+        return value
+
+    @validator('mode')
+    def check_mode(cls, value):
+        if value not in (0, 1, 2, 3):
+            raise ValueError("The SPI mode should be 0, 1, 2 or 3.")
+        return value
+
+    @validator('rate')
+    def check_rate(cls, value):
+        if not 1 <= value <= 100e3:
+            raise ValueError("The rate should be between 1 Hz and 100 kHz.")
+        return value
+
+    @validator('transactions', each_item=True)
+    def check_cs(cls, value, values):
+        if 'pins_cs' in values and not 0 <= value.cs < len(values['pins_cs']):
+            raise ValueError(f"Transaction '{value.name}' uses chip select {value.cs}, which does not exist.")
+        return value
+
+
+class SPIModule(Module, AutoDoc):
+    """SPI master, running a list of transactions at a fixed rate."""
+
+    def __init__(self, spi_config: SPIConfig, clock_frequency, pads=None) -> None:
+
+        self.intro = ModuleDoc("""
+        SPI master, for example for an ADC measuring the spindle load, a DAC or the
+        configuration of a stepper driver. On each strobe the transactions of the
+        configuration are run in turn, without any interaction with LinuxCNC. The
+        strobe is derived from the wall-clock, so the transactions are run at a fixed
+        rate and the results of all boards are sampled at the same moment.
+
+        Each transaction sends a word of up to 64 bits (MSB first) with a single chip
+        select asserted. A channel 'in' takes a part of the received word, which is
+        read by LinuxCNC. A channel 'out' replaces a part of the sent word with the
+        value written by LinuxCNC, or with the safe value when the watchdog has bitten.
+        Transactions marked as `once` are only run on the first strobe after the SPI
+        has been enabled, for example to write the configuration of a stepper driver.
+
+        The chip select is asserted half a clock-period before the first edge and
+        released half a clock-period after the last edge. Between two transactions the
+        chip selects are high for at least half a clock-period.
+        """)
+
+        transactions = spi_config.transactions
+        n = len(transactions)
+        num_cs = len(spi_config.pins_cs)
+        cpol = (spi_config.mode >> 1) & 1
+        cpha = spi_config.mode & 1
+
+        if pads is None:
+            pads = Record([("sclk", 1), ("mosi", 1), ("miso", 1), ("cs_n", num_cs)])
+        self.pads = pads
+
+        # Inputs
+        self.enable = Signal()
+        self.strobe = Signal()
+        self.watchdog = Signal()
+        self.values = [Signal(transaction.bits) for transaction in transactions]
+        # Outputs
+        self.results = [Signal(transaction.bits) for transaction in transactions]
+
+        # Half a period of the clock, in clock-cycles of the FPGA
+        half_cycles = max(1, int(math.ceil(clock_frequency / (2 * spi_config.frequency))))
+
+        # Sequencer
+        index = Signal(max=n + 1)
+        once_done = Signal()
+        timer = Signal(max=half_cycles)
+        edges = Signal(max=2 * 64 + 1)
+        first = Signal()
+        sclk = Signal()
+        tx = Signal(64)
+        rx = Signal(64)
+        cs = Signal(num_cs)
+        miso = Signal()
+        store = Signal()
+
+        # The properties of the transaction being run. The word is aligned to the MSB of
+        # the shift register.
+        length = Signal(max=65)
+        once = Signal()
+        select = Signal(num_cs)
+        word = Signal(64)
+        cases = {}
+        for i, transaction in enumerate(transactions):
+            data = transaction.data
+            if transaction.channel == 'out':
+                mask = ((1 << transaction.bits) - 1) << transaction.shift
+                value = self.values[i]
+                if transaction.safe_value is not None:
+                    value = Mux(self.watchdog, transaction.safe_value & ((1 << transaction.bits) - 1), self.values[i])
+                data = (data & ~mask) | (value << transaction.shift)
+            cases[i] = [
+                length.eq(transaction.length),
+                once.eq(transaction.once),
+                select.eq(1 << transaction.cs),
+                word.eq(data << (64 - transaction.length)),
+            ]
+        self.comb += Case(index, cases)
+
+        # The input is sampled directly on the edge of the clock, as the data of the device
+        # has been stable for half a clock-period at that moment
+        if hasattr(pads, 'miso'):
+            self.comb += miso.eq(pads.miso)
+        self.comb += [
+            pads.sclk.eq(sclk ^ cpol),
+            pads.mosi.eq(tx[63]),
+            pads.cs_n.eq(~cs),
+        ]
+
+        self.submodules.fsm = fsm = FSM(reset_state="IDLE")
+        fsm.act("IDLE",
+            If(
+                ~self.enable,
+                NextValue(once_done, 0)
+            ).Elif(
+                self.strobe,
+                NextValue(index, 0),
+                NextState("NEXT")
+            )
+        )
+        fsm.act("NEXT",
+            If(
+                index == n,
+                NextValue(once_done, 1),
+                NextState("IDLE")
+            ).Elif(
+                once & once_done,
+                NextValue(index, index + 1)
+            ).Else(
+                NextValue(tx, word),
+                NextValue(edges, 2 * length),
+                NextValue(first, 1),
+                NextValue(timer, half_cycles - 1),
+                NextValue(cs, select),
+                NextState("SELECT")
+            )
+        )
+        fsm.act("SELECT",
+            # Setup time of the chip select
+            If(
+                timer != 0,
+                NextValue(timer, timer - 1)
+            ).Else(
+                NextValue(timer, half_cycles - 1),
+                NextState("TRANSFER")
+            )
+        )
+        fsm.act("TRANSFER",
+            If(
+                timer != 0,
+                NextValue(timer, timer - 1)
+            ).Elif(
+                edges == 0,
+                NextValue(timer, half_cycles - 1),
+                NextState("HOLD")
+            ).Else(
+                NextValue(timer, half_cycles - 1),
+                NextValue(edges, edges - 1),
+                NextValue(sclk, ~sclk),
+                If(
+                    ~sclk,
+                    # Leading edge
+                    NextValue(first, 0),
+                    NextValue(rx, Cat(miso, rx[:63])) if not cpha else
+                    If(~first, NextValue(tx, tx << 1))
+                ).Else(
+                    # Trailing edge
+                    NextValue(tx, tx << 1) if not cpha else
+                    NextValue(rx, Cat(miso, rx[:63]))
+                )
+            )
+        )
+        fsm.act("HOLD",
+            # Hold time of the chip select
+            If(
+                timer != 0,
+                NextValue(timer, timer - 1)
+            ).Else(
+                store.eq(1),
+                NextValue(cs, 0),
+                NextValue(timer, half_cycles - 1),
+                NextState("DESELECT")
+            )
+        )
+        fsm.act("DESELECT",
+            # Minimum time the chip select is high
+            If(
+                timer != 0,
+                NextValue(timer, timer - 1)
+            ).Else(
+                NextValue(index, index + 1),
+                NextState("NEXT")
+            )
+        )
+
+        # Store the result of the transaction. The received word is aligned to the LSB of
+        # the shift register.
+        self.sync += If(
+            store,
+            Case(index, {
+                i: self.results[i].eq(rx[transaction.shift:transaction.shift + transaction.bits])
+                for i, transaction in enumerate(transactions) if transaction.channel == 'in'
+            })
+        )
+
+    @classmethod
+    def duration(cls, spi_config: SPIConfig, clock_frequency) -> int:
+        """Returns the number of clock-cycles required to run all transactions."""
+        half_cycles = max(1, int(math.ceil(clock_frequency / (2 * spi_config.frequency))))
+        # Select, transfer (including the last half period), hold and deselect, plus two
+        # cycles for the sequencer
+        return sum((2 * transaction.length + 4) * half_cycles + 2 for transaction in spi_config.transactions) + 1
+
+    @classmethod
+    def rate_shift(cls, spi_config: SPIConfig, clock_frequency) -> int:
+        """Returns n, where the transactions are run each 2^n clock-cycles."""
+        shift = 0
+        while clock_frequency / (1 << shift) > spi_config.rate:
+            shift += 1
+        return shift
+
+    @classmethod
+    def add_mmio_read_registers(cls, mmio, config: List[SPIConfig]):
+        """
+        Adds the status registers to the MMIO.
+        NOTE: Status registers are meant to be read by LinuxCNC and contain
+        the results of the transactions.
+        """
+        # Don't create the registers when the config is empty (no SPI defined in
+        # this case)
+        if not config:
+            return
+
+        for index, spi_config in enumerate(config):
+            for transaction_index, transaction in enumerate(spi_config.transactions):
+                if transaction.channel != 'in':
+                    continue
+                setattr(
+                    mmio,
+                    f'spi_{index}_{transaction_index}_result',
+                    CSRStatus(
+                        size=32,
+                        name=f'spi_{index}_{transaction_index}_result',
+                        description=f'SPI {index}: the value received in transaction {transaction_index}.'
+                    )
+                )
+
+    @classmethod
+    def add_mmio_write_registers(cls, mmio, config: List[SPIConfig]):
+        """
+        Adds the storage registers to the MMIO.
+        NOTE: Storage registers are meant to be written by LinuxCNC and contain
+        the flags and configuration for the module.
+        """
+        # Don't create the registers when the config is empty (no SPI defined in
+        # this case)
+        if not config:
+            return
+
+        mmio.spi_enable = CSRStorage(
+            size=int(math.ceil(float(len(config))/32))*32,
+            name='spi_enable',
+            description="Register containing the enable bits of the SPI. The transactions are "
+            "only run while the SPI is enabled.",
+            write_from_dev=False
+        )
+        for index, spi_config in enumerate(config):
+            for transaction_index, transaction in enumerate(spi_config.transactions):
+                if transaction.channel != 'out':
+                    continue
+                setattr(
+                    mmio,
+                    f'spi_{index}_{transaction_index}_value',
+                    CSRStorage(
+                        size=32,
+                        name=f'spi_{index}_{transaction_index}_value',
+                        description=f'SPI {index}: the value sent in transaction {transaction_index}.',
+                        write_from_dev=False
+                    )
+                )
+
+    @classmethod
+    def create_from_config(cls, soc: SoC, watchdog, config: List[SPIConfig]):
+        """
+        Adds the module as defined in the configuration to the SoC.
+        NOTE: the configuration must be a list and should contain all the module at
+        once. Otherwise naming conflicts will occur.
+        """
+        # Don't create the module when the config is empty (no SPI defined in
+        # this case)
+        if not config:
+            return
+
+        for index, spi_config in enumerate(config):
+            # The transactions must be finished before the next strobe
+            shift = cls.rate_shift(spi_config, soc.clock_frequency)
+            if cls.duration(spi_config, soc.clock_frequency) >= (1 << shift):
+                raise ValueError(f"The transactions of SPI {index} do not fit in a single period, decrease the rate or increase the frequency.")
+            # Add the io to the FPGA
+            subsignals = [
+                Subsignal("sclk", Pins(spi_config.pin_sclk), IOStandard(spi_config.io_standard)),
+                Subsignal("mosi", Pins(spi_config.pin_mosi), IOStandard(spi_config.io_standard)),
+                Subsignal("cs_n", Pins(" ".join(spi_config.pins_cs)), IOStandard(spi_config.io_standard)),
+            ]
+            if spi_config.pin_miso is not None:
+                subsignals.append(Subsignal("miso", Pins(spi_config.pin_miso), IOStandard(spi_config.io_standard)))
+            soc.platform.add_extension([("spi_master", index, *subsignals)])
+            pads = soc.platform.request("spi_master", index)
+            # Create the SPI
+            spi = cls(spi_config, soc.clock_frequency, pads)
+            soc.submodules += spi
+            soc.comb += spi.strobe.eq(soc.MMIO_inst.wall_clock.status[:shift] == 0)
+            soc.sync += [
+                spi.enable.eq(soc.MMIO_inst.spi_enable.storage[index] & ~soc.MMIO_inst.reset.storage),
+                spi.watchdog.eq(watchdog.has_bitten),
+            ]
+            for transaction_index, transaction in enumerate(spi_config.transactions):
+                if transaction.channel == 'out':
+                    soc.sync += spi.values[transaction_index].eq(getattr(soc.MMIO_inst, f'spi_{index}_{transaction_index}_value').storage[:transaction.bits])
+                elif transaction.channel == 'in':
+                    result = spi.results[transaction_index]
+                    if transaction.signed and transaction.bits < 32:
+                        # Sign extension, so the driver receives a 32-bit value
+                        result = Cat(result, Replicate(result[-1], 32 - transaction.bits))
+                    soc.sync += getattr(soc.MMIO_inst, f'spi_{index}_{transaction_index}_result').status.eq(result)
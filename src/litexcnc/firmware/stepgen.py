@@ -5,7 +5,8 @@ except ImportError:
     # Imports for Python <3.8
     from typing import Iterable, List, Union
     from typing_extensions import Literal
-from pydantic import BaseModel, Field
+from pydantic import BaseModel, Field, validator
+import math
 
 # Imports for creating a LiteX/Migen module
 from litex.soc.interconnect.csr import *
@@ -15,6 +16,9 @@ from litex.soc.integration.soc import SoC
 from litex.soc.integration.doc import AutoDoc, ModuleDoc
 from litex.build.generic_platform import *
 
+# Local imports
+from .encoder import EncoderModule
+
 
 class StepGenPinoutStepDirBaseConfig(BaseModel):
 
@@ -52,9 +56,10 @@ class StepGenPinoutStepDirBaseConfig(BaseModel):
         # registered is widened from the default 64-buit width to 64-bit + difference in pick-off for
         # position and velocity. This meands that the bit we have to watch is also shifted by the
         # same amount. This means that although we are watching the position, we have to use the pick-off
-        # for velocity
+        # for velocity. The steps are made on the position including the compensation (see
+        # `StepgenModule.create_compensation`).
         generator.sync += If(
-            generator.position[generator.pick_off_vel] != generator.step_prev,
+            generator.step_position[generator.pick_off_vel] != generator.step_prev,
             # Corner-case: The machine is at rest and starts to move in the opposite
             # direction. Wait with stepping the machine until the dir setup time has
             # passed.
@@ -62,7 +67,7 @@ class StepGenPinoutStepDirBaseConfig(BaseModel):
                 ~generator.hold_dds,
                 # The relevant bit has toggled, make a step to the next position by
                 # resetting the counters
-                generator.step_prev.eq(generator.position[generator.pick_off_vel]),
+                generator.step_prev.eq(generator.step_position[generator.pick_off_vel]),
                 generator.steplen_counter.counter.eq(generator.steplen),
                 generator.dir_hold_counter.counter.eq(generator.steplen + generator.dir_hold_time),
                 generator.dir_setup_counter.counter.eq(generator.steplen + generator.dir_hold_time + generator.dir_setup_time),
@@ -199,6 +204,50 @@ class StepGenPinoutStepDirDifferentialConfig(StepGenPinoutStepDirBaseConfig):
             pads.dir_neg.eq(~generator.dir),
         ]
 
+class StepgenGearingConfig(BaseModel):
+    encoder: int = Field(
+        ...,
+        description="The index of the encoder which drives the stepgen. When the gearing "
+        "is enabled by the driver, the speed of the stepgen follows the count rate of this "
+        "encoder times the gearing ratio, added to the commanded speed."
+    )
+
+
+class StepgenCompensationConfig(BaseModel):
+    entries: int = Field(
+        256,
+        description="The number of entries in the compensation table, which must be a power "
+        "of two (maximum 4096). The table is stored in block RAM on the FPGA and covers the "
+        "range of the compensation file with equally spaced entries. Default value: 256."
+    )
+    file: str = Field(
+        None,
+        description="The compensation file, which is loaded by the driver. Each line contains "
+        "the nominal position, the position when moving in positive direction and the position "
+        "when moving in negative direction, just like the compensation files of LinuxCNC. When "
+        "no file is given, only the backlash compensation is available."
+    )
+
+    @validator('entries')
+    def check_entries(cls, value):
+        if value < 2 or value > 4096 or (value & (value - 1)):
+            raise ValueError(f"The number of entries of the compensation table must be a power of two between 2 and 4096 (is {value}).")
+        return value
+
+
+class StepgenSlaveConfig(BaseModel):
+    pins: Union[
+            StepGenPinoutStepDirConfig, 
+            StepGenPinoutStepDirDifferentialConfig] = Field(
+        ...,
+        description="The configuration of the stepper type and pin-out of the slave."
+    )
+    name: str = Field(
+        None,
+        description="The name of the slave as used in LinuxCNC HAL-file (optional). "
+    )
+
+
 class StepgenConfig(BaseModel):
     pins: Union[
             StepGenPinoutStepDirConfig, 
@@ -216,6 +265,24 @@ class StepgenConfig(BaseModel):
         "disabled. When True, the stepgen will stop the machine with respect to the "
         "acceleration limits and then be disabled. Default value: False."
     )
+    gearing: StepgenGearingConfig = Field(
+        None,
+        description="When set, the stepgen can be slaved to an encoder on the FPGA (electronic "
+        "gearing), i.e. for rigid tapping and threading. Default value: None (no gearing)."
+    )
+    slaves: List[StepgenSlaveConfig] = Field(
+        [],
+        description="Additional step outputs driven by the speed of this stepgen (ganged "
+        "stepgen), i.e. for the second motor of a gantry. Each slave has its own position, "
+        "which can be held independently for homing and squaring the gantry. Default "
+        "value: [] (no slaves)."
+    )
+    compensation: StepgenCompensationConfig = Field(
+        None,
+        description="When set, the position of the stepgen is compensated on the FPGA for the "
+        "pitch error of the screw (compensation table) and backlash. Default value: None (no "
+        "compensation)."
+    )
 
 
 class StepgenCounter(Module, AutoDoc):
@@ -236,9 +303,57 @@ class StepgenCounter(Module, AutoDoc):
         )
 
 
+class StepgenSlaveModule(Module, AutoDoc):
+
+    def __init__(self, master, pads, soft_stop, create_routine) -> None:
+
+        self.intro = ModuleDoc("""
+        Additional step output of a stepgen (ganged stepgen). The slave is driven by the
+        speed of its master, so both outputs step in lockstep. The slave has its own
+        position, which is not updated while the slave is latched. This is used to
+        square a gantry: each motor is latched when it reaches its home switch. The
+        difference with the position of the master is the squaring offset.
+        """)
+        # Shared with the master
+        self.pick_off_pos = master.pick_off_pos
+        self.pick_off_vel = master.pick_off_vel
+        self.pick_off_acc = master.pick_off_acc
+        self.speed = master.speed
+
+        # Inputs
+        self.reset = Signal()
+        self.enable = Signal()
+        self.latch = Signal()
+        # Outputs
+        self.wait = Signal()
+        self.position = Signal(len(master.position))
+        # The slaves are not compensated
+        self.step_position = self.position
+
+        # Update the position in the same way as the master, except while latched
+        update = ~self.wait & ~self.latch
+        if not soft_stop:
+            update = update & self.enable
+        self.sync += If(
+            self.reset,
+            self.position.eq(0),
+        ).Elif(
+            update,
+            self.position.eq(self.position + self.speed[(self.pick_off_acc - self.pick_off_vel):] - 0x8000_0000)
+        )
+
+        # Create the routine which actually handles the steps
+        create_routine(self, pads)
+
+
 class StepgenModule(Module, AutoDoc):
 
-    def __init__(self, pads, pick_off, soft_stop, create_routine) -> None:
+    # Number of fractional bits of the gearing ratio (steps per encoder count)
+    GEARING_RATIO_FRACTION = 24
+    # Number of fractional bits of the entries of the compensation table and the backlash (steps)
+    COMPENSATION_FRACTION = 16
+
+    def __init__(self, pads, pick_off, soft_stop, create_routine, gearing=False, pid=False, compensation=0) -> None:
         """
         
         NOTE: pickoff should be a three-tuple. A different pick-off for position, speed
@@ -276,6 +391,31 @@ class StepgenModule(Module, AutoDoc):
           why there are signals for DDS (1+3+4) and for wait. Only when a step is
           commanded during the DDS period, the stepgen is temporarily paused by setting
           the wait-Signal HIGH.
+
+        Electronic gearing:
+        When the stepgen is created with gearing, its speed can be slaved to the count
+        rate of an encoder. The encoder counts the pulses in a fixed window (see
+        `EncoderModule.GEARING_WINDOW_BITS`), which is multiplied with the gearing ratio
+        (steps per count, fixed point with `GEARING_RATIO_FRACTION` fractional bits).
+        While the gearing is enabled, the speed is the sum of this speed and the target
+        speed as commanded by the driver (the offset), without acceleration limits. The
+        steps made in each window are exactly the steps the counts of the previous window
+        require, so the stepgen stays locked to the encoder.
+
+        PID-loop:
+        When the stepgen is created as the output of a PID-loop on the FPGA, the output
+        of the loop is added to the target speed in the same way as the gearing, without
+        acceleration limits, as the loop would otherwise become unstable.
+
+        Compensation:
+        When the stepgen is created with compensation, the steps are made on the position
+        plus a compensation for the pitch error of the screw and the backlash. The pitch
+        error is looked up in a table in block RAM, indexed by the position in steps, and
+        interpolated between the entries. The backlash is added with half its value in the
+        direction of the speed. The compensation follows its target with at most half the
+        speed of the stepgen, so the direction of the steps never changes and the step rate
+        increases at most 50%. At standstill the compensation is not changed. The reported
+        position does not include the compensation.
         """
         )
         # Store the pick-off (to prevent magic numbers later in the code)
@@ -319,9 +459,65 @@ class StepgenModule(Module, AutoDoc):
         # Optionally, use a different clock domain
         sync = self.sync
 
+        # Electronic gearing: the speed follows the count rate of an encoder
+        self.gearing = gearing
+        if gearing:
+            self.create_gearing()
+
+        # PID-loop: the speed is the output of a PID-loop
+        self.pid = pid
+        if pid:
+            self.pid_enable = Signal()
+            self.pid_speed = Signal((40, True))
+            self.speed_pid = self.create_speed_offset(self.pid_speed)
+
         # Determine the next speed, while taking into account acceleration limits if
         # applied. The speed is not updated when the direction has changed and we are
         # still waiting for the dir_setup to time out.
+        speed_update = If(
+            self.max_acceleration == 0,
+            # Case: no maximum acceleration defined, directly apply the requested speed
+            self.speed.eq(self.speed_target)
+        ).Else(
+            # Case: obey the maximum acceleration / deceleration
+            If(
+                # Accelerate, difference between actual speed and target speed is too
+                # large to bridge within one clock-cycle
+                self.speed_target > (self.speed + self.max_acceleration),
+                # The counters are again a fixed point arithmetric. Every loop we keep
+                # the fraction and add the integer part to the speed. The fraction is
+                # used as a starting point for the next loop.
+                self.speed.eq(self.speed + self.max_acceleration),
+            ).Elif(
+                # Decelerate, difference between actual speed and target speed is too
+                # large to bridge within one clock-cycle
+                self.speed_target < (self.speed - self.max_acceleration),
+                # The counters are again a fixed point arithmetric. Every loop we keep
+                # the fraction and add the integer part to the speed. However, we have
+                # keep in mind we are subtracting now every loop
+                self.speed.eq(self.speed - self.max_acceleration)
+            ).Else(
+                # Small difference between speed and target speed, gap can be bridged within
+                # one clock cycle.
+                self.speed.eq(self.speed_target)
+            )
+        )
+        if gearing:
+            # While geared, the speed is directly set, as any difference between the
+            # speed and the geared speed would lead to a loss of synchronisation
+            speed_update = If(
+                self.gearing_enable & self.enable,
+                self.speed.eq(self.speed_geared)
+            ).Else(
+                speed_update
+            )
+        if pid:
+            speed_update = If(
+                self.pid_enable & self.enable,
+                self.speed.eq(self.speed_pid)
+            ).Else(
+                speed_update
+            )
         sync += If(
             ~self.reset & ~self.wait,
             # When the machine is not enabled, the speed is clamped to 0. This results in a
@@ -331,34 +527,7 @@ class StepgenModule(Module, AutoDoc):
                 ~self.enable,
                 self.speed_target.eq(self.speed_reset_val)
             ),
-            If(
-                self.max_acceleration == 0,
-                # Case: no maximum acceleration defined, directly apply the requested speed
-                self.speed.eq(self.speed_target)
-            ).Else(
-                # Case: obey the maximum acceleration / deceleration
-                If(
-                    # Accelerate, difference between actual speed and target speed is too
-                    # large to bridge within one clock-cycle
-                    self.speed_target > (self.speed + self.max_acceleration),
-                    # The counters are again a fixed point arithmetric. Every loop we keep
-                    # the fraction and add the integer part to the speed. The fraction is
-                    # used as a starting point for the next loop.
-                    self.speed.eq(self.speed + self.max_acceleration),
-                ).Elif(
-                    # Decelerate, difference between actual speed and target speed is too
-                    # large to bridge within one clock-cycle
-                    self.speed_target < (self.speed - self.max_acceleration),
-                    # The counters are again a fixed point arithmetric. Every loop we keep
-                    # the fraction and add the integer part to the speed. However, we have
-                    # keep in mind we are subtracting now every loop
-                    self.speed.eq(self.speed - self.max_acceleration)
-                ).Else(
-                    # Small difference between speed and target speed, gap can be bridged within
-                    # one clock cycle.
-                    self.speed.eq(self.speed_target)
-                )
-            )
+            speed_update
         )
 
         # Reset algorithm.
@@ -375,24 +544,235 @@ class StepgenModule(Module, AutoDoc):
         )
 
         # Update the position
+        self.position_update = Signal()
         if soft_stop:
-            sync += If(
-                # Only check we are not waiting for the dir_setup. When the system is disabled, the
-                # speed is set to 0 (with respect to acceleration limits) and the machine will be
-                # stopped when disabled.
-                ~self.reset & ~self.wait,
-                self.position.eq(self.position + self.speed[(self.pick_off_acc - self.pick_off_vel):] - 0x8000_0000)
-            )
+            # Only check we are not waiting for the dir_setup. When the system is disabled, the
+            # speed is set to 0 (with respect to acceleration limits) and the machine will be
+            # stopped when disabled.
+            self.comb += self.position_update.eq(~self.reset & ~self.wait)
         else:
-            sync += If(
-                # Check whether the system is enabled and we are not waiting for the dir_setup
-                ~self.reset & self.enable & ~self.wait,
-                self.position.eq(self.position + self.speed[(self.pick_off_acc - self.pick_off_vel):] - 0x8000_0000)
-            )
+            # Check whether the system is enabled and we are not waiting for the dir_setup
+            self.comb += self.position_update.eq(~self.reset & self.enable & ~self.wait)
+        sync += If(
+            self.position_update,
+            self.position.eq(self.position + self.speed[(self.pick_off_acc - self.pick_off_vel):] - 0x8000_0000)
+        )
+
+        # Compensation of the pitch error and backlash, the steps are made on the compensated
+        # position
+        self.compensation = compensation
+        if compensation:
+            self.create_compensation(compensation)
+        else:
+            self.step_position = self.position
 
         # Create the routine which actually handles the steps
         create_routine(self, pads)
 
+    def create_gearing(self):
+        """
+        Creates the logic for the electronic gearing. The speed resulting from the
+        gearing is calculated in two clock-cycles after the rate of the encoder has been
+        updated, so it is constant during each window of the encoder.
+        """
+        # The speed is added to the position each clock-cycle. The gearing ratio is in
+        # steps per count and the rate in counts per window, so the product is shifted
+        # to steps (pick-off of the velocity) per clock-cycle.
+        shift = self.pick_off_vel - self.GEARING_RATIO_FRACTION - EncoderModule.GEARING_WINDOW_BITS
+        if shift < 0:
+            raise ValueError("The clock frequency is too low for electronic gearing.")
+        speed_offset = self.pick_off_acc - self.pick_off_vel
+
+        # Inputs
+        self.gearing_enable = Signal()
+        self.gearing_ratio = Signal((32, True))
+        self.gearing_rate = Signal((16, True))
+        # Outputs
+        self.gearing_speed = Signal((32, True))
+
+        # Internal fields
+        product = Signal((48, True))
+
+        # Determine the speed resulting from the gearing, saturated to the range of the speed
+        self.sync += [
+            product.eq(self.gearing_ratio * self.gearing_rate),
+            If(
+                product > ((2**31 - 1) >> shift),
+                self.gearing_speed.eq(2**31 - 1)
+            ).Elif(
+                product < -(2**31 >> shift),
+                self.gearing_speed.eq(-2**31)
+            ).Else(
+                self.gearing_speed.eq(product << shift)
+            )
+        ]
+        self.speed_geared = self.create_speed_offset(self.gearing_speed)
+
+    def create_compensation(self, entries):
+        """
+        Creates the compensation table and the logic for the compensation of the pitch
+        error and backlash. The table is looked up sequentially in eight clock-cycles,
+        which is fast enough, as the position changes by at most one step per cycle.
+        """
+        address_bits = max(1, (entries - 1).bit_length())
+        # The compensation is applied with the resolution of the position
+        position_shift = self.pick_off_vel - self.COMPENSATION_FRACTION
+        speed_offset = self.pick_off_acc - self.pick_off_vel
+
+        # Inputs
+        self.compensation_enable = Signal()
+        self.compensation_start = Signal((32, True))
+        self.compensation_shift = Signal(5)
+        self.compensation_backlash = Signal(26)
+        # - write port of the table
+        self.compensation_we = Signal()
+        self.compensation_address = Signal(address_bits)
+        self.compensation_value = Signal(32)
+        # Outputs
+        self.step_position = Signal(len(self.position))
+
+        # The table, with a write port for the driver and a read port for the lookup
+        table = Memory(32, entries)
+        write_port = table.get_port(write_capable=True)
+        read_port = table.get_port()
+        self.specials += table, write_port, read_port
+        self.comb += [
+            write_port.adr.eq(self.compensation_address),
+            write_port.dat_w.eq(self.compensation_value),
+            write_port.we.eq(self.compensation_we),
+        ]
+
+        # Internal fields
+        step = Signal(3)
+        relative = Signal((33, True))
+        index = Signal(address_bits)
+        fraction = Signal(16)
+        fraction_raw = Signal(48)
+        value_a = Signal((32, True))
+        value_b = Signal((32, True))
+        product = Signal((50, True))
+        interpolated = Signal((33, True))
+        backlash = Signal((27, True))
+        target = Signal((34, True))
+        target_position = Signal((34 + position_shift, True))
+        speed = Signal((32, True))
+        limit = Signal(32)
+        difference = Signal((36 + position_shift, True))
+        applied = Signal((35 + position_shift, True))
+
+        # Lookup of the table. The position before the first entry is compensated with the
+        # first entry, the position after the last entry with the last entry. The fraction
+        # between two entries is normalized to 16 bits.
+        self.comb += [
+            relative.eq(self.position[self.pick_off_vel:self.pick_off_vel + 32] - self.compensation_start),
+            fraction_raw.eq(Cat(Constant(0, 16), relative[:32]) >> self.compensation_shift),
+            If(
+                step == 1,
+                read_port.adr.eq(index)
+            ).Else(
+                read_port.adr.eq(index + 1)
+            )
+        ]
+        self.sync += [
+            step.eq(step + 1),
+            Case(step, {
+                # Determine the entry and the fraction
+                0: If(
+                    relative < 0,
+                    index.eq(0),
+                    fraction.eq(0)
+                ).Elif(
+                    (relative >> self.compensation_shift) >= entries - 1,
+                    index.eq(entries - 1),
+                    fraction.eq(0)
+                ).Else(
+                    index.eq(relative >> self.compensation_shift),
+                    fraction.eq(fraction_raw[:16])
+                ),
+                # The read port has a latency of one clock-cycle
+                2: value_a.eq(read_port.dat_r),
+                3: value_b.eq(read_port.dat_r),
+                # Interpolate between the entries
+                4: product.eq((value_b - value_a) * fraction),
+                5: interpolated.eq(value_a + (product >> 16)),
+                6: If(
+                    self.compensation_enable,
+                    target.eq(interpolated + backlash)
+                ).Else(
+                    target.eq(0)
+                ),
+                "default": []
+            })
+        ]
+
+        # The backlash is added with half its value in the direction of the speed. At
+        # standstill the last direction is kept.
+        self.comb += speed.eq(Cat(self.speed[speed_offset:speed_offset + 31], ~self.speed[speed_offset + 31]))
+        self.sync += If(
+            speed > 0,
+            backlash.eq(self.compensation_backlash >> 1)
+        ).Elif(
+            speed < 0,
+            backlash.eq(-(self.compensation_backlash >> 1))
+        )
+
+        # The compensation follows the target with at most half the speed, so the direction
+        # of the steps is not changed
+        self.comb += [
+            target_position.eq(target << position_shift),
+            difference.eq(target_position - applied),
+            If(
+                speed < 0,
+                limit.eq(-speed >> 1)
+            ).Else(
+                limit.eq(speed >> 1)
+            ),
+            self.step_position.eq(self.position + applied),
+        ]
+        self.sync += If(
+            self.reset,
+            applied.eq(0)
+        ).Elif(
+            self.position_update,
+            If(
+                difference > limit,
+                applied.eq(applied + limit)
+            ).Elif(
+                difference < -limit,
+                applied.eq(applied - limit)
+            ).Else(
+                applied.eq(target_position)
+            )
+        )
+
+    def create_speed_offset(self, speed):
+        """
+        Returns the speed, in the format of the speed of the stepgen, which is the sum of
+        the target speed and the given (signed) speed, saturated to the range of the speed.
+        """
+        speed_offset = self.pick_off_acc - self.pick_off_vel
+        target = Signal((32, True))
+        total = Signal((max(len(speed), 32) + 1, True))
+        total_clipped = Signal((32, True))
+        result = Signal(32 + speed_offset)
+        # The speed is stored with an offset of 2^31, which is converted to two's complement
+        # by inverting the most significant bit.
+        self.comb += [
+            target.eq(Cat(self.speed_target[speed_offset:speed_offset + 31], ~self.speed_target[speed_offset + 31])),
+            total.eq(target + speed),
+            If(
+                total > (2**31 - 1),
+                total_clipped.eq(2**31 - 1)
+            ).Elif(
+                total < -2**31,
+                total_clipped.eq(-2**31)
+            ).Else(
+                total_clipped.eq(total)
+            ),
+            result.eq(Cat(self.speed_target[:speed_offset], total_clipped[:31], ~total_clipped[31]))
+        ]
+        return result
+
     @classmethod
     def add_mmio_config_registers(cls, mmio, config: List[StepgenConfig]):
         """
@@ -424,6 +804,24 @@ class StepgenModule(Module, AutoDoc):
         if not config:
             return
 
+        # Compact image: the position (bits 16-47, as a delta with respect to the previous
+        # read) and the upper 24 bits of the speed are packed in a single 64-bit word.
+        if mmio.compact_image:
+            for index, _ in enumerate(config):
+                setattr(
+                    mmio,
+                    f'stepgen_{index}_feedback',
+                    CSRStatus(
+                        size=64,
+                        name=f'stepgen_{index}_feedback',
+                        description=f'The position and speed of stepper {index} (compact image). '
+                        'Bits 63-32 contain bits 16-47 of the position, bits 31-8 the upper 24 bits '
+                        'of the speed. Bits 7-0 are reserved for flags.',
+                    )
+                )
+            cls.add_mmio_slave_read_registers(mmio, config)
+            return
+
         for index, _ in enumerate(config):
             setattr(
                 mmio,
@@ -443,6 +841,27 @@ class StepgenModule(Module, AutoDoc):
                     name=f'stepgen_{index}_speed'
                 )
             )
+        cls.add_mmio_slave_read_registers(mmio, config)
+
+    @classmethod
+    def add_mmio_slave_read_registers(cls, mmio, config: List[StepgenConfig]):
+        """
+        Adds the status registers of the slaves to the MMIO. These are placed after the
+        other status registers of the stepgens. The slaves are numbered consecutively
+        over all stepgens.
+        """
+        slaves = sum(len(stepgen_config.slaves) for stepgen_config in config)
+        for index in range(slaves):
+            setattr(
+                mmio,
+                f'stepgen_slave_{index}_offset',
+                CSRStatus(
+                    size=32,
+                    name=f'stepgen_slave_{index}_offset',
+                    description=f'Bits 16-47 of the difference between the position of slave {index} '
+                    'and the position of its master (the squaring offset).',
+                )
+            )
 
     @classmethod
     def add_mmio_write_registers(cls, mmio, config: List[StepgenConfig]):
@@ -455,6 +874,32 @@ class StepgenModule(Module, AutoDoc):
         # defined in this case)
         if not config:
             return
+
+        # Compact image: the apply time only contains the lower 32 bits of the wall
+        # clock, the speed target and acceleration of all stepgens are packed as 24-bit
+        # fields in a single register. The first stepgen is stored in the most significant
+        # bits, so each stepgen occupies 6 consecutive bytes on the wire.
+        if mmio.compact_image:
+            mmio.stepgen_apply_time = CSRStorage(
+                size=32,
+                name=f'stepgen_apply_time',
+                description=f'The lower 32 bits of the time at which the current settings '
+                '(as stored in stepgen_speed_acceleration) will be applied.',
+                write_from_dev=True
+            )
+            size = int(math.ceil(48.0 * len(config) / 32)) * 32
+            mmio.stepgen_speed_acceleration = CSRStorage(
+                size=size,
+                reset=sum(0x800000 << (size - 48 * index - 24) for index in range(len(config))),
+                name=f'stepgen_speed_acceleration',
+                description=f'For each stepper 48 bits: the upper 24 bits of the target speed '
+                'followed by the maximum acceleration (24 bits).',
+                write_from_dev=False
+            )
+            cls.add_mmio_gearing_registers(mmio, config)
+            cls.add_mmio_slave_write_registers(mmio, config)
+            cls.add_mmio_compensation_registers(mmio, config)
+            return
         
         # General data - equal for each stepgen
         mmio.stepgen_apply_time = CSRStorage(
@@ -491,19 +936,136 @@ class StepgenModule(Module, AutoDoc):
                     write_from_dev=False
                 )
             )
+        cls.add_mmio_gearing_registers(mmio, config)
+        cls.add_mmio_slave_write_registers(mmio, config)
+        cls.add_mmio_compensation_registers(mmio, config)
+
+    @classmethod
+    def add_mmio_slave_write_registers(cls, mmio, config: List[StepgenConfig]):
+        """
+        Adds the storage registers of the slaves to the MMIO. These are placed after the
+        other storage registers of the stepgens and are only created when at least one
+        stepgen has slaves.
+        """
+        slaves = sum(len(stepgen_config.slaves) for stepgen_config in config)
+        if not slaves:
+            return
 
+        mmio.stepgen_slave_latch = CSRStorage(
+            size=int(math.ceil(float(slaves)/32))*32,
+            name='stepgen_slave_latch',
+            description="""Slave latch
+            Register containing the flags whether the position of the given slave is held,
+            while its master continues to move. Used for squaring a gantry.
+            """,
+            write_from_dev=False
+        )
 
     @classmethod
-    def create_from_config(cls, soc: SoC, watchdog, config: List[StepgenConfig]):
+    def add_mmio_compensation_registers(cls, mmio, config: List[StepgenConfig]):
+        """
+        Adds the storage registers for the compensation to the MMIO. These are placed after
+        the other storage registers of the stepgens and are only created when at least one
+        stepgen has compensation. The tables are written one entry at a time through a
+        shared register.
         """
-        Adds the module as defined in the configuration to the SoC.
+        if not any(stepgen_config.compensation for stepgen_config in config):
+            return
+
+        mmio.stepgen_compensation_write = CSRStorage(
+            fields=[
+                CSRField("value", size=32, offset=0, description="The compensation in steps, as a signed fixed point "
+                    f"value with {cls.COMPENSATION_FRACTION} bits after the point."),
+                CSRField("address", size=16, offset=32, description="The entry of the table."),
+                CSRField("stepgen", size=15, offset=48, description="The index of the stepgen."),
+                CSRField("valid", size=1, offset=63, description="When set, the value is written to the table."),
+            ],
+            name='stepgen_compensation_write',
+            description='An entry of the compensation table of one of the stepgens.',
+            write_from_dev=False
+        )
+        for index, stepgen_config in enumerate(config):
+            if not stepgen_config.compensation:
+                continue
+            setattr(
+                mmio,
+                f'stepgen_{index}_compensation_start',
+                CSRStorage(
+                    size=32,
+                    name=f'stepgen_{index}_compensation_start',
+                    description=f'The position (in steps) of the first entry of the compensation table '
+                    f'of stepper {index}.',
+                    write_from_dev=False
+                )
+            )
+            setattr(
+                mmio,
+                f'stepgen_{index}_compensation_config',
+                CSRStorage(
+                    fields=[
+                        CSRField("backlash", size=26, offset=0, description="The backlash in steps, as a fixed point "
+                            f"value with {cls.COMPENSATION_FRACTION} bits after the point."),
+                        CSRField("shift", size=5, offset=26, description="The distance between the entries of the "
+                            "table is 2^shift steps."),
+                        CSRField("enable", size=1, offset=31, description="Enables the compensation."),
+                    ],
+                    name=f'stepgen_{index}_compensation_config',
+                    description=f'The configuration of the compensation of stepper {index}.',
+                    write_from_dev=False
+                )
+            )
+
+    @classmethod
+    def add_mmio_gearing_registers(cls, mmio, config: List[StepgenConfig]):
+        """
+        Adds the storage registers for the electronic gearing to the MMIO. These are
+        placed after the other storage registers of the stepgens and are only created
+        when at least one stepgen has gearing.
+        """
+        if not any(stepgen_config.gearing for stepgen_config in config):
+            return
+
+        mmio.stepgen_gearing_enable = CSRStorage(
+            size=int(math.ceil(float(len(config))/32))*32,
+            name='stepgen_gearing_enable',
+            description="""Gearing enable
+            Register containing the flags whether the speed of the given stepgen follows
+            its encoder. Only used for stepgens with gearing.
+            """,
+            write_from_dev=False
+        )
+        for index, stepgen_config in enumerate(config):
+            if not stepgen_config.gearing:
+                continue
+            setattr(
+                mmio,
+                f'stepgen_{index}_gearing_ratio',
+                CSRStorage(
+                    size=32,
+                    name=f'stepgen_{index}_gearing_ratio',
+                    description=f'The gearing ratio for stepper {index}, in steps per count of the '
+                    f'encoder. The storage contains a signed fixed point value, with {cls.GEARING_RATIO_FRACTION} '
+                    'bits after the point.',
+                    write_from_dev=False
+                )
+            )
+
+
+    @classmethod
+    def create_from_config(cls, soc: SoC, watchdog, config: List[StepgenConfig], encoders: List[EncoderModule], pid_outputs: List[int] = []):
+        """
+        Adds the module as defined in the configuration to the SoC and returns the
+        created stepgens.
         NOTE: the configuration must be a list and should contain all the module at
-        once. Otherwise naming conflicts will occur.
+        once. Otherwise naming conflicts will occur. The encoders are the encoders
+        created by `EncoderModule.create_from_config`, which drive the stepgens with
+        gearing. The stepgens with their index in `pid_outputs` are driven by a
+        PID-loop (see `PIDModule.create_from_config`).
         """
         # Don't create the module when the config is empty (no stepgens 
         # defined in this case)
         if not config:
-            return
+            return []
 
         # Determine the pick-off for the velocity. This one is based on the clock-frequency
         # and the step frequency to be obtained
@@ -511,6 +1073,20 @@ class StepgenModule(Module, AutoDoc):
         while (soc.clock_frequency / (1 << shift) > 400e3):
             shift += 1
 
+        # Determine whether the apply time has passed. In the compact image only the lower
+        # 32 bits of the apply time are sent, so the comparison is done modulo 2^32.
+        apply_time_passed = Signal()
+        if soc.MMIO_inst.compact_image:
+            apply_time_delta = Signal(32)
+            soc.comb += [
+                apply_time_delta.eq(soc.MMIO_inst.wall_clock.status[:32] - soc.MMIO_inst.stepgen_apply_time.storage),
+                apply_time_passed.eq(~apply_time_delta[31])
+            ]
+        else:
+            soc.comb += apply_time_passed.eq(soc.MMIO_inst.wall_clock.status >= soc.MMIO_inst.stepgen_apply_time.storage)
+
+        stepgens = []
+        slave_index = 0
         for index, stepgen_config in enumerate(config):
             soc.platform.add_extension([
                 ("stepgen", index,
@@ -522,9 +1098,33 @@ class StepgenModule(Module, AutoDoc):
                 pads=soc.platform.request('stepgen', index),
                 pick_off=(32, 32 + shift, 32 + shift + 8),
                 soft_stop=stepgen_config.soft_stop,
-                create_routine=stepgen_config.pins.create_routine
+                create_routine=stepgen_config.pins.create_routine,
+                gearing=stepgen_config.gearing is not None,
+                pid=index in pid_outputs,
+                compensation=stepgen_config.compensation.entries if stepgen_config.compensation else 0
             )
             soc.submodules += stepgen
+            stepgens.append(stepgen)
+            # Slave the stepgen to its encoder
+            if stepgen.gearing:
+                soc.comb += stepgen.gearing_rate.eq(encoders[stepgen_config.gearing.encoder].gearing_rate)
+                soc.sync += [
+                    stepgen.gearing_enable.eq(soc.MMIO_inst.stepgen_gearing_enable.storage[index]),
+                    stepgen.gearing_ratio.eq(getattr(soc.MMIO_inst, f'stepgen_{index}_gearing_ratio').storage),
+                ]
+            # Connect the compensation table and its settings
+            if stepgen.compensation:
+                write = soc.MMIO_inst.stepgen_compensation_write.fields
+                compensation_config = getattr(soc.MMIO_inst, f'stepgen_{index}_compensation_config').fields
+                soc.sync += [
+                    stepgen.compensation_we.eq(write.valid & (write.stepgen == index)),
+                    stepgen.compensation_address.eq(write.address),
+                    stepgen.compensation_value.eq(write.value),
+                    stepgen.compensation_start.eq(getattr(soc.MMIO_inst, f'stepgen_{index}_compensation_start').storage),
+                    stepgen.compensation_shift.eq(compensation_config.shift),
+                    stepgen.compensation_backlash.eq(compensation_config.backlash),
+                    stepgen.compensation_enable.eq(compensation_config.enable),
+                ]
             # Connect all the memory
             soc.sync += [ # Aangepast
                 # Data from MMIO to stepgen
@@ -534,28 +1134,83 @@ class StepgenModule(Module, AutoDoc):
                 stepgen.dir_hold_time.eq(soc.MMIO_inst.stepgen_stepdata.fields.dir_hold_time),
                 stepgen.dir_setup_time.eq(soc.MMIO_inst.stepgen_stepdata.fields.dir_setup_time),
             ]
-            soc.sync += [
-                # Position and feedback from stepgen to MMIO
-                getattr(soc.MMIO_inst, f'stepgen_{index}_position').status.eq(stepgen.position[(stepgen.pick_off_vel - stepgen.pick_off_pos):]),
-                getattr(soc.MMIO_inst, f'stepgen_{index}_speed').status.eq(stepgen.speed[(stepgen.pick_off_acc - stepgen.pick_off_vel):])
-            ]
-            # Add speed target and the max acceleration in the protected sync
-            soc.sync += [
-                If(
-                    soc.MMIO_inst.wall_clock.status >= soc.MMIO_inst.stepgen_apply_time.storage,
-                    stepgen.speed_target.eq(Cat(Constant(0, bits_sign=(stepgen.pick_off_acc - stepgen.pick_off_vel)), getattr(soc.MMIO_inst, f'stepgen_{index}_speed_target').storage)),
-                    stepgen.max_acceleration.eq(getattr(soc.MMIO_inst, f'stepgen_{index}_max_acceleration').storage),
+            if soc.MMIO_inst.compact_image:
+                position_offset = stepgen.pick_off_vel - stepgen.pick_off_pos
+                speed_offset = stepgen.pick_off_acc - stepgen.pick_off_vel
+                storage = soc.MMIO_inst.stepgen_speed_acceleration.storage
+                top = len(storage) - 48 * index
+                soc.sync += [
+                    # Position and feedback from stepgen to MMIO
+                    getattr(soc.MMIO_inst, f'stepgen_{index}_feedback').status.eq(Cat(
+                        Constant(0, 8),
+                        stepgen.speed[speed_offset + 8:speed_offset + 32],
+                        stepgen.position[position_offset + 16:position_offset + 48]
+                    ))
+                ]
+                # Add speed target and the max acceleration in the protected sync
+                soc.sync += [
+                    If(
+                        apply_time_passed,
+                        stepgen.speed_target.eq(Cat(Constant(0, bits_sign=(speed_offset + 8)), storage[top - 24:top])),
+                        stepgen.max_acceleration.eq(storage[top - 48:top - 24]),
+                    )
+                ]
+            else:
+                soc.sync += [
+                    # Position and feedback from stepgen to MMIO
+                    getattr(soc.MMIO_inst, f'stepgen_{index}_position').status.eq(stepgen.position[(stepgen.pick_off_vel - stepgen.pick_off_pos):]),
+                    getattr(soc.MMIO_inst, f'stepgen_{index}_speed').status.eq(stepgen.speed[(stepgen.pick_off_acc - stepgen.pick_off_vel):])
+                ]
+                # Add speed target and the max acceleration in the protected sync
+                soc.sync += [
+                    If(
+                        apply_time_passed,
+                        stepgen.speed_target.eq(Cat(Constant(0, bits_sign=(stepgen.pick_off_acc - stepgen.pick_off_vel)), getattr(soc.MMIO_inst, f'stepgen_{index}_speed_target').storage)),
+                        stepgen.max_acceleration.eq(getattr(soc.MMIO_inst, f'stepgen_{index}_max_acceleration').storage),
+                    )
+                ]
+            # Create the slaves, which are driven by the speed of the stepgen
+            for slave_config in stepgen_config.slaves:
+                soc.platform.add_extension([
+                    ("stepgen_slave", slave_index,
+                        *slave_config.pins.convert_to_signal()
+                    )
+                ])
+                slave = StepgenSlaveModule(
+                    master=stepgen,
+                    pads=soc.platform.request('stepgen_slave', slave_index),
+                    soft_stop=stepgen_config.soft_stop,
+                    create_routine=slave_config.pins.create_routine
                 )
-            ]
+                soc.submodules += slave
+                offset = Signal(len(stepgen.position))
+                soc.comb += offset.eq(slave.position - stepgen.position)
+                soc.sync += [
+                    slave.reset.eq(soc.MMIO_inst.reset.storage),
+                    slave.enable.eq(~watchdog.has_bitten),
+                    slave.latch.eq(soc.MMIO_inst.stepgen_slave_latch.storage[slave_index]),
+                    slave.steplen.eq(soc.MMIO_inst.stepgen_stepdata.fields.steplen),
+                    slave.dir_hold_time.eq(soc.MMIO_inst.stepgen_stepdata.fields.dir_hold_time),
+                    slave.dir_setup_time.eq(soc.MMIO_inst.stepgen_stepdata.fields.dir_setup_time),
+                    # Offset with respect to the master, with the same resolution as the
+                    # position in the compact image
+                    getattr(soc.MMIO_inst, f'stepgen_slave_{slave_index}_offset').status.eq(
+                        offset[(stepgen.pick_off_vel - stepgen.pick_off_pos) + 16:(stepgen.pick_off_vel - stepgen.pick_off_pos) + 48]
+                    ),
+                ]
+                slave_index += 1
             # Add reset logic to stop the motion after reboot of LinuxCNC
             soc.sync += [
                 soc.MMIO_inst.stepgen_apply_time.we.eq(0),
                 If(
                     soc.MMIO_inst.reset.storage,
-                    soc.MMIO_inst.stepgen_apply_time.dat_w.eq(0x80000000),
+                    soc.MMIO_inst.stepgen_apply_time.dat_w.eq(
+                        soc.MMIO_inst.wall_clock.status[:32] if soc.MMIO_inst.compact_image else 0x80000000
+                    ),
                     soc.MMIO_inst.stepgen_apply_time.we.eq(1)
                 )
             ]
+        return stepgens
 
 
 if __name__ == "__main__":
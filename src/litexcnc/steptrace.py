@@ -0,0 +1,142 @@
+"""
+Extracts the step/dir timing of the stepgens from a trace of the simulation (VCD). The
+ports of the stepgens are named `stepgen<index>_step` and `stepgen<index>_dir` (or
+`_step_pos` and `_dir_pos` for the differential version) in the simulation.
+
+For each stepgen all edges are listed with the position after the edge, so the
+position can be compared with the position reported by the driver (`position-feedback`)
+and the position predicted by the driver. The direction pin is high for the positive
+direction. In addition the timing of the pulses is checked: the shortest step length,
+step space, direction setup time and direction hold time which occurred in the trace.
+"""
+import re
+from typing import Dict, Iterator, List, Optional, TextIO, Tuple
+
+# Pattern of the ports of the stepgens in the simulation
+STEPGEN_PORT = re.compile(r"^stepgen(\d+)_(step|dir)(_pos)?$")
+
+# Factors of the units of the timescale of a VCD to nanoseconds
+TIMESCALE_UNITS = {'s': 1e9, 'ms': 1e6, 'us': 1e3, 'ns': 1.0, 'ps': 1e-3, 'fs': 1e-6}
+
+
+class StepgenTrace:
+    """The edges and the timing of a single stepgen."""
+
+    def __init__(self, index: int):
+        self.index = index
+        self.step = 0
+        self.dir = 1
+        self.position = 0
+        self.edges: List[Tuple[float, str, int, int]] = []
+        # Time of the last edges (ns)
+        self._step_rise: Optional[float] = None
+        self._step_fall: Optional[float] = None
+        self._dir_change: Optional[float] = None
+        # Shortest timings (ns)
+        self.min_steplen: Optional[float] = None
+        self.min_stepspace: Optional[float] = None
+        self.min_dir_setup: Optional[float] = None
+        self.min_dir_hold: Optional[float] = None
+
+    @staticmethod
+    def _min(current: Optional[float], value: float) -> float:
+        return value if current is None else min(current, value)
+
+    def change(self, time: float, signal: str, value: int):
+        """Processes a change of the step or dir signal at the given time (ns)."""
+        if signal == 'step' and value != self.step:
+            if value:
+                # Rising edge: a step is made in the current direction
+                self.position += 1 if self.dir else -1
+                if self._step_fall is not None:
+                    self.min_stepspace = self._min(self.min_stepspace, time - self._step_fall)
+                if self._dir_change is not None and (self._step_rise is None or self._dir_change > self._step_rise):
+                    self.min_dir_setup = self._min(self.min_dir_setup, time - self._dir_change)
+                self._step_rise = time
+            else:
+                if self._step_rise is not None:
+                    self.min_steplen = self._min(self.min_steplen, time - self._step_rise)
+                self._step_fall = time
+            self.step = value
+        elif signal == 'dir' and value != self.dir:
+            if self._step_fall is not None:
+                self.min_dir_hold = self._min(self.min_dir_hold, time - self._step_fall)
+            self._dir_change = time
+            self.dir = value
+        else:
+            return
+        self.edges.append((time, signal, value, self.position))
+
+    @property
+    def steps(self) -> int:
+        """The number of steps in the trace."""
+        return sum(1 for _, signal, value, _ in self.edges if signal == 'step' and value)
+
+
+def _tokens(vcd: TextIO) -> Iterator[str]:
+    for line in vcd:
+        yield from line.split()
+
+
+def read_vcd(vcd: TextIO) -> Dict[int, StepgenTrace]:
+    """Reads the step and dir signals of all stepgens from the VCD."""
+    tokens = _tokens(vcd)
+    timescale = 1.0
+    # Identifiers of the signals in the VCD to (stepgen, signal). The same port can be
+    # present in multiple scopes, only the first occurrence is used.
+    signals: Dict[str, Tuple[int, str]] = {}
+    found = set()
+    for token in tokens:
+        if token == '$timescale':
+            value = ''.join(iter(lambda: next(tokens), '$end'))
+            match = re.match(r"(\d+)\s*(\w+)", value)
+            timescale = int(match[1]) * TIMESCALE_UNITS[match[2]]
+        elif token == '$var':
+            _, _, identifier, reference, *_ = iter(lambda: next(tokens), '$end')
+            match = STEPGEN_PORT.match(reference)
+            if match and (int(match[1]), match[2]) not in found:
+                found.add((int(match[1]), match[2]))
+                signals[identifier] = (int(match[1]), match[2])
+        elif token == '$enddefinitions':
+            next(tokens)
+            break
+
+    stepgens = {index: StepgenTrace(index) for index, _ in signals.values()}
+    time = 0.0
+    # The initial values (dumped at the start of the trace) are not edges
+    initial = False
+    for token in tokens:
+        if token[0] == '#':
+            time = int(token[1:]) * timescale
+            continue
+        if token == '$dumpvars':
+            initial = True
+            continue
+        if token == '$end':
+            initial = False
+            continue
+        if token[0] in '01xzXZ':
+            identifier, value = token[1:], token[0]
+        elif token[0] in 'bB':
+            identifier, value = next(tokens), token[-1]
+        else:
+            continue
+        if identifier in signals:
+            index, signal = signals[identifier]
+            if initial:
+                setattr(stepgens[index], signal, 1 if value == '1' else 0)
+            else:
+                stepgens[index].change(time, signal, 1 if value == '1' else 0)
+    return stepgens
+
+
+def write_csv(stepgens: Dict[int, StepgenTrace], output: TextIO):
+    """Writes all edges of the stepgens, ordered by time, as CSV."""
+    output.write("time_ns,stepgen,signal,value,position\n")
+    edges = sorted(
+        (time, index, signal, value, position)
+        for index, stepgen in stepgens.items()
+        for time, signal, value, position in stepgen.edges
+    )
+    for time, index, signal, value, position in edges:
+        output.write(f"{time:.0f},{index},{signal},{value},{position}\n")
@@ -0,0 +1,87 @@
+"""
+Reads the recordings of the data exchanged with a board, as created by the driver when
+the module parameter `record_directory` of `litexcnc` is set. The layout of the trace
+MUST coincide with `driver/trace.h`.
+
+The trace starts with a header, followed by the records. Each record consists of a
+fixed part (type, flags, size, address and timestamp) followed by the data, padded to a
+multiple of 8 bytes. The trace is written in the byte order of the host which recorded
+it, which is assumed to be little-endian.
+"""
+import mmap
+import struct
+from typing import BinaryIO, Iterator, NamedTuple
+
+TRACE_MAGIC = 0x4C585452
+TRACE_VERSION = 1
+TRACE_ALIGNMENT = 8
+
+# Types of the records
+TRACE_TYPES = {
+    1: 'config',
+    2: 'write',
+    3: 'read',
+    4: 'write_slow',
+    5: 'read_slow',
+    6: 'memory',
+}
+# Flags of the records
+TRACE_FLAG_FAILED = 0x01
+
+HEADER = struct.Struct("<IIIIQQQ")
+RECORD = struct.Struct("<HHIIIq")
+
+
+class TraceHeader(NamedTuple):
+    fpga_version: int
+    fingerprint: int
+    size: int
+    used: int
+    records: int
+
+
+class TraceRecord(NamedTuple):
+    type: str
+    failed: bool
+    address: int
+    timestamp: int
+    data: bytes
+
+
+def _align(size: int) -> int:
+    return (size + TRACE_ALIGNMENT - 1) & ~(TRACE_ALIGNMENT - 1)
+
+
+class Trace:
+    """A recording of a board, the records are read lazily from the mapped file."""
+
+    def __init__(self, file: BinaryIO):
+        self._memory = mmap.mmap(file.fileno(), 0, access=mmap.ACCESS_READ)
+        if len(self._memory) < HEADER.size:
+            raise ValueError("File is not a valid trace")
+        magic, version, *header = HEADER.unpack_from(self._memory, 0)
+        if magic != TRACE_MAGIC:
+            raise ValueError(f"File is not a valid trace (magic {magic:08X})")
+        if version != TRACE_VERSION:
+            raise ValueError(f"Unsupported version {version} of trace (supported: {TRACE_VERSION})")
+        self.header = TraceHeader(*header)
+
+    def __iter__(self) -> Iterator[TraceRecord]:
+        offset = _align(HEADER.size)
+        while offset + RECORD.size <= self.header.used:
+            type, flags, size, address, _, timestamp = RECORD.unpack_from(self._memory, offset)
+            if type == 0:
+                # The record is not complete yet (the trace is still being recorded)
+                break
+            start = offset + RECORD.size
+            yield TraceRecord(
+                TRACE_TYPES.get(type, str(type)),
+                bool(flags & TRACE_FLAG_FAILED),
+                address,
+                timestamp,
+                self._memory[start:start + size]
+            )
+            offset = start + _align(size)
+
+    def close(self):
+        self._memory.close()